@@ -1,5 +1,7 @@
 import 'dart:convert';
 import 'dart:io';
+import 'package:flutter/foundation.dart';
+import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
 import 'package:defyx_vpn/modules/main/data/models/vpn_config.dart';
 import 'package:http/http.dart' as http;
 import 'package:shared_preferences/shared_preferences.dart';
@@ -40,6 +42,11 @@ class ConfigService {
       if (apiConfigs.isNotEmpty) {
         await _cacheConfigs(apiConfigs);
         print('✅ API configs cached successfully');
+        if (Platform.isLinux) {
+          // The native store ranks servers by their probe history.
+          final ranked = await _getCachedConfigs();
+          if (ranked.isNotEmpty) return ranked;
+        }
         return apiConfigs;
       }
 
@@ -107,9 +114,64 @@ class ConfigService {
     }
   }
 
+  /// Turns a provider subscription, base64 as served or plain share links
+  /// one per line, into configs. Links to an endpoint already in the list
+  /// are dropped and lines that are not share links are skipped. Thousands
+  /// of links are parsed natively on Linux, and elsewhere on a background
+  /// isolate, so the UI keeps drawing while they import.
+  Future<List<VpnConfig>> importSubscription(String text) async {
+    if (Platform.isLinux) {
+      try {
+        final parsed = await VpnBridge().parseSubscription(text);
+        if (parsed['ok'] == true) {
+          final links = (parsed['links'] as List).cast<String>();
+          final names = (parsed['names'] as List).cast<String>();
+          final errors = (parsed['errorLines'] as List).length;
+          print('📥 Subscription: ${links.length} configs, '
+              '${parsed['duplicates']} duplicates, $errors rejected');
+          return List.generate(
+            links.length,
+            (i) => _subscriptionConfig(links[i], names[i], i),
+          );
+        }
+        print('❌ Subscription is not valid base64');
+        return [];
+      } catch (e) {
+        print('❌ Native subscription parser unavailable: $e');
+      }
+    }
+
+    final parsed = await compute(_parseSubscriptionLinks, text);
+    print('📥 Subscription: ${parsed.length} configs');
+    return [
+      for (final (index, entry) in parsed.indexed)
+        _subscriptionConfig(entry.$1, entry.$2, index),
+    ];
+  }
+
+  VpnConfig _subscriptionConfig(String link, String name, int index) {
+    return VpnConfig(
+      name: name.isNotEmpty ? name : 'Server ${index + 1}',
+      config: link,
+      country: 'Unknown',
+      flag: _getFlagForCountry(''),
+      premium: false,
+    );
+  }
+
   /// دریافت کانفیگ‌های cached
   Future<List<VpnConfig>> _getCachedConfigs() async {
     try {
+      if (Platform.isLinux) {
+        // The Linux runner keeps configs in an mmap'd store with their
+        // health, so they come back ranked without any JSON decoding.
+        final stored = await VpnBridge().loadConfigs();
+        return stored
+            .map((config) =>
+                VpnConfig.fromMap(Map<String, dynamic>.from(config)))
+            .toList();
+      }
+
       final prefs = await SharedPreferences.getInstance();
       final String? cachedData = prefs.getString(CACHE_KEY);
 
@@ -128,6 +190,11 @@ class ConfigService {
   /// ذخیره کانفیگ‌ها در cache
   Future<void> _cacheConfigs(List<VpnConfig> configs) async {
     try {
+      if (Platform.isLinux) {
+        await VpnBridge()
+            .storeConfigs(configs.map((config) => config.toMap()).toList());
+      }
+
       final prefs = await SharedPreferences.getInstance();
       final String configsJson =
           json.encode(configs.map((config) => config.toMap()).toList());
@@ -239,3 +306,38 @@ class ConfigService {
     };
   }
 }
+
+/// The (link, name) pairs in [text], for [ConfigService.importSubscription]
+/// where the native parser is not available. Runs on a background isolate;
+/// duplicates are dropped by link, as only the native parser reads
+/// endpoints.
+List<(String, String)> _parseSubscriptionLinks(String text) {
+  var decoded = text.trim();
+  if (!decoded.contains('://')) {
+    try {
+      final compact = decoded.replaceAll(RegExp(r'\s'), '');
+      decoded = utf8.decode(base64.decode(base64.normalize(compact)),
+          allowMalformed: true);
+    } on FormatException {
+      return [];
+    }
+  }
+
+  final seen = <String>{};
+  final configs = <(String, String)>[];
+  for (final line in const LineSplitter().convert(decoded)) {
+    final link = line.trim();
+    if (!link.contains('://') || !seen.add(link)) continue;
+    final fragment = link.indexOf('#');
+    var name = '';
+    if (fragment >= 0) {
+      try {
+        name = Uri.decodeComponent(link.substring(fragment + 1));
+      } on ArgumentError {
+        name = link.substring(fragment + 1);
+      }
+    }
+    configs.add((link, name));
+  }
+  return configs;
+}
@@ -1,12 +1,14 @@
 import 'dart:async';
 import 'dart:convert';
 import 'dart:developer';
+import 'dart:io';
 import 'package:flutter_riverpod/flutter_riverpod.dart';
 import 'package:flutter_v2ray_client/flutter_v2ray.dart';
 import 'package:shared_preferences/shared_preferences.dart';
 import 'package:defyx_vpn/core/services/ip_location_service.dart';
 import 'package:defyx_vpn/common/services/config_service.dart';
 import 'package:defyx_vpn/modules/main/data/models/vpn_config.dart';
+import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
 
 // V2Ray Connection Status Enum
 enum V2RayConnectionStatus {
@@ -70,7 +72,9 @@ class V2RayService extends StateNotifier<V2RayConnectionState> {
 
   static const String _kStorageKeyConfig = 'v2ray_config';
   static const String _kStorageKeyAutoConnect = 'v2ray_auto_connect';
-  static const String _kStorageKeySelectedServer = 'selected_server_index';
+  // The selected server's share link. Not its index: on Linux the list
+  // comes back re-ranked by probe health, so positions move between loads.
+  static const String _kStorageKeySelectedServer = 'selected_server_config';
 
   late V2ray _v2ray;
   Timer? _pingTimer;
@@ -127,12 +131,7 @@ class V2RayService extends StateNotifier<V2RayConnectionState> {
       _availableConfigs = await ConfigService.instance.getConfigs();
 
       // Load saved server selection
-      _selectedConfigIndex = _prefs?.getInt(_kStorageKeySelectedServer) ?? 0;
-
-      // Ensure index is valid
-      if (_selectedConfigIndex >= _availableConfigs.length) {
-        _selectedConfigIndex = 0;
-      }
+      _restoreSelection();
 
       log('✅ Loaded ${_availableConfigs.length} configs, selected index: $_selectedConfigIndex');
     } catch (e) {
@@ -402,11 +401,26 @@ class V2RayService extends StateNotifier<V2RayConnectionState> {
     return null;
   }
 
+  // Finds the saved server in the loaded list, falling back to the first
+  // one when it is no longer offered.
+  void _restoreSelection() {
+    final saved = _prefs?.getString(_kStorageKeySelectedServer);
+    final index = saved == null
+        ? -1
+        : _availableConfigs.indexWhere((c) => c.config == saved);
+    _selectedConfigIndex = index >= 0 ? index : 0;
+  }
+
+  Future<void> _saveSelection(int index) async {
+    _selectedConfigIndex = index;
+    await _prefs?.setString(
+        _kStorageKeySelectedServer, _availableConfigs[index].config);
+  }
+
   // Select server by index
   Future<void> selectServer(int index) async {
     if (index >= 0 && index < _availableConfigs.length) {
-      _selectedConfigIndex = index;
-      await _prefs?.setInt(_kStorageKeySelectedServer, index);
+      await _saveSelection(index);
 
       final config = _availableConfigs[index];
       await _prefs?.setString(_kStorageKeyConfig, config.config);
@@ -421,11 +435,8 @@ class V2RayService extends StateNotifier<V2RayConnectionState> {
       log('🔄 Refreshing configs from API...');
       _availableConfigs = await ConfigService.instance.refreshConfigs();
 
-      // Ensure current selection is still valid
-      if (_selectedConfigIndex >= _availableConfigs.length) {
-        _selectedConfigIndex = 0;
-        await _prefs?.setInt(_kStorageKeySelectedServer, 0);
-      }
+      // Follow the selected server to its place in the new list
+      _restoreSelection();
 
       log('✅ Configs refreshed: ${_availableConfigs.length} servers');
     } catch (e) {
@@ -462,6 +473,10 @@ class V2RayService extends StateNotifier<V2RayConnectionState> {
 
       log('🔍 شروع تست ${_availableConfigs.length} کانفیگ...');
 
+      if (Platform.isLinux) {
+        return await _probeAndConnectNative(onProgress: onProgress);
+      }
+
       // تست هر کانفیگ
       for (int i = 0; i < _availableConfigs.length; i++) {
         final config = _availableConfigs[i];
@@ -488,8 +503,7 @@ class V2RayService extends StateNotifier<V2RayConnectionState> {
             log('✅ کانفیگ کاری پیدا شد! ${config.name} - Ping: $ping ms');
 
             // انتخاب این کانفیگ
-            _selectedConfigIndex = i;
-            await _prefs?.setInt(_kStorageKeySelectedServer, i);
+            await _saveSelection(i);
 
             // اتصال
             return await connectWithConfig(config.config);
@@ -510,6 +524,52 @@ class V2RayService extends StateNotifier<V2RayConnectionState> {
     }
   }
 
+  // Probes every config at once in the Linux runner and connects to the
+  // first one that answers, instead of waiting out each timeout in turn.
+  Future<bool> _probeAndConnectNative({
+    Function(int current, int total, int? ping)? onProgress,
+  }) async {
+    final bridge = VpnBridge();
+    final total = _availableConfigs.length;
+    var finished = 0;
+    final health = <Map<String, dynamic>>[];
+    final subscription = bridge.probeResults.listen((result) {
+      finished++;
+      final ok = result['ok'] == true;
+      final index = result['index'] as int;
+      if (index < total) {
+        health.add({
+          'name': _availableConfigs[index].name,
+          'ok': ok,
+          'rttMs': result['latencyMs'] as int? ?? 0,
+        });
+      }
+      onProgress?.call(
+          finished, total, ok ? result['latencyMs'] as int? : null);
+    });
+
+    try {
+      final healthy = await bridge.probeConfigs(
+        _availableConfigs.map((config) => config.config).toList(),
+        stopAfter: 1,
+      );
+      if (healthy.isEmpty) {
+        log('❌ هیچ کانفیگ کاری پیدا نشد');
+        return false;
+      }
+
+      final index = healthy.first['index'] as int;
+      final config = _availableConfigs[index];
+      log('✅ کانفیگ کاری پیدا شد! ${config.name} - Ping: ${healthy.first['latencyMs']} ms');
+
+      await _saveSelection(index);
+      return await connectWithConfig(config.config);
+    } finally {
+      await subscription.cancel();
+      await bridge.recordConfigHealth(health);
+    }
+  }
+
   // Get V2Ray logs (Android only)
   Future<List<String>> getLogs() async {
     try {
@@ -692,8 +752,7 @@ class V2RayService extends StateNotifier<V2RayConnectionState> {
             log('✅ Ping OK: ${config.name} - $ping ms');
 
             // اگر ping خوب بود، انتخاب کن
-            _selectedConfigIndex = newIndex;
-            await _prefs?.setInt(_kStorageKeySelectedServer, newIndex);
+            await _saveSelection(newIndex);
             await _prefs?.setString(_kStorageKeyConfig, config.config);
 
             log('✅ Config selected: ${config.name}');
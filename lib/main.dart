@@ -6,9 +6,15 @@ import 'package:firebase_core/firebase_core.dart';
 import 'package:flutter_dotenv/flutter_dotenv.dart';
 import 'package:google_mobile_ads/google_mobile_ads.dart';
 import 'app/app.dart';
+import 'modules/core/vpn_bridge.dart';
 
 void main() async {
   WidgetsFlutterBinding.ensureInitialized();
+  final vpnBridge = VpnBridge();
+  vpnBridge.markStartupPhase('dart_main');
+  WidgetsBinding.instance.addPostFrameCallback((_) {
+    vpnBridge.markStartupPhase('dart_first_frame');
+  });
   await dotenv.load();
   await Firebase.initializeApp(
     name: "818-vpn",
@@ -1,3 +1,7 @@
+import 'dart:collection';
+import 'dart:io';
+
+import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
 import 'package:package_info_plus/package_info_plus.dart';
 
 class Log {
@@ -5,23 +9,75 @@ class Log {
   static final Log _instance = Log._internal();
   factory Log() => _instance;
 
-  String _logs = "";
+  /// Lines kept in memory on platforms without the native log ring.
+  static const int _capacity = 2000;
+  static const int _pageSize = 256;
+
+  final ListQueue<String> _lines = ListQueue<String>();
+
+  /// On Linux the runner keeps the log in a fixed-size native ring that its
+  /// tunnel, probe and speed test threads write to as well.
+  bool get _isNative => Platform.isLinux;
+
+  Future<String> getLogs() async {
+    if (!_isNative) {
+      return _lines.join('\n');
+    }
 
-  String getLogs() {
-    return _logs;
+    final lines = <String>[];
+    int after = 0;
+    while (true) {
+      final page = await VpnBridge().readLogs(after: after, limit: _pageSize);
+      lines.addAll(page.map(_formatRecord));
+      if (page.length < _pageSize) break;
+      after = page.last['sequence'] as int;
+    }
+    return lines.join('\n');
   }
 
   void clearLogs() {
-    _logs = "";
+    _lines.clear();
+    if (_isNative) {
+      VpnBridge().clearLogs();
+    }
   }
 
-  String addLog(String log) {
-    _logs += "\n$log";
-    return _logs;
+  void addLog(String log) {
+    if (_isNative) {
+      VpnBridge().appendLog(log);
+      return;
+    }
+    _lines.addLast(log);
+    if (_lines.length > _capacity) {
+      _lines.removeFirst();
+    }
+  }
+
+  /// Writes the retained log to [path]. Returns false if it could not be
+  /// written.
+  Future<bool> exportLogs(String path) async {
+    if (_isNative) {
+      return VpnBridge().exportLogs(path);
+    }
+    try {
+      await File(path).writeAsString(_lines.join('\n'));
+      return true;
+    } on FileSystemException {
+      return false;
+    }
   }
 
   Future<void> logAppVersion() async {
     final info = await PackageInfo.fromPlatform();
-    _logs += '[INFO] App Version: ${info.version}+${info.buildNumber}\n';
+    addLog('[INFO] App Version: ${info.version}+${info.buildNumber}');
+  }
+
+  String _formatRecord(Map<dynamic, dynamic> record) {
+    final source = record['source'] as String? ?? '';
+    final message = record['message'] as String? ?? '';
+    // App and VPN progress lines read as they always have; the runner's own
+    // subsystems are tagged with their name.
+    if (source == 'app' || source == 'vpn') return message;
+    return '[$source] $message';
   }
 }
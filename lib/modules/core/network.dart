@@ -1,4 +1,5 @@
 import 'dart:async';
+import 'dart:io';
 
 import 'package:connectivity_plus/connectivity_plus.dart';
 import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
@@ -67,10 +68,20 @@ class NetworkStatus {
   }
 
   static Future<bool> checkConnectivity() async {
+    if (Platform.isLinux) {
+      // The runner reads the default route itself, which also covers wired
+      // links and distinguishes a tunnel from the network underneath it.
+      try {
+        final state = await VpnBridge().getNetworkState();
+        if (state.containsKey('online')) {
+          return state['online'] == true;
+        }
+      } catch (_) {}
+    }
     final List<ConnectivityResult> connectivityResult =
         await (Connectivity().checkConnectivity());
 
-    return connectivityResult.contains(ConnectivityResult.mobile) ||
-        connectivityResult.contains(ConnectivityResult.wifi);
+    return connectivityResult
+        .any((result) => result != ConnectivityResult.none);
   }
 }
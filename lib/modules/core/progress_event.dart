@@ -0,0 +1,90 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+/// Kinds of events on `com.defyx.progress_events`. The order is the wire
+/// format shared with linux/runner/progress_event.h.
+enum ProgressEventType {
+  log,
+  configCount,
+  configIndex,
+  configLabel,
+  connected,
+  failed,
+  cancelled,
+  groupFailed,
+  stopped,
+  serviceDestroyed,
+  configSwitched,
+}
+
+class ProgressEvent {
+  final ProgressEventType type;
+  final int value;
+  final String text;
+
+  const ProgressEvent(this.type, {this.value = 0, this.text = ''});
+
+  static const int _formatVersion = 1;
+  static const int _recordHeaderSize = 7;
+
+  /// Parses a free-form line from the proxy core, as sent on the platforms
+  /// that still deliver one string per event.
+  factory ProgressEvent.fromMessage(String msg) {
+    if (msg.startsWith("Data: Config index: ")) {
+      final value = int.tryParse(msg.substring(20));
+      if (value != null) {
+        return ProgressEvent(ProgressEventType.configIndex, value: value, text: msg);
+      }
+    } else if (msg.startsWith("Data: Config Numbers: ")) {
+      final value = int.tryParse(msg.substring(22));
+      if (value != null) {
+        return ProgressEvent(ProgressEventType.configCount, value: value, text: msg);
+      }
+    } else if (msg.startsWith("Data: Config label: ")) {
+      return ProgressEvent(ProgressEventType.configLabel, text: msg.substring(20));
+    } else if (msg.startsWith("Data: VPN connected")) {
+      return ProgressEvent(ProgressEventType.connected, text: msg);
+    } else if (msg.startsWith("Data: VPN failed")) {
+      return ProgressEvent(ProgressEventType.failed, text: msg);
+    } else if (msg.startsWith("Data: VPN cancelled")) {
+      return ProgressEvent(ProgressEventType.cancelled, text: msg);
+    } else if (msg.startsWith("Data: VPN group failed")) {
+      return ProgressEvent(ProgressEventType.groupFailed, text: msg);
+    } else if (msg.startsWith("Data: VPN stopped")) {
+      return ProgressEvent(ProgressEventType.stopped, text: msg);
+    } else if (msg.startsWith("Data: VPN switched: ")) {
+      return ProgressEvent(ProgressEventType.configSwitched, text: msg.substring(20));
+    } else if (msg.contains("VPN Service Destroyed")) {
+      return ProgressEvent(ProgressEventType.serviceDestroyed, text: msg);
+    }
+    return ProgressEvent(ProgressEventType.log, text: msg);
+  }
+
+  /// Decodes a batch from the Linux runner: a version byte, then records of
+  /// a type byte, a little-endian int32 value, a little-endian uint16 text
+  /// length and the UTF-8 text. Unknown types are skipped.
+  static List<ProgressEvent> decodeBatch(Uint8List bytes) {
+    final events = <ProgressEvent>[];
+    if (bytes.isEmpty || bytes[0] != _formatVersion) return events;
+
+    final data = ByteData.sublistView(bytes);
+    int offset = 1;
+    while (offset + _recordHeaderSize <= bytes.length) {
+      final typeIndex = data.getUint8(offset);
+      final value = data.getInt32(offset + 1, Endian.little);
+      final textLength = data.getUint16(offset + 5, Endian.little);
+      offset += _recordHeaderSize;
+      if (offset + textLength > bytes.length) break;
+
+      final text = textLength == 0
+          ? ''
+          : utf8.decode(Uint8List.sublistView(bytes, offset, offset + textLength),
+              allowMalformed: true);
+      offset += textLength;
+      if (typeIndex < ProgressEventType.values.length) {
+        events.add(ProgressEvent(ProgressEventType.values[typeIndex], value: value, text: text));
+      }
+    }
+    return events;
+  }
+}
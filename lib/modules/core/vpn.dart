@@ -1,10 +1,13 @@
 import 'dart:async';
+import 'dart:convert';
 import 'dart:io';
+import 'dart:typed_data';
 
 import 'package:defyx_vpn/app/router/app_router.dart';
 import 'package:defyx_vpn/core/data/local/secure_storage/secure_storage.dart';
 import 'package:defyx_vpn/modules/core/log.dart';
 import 'package:defyx_vpn/modules/core/network.dart';
+import 'package:defyx_vpn/modules/core/progress_event.dart';
 import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
 import 'package:defyx_vpn/modules/main/application/main_screen_provider.dart';
 import 'package:defyx_vpn/modules/settings/providers/settings_provider.dart';
@@ -16,6 +19,7 @@ import 'package:defyx_vpn/shared/services/firebase_analytics_service.dart';
 import 'package:flutter/material.dart';
 import 'package:flutter/services.dart';
 import 'package:flutter_riverpod/flutter_riverpod.dart';
+import 'package:shared_preferences/shared_preferences.dart';
 import 'package:defyx_vpn/core/data/local/vpn_data/vpn_data.dart';
 
 class VPN {
@@ -34,12 +38,26 @@ class VPN {
   final _vpnBridge = VpnBridge();
   final _eventChannel = EventChannel("com.defyx.progress_events");
 
-  Stream<String> get vpnUpdates =>
-      _eventChannel.receiveBroadcastStream().map((event) => event.toString());
+  /// Progress events from the native side. The Linux runner sends binary
+  /// batches coalesced per frame; other platforms send one line per event.
+  Stream<List<ProgressEvent>> get vpnUpdates =>
+      _eventChannel.receiveBroadcastStream().map((event) {
+        if (event is Uint8List) {
+          return ProgressEvent.decodeBatch(event);
+        }
+        // The Linux runner logs its events natively; lines from other cores
+        // are logged here as they arrive.
+        final msg = event.toString();
+        log.addLog(msg);
+        return [ProgressEvent.fromMessage(msg)];
+      });
 
   bool _initialized = false;
   ProviderContainer? _container;
-  StreamSubscription<String>? _vpnSub;
+  StreamSubscription<List<ProgressEvent>>? _vpnSub;
+  StreamSubscription<Map<dynamic, dynamic>>? _latencySub;
+  StreamSubscription<Map<dynamic, dynamic>>? _networkSub;
+  StreamSubscription<Map<dynamic, dynamic>>? _quickActionSub;
   DateTime? _connectionStartTime;
 
   void _init(ProviderContainer container) {
@@ -54,13 +72,47 @@ class VPN {
     final offset = now.timeZoneOffset;
     final offsetInHours = offset.inMinutes / 60.0;
     _vpnBridge.setTimezone(offsetInHours.toString());
-    vpnUpdates.listen((msg) {
-      _handleVPNUpdates(msg);
+    vpnUpdates.listen((events) {
+      for (final event in events) {
+        _handleVPNUpdate(event);
+      }
     });
+    if (Platform.isLinux) {
+      _latencySub = _vpnBridge.latencyUpdates.listen(_handleLatencyUpdate);
+      _networkSub = _vpnBridge.networkChanges.listen(_handleNetworkChange);
+      // A later launch such as `--toggle` drives the engine directly; the
+      // UI catches up from its status.
+      _quickActionSub = _vpnBridge.quickActions.listen((_) => getVPNStatus());
+    }
   }
 
   void dispose() {
     _vpnSub?.cancel();
+    _latencySub?.cancel();
+    _networkSub?.cancel();
+    _quickActionSub?.cancel();
+  }
+
+  /// The Linux runner monitors latency while connected and pushes notable
+  /// changes, so the displayed ping follows the tunnel without polling.
+  void _handleLatencyUpdate(Map<dynamic, dynamic> stats) {
+    final connectionState = _container?.read(connectionStateProvider);
+    if (connectionState?.status != ConnectionStatus.connected) {
+      return;
+    }
+    final rttMs = stats['rttMs'] as int? ?? 0;
+    _container?.read(pingProvider.notifier).state = rttMs.toString();
+  }
+
+  /// The Linux runner has already rebound the tunnel when a network change
+  /// arrives; the ping shown was measured on the previous network.
+  void _handleNetworkChange(Map<dynamic, dynamic> state) {
+    final connectionState = _container?.read(connectionStateProvider);
+    if (connectionState?.status != ConnectionStatus.connected ||
+        state['online'] != true) {
+      return;
+    }
+    _updatePing();
   }
 
   void _loadChangeRootListener() {
@@ -73,53 +125,52 @@ class VPN {
     });
   }
 
-  void _handleVPNUpdates(String msg) {
+  void _handleVPNUpdate(ProgressEvent event) {
     final ref = _container!;
     final loggerNotifier = ref.read(loggerStateProvider.notifier);
     final groupNotifier = ref.read(groupStateProvider.notifier);
 
-    if (msg.startsWith("Data: Config index: ")) {
-      final configIndex = msg.replaceAll("Data: Config index: ", "");
-      final step = int.parse(configIndex);
-      _setConnectionStep(step);
-      loggerNotifier.setConnecting();
-
-      if (step > 1) {
-        vibrationService.vibrateHeartbeat();
-      }
-    }
-
-    if (msg.startsWith("Data: VPN connected")) {
-      _onSuccessConnect();
-    }
-    if (msg.startsWith("Data: VPN failed")) {
-      _onFailerConnect();
-    }
-    if (msg.startsWith("Data: VPN cancelled")) {
-      _closeTunnel();
-    }
-    if (msg.startsWith("Data: VPN group failed")) {
-      loggerNotifier.setSwitchingMethod();
-    }
-    if (msg.startsWith("Data: VPN stopped")) {
-      _closeTunnel();
-    }
-    if (msg.startsWith("Data: Config label: ")) {
-      final configLabel = msg.replaceAll("Data: Config label: ", "");
-      _vpnBridge.setConnectionMethod(configLabel);
-      groupNotifier.setGroupName(configLabel);
-    }
-
-    if (msg.startsWith("Data: Config Numbers: ")) {
-      final configIndex = msg.replaceAll("Data: Config Numbers: ", "");
-      _setConnectionTotalSteps(int.parse(configIndex));
-    }
+    switch (event.type) {
+      case ProgressEventType.configIndex:
+        final step = event.value;
+        _setConnectionStep(step);
+        loggerNotifier.setConnecting();
 
-    if (msg.contains("VPN Service Destroyed")) {
-      _onTunnelClosed();
+        if (step > 1) {
+          vibrationService.vibrateHeartbeat();
+        }
+        break;
+      case ProgressEventType.connected:
+        _onSuccessConnect();
+        break;
+      case ProgressEventType.failed:
+        _onFailerConnect();
+        break;
+      case ProgressEventType.cancelled:
+      case ProgressEventType.stopped:
+        _closeTunnel();
+        break;
+      case ProgressEventType.groupFailed:
+        loggerNotifier.setSwitchingMethod();
+        break;
+      case ProgressEventType.configLabel:
+        _vpnBridge.setConnectionMethod(event.text);
+        groupNotifier.setGroupName(event.text);
+        break;
+      case ProgressEventType.configCount:
+        _setConnectionTotalSteps(event.value);
+        break;
+      case ProgressEventType.configSwitched:
+        // The tunnel moved to a healthier upstream while staying connected.
+        _vpnBridge.setConnectionMethod(event.text);
+        groupNotifier.setGroupName(event.text);
+        break;
+      case ProgressEventType.serviceDestroyed:
+        _onTunnelClosed();
+        break;
+      case ProgressEventType.log:
+        break;
     }
-
-    log.addLog(msg);
   }
 
   Future<void> _connect() async {
@@ -129,6 +180,7 @@ class VPN {
     final settings = _container?.read(settingsProvider.notifier);
 
     _setConnectionStep(1);
+    _vpnBridge.markStartupPhase('connect_requested');
 
     WidgetsBinding.instance.addPostFrameCallback((_) {
       connectionNotifier?.setLoading();
@@ -186,6 +238,8 @@ class VPN {
 
     await _createTunnel();
     connectionNotifier?.setConnected();
+    // The first connection closes the tap-to-connected span of the trace.
+    _vpnBridge.markStartupPhase('vpn_connected');
     vpnData?.enableVPN();
     await refreshPing();
     vibrationService.vibrateSuccess();
@@ -262,6 +316,8 @@ class VPN {
         return await _vpnBridge.grantVpnPermission();
       case "ios":
         return await _vpnBridge.connectVpn();
+      case "linux":
+        return await _vpnBridge.grantVpnPermission();
       default:
         return false;
     }
@@ -272,12 +328,45 @@ class VPN {
       case 'android':
         await _vpnBridge.connectVpn();
         break;
+      case 'linux':
+        await _vpnBridge.connectVpn();
+        final prefs = await SharedPreferences.getInstance();
+        if (prefs.getString('proxy_mode') == 'proxyOnly') {
+          // Applications use the local proxy; no TUN device or routes.
+          final port = await _vpnBridge.startLocalProxy();
+          log.addLog(port > 0
+              ? '[INFO] Proxy-only mode on 127.0.0.1:$port'
+              : '[ERROR] Could not start the local proxy');
+          break;
+        }
+        await _applySplitTunnel();
+        await _vpnBridge.startTun2socks();
+        break;
       case "ios":
         await _vpnBridge.startTun2socks();
         break;
     }
   }
 
+  /// Passes the split mode and bypass list from settings to the Linux
+  /// runner, which routes those apps around the tunnel in the kernel.
+  Future<void> _applySplitTunnel() async {
+    final prefs = await SharedPreferences.getInstance();
+    List<String> apps = [];
+    final stored = prefs.getString('bypassed_apps');
+    if (stored != null && stored.isNotEmpty) {
+      try {
+        apps = List<String>.from(json.decode(stored));
+      } catch (e) {
+        log.addLog('[WARN] Could not read the bypass list: $e');
+      }
+    }
+    await _vpnBridge.setSplitTunnel(
+      enabled: prefs.getString('proxy_mode') == 'split',
+      apps: apps,
+    );
+  }
+
   void _setConnectionStep(int step) {
     // Note: FlowLine step tracking removed - V2Ray uses its own connection tracking
   }
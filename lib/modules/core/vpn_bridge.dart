@@ -1,3 +1,5 @@
+import 'dart:io';
+
 import 'package:flutter/services.dart';
 import 'package:flutter_dotenv/flutter_dotenv.dart';
 
@@ -7,6 +9,45 @@ class VpnBridge {
   factory VpnBridge() => _instance;
 
   final _methodChannel = MethodChannel('com.mimivpn.vpn');
+  final _probeResultsChannel = EventChannel('com.mimivpn.probe_results');
+  final _speedTestChannel = EventChannel('com.mimivpn.speed_test');
+  final _latencyChannel = EventChannel('com.mimivpn.latency');
+  final _networkChannel = EventChannel('com.mimivpn.network');
+  final _quickActionChannel = EventChannel('com.mimivpn.quick_actions');
+
+  /// Results of a [probeConfigs] run as each probe finishes: maps with
+  /// `index`, `ok`, `connectMs`, `latencyMs`, `resumed` (the TLS handshake
+  /// resumed a cached session) and `fastOpen`.
+  Stream<Map<dynamic, dynamic>> get probeResults => _probeResultsChannel
+      .receiveBroadcastStream()
+      .map((event) => event as Map<dynamic, dynamic>);
+
+  /// Running throughput of the current [measureThroughput] sample, in Mbps.
+  Stream<double> get speedTestUpdates => _speedTestChannel
+      .receiveBroadcastStream()
+      .map((event) => (event as num).toDouble());
+
+  /// Notable changes in the tunnel's latency while connected: maps with
+  /// `rttMs`, `avgMs`, `minMs`, `jitterMs`, `lossPercent`, `samples` and
+  /// `ok`. An all-zero map follows a disconnect.
+  Stream<Map<dynamic, dynamic>> get latencyUpdates => _latencyChannel
+      .receiveBroadcastStream()
+      .map((event) => event as Map<dynamic, dynamic>);
+
+  /// Changes of the host's network seen by the Linux runner, sent once a
+  /// connected tunnel has been rebound to it: maps with `online`, `kind`
+  /// (ethernet, wifi, mobile, vpn, other or none), `interface`, `gateway`,
+  /// `addresses` and `generation`.
+  Stream<Map<dynamic, dynamic>> get networkChanges => _networkChannel
+      .receiveBroadcastStream()
+      .map((event) => event as Map<dynamic, dynamic>);
+
+  /// Quick actions the Linux runner ran for a command-line launch such as
+  /// `--toggle`: maps with `action` (connect, disconnect or select-server),
+  /// `server` for select-server, `ok` and the resulting `status`.
+  Stream<Map<dynamic, dynamic>> get quickActions => _quickActionChannel
+      .receiveBroadcastStream()
+      .map((event) => event as Map<dynamic, dynamic>);
 
   Future<String?> getVpnStatus() => _methodChannel.invokeMethod('getVpnStatus');
 
@@ -17,6 +58,67 @@ class VpnBridge {
     return ping.toString();
   }
 
+  /// The latency monitor's current figures, in the [latencyUpdates] format.
+  Future<Map<dynamic, dynamic>> getLatencyStats() async {
+    final stats = await _methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'getLatencyStats',
+    );
+    return stats ?? {};
+  }
+
+  /// The host's current network, in the [networkChanges] format.
+  Future<Map<dynamic, dynamic>> getNetworkState() async {
+    final state = await _methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'getNetworkState',
+    );
+    return state ?? {};
+  }
+
+  /// Counters of the Linux tunnel's caching DNS forwarder: queries, hits,
+  /// negativeHits, coalesced, prefetches, upstreamQueries,
+  /// upstreamFailures, entries, hitRate (percent) and upstreamAvgMs,
+  /// upstreamP50Ms and upstreamP95Ms.
+  Future<Map<dynamic, dynamic>> getDnsStats() async {
+    final stats = await _methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'getDnsStats',
+    );
+    return stats ?? {};
+  }
+
+  /// TLS handshakes of the Linux config probes: `full` and `resumed`, each
+  /// an [addStats] summary of handshake times in milliseconds, plus
+  /// `fastOpen` (handshakes started in the SYN) and `cachedSessions`.
+  /// `reconnect` summarizes, in milliseconds, how long traffic took to flow
+  /// again after upstream switches and rebinds, plus the reconnects passed
+  /// to [recordReconnect]. Unlike the [addStats] series, it survives
+  /// [resetStats].
+  Future<Map<dynamic, dynamic>> getTlsStats() async {
+    final stats = await _methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'getTlsStats',
+    );
+    return stats ?? {};
+  }
+
+  /// Adds a reconnect that took [ms] milliseconds to the `reconnect`
+  /// summary of [getTlsStats]. Linux only.
+  Future<void> recordReconnect(int ms) =>
+      _methodChannel.invokeMethod('recordReconnect', {'ms': ms});
+
+  /// Cold-start phases recorded by the Linux and Windows runners, oldest
+  /// first: maps with `name` and `ms`, the time since the process started.
+  Future<List<Map<dynamic, dynamic>>> getStartupTrace() async {
+    final phases =
+        await _methodChannel.invokeMethod<List<dynamic>>('getStartupTrace');
+    return phases?.cast<Map<dynamic, dynamic>>() ?? [];
+  }
+
+  /// Adds [name] to the startup trace, e.g. `vpn_connected`. Only the first
+  /// mark of each name is kept. Does nothing on other platforms.
+  Future<void> markStartupPhase(String name) async {
+    if (!Platform.isLinux && !Platform.isWindows) return;
+    await _methodChannel.invokeMethod('markStartupPhase', {'name': name});
+  }
+
   Future<void> setTimezone(String timezone) =>
       _methodChannel.invokeMethod("setTimezone", {"timezone": timezone});
 
@@ -37,6 +139,190 @@ class VpnBridge {
   Future<void> startTun2socks() =>
       _methodChannel.invokeMethod("startTun2socks");
 
+  /// Opens the local SOCKS5 and HTTP CONNECT proxy used by the proxy-only
+  /// mode on Linux. [port] 0 keeps the runner's default. Returns the bound
+  /// port, or 0 when the proxy could not start.
+  Future<int> startLocalProxy({int port = 0}) async {
+    final int? bound = await _methodChannel.invokeMethod<int>(
+      'startLocalProxy',
+      {'port': port},
+    );
+    return bound ?? 0;
+  }
+
+  Future<void> stopLocalProxy() =>
+      _methodChannel.invokeMethod('stopLocalProxy');
+
+  /// Lets the processes of [apps] bypass the tunnel on Linux. Entries are
+  /// executable names or paths; [enabled] false tunnels everything.
+  Future<void> setSplitTunnel({
+    required bool enabled,
+    List<String> apps = const [],
+  }) =>
+      _methodChannel.invokeMethod(
+        'setSplitTunnel',
+        {'enabled': enabled, 'apps': apps},
+      );
+
+  /// Probes every share link in [configs] concurrently and returns the
+  /// healthy ones in the order they answered. Stops early once [stopAfter]
+  /// are healthy (0 probes all of them).
+  Future<List<Map<dynamic, dynamic>>> probeConfigs(
+    List<String> configs, {
+    int stopAfter = 0,
+    int concurrency = 32,
+    int timeoutMs = 3000,
+  }) async {
+    final results = await _methodChannel.invokeMethod<List<dynamic>>(
+      'probeConfigs',
+      {
+        'configs': configs,
+        'stopAfter': stopAfter,
+        'concurrency': concurrency,
+        'timeoutMs': timeoutMs,
+      },
+    );
+    return (results ?? []).cast<Map<dynamic, dynamic>>();
+  }
+
+  /// Sets the upstreams the Linux runner may fail over to while connected.
+  /// Each map has the `port` of a local SOCKS5 endpoint the proxy core
+  /// serves for one config, plus an optional `host`, `label` and `server`,
+  /// the proxy server that config dials, which the tunnel routes around
+  /// itself while the config is in use. A switch arrives as a
+  /// `configSwitched` progress event.
+  Future<void> setFailoverCandidates(List<Map<String, dynamic>> candidates) =>
+      _methodChannel.invokeMethod(
+        'setFailoverCandidates',
+        {'candidates': candidates},
+      );
+
+  /// The Linux runner's cached configs, best candidates first, as
+  /// `VpnConfig` maps with `successRate`, `probes` and `lastGoodMs` added.
+  /// [country] limits the list to one country.
+  Future<List<Map<dynamic, dynamic>>> loadConfigs({String? country}) async {
+    final configs = await _methodChannel.invokeMethod<List<dynamic>>(
+      'loadConfigs',
+      country == null ? null : {'country': country},
+    );
+    return (configs ?? []).cast<Map<dynamic, dynamic>>();
+  }
+
+  /// Replaces the cached configs with [configs] (`VpnConfig.toMap` maps).
+  /// Servers that keep their name keep their health history.
+  Future<bool> storeConfigs(List<Map<String, dynamic>> configs) async {
+    final stored = await _methodChannel.invokeMethod<bool>(
+      'storeConfigs',
+      {'configs': configs},
+    );
+    return stored ?? false;
+  }
+
+  /// Parses a provider subscription, base64-encoded as served or already
+  /// decoded, in one native call. Links reaching an endpoint seen earlier
+  /// in the list are dropped. Returns parallel lists `links`, `names`,
+  /// `schemes`, `hosts`, `serverNames`, `ports` (Int32List) and `tls`
+  /// (Uint8List, 1 for TLS), plus `errorLines` (1-based) and
+  /// `errorReasons` for the lines that were rejected, `duplicates` and
+  /// `ok`, false if the subscription was not valid base64.
+  Future<Map<dynamic, dynamic>> parseSubscription(String text) async {
+    final parsed = await _methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'parseSubscription',
+      {'text': text},
+    );
+    return parsed ?? {};
+  }
+
+  /// Adds probe outcomes, maps with `name`, `ok` and `rttMs`, to the cached
+  /// configs' health history.
+  Future<void> recordConfigHealth(List<Map<String, dynamic>> results) =>
+      _methodChannel.invokeMethod('recordConfigHealth', {'results': results});
+
+  Future<void> cancelProbe() => _methodChannel.invokeMethod('cancelProbe');
+
+  /// Runs [count] native throughput samples of [bytes] each over parallel
+  /// streams. [direction] is 'download' or 'upload'. Returns one speed in
+  /// Mbps per sample; failed samples are 0.
+  Future<List<double>> measureThroughput(
+    String direction,
+    int bytes,
+    int count,
+  ) async {
+    final results = await _methodChannel.invokeMethod<List<dynamic>>(
+      'measureThroughput',
+      {'direction': direction, 'bytes': bytes, 'count': count},
+    );
+    return (results ?? []).map((speed) => (speed as num).toDouble()).toList();
+  }
+
+  /// Measures latency idle and while parallel streams saturate the
+  /// connection for [loadMs] in each direction, leaving out probes in the
+  /// first [rampMs], and reports the load's speed on [speedTestUpdates].
+  /// Returns `ok`, `idleLatencyMs`, `loadedLatencyMs`, `downloadLatencyMs`,
+  /// `uploadLatencyMs`, `rpm`, `latencyInflation` (percent),
+  /// `downloadMbps`, `uploadMbps`, `probes` and `lostProbes`.
+  Future<Map<dynamic, dynamic>> measureResponsiveness({
+    required int idleProbes,
+    required int loadMs,
+    required int rampMs,
+  }) async {
+    final result = await _methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'measureResponsiveness',
+      {'idleProbes': idleProbes, 'loadMs': loadMs, 'rampMs': rampMs},
+    );
+    return result ?? {};
+  }
+
+  Future<void> cancelSpeedTest() =>
+      _methodChannel.invokeMethod('cancelSpeedTest');
+
+  /// Adds [values] to the native statistics series [series] and returns its
+  /// summary: `count`, `min`, `max`, `mean`, `p50`, `p90`, `jitter` and
+  /// `lossPercent`. [expected] raises the number of samples the series
+  /// should end up with, which is what packet loss is measured against.
+  Future<Map<dynamic, dynamic>> addStats(
+    String series,
+    List<num> values, {
+    int expected = 0,
+  }) async {
+    final stats = await _methodChannel.invokeMethod<Map<dynamic, dynamic>>(
+      'addStats',
+      {'series': series, 'values': values, 'expected': expected},
+    );
+    return stats ?? {};
+  }
+
+  Future<void> resetStats() => _methodChannel.invokeMethod('resetStats');
+
+  /// Returns up to [limit] records from the runner's log ring with a
+  /// sequence above [after], oldest first: maps with `sequence`, `timeMs`,
+  /// `level`, `source` and `message`.
+  Future<List<Map<dynamic, dynamic>>> readLogs({
+    int after = 0,
+    int limit = 256,
+  }) async {
+    final records = await _methodChannel.invokeMethod<List<dynamic>>(
+      'readLogs',
+      {'after': after, 'limit': limit},
+    );
+    return (records ?? []).cast<Map<dynamic, dynamic>>();
+  }
+
+  Future<void> appendLog(String message,
+          {String level = 'info', String source = 'app'}) =>
+      _methodChannel.invokeMethod(
+        'appendLog',
+        {'message': message, 'level': level, 'source': source},
+      );
+
+  Future<void> clearLogs() => _methodChannel.invokeMethod('clearLogs');
+
+  Future<bool> exportLogs(String path) async {
+    return await _methodChannel
+            .invokeMethod<bool>('exportLogs', {'path': path}) ??
+        false;
+  }
+
   Future<bool> isTunnelRunning() async {
     return await _methodChannel.invokeMethod<bool>("isTunnelRunning") ?? false;
   }
@@ -1,4 +1,5 @@
 import 'dart:async';
+import 'dart:io';
 
 import 'package:defyx_vpn/core/data/local/secure_storage/secure_storage.dart';
 import 'package:defyx_vpn/modules/main/presentation/widgets/google_ads.dart';
@@ -6,6 +7,7 @@ import 'package:defyx_vpn/modules/main/presentation/widgets/rewarded_ad_service.
 import 'package:flutter/services.dart';
 import 'package:flutter_riverpod/flutter_riverpod.dart';
 import 'package:defyx_vpn/modules/core/network.dart';
+import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
 import 'package:defyx_vpn/shared/providers/connection_state_provider.dart';
 import 'package:defyx_vpn/core/services/v2ray_service.dart';
 import 'package:package_info_plus/package_info_plus.dart';
@@ -123,7 +125,14 @@ class MainScreenLogic {
     if (connectionState.status == ConnectionStatus.connected &&
         v2rayState.status != V2RayConnectionStatus.connected) {
       // Re-establish V2Ray connection
+      final stopwatch = Stopwatch()..start();
       await connectOrDisconnect();
+      if (Platform.isLinux &&
+          ref.read(connectionStateProvider).status ==
+              ConnectionStatus.connected) {
+        // Reported by getTlsStats, next to what resumed handshakes save.
+        await VpnBridge().recordReconnect(stopwatch.elapsedMilliseconds);
+      }
     }
   }
 
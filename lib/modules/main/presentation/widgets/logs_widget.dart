@@ -37,7 +37,7 @@ class LogsNotifier extends StateNotifier<LogsState> {
     try {
       // Get only new logs from native code
 
-      final String newLogs = log.getLogs();
+      final String newLogs = await log.getLogs();
 
       if (newLogs.isNotEmpty) {
         // Split new logs by newline
@@ -388,7 +388,7 @@ class _LogScreenState extends ConsumerState<LogScreen> {
     // Show logs immediately
     WidgetsBinding.instance.addPostFrameCallback((_) async {
       // Get the full logs from WarpPlus
-      final allLogs = Log().getLogs();
+      final allLogs = await Log().getLogs();
 
       if (allLogs.isNotEmpty) {
         final logsNotifier = ref.read(logsProvider.notifier);
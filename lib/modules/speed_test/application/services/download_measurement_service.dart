@@ -1,6 +1,10 @@
+import 'dart:io';
 import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
 import '../../data/api/speed_test_api.dart';
 import 'speed_measurement_config.dart';
+import 'speed_stats_service.dart';
 
 class DownloadMeasurementService {
   final SpeedTestApi api;
@@ -11,8 +15,12 @@ class DownloadMeasurementService {
           double percentileSpeed, double avgSpeed, int currentPing, int avgLatency, int jitter)
       onMetricsUpdate;
 
+  /// Filled only where [SpeedStatsService] is unsupported; the native
+  /// statistics keep the samples otherwise.
   final List<double> downloadSpeeds = [];
   final List<int> latencies;
+  /// The latest latency sample, for when [latencies] is not filled.
+  final int lastLatency;
 
   DownloadMeasurementService({
     required this.api,
@@ -21,12 +29,17 @@ class DownloadMeasurementService {
     required this.onSpeedUpdate,
     required this.onMetricsUpdate,
     required this.latencies,
+    this.lastLatency = 0,
   });
 
   Future<void> runMeasurement(Map<String, dynamic> config) async {
     final bytes = config['bytes'] as int;
     final count = config['count'] as int;
     final sizeLabel = SpeedMeasurementConfig.formatBytes(bytes);
+    if (Platform.isLinux && await _runNativeMeasurement(bytes, count, sizeLabel)) {
+      return;
+    }
+
     int consecutiveFailures = 0;
 
     for (int i = 0; i < count; i++) {
@@ -38,29 +51,8 @@ class DownloadMeasurementService {
       try {
         final speed = await _measureSpeed(bytes);
         if (speed > 0) {
-          downloadSpeeds.add(speed);
           consecutiveFailures = 0;
-
-          final percentileSpeed = _calculatePercentile(downloadSpeeds, 0.9);
-          final avgSpeed = downloadSpeeds.reduce((a, b) => a + b) / downloadSpeeds.length;
-          final currentPing = latencies.isNotEmpty ? latencies.last : 0;
-          final avgLatency = latencies.isNotEmpty
-              ? (latencies.reduce((a, b) => a + b) / latencies.length).round()
-              : 0;
-
-          int jitter = 0;
-          if (latencies.length >= 2) {
-            int jitterSum = 0;
-            for (int j = 1; j < latencies.length; j++) {
-              jitterSum += (latencies[j] - latencies[j - 1]).abs();
-            }
-            jitter = (jitterSum / (latencies.length - 1)).round();
-          }
-
-          onMetricsUpdate(percentileSpeed, avgSpeed, currentPing, avgLatency, jitter);
-
-          debugPrint(
-              '   📥 Download ${i + 1}/$count ($sizeLabel): ${speed.toStringAsFixed(2)} Mbps (90th percentile: ${percentileSpeed.toStringAsFixed(2)} Mbps, Avg: ${avgSpeed.toStringAsFixed(2)} Mbps)');
+          await _recordSpeed(speed, i, count, sizeLabel);
         }
       } catch (e) {
         consecutiveFailures++;
@@ -75,6 +67,89 @@ class DownloadMeasurementService {
     }
   }
 
+  Future<void> _recordSpeed(double speed, int i, int count, String sizeLabel) async {
+    final currentPing = latencies.isNotEmpty ? latencies.last : lastLatency;
+    double percentileSpeed;
+    double avgSpeed;
+    int avgLatency;
+    int jitter = 0;
+    if (SpeedStatsService.isSupported) {
+      final speedStats = await SpeedStatsService.add(SpeedStatsService.download, [speed]);
+      final latencyStats = await SpeedStatsService.add(SpeedStatsService.latency);
+      percentileSpeed = speedStats.p90;
+      avgSpeed = speedStats.mean;
+      avgLatency = latencyStats.mean.round();
+      jitter = latencyStats.jitter.round();
+    } else {
+      downloadSpeeds.add(speed);
+      percentileSpeed = _calculatePercentile(downloadSpeeds, 0.9);
+      avgSpeed = downloadSpeeds.reduce((a, b) => a + b) / downloadSpeeds.length;
+      avgLatency = latencies.isNotEmpty
+          ? (latencies.reduce((a, b) => a + b) / latencies.length).round()
+          : 0;
+      if (latencies.length >= 2) {
+        int jitterSum = 0;
+        for (int j = 1; j < latencies.length; j++) {
+          jitterSum += (latencies[j] - latencies[j - 1]).abs();
+        }
+        jitter = (jitterSum / (latencies.length - 1)).round();
+      }
+    }
+
+    onMetricsUpdate(percentileSpeed, avgSpeed, currentPing, avgLatency, jitter);
+
+    debugPrint(
+        '   📥 Download ${i + 1}/$count ($sizeLabel): ${speed.toStringAsFixed(2)} Mbps (90th percentile: ${percentileSpeed.toStringAsFixed(2)} Mbps, Avg: ${avgSpeed.toStringAsFixed(2)} Mbps)');
+  }
+
+  /// Runs every sample of the current config in the native engine, which
+  /// splits each one across parallel streams and times it on the receiving
+  /// side. Returns false when no sample succeeded, so the caller can fall
+  /// back to measuring through Dio.
+  Future<bool> _runNativeMeasurement(int bytes, int count, String sizeLabel) async {
+    final bridge = VpnBridge();
+    final subscription = bridge.speedTestUpdates.listen((speed) {
+      if (isCanceledCheck(false)) {
+        bridge.cancelSpeedTest();
+        return;
+      }
+      onSpeedUpdate(SpeedMeasurementConfig.roundSpeed(speed));
+    });
+
+    List<double> speeds;
+    try {
+      speeds = await bridge.measureThroughput('download', bytes, count);
+    } on PlatformException catch (e) {
+      debugPrint('   ❌ Native download measurement unavailable: ${e.message}');
+      return false;
+    } finally {
+      await subscription.cancel();
+    }
+
+    if (!speeds.any((speed) => speed > 0)) {
+      return isCanceledCheck(false);
+    }
+
+    int consecutiveFailures = 0;
+    for (int i = 0; i < speeds.length; i++) {
+      if (isCanceledCheck(false)) {
+        debugPrint('🛑 Download measurement canceled');
+        return true;
+      }
+      if (speeds[i] > 0) {
+        consecutiveFailures = 0;
+        await _recordSpeed(speeds[i], i, count, sizeLabel);
+      } else {
+        consecutiveFailures++;
+        debugPrint('   ❌ Download measurement ${i + 1} failed');
+        if (consecutiveFailures >= SpeedMeasurementConfig.maxConsecutiveFailures) {
+          throw Exception('Network connection lost during download test.');
+        }
+      }
+    }
+    return true;
+  }
+
   Future<double> _measureSpeed(int bytes) async {
     if (isCanceledCheck(false)) {
       debugPrint('   🛑 Download measurement canceled before start');
@@ -1,6 +1,7 @@
 import 'package:flutter/foundation.dart';
 import '../../data/api/speed_test_api.dart';
 import 'speed_measurement_config.dart';
+import 'speed_stats_service.dart';
 
 class LatencyMeasurementService {
   final SpeedTestApi api;
@@ -8,7 +9,11 @@ class LatencyMeasurementService {
   final Function(bool) isCanceledCheck;
   final Function(int ping, int latency, int jitter) onMetricsUpdate;
 
+  /// Filled only where [SpeedStatsService] is unsupported; the native
+  /// statistics keep the samples otherwise.
   final List<int> latencies = [];
+  int measured = 0;
+  int lastLatency = 0;
 
   LatencyMeasurementService({
     required this.api,
@@ -21,6 +26,10 @@ class LatencyMeasurementService {
     final numPackets = config['numPackets'] as int;
     int consecutiveFailures = 0;
 
+    if (SpeedStatsService.isSupported) {
+      await SpeedStatsService.add(SpeedStatsService.latency, const [], numPackets);
+    }
+
     for (int i = 0; i < numPackets; i++) {
       if (isCanceledCheck(false)) {
         debugPrint('🛑 Latency measurement canceled');
@@ -40,20 +49,26 @@ class LatencyMeasurementService {
           return;
         }
 
-        latencies.add(latency);
+        measured++;
+        lastLatency = latency;
         consecutiveFailures = 0;
 
-        final avgLatency = latencies.isNotEmpty
-            ? (latencies.reduce((a, b) => a + b) / latencies.length).round()
-            : 0;
-
+        int avgLatency;
         int jitter = 0;
-        if (latencies.length >= 2) {
-          int jitterSum = 0;
-          for (int j = 1; j < latencies.length; j++) {
-            jitterSum += (latencies[j] - latencies[j - 1]).abs();
+        if (SpeedStatsService.isSupported) {
+          final stats = await SpeedStatsService.add(SpeedStatsService.latency, [latency]);
+          avgLatency = stats.mean.round();
+          jitter = stats.jitter.round();
+        } else {
+          latencies.add(latency);
+          avgLatency = (latencies.reduce((a, b) => a + b) / latencies.length).round();
+          if (latencies.length >= 2) {
+            int jitterSum = 0;
+            for (int j = 1; j < latencies.length; j++) {
+              jitterSum += (latencies[j] - latencies[j - 1]).abs();
+            }
+            jitter = (jitterSum / (latencies.length - 1)).round();
           }
-          jitter = (jitterSum / (latencies.length - 1)).round();
         }
 
         onMetricsUpdate(latency, avgLatency, jitter);
@@ -72,7 +87,7 @@ class LatencyMeasurementService {
       await Future.delayed(SpeedMeasurementConfig.latencyDelay);
     }
 
-    if (latencies.isEmpty) {
+    if (measured == 0) {
       throw Exception('Failed to measure latency. Please check your internet connection.');
     }
   }
@@ -0,0 +1,269 @@
+import 'dart:async';
+import 'dart:io';
+import 'dart:math';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
+import '../../data/api/speed_test_api.dart';
+import '../../models/speed_test_result.dart';
+import 'speed_measurement_config.dart';
+
+/// Measures working latency: latency probes run on an idle connection and
+/// then keep going while parallel downloads, and then uploads, saturate it.
+/// The rise from idle to loaded latency is the bufferbloat users feel, and
+/// round trips per minute under load (RPM) sum it up in one number. Each
+/// latency is the mean of its probes without the slowest tenth, as the IETF
+/// responsiveness draft computes RPM.
+class ResponsivenessMeasurementService {
+  static const int _loadStreams = 4;
+  static const double _trimmedShare = 0.1;
+
+  final SpeedTestApi api;
+  final String measurementId;
+  final Function(bool) isCanceledCheck;
+  final Function(double speed) onSpeedUpdate;
+  final Function(int latency) onLatencyUpdate;
+
+  SpeedTestResult result = const SpeedTestResult();
+
+  ResponsivenessMeasurementService({
+    required this.api,
+    required this.measurementId,
+    required this.isCanceledCheck,
+    required this.onSpeedUpdate,
+    required this.onLatencyUpdate,
+  });
+
+  Future<void> runMeasurement(Map<String, dynamic> config) async {
+    if (Platform.isLinux && await _runNativeMeasurement(config)) {
+      return;
+    }
+
+    final idleProbes = config['idleProbes'] as int;
+    final idle = <int>[];
+    for (int i = 0; i < idleProbes && !isCanceledCheck(false); i++) {
+      final latency = await _probe();
+      if (latency != null) {
+        idle.add(latency);
+        onLatencyUpdate(latency);
+      }
+      await Future.delayed(SpeedMeasurementConfig.probeInterval);
+    }
+    if (idle.isEmpty) {
+      if (isCanceledCheck(false)) return;
+      throw Exception('Failed to measure latency. Please check your internet connection.');
+    }
+
+    final download = await _probeUnderLoad('download', config);
+    final upload = await _probeUnderLoad('upload', config);
+    if (isCanceledCheck(false)) return;
+
+    final loaded = [...download.latencies, ...upload.latencies];
+    if (loaded.isEmpty) {
+      throw Exception('Network connection lost during responsiveness test.');
+    }
+    final lost = download.lost + upload.lost;
+    _setResult(
+      idleLatency: _trimmedMean(idle),
+      loadedLatency: _trimmedMean(loaded),
+      downloadMbps: download.mbps,
+      uploadMbps: upload.mbps,
+      minLatency: idle.reduce(min),
+      lossPercent: lost * 100 / (loaded.length + lost),
+    );
+  }
+
+  /// Runs the whole test in the native engine, which drives the load
+  /// streams and the probes from its own threads. Returns false when the
+  /// engine is unavailable or no probe was answered, so the caller can fall
+  /// back to measuring through Dio.
+  Future<bool> _runNativeMeasurement(Map<String, dynamic> config) async {
+    final bridge = VpnBridge();
+    final subscription = bridge.speedTestUpdates.listen((speed) {
+      if (isCanceledCheck(false)) {
+        bridge.cancelSpeedTest();
+        return;
+      }
+      onSpeedUpdate(SpeedMeasurementConfig.roundSpeed(speed));
+    });
+
+    Map<dynamic, dynamic> native;
+    try {
+      native = await bridge.measureResponsiveness(
+        idleProbes: config['idleProbes'] as int,
+        loadMs: config['loadMs'] as int,
+        rampMs: config['rampMs'] as int,
+      );
+    } on PlatformException catch (e) {
+      debugPrint('   ❌ Native responsiveness measurement unavailable: ${e.message}');
+      return false;
+    } finally {
+      await subscription.cancel();
+    }
+
+    if (native['ok'] != true) {
+      return isCanceledCheck(false);
+    }
+    final probes = native['probes'] as int;
+    final lost = native['lostProbes'] as int;
+    _setResult(
+      idleLatency: (native['idleLatencyMs'] as num).toDouble(),
+      loadedLatency: (native['loadedLatencyMs'] as num).toDouble(),
+      downloadMbps: (native['downloadMbps'] as num).toDouble(),
+      uploadMbps: (native['uploadMbps'] as num).toDouble(),
+      minLatency: (native['idleLatencyMs'] as num).round(),
+      lossPercent: probes + lost > 0 ? lost * 100 / (probes + lost) : 0.0,
+    );
+    return true;
+  }
+
+  void _setResult({
+    required double idleLatency,
+    required double loadedLatency,
+    required double downloadMbps,
+    required double uploadMbps,
+    required int minLatency,
+    required double lossPercent,
+  }) {
+    final inflation = idleLatency > 0
+        ? max(0.0, (loadedLatency - idleLatency) / idleLatency * 100)
+        : 0.0;
+    result = SpeedTestResult(
+      downloadSpeed: downloadMbps,
+      uploadSpeed: uploadMbps,
+      ping: minLatency,
+      latency: loadedLatency.round(),
+      packetLoss: lossPercent,
+      idleLatency: idleLatency.round(),
+      loadedLatency: loadedLatency.round(),
+      rpm: loadedLatency > 0 ? (60000 / loadedLatency).round() : 0,
+      latencyInflation: inflation,
+    );
+
+    debugPrint(
+        '   🫧 Responsiveness: idle ${idleLatency.toStringAsFixed(1)}ms, loaded ${loadedLatency.toStringAsFixed(1)}ms (+${inflation.toStringAsFixed(0)}%), ${result.rpm} RPM');
+  }
+
+  /// Probes for [config]'s `loadMs` while [_loadStreams] requests in
+  /// [direction] keep the connection busy. Probes during the first
+  /// `rampMs`, while the load is still building up, are not counted.
+  Future<_LoadedProbes> _probeUnderLoad(
+      String direction, Map<String, dynamic> config) async {
+    final probes = _LoadedProbes();
+    if (isCanceledCheck(false)) return probes;
+
+    final loadBytes = config['loadBytes'] as int;
+    final stopwatch = Stopwatch()..start();
+    final deadline = Duration(milliseconds: config['loadMs'] as int);
+    final ramp = Duration(milliseconds: config['rampMs'] as int);
+    final moved = List<int>.filled(_loadStreams, 0);
+    int rampBytes = 0;
+    bool loading = true;
+
+    Future<void> load(int stream) async {
+      int done = 0;
+      while (loading && !isCanceledCheck(false)) {
+        try {
+          void onProgress(int count, int total) {
+            moved[stream] = done + count;
+          }
+
+          if (direction == 'download') {
+            await api.downloadTest(
+              bytes: loadBytes,
+              measurementId: measurementId,
+              during: 'responsiveness',
+              onReceiveProgress: onProgress,
+            );
+          } else {
+            await api.uploadTest(
+              _uploadBody(loadBytes, () => loading),
+              contentLength: loadBytes,
+              measurementId: measurementId,
+              during: 'responsiveness',
+              onSendProgress: onProgress,
+            );
+          }
+          done = moved[stream];
+        } catch (e) {
+          // An upload cut short at the end of the phase fails by design.
+          if (loading) debugPrint('   ❌ Responsiveness $direction load failed: $e');
+          return;
+        }
+      }
+    }
+
+    final streams = List.generate(_loadStreams, load);
+    while (stopwatch.elapsed < deadline && !isCanceledCheck(false)) {
+      final ramped = stopwatch.elapsed >= ramp;
+      if (ramped && rampBytes == 0) {
+        rampBytes = max(1, moved.reduce((a, b) => a + b));
+      }
+      final latency = await _probe();
+      final elapsed = stopwatch.elapsed;
+      if (elapsed.inMilliseconds > 50) {
+        final mbps = moved.reduce((a, b) => a + b) * 8 / elapsed.inMicroseconds;
+        onSpeedUpdate(SpeedMeasurementConfig.roundSpeed(mbps));
+      }
+      if (ramped && elapsed < deadline) {
+        if (latency != null) {
+          probes.latencies.add(latency);
+          onLatencyUpdate(latency);
+        } else if (!isCanceledCheck(false)) {
+          probes.lost++;
+        }
+      }
+      await Future.delayed(SpeedMeasurementConfig.probeInterval);
+    }
+    loading = false;
+
+    final loadedTime = stopwatch.elapsed - ramp;
+    if (rampBytes > 0 && loadedTime.inMicroseconds > 0) {
+      final loadedBytes = moved.reduce((a, b) => a + b) - rampBytes;
+      probes.mbps = max(0, loadedBytes) * 8 / loadedTime.inMicroseconds;
+    }
+    // Downloads still in flight finish in the background; the next phase
+    // does not wait for them.
+    unawaited(Future.wait(streams));
+    return probes;
+  }
+
+  /// One latency probe in ms, or null if it failed.
+  Future<int?> _probe() async {
+    try {
+      final stopwatch = Stopwatch()..start();
+      await api.latencyTest(bytes: 0, measurementId: measurementId)
+          .timeout(SpeedMeasurementConfig.probeTimeout);
+      return stopwatch.elapsedMilliseconds;
+    } catch (e) {
+      return null;
+    }
+  }
+
+  /// [bytes] of random data, one chunk repeated, ending early once
+  /// [keepGoing] turns false.
+  Stream<List<int>> _uploadBody(int bytes, bool Function() keepGoing) async* {
+    final random = Random();
+    final chunk = List<int>.generate(
+        SpeedMeasurementConfig.chunkSize, (_) => random.nextInt(256));
+    int sent = 0;
+    while (sent < bytes && keepGoing() && !isCanceledCheck(false)) {
+      final size = min(chunk.length, bytes - sent);
+      yield size == chunk.length ? chunk : chunk.sublist(0, size);
+      sent += size;
+      await Future.delayed(Duration.zero);
+    }
+  }
+
+  static double _trimmedMean(List<int> latencies) {
+    final sorted = List<int>.from(latencies)..sort();
+    final kept = sorted.length - (sorted.length * _trimmedShare).floor();
+    return sorted.take(kept).reduce((a, b) => a + b) / kept;
+  }
+}
+
+class _LoadedProbes {
+  final List<int> latencies = [];
+  int lost = 0;
+  double mbps = 0.0;
+}
@@ -1,4 +1,5 @@
 import '../../models/speed_test_result.dart';
+import 'speed_stats_service.dart';
 
 class ResultsCalculatorService {
   static SpeedTestResult calculateFinalResults({
@@ -43,6 +44,23 @@ class ResultsCalculatorService {
     );
   }
 
+  /// Same results as [calculateFinalResults], read from the native streaming
+  /// statistics the measurement services fed while the test ran.
+  static Future<SpeedTestResult> calculateFinalResultsFromStats() async {
+    final download = await SpeedStatsService.add(SpeedStatsService.download);
+    final upload = await SpeedStatsService.add(SpeedStatsService.upload);
+    final latency = await SpeedStatsService.add(SpeedStatsService.latency);
+
+    return SpeedTestResult(
+      downloadSpeed: download.p90,
+      uploadSpeed: upload.p90,
+      ping: latency.min.round(),
+      latency: latency.p50.round(),
+      jitter: latency.jitter.round(),
+      packetLoss: latency.count > 10 ? latency.lossPercent : 0.0,
+    );
+  }
+
   static double _calculatePercentile(List<double> values, double percentile) {
     if (values.isEmpty) return 0.0;
 
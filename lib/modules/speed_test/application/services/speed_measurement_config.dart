@@ -10,7 +10,18 @@ class SpeedMeasurementConfig {
     {'type': 'download', 'bytes': 10000000, 'count': 6},
   ];
 
+  /// Responsiveness mode: idle probes, then probes kept going through
+  /// [loadMs] of saturating download and as long again of upload.
+  static const Map<String, dynamic> responsiveness = {
+    'idleProbes': 10,
+    'loadMs': 8000,
+    'rampMs': 1500,
+    'loadBytes': 25000000,
+  };
+
   static const int totalMeasurements = 8;
+  static const Duration probeInterval = Duration(milliseconds: 100);
+  static const Duration probeTimeout = Duration(seconds: 3);
   static const int maxConsecutiveFailures = 3;
   static const int chunkSize = 65536;
   static const Duration measurementDelay = Duration(milliseconds: 50);
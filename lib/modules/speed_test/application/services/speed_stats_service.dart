@@ -0,0 +1,30 @@
+import 'dart:io';
+import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
+import '../../models/speed_stats.dart';
+
+/// Feeds speed test samples to the runner's streaming statistics, which keep
+/// percentiles, jitter and packet loss in constant memory with O(1) updates
+/// instead of re-sorting every sample list on each new sample.
+class SpeedStatsService {
+  static const String download = 'download';
+  static const String upload = 'upload';
+  static const String latency = 'latency';
+
+  /// Only the Linux runner implements the statistics channel; other
+  /// platforms compute from the sample lists.
+  static bool get isSupported => Platform.isLinux;
+
+  /// Adds [values] to [series] and returns the updated summary. Pass no
+  /// values to read the summary.
+  static Future<SpeedStats> add(
+    String series, [
+    List<num> values = const [],
+    int expected = 0,
+  ]) async {
+    final stats =
+        await VpnBridge().addStats(series, values, expected: expected);
+    return SpeedStats.fromMap(stats);
+  }
+
+  static Future<void> reset() => VpnBridge().resetStats();
+}
@@ -1,8 +1,12 @@
 import 'dart:async';
+import 'dart:io';
 import 'dart:math';
 import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
 import '../../data/api/speed_test_api.dart';
 import 'speed_measurement_config.dart';
+import 'speed_stats_service.dart';
 
 class UploadMeasurementService {
   final SpeedTestApi api;
@@ -12,6 +16,8 @@ class UploadMeasurementService {
   final Function(double percentileSpeed, double avgSpeed, int jitter, double packetLoss)
       onMetricsUpdate;
 
+  /// Filled only where [SpeedStatsService] is unsupported; the native
+  /// statistics keep the samples otherwise.
   final List<double> uploadSpeeds = [];
   final List<int> latencies;
   final List<Map<String, dynamic>> measurements;
@@ -30,6 +36,10 @@ class UploadMeasurementService {
     final bytes = config['bytes'] as int;
     final count = config['count'] as int;
     final sizeLabel = SpeedMeasurementConfig.formatBytes(bytes);
+    if (Platform.isLinux && await _runNativeMeasurement(bytes, count, sizeLabel)) {
+      return;
+    }
+
     int consecutiveFailures = 0;
 
     for (int i = 0; i < count; i++) {
@@ -41,34 +51,8 @@ class UploadMeasurementService {
       try {
         final speed = await _measureSpeed(bytes);
         if (speed > 0 && !isCanceledCheck(false)) {
-          uploadSpeeds.add(speed);
           consecutiveFailures = 0;
-
-          final percentileSpeed = _calculatePercentile(uploadSpeeds, 0.9);
-          final avgSpeed = uploadSpeeds.reduce((a, b) => a + b) / uploadSpeeds.length;
-
-          int jitter = 0;
-          if (latencies.length >= 2) {
-            int jitterSum = 0;
-            for (int j = 1; j < latencies.length; j++) {
-              jitterSum += (latencies[j] - latencies[j - 1]).abs();
-            }
-            jitter = (jitterSum / (latencies.length - 1)).round();
-          }
-
-          double packetLoss = 0.0;
-          if (latencies.length > 10) {
-            final expectedPackets = measurements
-                .where((m) => m['type'] == 'latency')
-                .fold<int>(0, (sum, m) => sum + (m['numPackets'] as int));
-            packetLoss =
-                ((expectedPackets - latencies.length) / expectedPackets * 100).clamp(0.0, 100.0);
-          }
-
-          onMetricsUpdate(percentileSpeed, avgSpeed, jitter, packetLoss);
-
-          debugPrint(
-              '   📤 Upload ${i + 1}/$count ($sizeLabel): ${speed.toStringAsFixed(2)} Mbps (90th percentile: ${percentileSpeed.toStringAsFixed(2)} Mbps, Avg: ${avgSpeed.toStringAsFixed(2)} Mbps)');
+          await _recordSpeed(speed, i, count, sizeLabel);
         }
       } catch (e) {
         consecutiveFailures++;
@@ -83,6 +67,94 @@ class UploadMeasurementService {
     }
   }
 
+  Future<void> _recordSpeed(double speed, int i, int count, String sizeLabel) async {
+    double percentileSpeed;
+    double avgSpeed;
+    int jitter = 0;
+    double packetLoss = 0.0;
+    if (SpeedStatsService.isSupported) {
+      final speedStats = await SpeedStatsService.add(SpeedStatsService.upload, [speed]);
+      final latencyStats = await SpeedStatsService.add(SpeedStatsService.latency);
+      percentileSpeed = speedStats.p90;
+      avgSpeed = speedStats.mean;
+      jitter = latencyStats.jitter.round();
+      if (latencyStats.count > 10) {
+        packetLoss = latencyStats.lossPercent;
+      }
+    } else {
+      uploadSpeeds.add(speed);
+      percentileSpeed = _calculatePercentile(uploadSpeeds, 0.9);
+      avgSpeed = uploadSpeeds.reduce((a, b) => a + b) / uploadSpeeds.length;
+      if (latencies.length >= 2) {
+        int jitterSum = 0;
+        for (int j = 1; j < latencies.length; j++) {
+          jitterSum += (latencies[j] - latencies[j - 1]).abs();
+        }
+        jitter = (jitterSum / (latencies.length - 1)).round();
+      }
+      if (latencies.length > 10) {
+        final expectedPackets = measurements
+            .where((m) => m['type'] == 'latency')
+            .fold<int>(0, (sum, m) => sum + (m['numPackets'] as int));
+        packetLoss =
+            ((expectedPackets - latencies.length) / expectedPackets * 100).clamp(0.0, 100.0);
+      }
+    }
+
+    onMetricsUpdate(percentileSpeed, avgSpeed, jitter, packetLoss);
+
+    debugPrint(
+        '   📤 Upload ${i + 1}/$count ($sizeLabel): ${speed.toStringAsFixed(2)} Mbps (90th percentile: ${percentileSpeed.toStringAsFixed(2)} Mbps, Avg: ${avgSpeed.toStringAsFixed(2)} Mbps)');
+  }
+
+  /// Runs every sample of the current config in the native engine, which
+  /// splits each one across parallel streams and times it on the receiving
+  /// side. Returns false when no sample succeeded, so the caller can fall
+  /// back to measuring through Dio.
+  Future<bool> _runNativeMeasurement(int bytes, int count, String sizeLabel) async {
+    final bridge = VpnBridge();
+    final subscription = bridge.speedTestUpdates.listen((speed) {
+      if (isCanceledCheck(false)) {
+        bridge.cancelSpeedTest();
+        return;
+      }
+      onSpeedUpdate(SpeedMeasurementConfig.roundSpeed(speed));
+    });
+
+    List<double> speeds;
+    try {
+      speeds = await bridge.measureThroughput('upload', bytes, count);
+    } on PlatformException catch (e) {
+      debugPrint('   ❌ Native upload measurement unavailable: ${e.message}');
+      return false;
+    } finally {
+      await subscription.cancel();
+    }
+
+    if (!speeds.any((speed) => speed > 0)) {
+      return isCanceledCheck(false);
+    }
+
+    int consecutiveFailures = 0;
+    for (int i = 0; i < speeds.length; i++) {
+      if (isCanceledCheck(false)) {
+        debugPrint('🛑 Upload measurement canceled');
+        return true;
+      }
+      if (speeds[i] > 0) {
+        consecutiveFailures = 0;
+        await _recordSpeed(speeds[i], i, count, sizeLabel);
+      } else {
+        consecutiveFailures++;
+        debugPrint('   ❌ Upload measurement ${i + 1} failed');
+        if (consecutiveFailures >= SpeedMeasurementConfig.maxConsecutiveFailures) {
+          throw Exception('Network connection lost during upload test.');
+        }
+      }
+    }
+    return true;
+  }
+
   Future<double> _measureSpeed(int bytes) async {
     if (isCanceledCheck(false)) {
       debugPrint('   🛑 Upload measurement canceled before start');
@@ -1,7 +1,9 @@
 import 'dart:async';
+import 'dart:io';
 import 'dart:math';
 import 'package:defyx_vpn/core/network/http_client.dart';
 import 'package:defyx_vpn/core/network/http_client_interface.dart';
+import 'package:defyx_vpn/modules/core/vpn_bridge.dart';
 import 'package:defyx_vpn/modules/speed_test/data/api/speed_test_api.dart';
 import 'package:defyx_vpn/modules/speed_test/models/speed_test_result.dart';
 import 'package:defyx_vpn/shared/providers/connection_state_provider.dart';
@@ -11,12 +13,15 @@ import 'package:flutter_riverpod/flutter_riverpod.dart';
 import 'services/cloudflare_logger_service.dart';
 import 'services/download_measurement_service.dart';
 import 'services/latency_measurement_service.dart';
+import 'services/responsiveness_measurement_service.dart';
 import 'services/results_calculator_service.dart';
 import 'services/speed_measurement_config.dart';
+import 'services/speed_stats_service.dart';
 import 'services/upload_measurement_service.dart';
 
 class SpeedTestState {
   final SpeedTestStep step;
+  final SpeedTestMode mode;
   final SpeedTestResult result;
   final double progress;
   final bool isConnectionStable;
@@ -28,6 +33,7 @@ class SpeedTestState {
 
   const SpeedTestState({
     this.step = SpeedTestStep.ready,
+    this.mode = SpeedTestMode.standard,
     this.result = const SpeedTestResult(),
     this.progress = 0.0,
     this.isConnectionStable = true,
@@ -40,6 +46,7 @@ class SpeedTestState {
 
   SpeedTestState copyWith({
     SpeedTestStep? step,
+    SpeedTestMode? mode,
     SpeedTestResult? result,
     double? progress,
     bool? isConnectionStable,
@@ -52,6 +59,7 @@ class SpeedTestState {
   }) {
     return SpeedTestState(
       step: step ?? this.step,
+      mode: mode ?? this.mode,
       result: result ?? this.result,
       progress: progress ?? this.progress,
       isConnectionStable: isConnectionStable ?? this.isConnectionStable,
@@ -87,6 +95,7 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
   final List<double> _downloadSpeeds = [];
   final List<double> _uploadSpeeds = [];
   final List<int> _latencies = [];
+  int _lastLatency = 0;
 
   SpeedTestNotifier(this._httpClient, this._ref)
       : super(const SpeedTestState()) {
@@ -118,6 +127,9 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
     _isTestCanceled = true;
     _testTimer?.cancel();
     _testTimer = null;
+    if (Platform.isLinux) {
+      VpnBridge().cancelSpeedTest();
+    }
 
     _stopConnectionMonitoring();
 
@@ -129,8 +141,10 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
     _downloadSpeeds.clear();
     _uploadSpeeds.clear();
     _latencies.clear();
+    _lastLatency = 0;
 
-    state = const SpeedTestState();
+    // The chosen mode outlives the reset, so a retry runs the same test.
+    state = SpeedTestState(mode: state.mode);
 
     debugPrint('🛑 Speed test stopped and reset');
   }
@@ -139,6 +153,9 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
     _isTestCanceled = true;
     _testTimer?.cancel();
     _testTimer = null;
+    if (Platform.isLinux) {
+      VpnBridge().cancelSpeedTest();
+    }
 
     for (final subscription in _activeSubscriptions) {
       subscription.cancel();
@@ -148,11 +165,22 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
     _downloadSpeeds.clear();
     _uploadSpeeds.clear();
     _latencies.clear();
+    _lastLatency = 0;
 
     debugPrint('🛑 Speed test stopped (without state reset)');
   }
 
-  Future<void> startTest() async {
+  /// Picks the mode the next test runs in, while no test is running.
+  void setMode(SpeedTestMode mode) {
+    if (state.step != SpeedTestStep.ready) return;
+    state = state.copyWith(mode: mode);
+  }
+
+  /// Runs a test in [mode], by default the one last picked;
+  /// [SpeedTestMode.responsiveness] measures latency under load instead of
+  /// the separate latency and throughput phases.
+  Future<void> startTest({SpeedTestMode? mode}) async {
+    mode ??= state.mode;
     if (!_isTestCanceled) {
       stopAndResetTest();
     }
@@ -163,6 +191,7 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
 
     state = state.copyWith(
       step: SpeedTestStep.loading,
+      mode: mode,
       progress: 0.0,
       result: const SpeedTestResult(),
       currentPhase: 'Initializing...',
@@ -175,11 +204,19 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
     _downloadSpeeds.clear();
     _uploadSpeeds.clear();
     _latencies.clear();
+    _lastLatency = 0;
+    if (SpeedStatsService.isSupported) {
+      await SpeedStatsService.reset();
+    }
 
     _startConnectionMonitoring();
 
     try {
-      await _runMeasurementSequence();
+      if (mode == SpeedTestMode.responsiveness) {
+        await _runResponsivenessMeasurement();
+      } else {
+        await _runMeasurementSequence();
+      }
 
       if (_isTestCanceled) {
         debugPrint('🛑 Speed test was canceled');
@@ -187,7 +224,9 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
         return;
       }
 
-      _calculateFinalResults();
+      if (mode == SpeedTestMode.standard) {
+        await _calculateFinalResults();
+      }
       _checkConnectionStability();
       debugPrint('🏁 Speed test completed successfully');
       _stopConnectionMonitoring();
@@ -325,6 +364,7 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
 
     await service.runMeasurement(config);
     _latencies.addAll(service.latencies);
+    _lastLatency = service.lastLatency;
   }
 
   Future<void> _runDownloadMeasurement(
@@ -358,6 +398,7 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
         );
       },
       latencies: _latencies,
+      lastLatency: _lastLatency,
     );
 
     await service.runMeasurement(config);
@@ -400,14 +441,59 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
     _uploadSpeeds.addAll(service.uploadSpeeds);
   }
 
-  void _calculateFinalResults() {
-    final result = ResultsCalculatorService.calculateFinalResults(
-      downloadSpeeds: _downloadSpeeds,
-      uploadSpeeds: _uploadSpeeds,
-      latencies: _latencies,
-      measurements: SpeedMeasurementConfig.measurements,
+  Future<void> _runResponsivenessMeasurement() async {
+    final config = SpeedMeasurementConfig.responsiveness;
+    state = state.copyWith(
+      step: SpeedTestStep.loading,
+      currentPhase: 'Measuring idle latency...',
     );
 
+    final service = ResponsivenessMeasurementService(
+      api: _api,
+      measurementId: _measurementId,
+      isCanceledCheck: (reset) => _isTestCanceled,
+      onSpeedUpdate: (speed) {
+        if (state.step == SpeedTestStep.loading) {
+          state = state.copyWith(
+            step: SpeedTestStep.download,
+            currentPhase: 'Measuring latency under load...',
+          );
+        }
+        state = state.copyWith(currentSpeed: speed);
+      },
+      onLatencyUpdate: (latency) {
+        state = state.copyWith(
+          result: state.result.copyWith(ping: latency, latency: latency),
+        );
+      },
+    );
+
+    await service.runMeasurement(config);
+    if (_isTestCanceled) return;
+
+    state = state.copyWith(
+      result: service.result,
+      progress: 1.0,
+      currentPhase: 'Test completed',
+      testCompleted: true,
+    );
+
+    _logger.logResults(
+      measurementId: _measurementId,
+      result: service.result,
+    );
+  }
+
+  Future<void> _calculateFinalResults() async {
+    final result = SpeedStatsService.isSupported
+        ? await ResultsCalculatorService.calculateFinalResultsFromStats()
+        : ResultsCalculatorService.calculateFinalResults(
+            downloadSpeeds: _downloadSpeeds,
+            uploadSpeeds: _uploadSpeeds,
+            latencies: _latencies,
+            measurements: SpeedMeasurementConfig.measurements,
+          );
+
     state = state.copyWith(
       result: result,
       progress: 1.0,
@@ -448,10 +534,11 @@ class SpeedTestNotifier extends StateNotifier<SpeedTestState> {
   }
 
   void retryConnection() {
+    final mode = state.mode;
     stopAndResetTest();
     Future.delayed(const Duration(milliseconds: 100), () {
       if (!_isTestCanceled) {
-        startTest();
+        startTest(mode: mode);
       }
     });
   }
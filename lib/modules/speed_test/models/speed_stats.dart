@@ -0,0 +1,37 @@
+/// Summary of one series of speed test samples, as kept by the native
+/// runner.
+class SpeedStats {
+  final int count;
+  final double min;
+  final double max;
+  final double mean;
+  final double p50;
+  final double p90;
+  final double jitter;
+  final double lossPercent;
+
+  const SpeedStats({
+    this.count = 0,
+    this.min = 0.0,
+    this.max = 0.0,
+    this.mean = 0.0,
+    this.p50 = 0.0,
+    this.p90 = 0.0,
+    this.jitter = 0.0,
+    this.lossPercent = 0.0,
+  });
+
+  factory SpeedStats.fromMap(Map<dynamic, dynamic> map) {
+    double read(String key) => (map[key] as num?)?.toDouble() ?? 0.0;
+    return SpeedStats(
+      count: (map['count'] as num?)?.toInt() ?? 0,
+      min: read('min'),
+      max: read('max'),
+      mean: read('mean'),
+      p50: read('p50'),
+      p90: read('p90'),
+      jitter: read('jitter'),
+      lossPercent: read('lossPercent'),
+    );
+  }
+}
@@ -5,6 +5,15 @@ enum SpeedTestStep {
   upload,
 }
 
+enum SpeedTestMode {
+  /// Latency, download and upload measured one after another.
+  standard,
+
+  /// Latency measured idle and again while downloads and then uploads
+  /// saturate the connection, which is what exposes bufferbloat.
+  responsiveness,
+}
+
 class SpeedTestResult {
   final double downloadSpeed;
   final double uploadSpeed;
@@ -13,6 +22,17 @@ class SpeedTestResult {
   final double packetLoss;
   final int jitter;
 
+  /// Responsiveness mode only: latency in ms with the connection idle and
+  /// while it is saturated.
+  final int idleLatency;
+  final int loadedLatency;
+
+  /// Round trips per minute under load, 60000 / [loadedLatency].
+  final int rpm;
+
+  /// How much load inflates latency over [idleLatency], in percent.
+  final double latencyInflation;
+
   const SpeedTestResult({
     this.downloadSpeed = 0.0,
     this.uploadSpeed = 0.0,
@@ -20,6 +40,10 @@ class SpeedTestResult {
     this.latency = 0,
     this.packetLoss = 0.0,
     this.jitter = 0,
+    this.idleLatency = 0,
+    this.loadedLatency = 0,
+    this.rpm = 0,
+    this.latencyInflation = 0.0,
   });
 
   SpeedTestResult copyWith({
@@ -29,6 +53,10 @@ class SpeedTestResult {
     int? latency,
     double? packetLoss,
     int? jitter,
+    int? idleLatency,
+    int? loadedLatency,
+    int? rpm,
+    double? latencyInflation,
   }) {
     return SpeedTestResult(
       downloadSpeed: downloadSpeed ?? this.downloadSpeed,
@@ -37,6 +65,10 @@ class SpeedTestResult {
       latency: latency ?? this.latency,
       packetLoss: packetLoss ?? this.packetLoss,
       jitter: jitter ?? this.jitter,
+      idleLatency: idleLatency ?? this.idleLatency,
+      loadedLatency: loadedLatency ?? this.loadedLatency,
+      rpm: rpm ?? this.rpm,
+      latencyInflation: latencyInflation ?? this.latencyInflation,
     );
   }
 }
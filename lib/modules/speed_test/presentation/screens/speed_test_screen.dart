@@ -167,7 +167,7 @@ class _SpeedTestScreenState extends ConsumerState<SpeedTestScreen> {
       case SpeedTestStep.ready:
         return SpeedTestReadyState(
           onRetry: () {
-            ref.read(speedTestProvider.notifier).startTest();
+            ref.read(speedTestProvider.notifier).startTest(mode: state.mode);
           },
         );
       case SpeedTestStep.loading:
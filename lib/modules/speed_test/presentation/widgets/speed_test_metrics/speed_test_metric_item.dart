@@ -168,7 +168,9 @@ class MetricItemHorizontal extends StatelessWidget {
   @override
   Widget build(BuildContext context) {
     final animationService = AnimationService();
-    final bool hasValue = (label == 'P.LOSS') ? true : value > 0;
+    // Zero loss and no inflation are results, not missing values.
+    final bool hasValue =
+        (label == 'P.LOSS' || label == 'INFLATION') ? true : value > 0;
 
     return SizedBox(
       width: 115.w,
@@ -10,6 +10,13 @@ class SpeedTestMetricsDisplay extends StatelessWidget {
   final int latency;
   final double packetLoss;
   final int jitter;
+  /// Responsiveness mode replaces latency, loss and jitter with latency
+  /// idle and under load, round trips per minute and the inflation.
+  final bool showResponsiveness;
+  final int idleLatency;
+  final int loadedLatency;
+  final int rpm;
+  final double latencyInflation;
   final bool showDownload;
   final bool showUpload;
   final ConnectionStatus connectionStatus;
@@ -22,6 +29,11 @@ class SpeedTestMetricsDisplay extends StatelessWidget {
     required this.latency,
     required this.packetLoss,
     required this.jitter,
+    this.showResponsiveness = false,
+    this.idleLatency = 0,
+    this.loadedLatency = 0,
+    this.rpm = 0,
+    this.latencyInflation = 0.0,
     required this.showDownload,
     required this.showUpload,
     required this.connectionStatus,
@@ -72,30 +84,65 @@ class SpeedTestMetricsDisplay extends StatelessWidget {
             Column(
               spacing: 5.h,
               crossAxisAlignment: CrossAxisAlignment.start,
-              children: [
-                MetricItemHorizontal(
-                  label: 'LATENCY',
-                  value: latency,
-                  unit: 'ms',
-                  connectionStatus: connectionStatus,
-                ),
-                MetricItemHorizontal(
-                  label: 'P.LOSS',
-                  value: packetLoss,
-                  unit: '%',
-                  connectionStatus: connectionStatus,
-                ),
-                MetricItemHorizontal(
-                  label: 'JITTER',
-                  value: jitter,
-                  unit: 'ms',
-                  connectionStatus: connectionStatus,
-                ),
-              ],
+              children: showResponsiveness
+                  ? _responsivenessItems()
+                  : _latencyItems(),
             ),
           ],
         ),
       ],
     );
   }
+
+  List<Widget> _latencyItems() {
+    return [
+      MetricItemHorizontal(
+        label: 'LATENCY',
+        value: latency,
+        unit: 'ms',
+        connectionStatus: connectionStatus,
+      ),
+      MetricItemHorizontal(
+        label: 'P.LOSS',
+        value: packetLoss,
+        unit: '%',
+        connectionStatus: connectionStatus,
+      ),
+      MetricItemHorizontal(
+        label: 'JITTER',
+        value: jitter,
+        unit: 'ms',
+        connectionStatus: connectionStatus,
+      ),
+    ];
+  }
+
+  List<Widget> _responsivenessItems() {
+    return [
+      MetricItemHorizontal(
+        label: 'IDLE',
+        value: idleLatency,
+        unit: 'ms',
+        connectionStatus: connectionStatus,
+      ),
+      MetricItemHorizontal(
+        label: 'LOADED',
+        value: loadedLatency,
+        unit: 'ms',
+        connectionStatus: connectionStatus,
+      ),
+      MetricItemHorizontal(
+        label: 'RPM',
+        value: rpm,
+        unit: '',
+        connectionStatus: connectionStatus,
+      ),
+      MetricItemHorizontal(
+        label: 'INFLATION',
+        value: latencyInflation.round(),
+        unit: '%',
+        connectionStatus: connectionStatus,
+      ),
+    ];
+  }
 }
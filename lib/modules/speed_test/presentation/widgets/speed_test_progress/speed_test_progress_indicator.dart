@@ -17,6 +17,7 @@ class SpeedTestProgressIndicator extends StatefulWidget {
   final String? centerUnit;
   final String? subtitle;
   final SpeedTestResult? result;
+  final SpeedTestMode mode;
   final Widget? button;
   final SpeedTestStep? currentStep;
   final ConnectionStatus connectionStatus;
@@ -31,6 +32,7 @@ class SpeedTestProgressIndicator extends StatefulWidget {
     this.centerUnit,
     this.subtitle,
     this.result,
+    this.mode = SpeedTestMode.standard,
     this.button,
     this.currentStep,
     required this.connectionStatus,
@@ -210,6 +212,12 @@ class _SpeedTestProgressIndicatorState extends State<SpeedTestProgressIndicator>
                     latency: widget.result!.latency,
                     packetLoss: widget.result!.packetLoss,
                     jitter: widget.result!.jitter,
+                    showResponsiveness:
+                        widget.mode == SpeedTestMode.responsiveness,
+                    idleLatency: widget.result!.idleLatency,
+                    loadedLatency: widget.result!.loadedLatency,
+                    rpm: widget.result!.rpm,
+                    latencyInflation: widget.result!.latencyInflation,
                     showDownload: true,
                     showUpload: true,
                     connectionStatus: widget.connectionStatus,
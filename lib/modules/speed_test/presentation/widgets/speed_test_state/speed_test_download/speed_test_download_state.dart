@@ -37,6 +37,7 @@ class SpeedTestDownloadState extends ConsumerWidget {
             centerUnit: 'Mbps',
             subtitle: 'DOWNLOAD',
             result: state.result,
+            mode: state.mode,
             currentStep: SpeedTestStep.download,
             connectionStatus: connectionState.status,
           ),
@@ -24,6 +24,7 @@ class SpeedTestLoadingState extends ConsumerWidget {
           showButton: false,
           showLoadingIndicator: true,
           result: state.result,
+          mode: state.mode,
           connectionStatus: connectionState.status,
           currentStep: SpeedTestStep.loading,
         ),
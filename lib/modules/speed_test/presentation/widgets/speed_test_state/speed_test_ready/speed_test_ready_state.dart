@@ -24,7 +24,7 @@ class SpeedTestReadyState extends ConsumerWidget {
       final status = connectionState.status;
 
       if (status == ConnectionStatus.disconnected || status == ConnectionStatus.connected) {
-        ref.read(speedTestProvider.notifier).startTest();
+        ref.read(speedTestProvider.notifier).startTest(mode: state.mode);
       } else {
         debugPrint(
             'Button clicked but connection status is $status. Will start when connection is valid.');
@@ -40,6 +40,7 @@ class SpeedTestReadyState extends ConsumerWidget {
           color: Colors.green,
           showButton: true,
           result: state.result,
+          mode: state.mode,
           connectionStatus: connectionState.status,
           button: state.testCompleted
               ? SpeedTestStartButton(
@@ -70,7 +71,62 @@ class SpeedTestReadyState extends ConsumerWidget {
                   ),
                 ),
         ),
+        if (!state.testCompleted)
+          _ModeSelector(
+            mode: state.mode,
+            onChanged: ref.read(speedTestProvider.notifier).setMode,
+          ),
       ],
     );
   }
 }
+
+/// Picks between the standard test and the one measuring latency under
+/// load, which is what bufferbloat shows up in.
+class _ModeSelector extends StatelessWidget {
+  final SpeedTestMode mode;
+  final ValueChanged<SpeedTestMode> onChanged;
+
+  const _ModeSelector({
+    required this.mode,
+    required this.onChanged,
+  });
+
+  @override
+  Widget build(BuildContext context) {
+    return Row(
+      mainAxisAlignment: MainAxisAlignment.center,
+      spacing: 8.w,
+      children: [
+        _option(SpeedTestMode.standard, 'SPEED'),
+        _option(SpeedTestMode.responsiveness, 'RESPONSIVENESS'),
+      ],
+    );
+  }
+
+  Widget _option(SpeedTestMode value, String label) {
+    final selected = mode == value;
+    return InkWell(
+      onTap: () => onChanged(value),
+      borderRadius: BorderRadius.circular(15.r),
+      child: Container(
+        padding: EdgeInsets.symmetric(horizontal: 14.w, vertical: 6.h),
+        decoration: BoxDecoration(
+          borderRadius: BorderRadius.circular(15.r),
+          border: Border.all(
+            color: selected ? Colors.white : Colors.grey.shade700,
+          ),
+        ),
+        child: Text(
+          label,
+          style: TextStyle(
+            color: selected ? Colors.white : const Color(0xFFABABAB),
+            fontSize: 12.sp,
+            fontFamily: 'Lato',
+            fontWeight: FontWeight.w600,
+          ),
+        ),
+      ),
+    );
+  }
+}
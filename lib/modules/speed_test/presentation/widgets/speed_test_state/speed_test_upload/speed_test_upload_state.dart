@@ -37,6 +37,7 @@ class SpeedTestUploadState extends ConsumerWidget {
             centerUnit: 'Mbps',
             subtitle: 'UPLOAD',
             result: state.result,
+            mode: state.mode,
             currentStep: SpeedTestStep.upload,
             connectionStatus: connectionState.status,
           ),
@@ -0,0 +1,318 @@
+#include "base64.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+constexpr uint8_t kInvalid = 0xff;
+
+struct DecodeTable {
+  uint8_t values[256];
+};
+
+constexpr DecodeTable MakeDecodeTable() {
+  DecodeTable table = {};
+  for (int i = 0; i < 256; i++) {
+    table.values[i] = kInvalid;
+  }
+  for (int i = 0; i < 26; i++) {
+    table.values['A' + i] = static_cast<uint8_t>(i);
+    table.values['a' + i] = static_cast<uint8_t>(26 + i);
+  }
+  for (int i = 0; i < 10; i++) {
+    table.values['0' + i] = static_cast<uint8_t>(52 + i);
+  }
+  table.values['+'] = table.values['-'] = 62;
+  table.values['/'] = table.values['_'] = 63;
+  return table;
+}
+
+constexpr DecodeTable kDecodeTable = MakeDecodeTable();
+
+uint8_t ValueOf(char c) {
+  return kDecodeTable.values[static_cast<uint8_t>(c)];
+}
+
+// Four characters at a time through the table.
+size_t DecodeScalar(const char* input, size_t length, uint8_t* output) {
+  size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    uint32_t a = ValueOf(input[i]);
+    uint32_t b = ValueOf(input[i + 1]);
+    uint32_t c = ValueOf(input[i + 2]);
+    uint32_t d = ValueOf(input[i + 3]);
+    if (((a | b | c | d) & 0x80) != 0) {
+      break;
+    }
+    uint32_t group = (a << 18) | (b << 12) | (c << 6) | d;
+    output[0] = static_cast<uint8_t>(group >> 16);
+    output[1] = static_cast<uint8_t>(group >> 8);
+    output[2] = static_cast<uint8_t>(group);
+    output += 3;
+  }
+  return i;
+}
+
+#if defined(__x86_64__)
+// The x86 kernels classify each character by its two nibbles, as Muła and
+// Lemire do: a table indexed by the high nibble and one indexed by the low
+// nibble share a bit exactly when the character is outside the alphabet.
+// Two more lookups give the offset from character to six-bit value, then
+// each group of four values is packed into three bytes.
+//
+// One bit per high nibble class: 2 (+ - /), 3 (digits), 4 and 6 (letters
+// from low nibble 1), 5 (letters up to low nibble A, and _) and 7 (letters
+// up to A); no other high nibble is ever valid. Each low nibble entry holds
+// the classes it is invalid in.
+#define BASE64_CLASS_BITS 0x20, 0x20, 0x01, 0x02, 0x04, 0x08, 0x04, 0x10, \
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20
+#define BASE64_INVALID_BITS 0x25, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, \
+    0x21, 0x21, 0x21, 0x23, 0x3a, 0x3b, 0x3a, 0x3b, 0x32
+// Offsets by high nibble; class 2 takes its own from the low nibble.
+#define BASE64_LETTER_OFFSETS 0, 0, 0, 4, -65, -65, -71, -71, 0, 0, 0, 0, \
+    0, 0, 0, 0
+#define BASE64_SYMBOL_OFFSETS 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 19, 0, 17, \
+    0, 16
+
+// 16 characters into 12 bytes per step.
+__attribute__((target("ssse3"))) size_t DecodeSsse3(const char* input,
+                                                    size_t length,
+                                                    uint8_t* output) {
+  const __m128i class_bits = _mm_setr_epi8(BASE64_CLASS_BITS);
+  const __m128i invalid_bits = _mm_setr_epi8(BASE64_INVALID_BITS);
+  const __m128i letter_offsets = _mm_setr_epi8(BASE64_LETTER_OFFSETS);
+  const __m128i symbol_offsets = _mm_setr_epi8(BASE64_SYMBOL_OFFSETS);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i symbols = _mm_set1_epi8(2);
+  // '_' sits among the upper case letters but decodes to 63.
+  const __m128i underscore = _mm_set1_epi8('_');
+  const __m128i underscore_offset = _mm_set1_epi8(63 - ('_' - 65));
+  // Values a b c d of a group become a << 6 | b and c << 6 | d, then one
+  // 24-bit word, whose bytes are picked out high first.
+  const __m128i pairs = _mm_set1_epi32(0x01400140);
+  const __m128i words = _mm_set1_epi32(0x00011000);
+  const __m128i order =
+      _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+    __m128i high = _mm_and_si128(_mm_srli_epi32(c, 4), nibble);
+    __m128i low = _mm_and_si128(c, nibble);
+    __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(class_bits, high),
+                                    _mm_shuffle_epi8(invalid_bits, low));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128())) !=
+        0xffff) {
+      break;
+    }
+    __m128i offset = _mm_or_si128(
+        _mm_shuffle_epi8(letter_offsets, high),
+        _mm_and_si128(_mm_cmpeq_epi8(high, symbols),
+                      _mm_shuffle_epi8(symbol_offsets, low)));
+    offset = _mm_add_epi8(offset,
+                          _mm_and_si128(_mm_cmpeq_epi8(c, underscore),
+                                        underscore_offset));
+    __m128i values = _mm_add_epi8(c, offset);
+    __m128i packed =
+        _mm_madd_epi16(_mm_maddubs_epi16(values, pairs), words);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output),
+                     _mm_shuffle_epi8(packed, order));
+    output += 12;
+  }
+  return i;
+}
+
+// 32 characters into 24 bytes per step, as two SSSE3 steps side by side
+// whose halves are then moved together.
+__attribute__((target("avx2"))) size_t DecodeAvx2(const char* input,
+                                                  size_t length,
+                                                  uint8_t* output) {
+  const __m256i class_bits =
+      _mm256_setr_epi8(BASE64_CLASS_BITS, BASE64_CLASS_BITS);
+  const __m256i invalid_bits =
+      _mm256_setr_epi8(BASE64_INVALID_BITS, BASE64_INVALID_BITS);
+  const __m256i letter_offsets =
+      _mm256_setr_epi8(BASE64_LETTER_OFFSETS, BASE64_LETTER_OFFSETS);
+  const __m256i symbol_offsets =
+      _mm256_setr_epi8(BASE64_SYMBOL_OFFSETS, BASE64_SYMBOL_OFFSETS);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i symbols = _mm256_set1_epi8(2);
+  const __m256i underscore = _mm256_set1_epi8('_');
+  const __m256i underscore_offset = _mm256_set1_epi8(63 - ('_' - 65));
+  const __m256i pairs = _mm256_set1_epi32(0x01400140);
+  const __m256i words = _mm256_set1_epi32(0x00011000);
+  const __m256i order = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5,
+      4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i halves = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i c =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+    __m256i high = _mm256_and_si256(_mm256_srli_epi32(c, 4), nibble);
+    __m256i low = _mm256_and_si256(c, nibble);
+    __m256i invalid =
+        _mm256_and_si256(_mm256_shuffle_epi8(class_bits, high),
+                         _mm256_shuffle_epi8(invalid_bits, low));
+    if (!_mm256_testz_si256(invalid, invalid)) {
+      break;
+    }
+    __m256i offset = _mm256_or_si256(
+        _mm256_shuffle_epi8(letter_offsets, high),
+        _mm256_and_si256(_mm256_cmpeq_epi8(high, symbols),
+                         _mm256_shuffle_epi8(symbol_offsets, low)));
+    offset = _mm256_add_epi8(
+        offset, _mm256_and_si256(_mm256_cmpeq_epi8(c, underscore),
+                                 underscore_offset));
+    __m256i values = _mm256_add_epi8(c, offset);
+    __m256i packed =
+        _mm256_madd_epi16(_mm256_maddubs_epi16(values, pairs), words);
+    packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(packed, order),
+                                         halves);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(output), packed);
+    output += 24;
+  }
+  return i;
+}
+
+#undef BASE64_CLASS_BITS
+#undef BASE64_INVALID_BITS
+#undef BASE64_LETTER_OFFSETS
+#undef BASE64_SYMBOL_OFFSETS
+#elif defined(__aarch64__)
+// Maps characters to six-bit values by range, which also flags anything
+// outside the alphabet.
+bool Translate(uint8x16_t c, uint8x16_t* values) {
+  uint8x16_t upper = vandq_u8(vcgeq_u8(c, vdupq_n_u8('A')),
+                              vcleq_u8(c, vdupq_n_u8('Z')));
+  uint8x16_t lower = vandq_u8(vcgeq_u8(c, vdupq_n_u8('a')),
+                              vcleq_u8(c, vdupq_n_u8('z')));
+  uint8x16_t digit = vandq_u8(vcgeq_u8(c, vdupq_n_u8('0')),
+                              vcleq_u8(c, vdupq_n_u8('9')));
+  uint8x16_t plus = vorrq_u8(vceqq_u8(c, vdupq_n_u8('+')),
+                             vceqq_u8(c, vdupq_n_u8('-')));
+  uint8x16_t slash = vorrq_u8(vceqq_u8(c, vdupq_n_u8('/')),
+                              vceqq_u8(c, vdupq_n_u8('_')));
+  uint8x16_t valid = vorrq_u8(vorrq_u8(upper, lower),
+                              vorrq_u8(digit, vorrq_u8(plus, slash)));
+  if (vminvq_u8(valid) == 0) {
+    return false;
+  }
+  uint8x16_t shift = vorrq_u8(
+      vorrq_u8(vandq_u8(upper, vdupq_n_u8(static_cast<uint8_t>(-'A'))),
+               vandq_u8(lower, vdupq_n_u8(static_cast<uint8_t>(26 - 'a')))),
+      vandq_u8(digit, vdupq_n_u8(static_cast<uint8_t>(52 - '0'))));
+  uint8x16_t result = vaddq_u8(c, shift);
+  result = vbslq_u8(plus, vdupq_n_u8(62), result);
+  *values = vbslq_u8(slash, vdupq_n_u8(63), result);
+  return true;
+}
+
+// 64 characters into 48 bytes per step; the loads and stores interleave
+// the groups, so each vector holds one position of sixteen of them.
+size_t DecodeNeon(const char* input, size_t length, uint8_t* output) {
+  size_t i = 0;
+  for (; i + 64 <= length; i += 64) {
+    uint8x16x4_t chars = vld4q_u8(reinterpret_cast<const uint8_t*>(input + i));
+    uint8x16_t a, b, c, d;
+    if (!Translate(chars.val[0], &a) || !Translate(chars.val[1], &b) ||
+        !Translate(chars.val[2], &c) || !Translate(chars.val[3], &d)) {
+      break;
+    }
+    uint8x16x3_t bytes;
+    bytes.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+    bytes.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+    bytes.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+    vst3q_u8(output, bytes);
+    output += 48;
+  }
+  return i;
+}
+#endif
+
+Base64Kernel PickKernel() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) {
+    return {"avx2", DecodeAvx2};
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return {"ssse3", DecodeSsse3};
+  }
+#elif defined(__aarch64__)
+  return {"neon", DecodeNeon};
+#endif
+  return {"scalar", DecodeScalar};
+}
+
+}  // namespace
+
+bool DecodeBase64(std::string_view input, std::string* output) {
+  return DecodeBase64With(ActiveBase64Kernel(), input, output);
+}
+
+bool DecodeBase64With(const Base64Kernel& kernel, std::string_view input,
+                      std::string* output) {
+  output->resize(input.size() / 4 * 3 + 3 + kBase64KernelSlack);
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(&(*output)[0]);
+  size_t written = 0;
+  uint32_t accumulator = 0;
+  int bits = 0;
+  // Characters of the current group taken one at a time.
+  int pending = 0;
+  size_t i = 0;
+  while (i < input.size()) {
+    if (pending == 0) {
+      size_t decoded =
+          kernel.decode(input.data() + i, input.size() - i, bytes + written);
+      i += decoded;
+      written += decoded / 4 * 3;
+      if (i == input.size()) {
+        break;
+      }
+    }
+    // What stopped the kernel, and the rest of its group, go one character
+    // at a time; the kernel takes over again at the next group boundary.
+    char c = input[i++];
+    uint8_t value = ValueOf(c);
+    if (value == kInvalid) {
+      if (c == '=' || c == '\n' || c == '\r') {
+        continue;
+      }
+      output->clear();
+      return false;
+    }
+    accumulator = (accumulator << 6) | value;
+    bits += 6;
+    pending = (pending + 1) % 4;
+    if (bits >= 8) {
+      bits -= 8;
+      bytes[written++] = static_cast<uint8_t>(accumulator >> bits);
+    }
+  }
+  output->resize(written);
+  return true;
+}
+
+const Base64Kernel& ActiveBase64Kernel() {
+  static const Base64Kernel kernel = PickKernel();
+  return kernel;
+}
+
+std::vector<Base64Kernel> SupportedBase64Kernels() {
+  std::vector<Base64Kernel> kernels;
+  kernels.push_back({"scalar", DecodeScalar});
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("ssse3")) {
+    kernels.push_back({"ssse3", DecodeSsse3});
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({"avx2", DecodeAvx2});
+  }
+#elif defined(__aarch64__)
+  kernels.push_back({"neon", DecodeNeon});
+#endif
+  return kernels;
+}
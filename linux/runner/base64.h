@@ -0,0 +1,43 @@
+#ifndef RUNNER_BASE64_H_
+#define RUNNER_BASE64_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Base64 decoding for share links and subscriptions, with vector kernels
+// picked at runtime for the CPU. Both the standard and the URL-safe
+// alphabet are accepted, even mixed, with or without padding, and line
+// breaks are skipped.
+
+// An implementation of the block decoder behind DecodeBase64().
+struct Base64Kernel {
+  const char* name;
+  // Decodes whole blocks from the start of |input| up to the first block
+  // holding anything but alphabet characters, such as padding or a line
+  // break. Writes three bytes per four characters to |output|, and may
+  // write up to kBase64KernelSlack bytes past them. Returns how many
+  // characters were decoded, a multiple of four.
+  size_t (*decode)(const char* input, size_t length, uint8_t* output);
+};
+
+// Room a kernel may write past its decoded bytes.
+constexpr size_t kBase64KernelSlack = 16;
+
+// Decodes |input| into |output|. Returns false on characters outside the
+// alphabet. Runs the fastest kernel this CPU supports.
+bool DecodeBase64(std::string_view input, std::string* output);
+
+// DecodeBase64() on |kernel|, for benchmarks and tests.
+bool DecodeBase64With(const Base64Kernel& kernel, std::string_view input,
+                      std::string* output);
+
+// The kernel DecodeBase64() runs, chosen once on first use.
+const Base64Kernel& ActiveBase64Kernel();
+
+// Every kernel this CPU can run, the portable one first.
+std::vector<Base64Kernel> SupportedBase64Kernels();
+
+#endif  // RUNNER_BASE64_H_
@@ -0,0 +1,270 @@
+// Subscription import: base64 decoding per kernel, then a synthetic
+// 10,000-link subscription parsed in one ParseSubscription() call against
+// the same links parsed and deduplicated one at a time. Every kernel is
+// first checked against the scalar one; a mismatch fails the run, as does
+// a parse that disagrees with the one-at-a-time result.
+//
+//   cmake -DMIMIVPN_BENCHMARKS=ON ... && ./share_link_benchmark
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "base64.h"
+#include "share_link.h"
+#include "subscription.h"
+
+namespace {
+
+constexpr size_t kLinks = 10000;
+constexpr int kRounds = 20;
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+// Keeps results alive so the work is not optimized away.
+uint64_t sink = 0;
+
+std::string EncodeBase64(const std::string& input, bool url_safe) {
+  const char* alphabet =
+      url_safe
+          ? "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+          : "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string output;
+  size_t i = 0;
+  for (; i + 3 <= input.size(); i += 3) {
+    uint32_t group = static_cast<uint8_t>(input[i]) << 16 |
+                     static_cast<uint8_t>(input[i + 1]) << 8 |
+                     static_cast<uint8_t>(input[i + 2]);
+    output.push_back(alphabet[group >> 18]);
+    output.push_back(alphabet[(group >> 12) & 63]);
+    output.push_back(alphabet[(group >> 6) & 63]);
+    output.push_back(alphabet[group & 63]);
+  }
+  if (i < input.size()) {
+    uint32_t group = static_cast<uint8_t>(input[i]) << 16;
+    if (i + 1 < input.size()) {
+      group |= static_cast<uint8_t>(input[i + 1]) << 8;
+    }
+    output.push_back(alphabet[group >> 18]);
+    output.push_back(alphabet[(group >> 12) & 63]);
+    output.push_back(i + 1 < input.size() ? alphabet[(group >> 6) & 63]
+                                          : '=');
+    output.push_back('=');
+  }
+  return output;
+}
+
+// Random lengths in both alphabets, with padding, wrapped lines and, now
+// and then, a stray character that must be rejected.
+bool VerifyKernels(const std::vector<Base64Kernel>& kernels) {
+  std::mt19937 random(1);
+  for (int round = 0; round < 20000; round++) {
+    std::string data(round < 2000 ? round % 200 : random() % 5000, '\0');
+    for (char& c : data) {
+      c = static_cast<char>(random());
+    }
+    std::string encoded = EncodeBase64(data, round % 2 == 1);
+    if (round % 3 == 0) {
+      for (size_t i = 76; i < encoded.size(); i += 77) {
+        encoded.insert(i, "\n");
+      }
+    }
+    bool corrupt = round % 10 == 0 && !encoded.empty();
+    if (corrupt) {
+      encoded[random() % encoded.size()] = '*';
+    }
+    std::string expected;
+    bool expected_ok = DecodeBase64With(kernels[0], encoded, &expected);
+    if (expected_ok == corrupt || (expected_ok && expected != data)) {
+      fprintf(stderr, "%s: length %zu: wrong result\n", kernels[0].name,
+              encoded.size());
+      return false;
+    }
+    for (const Base64Kernel& kernel : kernels) {
+      std::string actual;
+      if (DecodeBase64With(kernel, encoded, &actual) != expected_ok ||
+          actual != expected) {
+        fprintf(stderr, "%s: length %zu: differs from %s\n", kernel.name,
+                encoded.size(), kernels[0].name);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void BenchmarkKernels(const std::vector<Base64Kernel>& kernels) {
+  const size_t sizes[] = {64, 1024, 1024 * 1024};
+  std::mt19937 random(2);
+  printf("%-8s", "bytes");
+  for (const Base64Kernel& kernel : kernels) {
+    printf(" %10s MB/s", kernel.name);
+  }
+  printf("\n");
+  for (size_t size : sizes) {
+    std::string data(size, '\0');
+    for (char& c : data) {
+      c = static_cast<char>(random());
+    }
+    std::string encoded = EncodeBase64(data, false);
+    size_t runs = (256 * 1024 * 1024) / encoded.size();
+    printf("%-8zu", size);
+    for (const Base64Kernel& kernel : kernels) {
+      std::string output;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t run = 0; run < runs; run++) {
+        DecodeBase64With(kernel, encoded, &output);
+        sink += static_cast<uint8_t>(output[0]);
+      }
+      printf(" %15.0f", encoded.size() * runs / 1e3 / MsSince(start));
+    }
+    printf("\n");
+  }
+}
+
+std::string VmessLink(size_t i) {
+  std::string json = "{\"v\":\"2\",\"ps\":\"Server \\u00e9 " +
+                     std::to_string(i) + "\",\"add\":\"" +
+                     std::to_string(10 + i % 200) + ".example.net\"," +
+                     "\"port\":\"" + std::to_string(443 + i % 1000) +
+                     "\",\"id\":\"b831381d-6324-4d53-ad4f-8cda48b30811\"," +
+                     "\"aid\":0,\"net\":\"ws\",\"type\":\"none\"," +
+                     "\"host\":\"cdn.example.net\",\"path\":\"/ws\"," +
+                     "\"tls\":\"tls\"}";
+  return "vmess://" + EncodeBase64(json, false);
+}
+
+// Mostly vless, vmess, trojan and ss links, with some repeats of earlier
+// endpoints and some lines that do not parse.
+std::vector<std::string> SyntheticLinks() {
+  std::vector<std::string> links;
+  std::mt19937 random(3);
+  for (size_t i = 0; i < kLinks; i++) {
+    std::string host = "node" + std::to_string(i) + ".example.com";
+    std::string port = std::to_string(1000 + i % 60000);
+    switch (random() % 20) {
+      case 0:
+        links.push_back("http://" + host + ":" + port);
+        break;
+      case 1:
+        links.push_back("vless://uuid@" + host + ":99999#bad");
+        break;
+      case 2:
+      case 3:
+        links.push_back(links.empty() ? host
+                                      : links[random() % links.size()]);
+        break;
+      case 4:
+      case 5:
+      case 6:
+      case 7:
+        links.push_back(VmessLink(i));
+        break;
+      case 8:
+      case 9:
+      case 10:
+        links.push_back("trojan://password@" + host + ":" + port +
+                        "?sni=" + host + "&type=tcp#Trojan%20" +
+                        std::to_string(i));
+        break;
+      case 11:
+      case 12:
+        links.push_back("ss://" +
+                        EncodeBase64("chacha20-ietf-poly1305:secret", true) +
+                        "@" + host + ":" + port + "#SS%20" +
+                        std::to_string(i));
+        break;
+      default:
+        links.push_back("vless://b831381d-6324-4d53-ad4f-8cda48b30811@" +
+                        host + ":" + port +
+                        "?encryption=none&security=reality&sni=www." +
+                        "microsoft.com&fp=chrome&pbk=SbVKOEMjK0sIlbwg4akyBg" +
+                        "5mL5KZwwB-ed4eEE7YnRc&type=grpc#VLESS%20" +
+                        std::to_string(i));
+        break;
+    }
+  }
+  return links;
+}
+
+bool BenchmarkSubscription() {
+  std::vector<std::string> links = SyntheticLinks();
+  std::string text;
+  for (const std::string& link : links) {
+    text += link;
+    text += "\r\n";
+  }
+  std::string subscription = EncodeBase64(text, false);
+
+  size_t parsed_one_by_one = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < kRounds; round++) {
+    // Line by line into owned strings, deduplicated by a set of formatted
+    // keys: the same result, built the way the import did before.
+    std::string decoded;
+    DecodeBase64(subscription, &decoded);
+    std::unordered_set<std::string> endpoints;
+    size_t begin = 0;
+    parsed_one_by_one = 0;
+    while (begin < decoded.size()) {
+      size_t end = decoded.find('\n', begin);
+      std::string link = decoded.substr(begin, end - begin - 1);
+      begin = end + 1;
+      ShareLinkEndpoint endpoint;
+      if (ParseShareLinkEndpoint(link, &endpoint) &&
+          endpoints
+              .insert(endpoint.scheme + "|" + endpoint.host + "|" +
+                      std::to_string(endpoint.port) +
+                      (endpoint.tls ? "|" : "-") + endpoint.server_name)
+              .second) {
+        parsed_one_by_one++;
+      }
+    }
+  }
+  double one_by_one = MsSince(start) / kRounds;
+
+  ParsedSubscription parsed;
+  start = std::chrono::steady_clock::now();
+  for (int round = 0; round < kRounds; round++) {
+    parsed = ParseSubscription(subscription);
+    sink += parsed.configs.size();
+  }
+  double batched = MsSince(start) / kRounds;
+
+  printf("\n%zu links, %zu KB as served\n", links.size(),
+         subscription.size() / 1024);
+  printf("  one at a time:     %8.2f ms, %zu configs\n", one_by_one,
+         parsed_one_by_one);
+  printf("  ParseSubscription: %8.2f ms, %zu configs, %u duplicates, "
+         "%zu errors\n",
+         batched, parsed.configs.size(), parsed.duplicates,
+         parsed.errors.size());
+  if (!parsed.ok || parsed.configs.size() != parsed_one_by_one ||
+      parsed.configs.size() + parsed.duplicates + parsed.errors.size() !=
+          links.size()) {
+    fprintf(stderr, "subscription: lines went missing\n");
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  std::vector<Base64Kernel> kernels = SupportedBase64Kernels();
+  if (!VerifyKernels(kernels)) {
+    return 1;
+  }
+  printf("active kernel: %s\n\n", ActiveBase64Kernel().name);
+  BenchmarkKernels(kernels);
+  if (!BenchmarkSubscription()) {
+    return 1;
+  }
+  return sink == 0 ? 1 : 0;
+}
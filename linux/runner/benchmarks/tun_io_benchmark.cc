@@ -0,0 +1,330 @@
+// Packets per second and CPU per gigabit of a TUN queue worker on each I/O
+// backend, epoll and io_uring. A socketpair stands in for the TUN queue and
+// a minimal TCP client on its far end downloads from and uploads to a
+// loopback server through a SocksStandIn, one MSS-sized packet at a time.
+// CPU is the worker thread's, plus any io_uring kernel workers it spawns.
+//
+//   cmake -DMIMIVPN_BENCHMARKS=ON ... && ./tun_io_benchmark
+//
+// Kernels or sandboxes without io_uring report it falling back to epoll.
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packet_headers.h"
+#include "socks_standin.h"
+#include "tun_worker.h"
+
+namespace {
+
+constexpr uint8_t kClientAddress[4] = {198, 18, 0, 1};
+constexpr uint8_t kServerAddress[4] = {127, 0, 0, 1};
+constexpr uint16_t kClientPort = 40000;
+constexpr uint16_t kMss = 1460;
+constexpr uint8_t kClientWindowScale = 7;
+constexpr int kBatch = 64;
+constexpr size_t kPacketSize = 2048;
+constexpr int kQueueBuffer = 8 * 1024 * 1024;
+constexpr auto kWarmUp = std::chrono::milliseconds(500);
+constexpr auto kMeasured = std::chrono::seconds(3);
+
+struct Sample {
+  std::chrono::steady_clock::time_point time;
+  uint64_t cpu_ns;
+  uint64_t packets;
+  uint64_t bytes;
+};
+
+// CPU time of the worker thread and of io_uring's kernel workers, from
+// their scheduler statistics.
+uint64_t WorkerCpuNs() {
+  uint64_t total = 0;
+  DIR* tasks = opendir("/proc/self/task");
+  if (tasks == nullptr) {
+    return 0;
+  }
+  while (struct dirent* entry = readdir(tasks)) {
+    std::string task = std::string("/proc/self/task/") + entry->d_name;
+    std::string name;
+    std::ifstream(task + "/comm") >> name;
+    if (name != "tun-q0" && name.compare(0, 4, "iou-") != 0) {
+      continue;
+    }
+    uint64_t ns = 0;
+    std::ifstream(task + "/schedstat") >> ns;
+    total += ns;
+  }
+  closedir(tasks);
+  return total;
+}
+
+// The far end of the queue: one TCP connection spoken packet by packet.
+class Client {
+ public:
+  Client(int fd, uint16_t server_port)
+      : fd_(fd), server_port_(server_port), out_(kPacketHeadroom + kMss) {
+    for (int i = 0; i < kBatch; i++) {
+      in_[i].resize(kPacketSize);
+      parts_[i].iov_base = in_[i].data();
+      parts_[i].iov_len = kPacketSize;
+      memset(&messages_[i], 0, sizeof(messages_[i]));
+      messages_[i].msg_hdr.msg_iov = &parts_[i];
+      messages_[i].msg_hdr.msg_iovlen = 1;
+    }
+  }
+
+  bool Connect() {
+    const uint8_t options[] = {2, 4, kMss >> 8, kMss & 0xff,
+                               1, 3, 3, kClientWindowScale};
+    Send(kTcpSyn, 0, options, sizeof(options));
+    snd_nxt_++;
+    for (int attempt = 0; attempt < 20; attempt++) {
+      int count = Receive(100);
+      for (int i = 0; i < count; i++) {
+        PacketInfo info;
+        if (!Parse(i, &info) || (info.tcp_flags & kTcpSyn) == 0) {
+          continue;
+        }
+        rcv_nxt_ = info.seq + 1;
+        snd_una_ = info.ack;
+        peer_scale_ = WindowScale(info);
+        peer_window_ = static_cast<uint32_t>(info.window) << peer_scale_;
+        Send(kTcpAck, 0, nullptr, 0);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Takes in what the worker sent, ACKing once per batch (and at once past
+  // a hole, so losses are retransmitted quickly).
+  void Download(Sample* sample) {
+    int count = Receive(100);
+    bool hole = false;
+    for (int i = 0; i < count; i++) {
+      PacketInfo info;
+      if (!Parse(i, &info) || info.payload_length == 0) {
+        continue;
+      }
+      if (info.seq != rcv_nxt_) {
+        hole = true;
+        continue;
+      }
+      rcv_nxt_ += static_cast<uint32_t>(info.payload_length);
+      sample->packets++;
+      sample->bytes += info.payload_length;
+    }
+    if (count > 0 || hole) {
+      Send(kTcpAck, 0, nullptr, 0);
+    }
+  }
+
+  // Fills the worker's window with full segments, then takes its ACKs.
+  void Upload(Sample* sample) {
+    while (snd_nxt_ - snd_una_ + kMss <= peer_window_) {
+      Send(kTcpAck | kTcpPsh, kMss, nullptr, 0);
+      snd_nxt_ += kMss;
+    }
+    int count = Receive(100);
+    for (int i = 0; i < count; i++) {
+      PacketInfo info;
+      if (!Parse(i, &info) || (info.tcp_flags & kTcpAck) == 0) {
+        continue;
+      }
+      if (static_cast<int32_t>(info.ack - snd_una_) > 0) {
+        uint32_t acked = info.ack - snd_una_;
+        sample->bytes += acked;
+        sample->packets += acked / kMss;
+        snd_una_ = info.ack;
+      }
+      peer_window_ = static_cast<uint32_t>(info.window) << peer_scale_;
+    }
+  }
+
+  void Reset() { Send(kTcpRst | kTcpAck, 0, nullptr, 0); }
+
+ private:
+  void Send(uint8_t flags, size_t payload_length, const uint8_t* options,
+            size_t options_length) {
+    TcpSegmentSpec spec = {AF_INET, kClientAddress, kServerAddress,
+                           kClientPort, server_port_, snd_nxt_, rcv_nxt_,
+                           flags, 0xffff, options, options_length};
+    size_t length = 0;
+    uint8_t* packet =
+        WriteTcpHeaders(&out_[kPacketHeadroom], payload_length, spec, &length);
+    send(fd_, packet, length, 0);
+  }
+
+  int Receive(int timeout_ms) {
+    struct pollfd ready = {fd_, POLLIN, 0};
+    if (poll(&ready, 1, timeout_ms) <= 0) {
+      return 0;
+    }
+    int count = recvmmsg(fd_, messages_, kBatch, MSG_DONTWAIT, nullptr);
+    return count < 0 ? 0 : count;
+  }
+
+  bool Parse(int index, PacketInfo* info) const {
+    return ParsePacket(in_[index].data(), messages_[index].msg_len, info) &&
+           info->protocol == kIpProtoTcp && info->dst_port == kClientPort;
+  }
+
+  static uint8_t WindowScale(const PacketInfo& info) {
+    size_t i = 0;
+    while (i + 1 < info.tcp_options_length) {
+      uint8_t kind = info.tcp_options[i];
+      if (kind == 0) {
+        break;
+      }
+      if (kind == 1) {
+        i++;
+        continue;
+      }
+      if (kind == 3 && i + 2 < info.tcp_options_length) {
+        return info.tcp_options[i + 2];
+      }
+      i += info.tcp_options[i + 1] < 2 ? 2 : info.tcp_options[i + 1];
+    }
+    return 0;
+  }
+
+  int fd_;
+  uint16_t server_port_;
+  uint32_t snd_nxt_ = 1;
+  uint32_t snd_una_ = 1;
+  uint32_t rcv_nxt_ = 0;
+  uint32_t peer_window_ = 0;
+  uint8_t peer_scale_ = 0;
+  std::vector<uint8_t> out_;
+  std::vector<uint8_t> in_[kBatch];
+  struct iovec parts_[kBatch];
+  struct mmsghdr messages_[kBatch];
+};
+
+// Sends to (|download|) or drains from the first connection accepted.
+void Serve(int listen_fd, bool download) {
+  int fd = accept(listen_fd, nullptr, nullptr);
+  if (fd < 0) {
+    return;
+  }
+  std::vector<uint8_t> data(256 * 1024);
+  for (;;) {
+    ssize_t result = download ? send(fd, data.data(), data.size(),
+                                     MSG_NOSIGNAL)
+                              : recv(fd, data.data(), data.size(), 0);
+    if (result <= 0) {
+      break;
+    }
+  }
+  close(fd);
+}
+
+bool Run(bool io_uring, bool download, uint16_t socks_port) {
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t address_length = sizeof(address);
+  if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd, 1) != 0 ||
+      getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address),
+                  &address_length) != 0) {
+    close(listen_fd);
+    return false;
+  }
+  std::thread server(Serve, listen_fd, download);
+
+  int queue[2];
+  socketpair(AF_UNIX, SOCK_SEQPACKET, 0, queue);
+  for (int fd : queue) {
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &kQueueBuffer, sizeof(kQueueBuffer));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &kQueueBuffer, sizeof(kQueueBuffer));
+  }
+  // Like a TUN queue, the worker's end is non-blocking.
+  int flags = fcntl(queue[0], F_GETFL);
+  fcntl(queue[0], F_SETFL, flags | O_NONBLOCK);
+
+  TunWorkerOptions options;
+  options.socks_port = socks_port;
+  options.relay_udp = false;
+  options.io_uring = io_uring;
+  bool ok = false;
+  {
+    TunWorker worker(queue[0], options);
+    Client client(queue[1], ntohs(address.sin_port));
+    if (worker.Start(0) && client.Connect()) {
+      Sample start = {};
+      Sample sample = {};
+      auto begin = std::chrono::steady_clock::now();
+      while (std::chrono::steady_clock::now() - begin < kWarmUp + kMeasured) {
+        if (download) {
+          client.Download(&sample);
+        } else {
+          client.Upload(&sample);
+        }
+        if (start.time == std::chrono::steady_clock::time_point() &&
+            std::chrono::steady_clock::now() - begin >= kWarmUp) {
+          start = sample;
+          start.time = std::chrono::steady_clock::now();
+          start.cpu_ns = WorkerCpuNs();
+        }
+      }
+      double seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start.time)
+                           .count();
+      double cpu = (WorkerCpuNs() - start.cpu_ns) / 1e9;
+      double gigabits = (sample.bytes - start.bytes) * 8 / 1e9;
+      printf("%-9s %-38s %10.0f %8.2f %8.0f%% %10.0f\n",
+             download ? "download" : "upload", worker.io_backend().c_str(),
+             (sample.packets - start.packets) / seconds, gigabits / seconds,
+             100 * cpu / seconds, gigabits > 0 ? 1000 * cpu / gigabits : 0);
+      ok = true;
+      client.Reset();
+    }
+    worker.Stop();
+  }
+  close(queue[1]);
+  close(queue[0]);
+  shutdown(listen_fd, SHUT_RDWR);
+  close(listen_fd);
+  server.join();
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  signal(SIGPIPE, SIG_IGN);
+  SocksStandIn standin;
+  if (!standin.Start(0)) {
+    fprintf(stderr, "could not start the SOCKS stand-in\n");
+    return 1;
+  }
+  printf("%-9s %-38s %10s %8s %9s %10s\n", "", "backend", "packets/s",
+         "Gbit/s", "cpu", "cpu ms/Gb");
+  for (bool download : {true, false}) {
+    for (bool io_uring : {false, true}) {
+      if (!Run(io_uring, download, standin.port())) {
+        fprintf(stderr, "connection through the worker failed\n");
+        return 1;
+      }
+    }
+  }
+  standin.Stop();
+  return 0;
+}
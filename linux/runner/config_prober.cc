@@ -0,0 +1,674 @@
+#include "config_prober.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "log_ring.h"
+#include "net_util.h"
+
+namespace {
+
+constexpr size_t kMaxResolverThreads = 4;
+constexpr int kMaxEvents = 64;
+// How long a TLS 1.3 connection waits for its ticket beyond the time the
+// handshake itself took.
+constexpr int64_t kTicketSlackMs = 100;
+
+// Distinguish the control descriptors from probes in epoll.
+char kCancelTag;
+char kResolverTag;
+
+struct Address {
+  struct sockaddr_storage storage;
+  socklen_t length;
+};
+
+// Host names waiting for and coming back from the resolver threads. Shared
+// with those threads, which are detached so that a slow getaddrinfo() never
+// holds up the end of a run.
+struct Resolver {
+  std::mutex mutex;
+  std::deque<std::string> pending;
+  // A null address means the name did not resolve.
+  std::vector<std::pair<std::string, std::unique_ptr<Address>>> finished;
+  int event_fd = -1;
+
+  ~Resolver() {
+    if (event_fd >= 0) {
+      close(event_fd);
+    }
+  }
+};
+
+void ResolveLoop(std::shared_ptr<Resolver> resolver) {
+  for (;;) {
+    std::string host;
+    {
+      std::lock_guard<std::mutex> lock(resolver->mutex);
+      if (resolver->pending.empty()) {
+        return;
+      }
+      host = resolver->pending.front();
+      resolver->pending.pop_front();
+    }
+
+    std::unique_ptr<Address> address;
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    struct addrinfo* results = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &results) == 0 &&
+        results != nullptr) {
+      address.reset(new Address());
+      memcpy(&address->storage, results->ai_addr, results->ai_addrlen);
+      address->length = results->ai_addrlen;
+      freeaddrinfo(results);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(resolver->mutex);
+      resolver->finished.emplace_back(host, std::move(address));
+    }
+    uint64_t one = 1;
+    if (write(resolver->event_fd, &one, sizeof(one)) != sizeof(one)) {
+      return;
+    }
+  }
+}
+
+bool ParseNumericHost(const std::string& host, Address* address) {
+  memset(&address->storage, 0, sizeof(address->storage));
+  auto* v4 = reinterpret_cast<struct sockaddr_in*>(&address->storage);
+  if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    address->length = sizeof(*v4);
+    return true;
+  }
+  auto* v6 = reinterpret_cast<struct sockaddr_in6*>(&address->storage);
+  if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    address->length = sizeof(*v6);
+    return true;
+  }
+  return false;
+}
+
+void SetPort(Address* address, uint16_t port) {
+  if (address->storage.ss_family == AF_INET6) {
+    reinterpret_cast<struct sockaddr_in6*>(&address->storage)->sin6_port =
+        htons(port);
+  } else {
+    reinterpret_cast<struct sockaddr_in*>(&address->storage)->sin_port =
+        htons(port);
+  }
+}
+
+bool IsLiteralAddress(const std::string& host) {
+  struct in6_addr ignored;
+  return inet_pton(AF_INET, host.c_str(), &ignored) == 1 ||
+         inet_pton(AF_INET6, host.c_str(), &ignored) == 1;
+}
+
+// The client side of the probes' TLS: any certificate is accepted, as only
+// reachability and timing are measured, and a session is kept only when
+// the new-session callback hands it to the cache.
+SSL_CTX* NewTlsContext(TlsSessionCache* session_cache) {
+  SSL_CTX* context = SSL_CTX_new(TLS_client_method());
+  if (context == nullptr) {
+    return nullptr;
+  }
+  SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+  SSL_CTX_set_verify(context, SSL_VERIFY_NONE, nullptr);
+  if (session_cache != nullptr) {
+    SSL_CTX_set_app_data(context, session_cache);
+    SSL_CTX_set_session_cache_mode(
+        context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  }
+  return context;
+}
+
+int64_t ElapsedMs(int64_t start_ns) {
+  return (MonotonicNowNs() - start_ns + 999999) / 1000000;
+}
+
+}  // namespace
+
+struct ConfigProber::Probe {
+  size_t index;
+  int fd = -1;
+  SSL* ssl = nullptr;
+  // The connect has finished, or fast open deferred it to the first send.
+  bool connected = false;
+  bool deferred_connect = false;
+  // The result has been reported.
+  bool done = false;
+  // Reported, but the connection stays open for a TLS 1.3 ticket.
+  bool awaiting_ticket = false;
+  bool ticket_stored = false;
+  std::string session_key;
+  int64_t start_ns = 0;
+  int64_t deadline_ms = 0;
+  int64_t connect_ms = 0;
+
+  ~Probe() {
+    if (ssl != nullptr) {
+      SSL_free(ssl);
+    }
+  }
+
+  // Lets OpenSSL take in what the server sent after the handshake, which
+  // stores any ticket through OnNewSession(), and closes the connection
+  // once one has been stored or the connection fails.
+  void ReadTicket() {
+    char buffer[512];
+    int result;
+    do {
+      result = SSL_read(ssl, buffer, sizeof(buffer));
+    } while (result > 0);
+    if (ticket_stored || SSL_get_error(ssl, result) != SSL_ERROR_WANT_READ) {
+      StopWaiting();
+    }
+  }
+
+  void StopWaiting() {
+    awaiting_ticket = false;
+    close(fd);
+    fd = -1;
+    ERR_clear_error();
+  }
+};
+
+ConfigProber::ConfigProber(const ConfigProberOptions& options)
+    : options_(options),
+      cancel_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+  options_.concurrency = std::max(1, options_.concurrency);
+}
+
+ConfigProber::~ConfigProber() {
+  for (const auto& probe : ticket_waits_) {
+    if (probe->awaiting_ticket) {
+      close(probe->fd);
+    }
+  }
+  ticket_waits_.clear();
+  if (tls_context_ != nullptr) {
+    SSL_CTX_free(tls_context_);
+  }
+  if (cancel_fd_ >= 0) {
+    close(cancel_fd_);
+  }
+}
+
+void ConfigProber::Cancel() {
+  cancelled_.store(true);
+  uint64_t one = 1;
+  if (write(cancel_fd_, &one, sizeof(one)) != sizeof(one)) {
+    return;
+  }
+}
+
+int ConfigProber::OnNewSession(SSL* ssl, SSL_SESSION* session) {
+  auto* cache = static_cast<TlsSessionCache*>(
+      SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+  auto* probe = static_cast<Probe*>(SSL_get_app_data(ssl));
+  cache->Put(probe->session_key, session);
+  probe->ticket_stored = true;
+  // The cache keeps its own copy.
+  return 0;
+}
+
+std::vector<ProbeResult> ConfigProber::Run(
+    const std::vector<ProbeTarget>& targets, const ResultCallback& on_result) {
+  std::vector<ProbeResult> healthy;
+  size_t remaining = targets.size();
+  auto finish = [&](const ProbeResult& result) {
+    remaining--;
+    if (result.ok) {
+      healthy.push_back(result);
+    }
+    if (on_result) {
+      on_result(result);
+    }
+  };
+  auto fail = [&](size_t index) {
+    ProbeResult result;
+    result.index = index;
+    finish(result);
+  };
+  auto finished = [&] {
+    return remaining == 0 || cancelled_.load() ||
+           (options_.stop_after > 0 && healthy.size() >= options_.stop_after);
+  };
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  auto resolver = std::make_shared<Resolver>();
+  resolver->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (epoll_fd < 0 || resolver->event_fd < 0 || cancel_fd_ < 0) {
+    if (epoll_fd >= 0) {
+      close(epoll_fd);
+    }
+    for (size_t i = 0; i < targets.size(); i++) {
+      fail(i);
+    }
+    return healthy;
+  }
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = &kCancelTag;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cancel_fd_, &event);
+  event.data.ptr = &kResolverTag;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, resolver->event_fd, &event);
+
+  bool any_tls = std::any_of(
+      targets.begin(), targets.end(),
+      [](const ProbeTarget& target) { return target.tls; });
+  if (any_tls && tls_context_ == nullptr) {
+    tls_context_ = NewTlsContext(options_.session_cache);
+    if (tls_context_ != nullptr && options_.session_cache != nullptr) {
+      SSL_CTX_sess_set_new_cb(tls_context_, OnNewSession);
+    }
+  }
+
+  // Targets with a literal address are ready at once; the rest wait for
+  // their host name, which is resolved once however many targets share it.
+  std::vector<Address> addresses(targets.size());
+  std::deque<size_t> ready;
+  std::unordered_map<std::string, std::vector<size_t>> waiting;
+  for (size_t i = 0; i < targets.size(); i++) {
+    const ProbeTarget& target = targets[i];
+    if (target.host.empty() || target.port == 0) {
+      fail(i);
+    } else if (ParseNumericHost(target.host, &addresses[i])) {
+      SetPort(&addresses[i], target.port);
+      ready.push_back(i);
+    } else {
+      std::vector<size_t>& indices = waiting[target.host];
+      if (indices.empty()) {
+        resolver->pending.push_back(target.host);
+      }
+      indices.push_back(i);
+    }
+  }
+  // Names get the same budget as a single probe.
+  int64_t resolve_deadline_ms = MonotonicNowMs() + options_.timeout_ms;
+  size_t resolver_threads =
+      std::min(kMaxResolverThreads, resolver->pending.size());
+  for (size_t i = 0; i < resolver_threads; i++) {
+    std::thread(ResolveLoop, resolver).detach();
+  }
+
+  std::vector<std::unique_ptr<Probe>> active;
+
+  auto watch = [&](Probe* probe, uint32_t events) {
+    struct epoll_event update = {};
+    update.events = events;
+    update.data.ptr = probe;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, probe->fd, &update) == 0;
+  };
+  auto complete = [&](Probe* probe, bool ok) {
+    ProbeResult result;
+    result.index = probe->index;
+    result.ok = ok;
+    if (ok) {
+      result.latency_ms = ElapsedMs(probe->start_ns);
+      // A deferred connect can be answered within a single step.
+      result.connect_ms =
+          probe->connect_ms > 0 ? probe->connect_ms : result.latency_ms;
+    }
+    probe->done = true;
+    if (ok && probe->ssl != nullptr) {
+      result.resumed = SSL_session_reused(probe->ssl) == 1;
+      struct tcp_info info;
+      socklen_t info_length = sizeof(info);
+      result.fast_open = getsockopt(probe->fd, IPPROTO_TCP, TCP_INFO, &info,
+                                    &info_length) == 0 &&
+                         (info.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+      if (options_.session_cache != nullptr && !probe->ticket_stored) {
+        if (SSL_version(probe->ssl) == TLS1_3_VERSION) {
+          // The ticket follows the handshake; keep the connection open
+          // for it, about as long again as the handshake took.
+          probe->deadline_ms =
+              MonotonicNowMs() +
+              std::min<int64_t>(options_.timeout_ms,
+                                result.latency_ms + kTicketSlackMs);
+          probe->awaiting_ticket = watch(probe, EPOLLIN);
+        } else {
+          // A TLS 1.2 resumption without a new ticket keeps the session
+          // it resumed, which Take() removed from the cache.
+          options_.session_cache->Put(probe->session_key,
+                                      SSL_get_session(probe->ssl));
+        }
+      }
+    }
+    if (!probe->awaiting_ticket) {
+      close(probe->fd);
+      ERR_clear_error();
+    }
+    finish(result);
+  };
+  // Sets up the client side of the TLS handshake, offering the cached
+  // session for the target if there is one.
+  auto start_tls = [&](Probe* probe) {
+    const ProbeTarget& target = targets[probe->index];
+    if (tls_context_ == nullptr) {
+      return false;
+    }
+    probe->ssl = SSL_new(tls_context_);
+    if (probe->ssl == nullptr || SSL_set_fd(probe->ssl, probe->fd) != 1) {
+      return false;
+    }
+    SSL_set_app_data(probe->ssl, probe);
+    SSL_set_connect_state(probe->ssl);
+    const std::string& server_name =
+        target.server_name.empty() ? target.host : target.server_name;
+    if (!IsLiteralAddress(server_name)) {
+      SSL_set_tlsext_host_name(probe->ssl, server_name.c_str());
+    }
+    if (options_.session_cache != nullptr) {
+      probe->session_key =
+          TlsSessionCache::KeyFor(target.host, target.port, server_name);
+      SSL_SESSION* session = options_.session_cache->Take(probe->session_key);
+      if (session != nullptr) {
+        SSL_set_session(probe->ssl, session);
+        SSL_SESSION_free(session);
+      }
+    }
+    return true;
+  };
+  // Advances the TLS handshake as far as the socket allows.
+  auto handshake = [&](Probe* probe) {
+    int result = SSL_do_handshake(probe->ssl);
+    if (result == 1) {
+      complete(probe, true);
+      return;
+    }
+    switch (SSL_get_error(probe->ssl, result)) {
+      case SSL_ERROR_WANT_READ:
+        if (!watch(probe, EPOLLIN)) {
+          complete(probe, false);
+        }
+        break;
+      case SSL_ERROR_WANT_WRITE:
+        if (!watch(probe, EPOLLOUT)) {
+          complete(probe, false);
+        }
+        break;
+      default:
+        complete(probe, false);
+        break;
+    }
+  };
+  // Called once the connect has finished, successfully or not, or at once
+  // when fast open defers it.
+  auto on_connected = [&](Probe* probe) {
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    getsockopt(probe->fd, SOL_SOCKET, SO_ERROR, &error, &error_length);
+    if (error != 0) {
+      complete(probe, false);
+      return;
+    }
+    probe->connected = true;
+    if (!probe->deferred_connect) {
+      probe->connect_ms = ElapsedMs(probe->start_ns);
+    }
+    if (!targets[probe->index].tls) {
+      complete(probe, true);
+    } else if (!start_tls(probe)) {
+      complete(probe, false);
+    } else {
+      handshake(probe);
+    }
+  };
+  auto start = [&](size_t index) {
+    std::unique_ptr<Probe> probe(new Probe());
+    probe->index = index;
+    probe->start_ns = MonotonicNowNs();
+    probe->deadline_ms = probe->start_ns / 1000000 + options_.timeout_ms;
+    const Address& address = addresses[index];
+    probe->fd = socket(address.storage.ss_family,
+                       SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe->fd < 0) {
+      fail(index);
+      return;
+    }
+    int one = 1;
+    setsockopt(probe->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // With a cookie from an earlier connection, the kernel holds the SYN
+    // back and sends the ClientHello in it.
+    bool fast_open = targets[index].tls && options_.fast_open &&
+                     setsockopt(probe->fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                                &one, sizeof(one)) == 0;
+    struct epoll_event add = {};
+    add.events = EPOLLOUT;
+    add.data.ptr = probe.get();
+    int result = connect(probe->fd,
+                         reinterpret_cast<const struct sockaddr*>(
+                             &address.storage),
+                         address.length);
+    if ((result != 0 && errno != EINPROGRESS) ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, probe->fd, &add) != 0) {
+      complete(probe.get(), false);
+      return;
+    }
+    probe->deferred_connect = result == 0 && fast_open;
+    Probe* raw = probe.get();
+    active.push_back(std::move(probe));
+    if (result == 0) {
+      on_connected(raw);
+    }
+  };
+  // Hands the connections still waiting for a ticket over to
+  // AwaitSessionTickets() and drops the finished probes.
+  auto prune = [&] {
+    for (auto& probe : active) {
+      if (probe->awaiting_ticket) {
+        ticket_waits_.push_back(std::move(probe));
+      }
+    }
+    active.erase(std::remove_if(active.begin(), active.end(),
+                                [](const std::unique_ptr<Probe>& probe) {
+                                  return !probe || probe->done;
+                                }),
+                 active.end());
+  };
+
+  struct epoll_event events[kMaxEvents];
+  while (!finished()) {
+    // Fill free slots; a probe can finish inside start() when the connect
+    // completes at once, so slots are recounted after each one.
+    for (;;) {
+      prune();
+      if (active.size() >= static_cast<size_t>(options_.concurrency) ||
+          ready.empty() || finished()) {
+        break;
+      }
+      size_t index = ready.front();
+      ready.pop_front();
+      start(index);
+    }
+    if (finished()) {
+      break;
+    }
+
+    int timeout = -1;
+    if (!active.empty() || !waiting.empty()) {
+      int64_t next = waiting.empty() ? INT64_MAX : resolve_deadline_ms;
+      for (const auto& probe : active) {
+        next = std::min(next, probe->deadline_ms);
+      }
+      timeout = static_cast<int>(
+          std::max<int64_t>(0, next - MonotonicNowMs()));
+    }
+    int count = epoll_wait(epoll_fd, events, kMaxEvents, timeout);
+    if (count < 0 && errno != EINTR) {
+      break;
+    }
+    for (int i = 0; i < count && !finished(); i++) {
+      void* tag = events[i].data.ptr;
+      if (tag == &kCancelTag) {
+        break;
+      }
+      if (tag == &kResolverTag) {
+        uint64_t value;
+        if (read(resolver->event_fd, &value, sizeof(value)) < 0) {
+          continue;
+        }
+        std::vector<std::pair<std::string, std::unique_ptr<Address>>> names;
+        {
+          std::lock_guard<std::mutex> lock(resolver->mutex);
+          names.swap(resolver->finished);
+        }
+        for (auto& name : names) {
+          for (size_t index : waiting[name.first]) {
+            if (!name.second) {
+              fail(index);
+              continue;
+            }
+            addresses[index] = *name.second;
+            SetPort(&addresses[index], targets[index].port);
+            ready.push_back(index);
+          }
+          waiting.erase(name.first);
+        }
+        continue;
+      }
+      Probe* probe = static_cast<Probe*>(tag);
+      if (probe->awaiting_ticket) {
+        probe->ReadTicket();
+      } else if (probe->done) {
+        continue;
+      } else if (!probe->connected) {
+        on_connected(probe);
+      } else {
+        if (probe->connect_ms == 0) {
+          // The deferred connect has been answered.
+          probe->connect_ms = ElapsedMs(probe->start_ns);
+        }
+        handshake(probe);
+      }
+    }
+
+    int64_t now = MonotonicNowMs();
+    for (const auto& probe : active) {
+      if (!probe->done && now >= probe->deadline_ms && !finished()) {
+        complete(probe.get(), false);
+      }
+    }
+    if (now >= resolve_deadline_ms && !waiting.empty()) {
+      for (const auto& name : waiting) {
+        for (size_t index : name.second) {
+          if (!finished()) {
+            fail(index);
+          }
+        }
+      }
+      waiting.clear();
+    }
+  }
+
+  prune();
+  for (const auto& probe : active) {
+    close(probe->fd);
+  }
+  {
+    // Threads still resolving see an empty queue and exit on their own.
+    std::lock_guard<std::mutex> lock(resolver->mutex);
+    resolver->pending.clear();
+  }
+  close(epoll_fd);
+  ERR_clear_error();
+  WriteLog(LogLevel::kInfo, "prober",
+           "Probed " + std::to_string(targets.size() - remaining) + " of " +
+               std::to_string(targets.size()) + " configs, " +
+               std::to_string(healthy.size()) + " healthy");
+  return healthy;
+}
+
+void ConfigProber::AwaitSessionTickets() {
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd >= 0) {
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &kCancelTag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cancel_fd_, &event);
+    for (const auto& probe : ticket_waits_) {
+      event.data.ptr = probe.get();
+      if (probe->awaiting_ticket &&
+          epoll_ctl(epoll_fd, EPOLL_CTL_ADD, probe->fd, &event) != 0) {
+        probe->StopWaiting();
+      }
+    }
+
+    struct epoll_event events[kMaxEvents];
+    while (!cancelled_.load()) {
+      int64_t next = INT64_MAX;
+      for (const auto& probe : ticket_waits_) {
+        if (probe->awaiting_ticket) {
+          next = std::min(next, probe->deadline_ms);
+        }
+      }
+      if (next == INT64_MAX) {
+        break;
+      }
+      int timeout = static_cast<int>(
+          std::max<int64_t>(0, next - MonotonicNowMs()));
+      int count = epoll_wait(epoll_fd, events, kMaxEvents, timeout);
+      if (count < 0 && errno != EINTR) {
+        break;
+      }
+      for (int i = 0; i < count; i++) {
+        if (events[i].data.ptr == &kCancelTag) {
+          break;
+        }
+        Probe* probe = static_cast<Probe*>(events[i].data.ptr);
+        if (probe->awaiting_ticket) {
+          probe->ReadTicket();
+        }
+      }
+      int64_t now = MonotonicNowMs();
+      for (const auto& probe : ticket_waits_) {
+        if (probe->awaiting_ticket && now >= probe->deadline_ms) {
+          probe->StopWaiting();
+        }
+      }
+    }
+    close(epoll_fd);
+  }
+
+  size_t stored = 0;
+  for (const auto& probe : ticket_waits_) {
+    if (probe->awaiting_ticket) {
+      probe->StopWaiting();
+    }
+    stored += probe->ticket_stored ? 1 : 0;
+  }
+  if (!ticket_waits_.empty()) {
+    WriteLog(LogLevel::kInfo, "prober",
+             "Stored " + std::to_string(stored) + " of " +
+                 std::to_string(ticket_waits_.size()) +
+                 " session tickets after the handshake");
+  }
+  ticket_waits_.clear();
+}
@@ -0,0 +1,106 @@
+#ifndef RUNNER_CONFIG_PROBER_H_
+#define RUNNER_CONFIG_PROBER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tls_session_cache.h"
+
+struct ssl_ctx_st;
+struct ssl_session_st;
+struct ssl_st;
+
+struct ProbeTarget {
+  std::string host;
+  uint16_t port = 0;
+  // Follow the TCP connect with a TLS handshake, which also catches servers
+  // that accept but never answer.
+  bool tls = false;
+  // SNI for the ClientHello; empty means |host|.
+  std::string server_name;
+};
+
+struct ProbeResult {
+  // Position of the target in the list passed to Run().
+  size_t index = 0;
+  bool ok = false;
+  // Time to establish TCP, and to the end of the TLS handshake when the
+  // target uses TLS (equal to |connect_ms| otherwise). When fast open
+  // defers the connect into the ClientHello, |connect_ms| is the time to
+  // the server's first reply.
+  int64_t connect_ms = 0;
+  int64_t latency_ms = 0;
+  // The TLS handshake resumed a cached session.
+  bool resumed = false;
+  // The ClientHello went out in the SYN and the server accepted it.
+  bool fast_open = false;
+};
+
+struct ConfigProberOptions {
+  // Probes in flight at once.
+  int concurrency = 32;
+  // Per-probe deadline, counted from the start of its connect.
+  int timeout_ms = 3000;
+  // Stop as soon as this many targets are healthy. 0 probes every target.
+  size_t stop_after = 0;
+  // Offers the sessions cached here to TLS targets and stores the ones
+  // they issue. Not owned; null disables resumption.
+  TlsSessionCache* session_cache = nullptr;
+  // Sends the ClientHello in the SYN to servers that have handed out a
+  // TCP Fast Open cookie before.
+  bool fast_open = true;
+};
+
+// Checks many proxy servers at once. Host names are resolved on a few
+// helper threads; everything else runs on the caller's thread in a single
+// epoll loop that keeps up to |concurrency| non-blocking handshakes in
+// flight and fails each one at its own deadline, so a list of dead servers
+// costs roughly one timeout instead of one per server.
+class ConfigProber {
+ public:
+  using ResultCallback = std::function<void(const ProbeResult& result)>;
+
+  explicit ConfigProber(const ConfigProberOptions& options);
+  ~ConfigProber();
+
+  // Prevent copying.
+  ConfigProber(ConfigProber const&) = delete;
+  ConfigProber& operator=(ConfigProber const&) = delete;
+
+  // Probes |targets|, calling |on_result| on this thread as each probe
+  // finishes. Returns the healthy results in the order they finished.
+  // Blocks until every target is done, |stop_after| is reached or Cancel()
+  // is called. A prober runs once.
+  std::vector<ProbeResult> Run(const std::vector<ProbeTarget>& targets,
+                               const ResultCallback& on_result);
+
+  // Makes Run() return promptly. Safe to call from any thread, before or
+  // during Run().
+  void Cancel();
+
+  // TLS 1.3 servers issue session tickets only after the handshake, so
+  // Run() returns with the connections still waiting for one. Waits a
+  // round trip or so for those tickets to reach the session cache, then
+  // closes the connections. Returns early on Cancel().
+  void AwaitSessionTickets();
+
+ private:
+  struct Probe;
+
+  static int OnNewSession(ssl_st* ssl, ssl_session_st* session);
+
+  ConfigProberOptions options_;
+  int cancel_fd_;
+  std::atomic<bool> cancelled_{false};
+  // Created on the first run with a TLS target.
+  ssl_ctx_st* tls_context_ = nullptr;
+  // Handshakes reported by Run() that are still waiting for a ticket.
+  std::vector<std::unique_ptr<Probe>> ticket_waits_;
+};
+
+#endif  // RUNNER_CONFIG_PROBER_H_
@@ -0,0 +1,455 @@
+#include "config_store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+constexpr char kMagic[8] = {'M', 'I', 'M', 'I', 'C', 'F', 'G', '\0'};
+
+// Weight of the newest probe in the rolling health figures.
+constexpr float kHealthWeight = 0.3f;
+// Configs below this success rate rank after unprobed ones.
+constexpr float kHealthyRate = 0.5f;
+
+// Index slots hold a record index plus one, so zero marks an empty slot.
+constexpr uint32_t kEmptySlot = 0;
+
+// FNV-1a.
+uint32_t Hash(const char* data, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Keeps each table at most half full so probe sequences stay short.
+uint32_t BucketCountFor(size_t records) {
+  uint32_t buckets = 8;
+  while (buckets < records * 2) {
+    buckets *= 2;
+  }
+  return buckets;
+}
+
+size_t AlignUp(size_t value) { return (value + 7) & ~static_cast<size_t>(7); }
+
+bool WriteAll(int fd, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    length -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+// Creates the directories leading up to |path|'s last component.
+void MakeParentDirectories(const std::string& path) {
+  for (size_t slash = path.find('/', 1); slash != std::string::npos;
+       slash = path.find('/', slash + 1)) {
+    mkdir(path.substr(0, slash).c_str(), 0700);
+  }
+}
+
+}  // namespace
+
+constexpr uint32_t ConfigStore::kVersion;
+
+struct ConfigStore::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_count;
+  // Slots in each index table; a power of two.
+  uint32_t bucket_count;
+  uint32_t records_offset;
+  uint32_t name_index_offset;
+  uint32_t country_index_offset;
+  uint32_t strings_offset;
+  uint32_t strings_length;
+  uint32_t file_length;
+  uint32_t reserved;
+};
+
+// String fields are offsets into the pool, which is not NUL-terminated.
+struct ConfigStore::Record {
+  uint32_t name_offset;
+  uint32_t name_length;
+  uint32_t config_offset;
+  uint32_t config_length;
+  uint32_t country_offset;
+  uint32_t country_length;
+  uint32_t flag_offset;
+  uint32_t flag_length;
+  uint32_t name_hash;
+  uint32_t country_hash;
+  uint8_t premium;
+  uint8_t reserved[3];
+  ServerHealth health;
+};
+
+
+ConfigStore::ConfigStore() = default;
+
+ConfigStore::~ConfigStore() { Close(); }
+
+bool ConfigStore::Open(const std::string& path) {
+  Close();
+  path_ = path;
+  int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) < sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+  size_t length = static_cast<size_t>(info.st_size);
+  void* mapping =
+      mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<uint8_t*>(mapping);
+  length_ = length;
+  if (!Validate()) {
+    Close();
+    path_ = path;
+    return false;
+  }
+  return true;
+}
+
+void ConfigStore::Close() {
+  if (data_ != nullptr) {
+    munmap(data_, length_);
+  }
+  data_ = nullptr;
+  length_ = 0;
+}
+
+bool ConfigStore::Replace(const std::vector<StoredConfig>& configs) {
+  if (path_.empty()) {
+    return false;
+  }
+  uint32_t buckets = BucketCountFor(configs.size());
+  size_t records_offset = AlignUp(sizeof(Header));
+  size_t name_index_offset = records_offset + configs.size() * sizeof(Record);
+  size_t country_index_offset = name_index_offset + buckets * sizeof(uint32_t);
+  size_t strings_offset = country_index_offset + buckets * sizeof(uint32_t);
+  size_t strings_length = 0;
+  for (const StoredConfig& config : configs) {
+    strings_length += config.name.size() + config.config.size() +
+                      config.country.size() + config.flag.size();
+  }
+  size_t file_length = strings_offset + strings_length;
+  if (file_length > UINT32_MAX) {
+    return false;
+  }
+
+  std::vector<uint8_t> buffer(file_length, 0);
+  Header* header = reinterpret_cast<Header*>(buffer.data());
+  memcpy(header->magic, kMagic, sizeof(kMagic));
+  header->version = kVersion;
+  header->record_count = static_cast<uint32_t>(configs.size());
+  header->bucket_count = buckets;
+  header->records_offset = static_cast<uint32_t>(records_offset);
+  header->name_index_offset = static_cast<uint32_t>(name_index_offset);
+  header->country_index_offset = static_cast<uint32_t>(country_index_offset);
+  header->strings_offset = static_cast<uint32_t>(strings_offset);
+  header->strings_length = static_cast<uint32_t>(strings_length);
+  header->file_length = static_cast<uint32_t>(file_length);
+
+  Record* records = reinterpret_cast<Record*>(buffer.data() + records_offset);
+  uint32_t* name_index =
+      reinterpret_cast<uint32_t*>(buffer.data() + name_index_offset);
+  uint32_t* country_index =
+      reinterpret_cast<uint32_t*>(buffer.data() + country_index_offset);
+  uint8_t* strings = buffer.data() + strings_offset;
+  uint32_t mask = buckets - 1;
+  uint32_t pool = 0;
+  auto add_string = [&](const std::string& value, uint32_t* offset,
+                        uint32_t* length) {
+    memcpy(strings + pool, value.data(), value.size());
+    *offset = pool;
+    *length = static_cast<uint32_t>(value.size());
+    pool += static_cast<uint32_t>(value.size());
+  };
+
+  for (size_t i = 0; i < configs.size(); i++) {
+    const StoredConfig& config = configs[i];
+    Record& record = records[i];
+    add_string(config.name, &record.name_offset, &record.name_length);
+    add_string(config.config, &record.config_offset, &record.config_length);
+    add_string(config.country, &record.country_offset,
+               &record.country_length);
+    add_string(config.flag, &record.flag_offset, &record.flag_length);
+    record.premium = config.premium ? 1 : 0;
+    record.name_hash = Hash(config.name.data(), config.name.size());
+    record.country_hash = Hash(config.country.data(), config.country.size());
+
+    int previous = FindByName(config.name);
+    if (previous >= 0) {
+      record.health = Health(static_cast<size_t>(previous));
+    }
+
+    // Duplicate names keep the first record in the name index.
+    uint32_t slot = record.name_hash & mask;
+    bool duplicate = false;
+    while (name_index[slot] != kEmptySlot) {
+      const Record& other = records[name_index[slot] - 1];
+      if (other.name_hash == record.name_hash &&
+          configs[name_index[slot] - 1].name == config.name) {
+        duplicate = true;
+        break;
+      }
+      slot = (slot + 1) & mask;
+    }
+    if (!duplicate) {
+      name_index[slot] = static_cast<uint32_t>(i + 1);
+    }
+    slot = record.country_hash & mask;
+    while (country_index[slot] != kEmptySlot) {
+      slot = (slot + 1) & mask;
+    }
+    country_index[slot] = static_cast<uint32_t>(i + 1);
+  }
+
+  MakeParentDirectories(path_);
+  std::string temp_path = path_ + ".tmp";
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0600);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = WriteAll(fd, buffer.data(), buffer.size()) && fsync(fd) == 0;
+  close(fd);
+  if (!written || rename(temp_path.c_str(), path_.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return Open(path_);
+}
+
+size_t ConfigStore::size() const {
+  return data_ != nullptr ? header()->record_count : 0;
+}
+
+StoredConfig ConfigStore::Get(size_t index) const {
+  const Record& record = records()[index];
+  StoredConfig config;
+  config.name = String(record.name_offset, record.name_length);
+  config.config = String(record.config_offset, record.config_length);
+  config.country = String(record.country_offset, record.country_length);
+  config.flag = String(record.flag_offset, record.flag_length);
+  config.premium = record.premium != 0;
+  return config;
+}
+
+ServerHealth ConfigStore::Health(size_t index) const {
+  return records()[index].health;
+}
+
+int ConfigStore::FindByName(const std::string& name) const {
+  if (data_ == nullptr) {
+    return -1;
+  }
+  const char* strings =
+      reinterpret_cast<const char*>(data_ + header()->strings_offset);
+  uint32_t hash = Hash(name.data(), name.size());
+  uint32_t mask = header()->bucket_count - 1;
+  const uint32_t* index = name_index();
+  for (uint32_t slot = hash & mask; index[slot] != kEmptySlot;
+       slot = (slot + 1) & mask) {
+    const Record& record = records()[index[slot] - 1];
+    if (record.name_hash == hash && record.name_length == name.size() &&
+        memcmp(strings + record.name_offset, name.data(), name.size()) == 0) {
+      return static_cast<int>(index[slot] - 1);
+    }
+  }
+  return -1;
+}
+
+std::vector<size_t> ConfigStore::FindByCountry(
+    const std::string& country) const {
+  std::vector<size_t> matches;
+  if (data_ == nullptr) {
+    return matches;
+  }
+  const char* strings =
+      reinterpret_cast<const char*>(data_ + header()->strings_offset);
+  uint32_t hash = Hash(country.data(), country.size());
+  uint32_t mask = header()->bucket_count - 1;
+  const uint32_t* index = country_index();
+  for (uint32_t slot = hash & mask; index[slot] != kEmptySlot;
+       slot = (slot + 1) & mask) {
+    const Record& record = records()[index[slot] - 1];
+    if (record.country_hash == hash &&
+        record.country_length == country.size() &&
+        memcmp(strings + record.country_offset, country.data(),
+               country.size()) == 0) {
+      matches.push_back(index[slot] - 1);
+    }
+  }
+  std::sort(matches.begin(), matches.end());
+  return matches;
+}
+
+void ConfigStore::RecordProbe(size_t index, bool ok, int32_t rtt_ms,
+                              int64_t now_ms) {
+  ServerHealth& health = records()[index].health;
+  float outcome = ok ? 1.0f : 0.0f;
+  health.success_rate =
+      health.probes == 0
+          ? outcome
+          : health.success_rate +
+                kHealthWeight * (outcome - health.success_rate);
+  health.probes++;
+  health.last_probe_ms = now_ms;
+  if (ok) {
+    health.avg_rtt_ms =
+        health.avg_rtt_ms == 0
+            ? rtt_ms
+            : health.avg_rtt_ms +
+                  static_cast<int32_t>(kHealthWeight *
+                                       (rtt_ms - health.avg_rtt_ms));
+    health.last_rtt_ms = rtt_ms;
+    health.last_good_ms = now_ms;
+  }
+}
+
+std::vector<size_t> ConfigStore::Ranked() const {
+  std::vector<size_t> order(size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  const Record* all = records();
+  // 0 for healthy, 1 for unprobed, 2 for failing.
+  auto tier = [](const ServerHealth& health) {
+    if (health.probes == 0) {
+      return 1;
+    }
+    return health.success_rate >= kHealthyRate ? 0 : 2;
+  };
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    const ServerHealth& first = all[a].health;
+    const ServerHealth& second = all[b].health;
+    int first_tier = tier(first);
+    int second_tier = tier(second);
+    if (first_tier != second_tier) {
+      return first_tier < second_tier;
+    }
+    if (first_tier == 0) {
+      // Expected time to a working connection.
+      return first.avg_rtt_ms / first.success_rate <
+             second.avg_rtt_ms / second.success_rate;
+    }
+    if (first_tier == 2) {
+      return first.success_rate > second.success_rate;
+    }
+    return false;
+  });
+  return order;
+}
+
+std::string ConfigStore::DefaultPath() {
+  if (const char* path = getenv("MIMIVPN_CONFIG_STORE")) {
+    return path;
+  }
+  std::string cache;
+  if (const char* xdg = getenv("XDG_CACHE_HOME")) {
+    cache = xdg;
+  } else if (const char* home = getenv("HOME")) {
+    cache = std::string(home) + "/.cache";
+  } else {
+    cache = "/tmp";
+  }
+  return cache + "/mimivpn/configs.bin";
+}
+
+const ConfigStore::Header* ConfigStore::header() const {
+  return reinterpret_cast<const Header*>(data_);
+}
+
+ConfigStore::Record* ConfigStore::records() const {
+  return reinterpret_cast<Record*>(data_ + header()->records_offset);
+}
+
+const uint32_t* ConfigStore::name_index() const {
+  return reinterpret_cast<const uint32_t*>(data_ +
+                                           header()->name_index_offset);
+}
+
+const uint32_t* ConfigStore::country_index() const {
+  return reinterpret_cast<const uint32_t*>(data_ +
+                                           header()->country_index_offset);
+}
+
+std::string ConfigStore::String(uint32_t offset, uint32_t length) const {
+  return std::string(reinterpret_cast<const char*>(
+                         data_ + header()->strings_offset + offset),
+                     length);
+}
+
+bool ConfigStore::Validate() const {
+  const Header* h = header();
+  if (memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 ||
+      h->version != kVersion || h->file_length != length_) {
+    return false;
+  }
+  uint64_t buckets = h->bucket_count;
+  if (buckets == 0 || (buckets & (buckets - 1)) != 0 ||
+      buckets < h->record_count * 2ull) {
+    return false;
+  }
+  // Sections must follow each other in order and end inside the file.
+  uint64_t records_end =
+      h->records_offset + uint64_t{h->record_count} * sizeof(Record);
+  if (h->records_offset < sizeof(Header) || h->records_offset % 8 != 0 ||
+      h->name_index_offset != records_end ||
+      h->country_index_offset != h->name_index_offset + buckets * 4 ||
+      h->strings_offset != h->country_index_offset + buckets * 4 ||
+      uint64_t{h->strings_offset} + h->strings_length != length_) {
+    return false;
+  }
+  const Record* all = records();
+  for (uint32_t i = 0; i < h->record_count; i++) {
+    const Record& record = all[i];
+    const uint32_t spans[4][2] = {
+        {record.name_offset, record.name_length},
+        {record.config_offset, record.config_length},
+        {record.country_offset, record.country_length},
+        {record.flag_offset, record.flag_length},
+    };
+    for (const auto& span : spans) {
+      if (uint64_t{span[0]} + span[1] > h->strings_length) {
+        return false;
+      }
+    }
+  }
+  for (const uint32_t* index : {name_index(), country_index()}) {
+    for (uint64_t slot = 0; slot < buckets; slot++) {
+      if (index[slot] > h->record_count) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
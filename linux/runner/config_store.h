@@ -0,0 +1,103 @@
+#ifndef RUNNER_CONFIG_STORE_H_
+#define RUNNER_CONFIG_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A server config as the Dart VpnConfig model holds it.
+struct StoredConfig {
+  std::string name;
+  std::string config;
+  std::string country;
+  std::string flag;
+  bool premium = false;
+};
+
+// Probe history kept with each config across launches.
+struct ServerHealth {
+  // Probes recorded so far; the other fields mean nothing while 0.
+  uint32_t probes = 0;
+  int32_t last_rtt_ms = 0;
+  // Exponentially weighted over recent successful probes.
+  int32_t avg_rtt_ms = 0;
+  // Exponentially weighted share of recent probes that succeeded, 0..1.
+  float success_rate = 0;
+  // Wall-clock milliseconds since the epoch.
+  int64_t last_good_ms = 0;
+  int64_t last_probe_ms = 0;
+};
+
+// Server configs and their health, persisted in one binary file that is
+// used straight from an mmap: a header, fixed-size records, hash tables
+// indexing the records by name and by country, and a string pool. Opening
+// the store validates offsets and nothing is parsed, so the list is
+// available as soon as the file is mapped. Health updates are written into
+// the shared mapping in place; replacing the configs rewrites the file.
+//
+// Not thread-safe; the plugin uses it from the main thread only.
+class ConfigStore {
+ public:
+  // Bumped whenever the layout changes; older files are ignored.
+  static constexpr uint32_t kVersion = 1;
+
+  ConfigStore();
+  ~ConfigStore();
+
+  // Prevent copying.
+  ConfigStore(ConfigStore const&) = delete;
+  ConfigStore& operator=(ConfigStore const&) = delete;
+
+  // Maps the store at |path|. Returns false, leaving the store empty but
+  // bound to |path|, when the file is missing or not a valid store of this
+  // version.
+  bool Open(const std::string& path);
+
+  void Close();
+
+  // Rewrites the file with |configs| in the given order. Configs whose name
+  // was already stored keep their health. The new file is written next to
+  // the old one and renamed over it, so a crash leaves either version.
+  bool Replace(const std::vector<StoredConfig>& configs);
+
+  size_t size() const;
+
+  // Copies out the config at |index|, which must be below size().
+  StoredConfig Get(size_t index) const;
+  ServerHealth Health(size_t index) const;
+
+  // Returns the index of the config named |name|, or -1.
+  int FindByName(const std::string& name) const;
+
+  // Returns the indices of the configs in |country|, in stored order.
+  std::vector<size_t> FindByCountry(const std::string& country) const;
+
+  // Folds one probe into the health of the config at |index|.
+  void RecordProbe(size_t index, bool ok, int32_t rtt_ms, int64_t now_ms);
+
+  // Returns every index, best candidate first: configs that answered
+  // reliably and fast, then unprobed ones in stored order, then ones whose
+  // recent probes failed.
+  std::vector<size_t> Ranked() const;
+
+  // $MIMIVPN_CONFIG_STORE, or configs.bin in the user's cache directory.
+  static std::string DefaultPath();
+
+ private:
+  struct Header;
+  struct Record;
+
+  const Header* header() const;
+  Record* records() const;
+  const uint32_t* name_index() const;
+  const uint32_t* country_index() const;
+  std::string String(uint32_t offset, uint32_t length) const;
+  bool Validate() const;
+
+  std::string path_;
+  uint8_t* data_ = nullptr;
+  size_t length_ = 0;
+};
+
+#endif  // RUNNER_CONFIG_STORE_H_
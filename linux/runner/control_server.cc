@@ -0,0 +1,355 @@
+#include "control_server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "log_ring.h"
+
+namespace {
+
+// Longest request line; a client sending more without a newline is
+// dropped.
+constexpr size_t kMaxLine = 4096;
+constexpr size_t kMaxClients = 64;
+
+bool FillAddress(const std::string& path, struct sockaddr_un* address) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address->sun_path)) {
+    return false;
+  }
+  memcpy(address->sun_path, path.data(), path.size());
+  return true;
+}
+
+ControlRequest ParseRequest(const std::string& line) {
+  ControlRequest request;
+  size_t position = 0;
+  while (position < line.size()) {
+    size_t start = line.find_first_not_of(" \t\r", position);
+    if (start == std::string::npos) {
+      break;
+    }
+    size_t end = line.find_first_of(" \t\r", start);
+    if (end == std::string::npos) {
+      end = line.size();
+    }
+    std::string word = line.substr(start, end - start);
+    if (request.verb.empty()) {
+      request.verb = std::move(word);
+    } else {
+      request.args.push_back(std::move(word));
+    }
+    position = end;
+  }
+  return request;
+}
+
+}  // namespace
+
+std::string JsonQuote(const std::string& text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      quoted.push_back('\\');
+      quoted.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      quoted += code;
+    } else {
+      quoted.push_back(c);
+    }
+  }
+  quoted.push_back('"');
+  return quoted;
+}
+
+ControlServer::ControlServer(const std::string& path, Handler handler)
+    : path_(path), handler_(std::move(handler)) {}
+
+ControlServer::~ControlServer() { Stop(); }
+
+bool ControlServer::Start() {
+  if (thread_.joinable()) {
+    return true;
+  }
+  struct sockaddr_un address;
+  if (!FillAddress(path_, &address)) {
+    WriteLog(LogLevel::kError, "control", "Socket path too long: " + path_);
+    return false;
+  }
+
+  // A socket nobody answers on was left behind by a run that did not
+  // shut down cleanly.
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe >= 0) {
+    bool live = connect(probe, reinterpret_cast<struct sockaddr*>(&address),
+                        sizeof(address)) == 0;
+    close(probe);
+    if (live) {
+      WriteLog(LogLevel::kError, "control",
+               "Another instance is serving " + path_);
+      return false;
+    }
+  }
+  unlink(path_.c_str());
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (listen_fd_ < 0) {
+    return false;
+  }
+  // Created without group or other access, then listened on.
+  mode_t previous_mask = umask(0177);
+  bool bound = bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&address),
+                    sizeof(address)) == 0;
+  umask(previous_mask);
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (!bound || listen(listen_fd_, 16) != 0 || wake_fd_ < 0) {
+    WriteLog(LogLevel::kError, "control",
+             "Could not listen on " + path_ + ": " + strerror(errno));
+    close(listen_fd_);
+    listen_fd_ = -1;
+    if (wake_fd_ >= 0) {
+      close(wake_fd_);
+      wake_fd_ = -1;
+    }
+    if (bound) {
+      unlink(path_.c_str());
+    }
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = true;
+  }
+  thread_ = std::thread([this] {
+    pthread_setname_np(pthread_self(), "vpn-control-api");
+    Run();
+  });
+  return true;
+}
+
+void ControlServer::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+    replies_.clear();
+  }
+  Wake();
+  thread_.join();
+
+  for (auto& entry : clients_) {
+    close(entry.second.fd);
+  }
+  clients_.clear();
+  close(listen_fd_);
+  listen_fd_ = -1;
+  close(wake_fd_);
+  wake_fd_ = -1;
+  unlink(path_.c_str());
+}
+
+std::string ControlServer::DefaultPath() {
+  if (const char* path = getenv("MIMIVPN_CONTROL_SOCKET")) {
+    return path;
+  }
+  if (const char* runtime = getenv("XDG_RUNTIME_DIR")) {
+    return std::string(runtime) + "/mimivpn.sock";
+  }
+  return "/tmp/mimivpn-" + std::to_string(getuid()) + ".sock";
+}
+
+void ControlServer::Wake() {
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+    // The counter is already non-zero, so the thread wakes anyway.
+  }
+}
+
+void ControlServer::Run() {
+  std::vector<struct pollfd> fds;
+  std::vector<uint64_t> ids;
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!running_) {
+        break;
+      }
+    }
+    fds.clear();
+    ids.clear();
+    fds.push_back({wake_fd_, POLLIN, 0});
+    fds.push_back({listen_fd_, POLLIN, 0});
+    for (auto& entry : clients_) {
+      // A client that hung up reports POLLHUP on every poll, so it is only
+      // watched while there is something left to send it.
+      short events = entry.second.closing ? 0 : POLLIN;
+      if (!entry.second.output.empty()) {
+        events |= POLLOUT;
+      }
+      if (events != 0) {
+        fds.push_back({entry.second.fd, events, 0});
+        ids.push_back(entry.first);
+      }
+    }
+    if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      uint64_t count;
+      if (read(wake_fd_, &count, sizeof(count)) < 0) {
+        // Nothing to drain.
+      }
+    }
+    CollectReplies();
+    if (fds[1].revents & POLLIN) {
+      Accept();
+    }
+
+    for (size_t i = 0; i < ids.size(); i++) {
+      auto found = clients_.find(ids[i]);
+      if (found == clients_.end()) {
+        continue;
+      }
+      Client& client = found->second;
+      short revents = fds[i + 2].revents;
+      bool keep = true;
+      if (!client.closing && (revents & (POLLIN | POLLHUP | POLLERR))) {
+        keep = ReadClient(ids[i], &client);
+      }
+      if (keep && !client.output.empty()) {
+        keep = FlushClient(&client);
+      }
+      if (!keep) {
+        close(client.fd);
+        clients_.erase(found);
+      }
+    }
+    for (auto it = clients_.begin(); it != clients_.end();) {
+      Client& client = it->second;
+      if (client.closing && !client.busy && client.output.empty()) {
+        close(client.fd);
+        it = clients_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+void ControlServer::Accept() {
+  for (;;) {
+    int fd = accept4(listen_fd_, nullptr, nullptr,
+                     SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) {
+      return;
+    }
+    if (clients_.size() >= kMaxClients) {
+      close(fd);
+      continue;
+    }
+    Client& client = clients_[next_client_id_++];
+    client.fd = fd;
+  }
+}
+
+bool ControlServer::ReadClient(uint64_t id, Client* client) {
+  char buffer[1024];
+  for (;;) {
+    ssize_t received = recv(client->fd, buffer, sizeof(buffer), 0);
+    if (received > 0) {
+      client->input.append(buffer, static_cast<size_t>(received));
+      if (client->input.size() > kMaxLine &&
+          client->input.find('\n') == std::string::npos) {
+        return false;
+      }
+      continue;
+    }
+    if (received == 0) {
+      // Requests already sent are still answered.
+      client->closing = true;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      return false;
+    }
+    break;
+  }
+  DispatchNext(id, client);
+  return true;
+}
+
+void ControlServer::DispatchNext(uint64_t id, Client* client) {
+  while (!client->busy) {
+    size_t newline = client->input.find('\n');
+    if (newline == std::string::npos) {
+      return;
+    }
+    ControlRequest request = ParseRequest(client->input.substr(0, newline));
+    client->input.erase(0, newline + 1);
+    if (request.verb.empty()) {
+      continue;
+    }
+    client->busy = true;
+    handler_(request,
+             [this, id](const std::string& result, const std::string& error) {
+               std::string line =
+                   error.empty()
+                       ? "{\"ok\":true,\"result\":" +
+                             (result.empty() ? std::string("null") : result) +
+                             "}\n"
+                       : "{\"ok\":false,\"error\":" + JsonQuote(error) + "}\n";
+               {
+                 std::lock_guard<std::mutex> lock(mutex_);
+                 if (!running_) {
+                   return;
+                 }
+                 replies_.emplace_back(id, std::move(line));
+               }
+               Wake();
+             });
+  }
+}
+
+bool ControlServer::FlushClient(Client* client) {
+  while (!client->output.empty()) {
+    ssize_t sent = send(client->fd, client->output.data(),
+                        client->output.size(), MSG_NOSIGNAL);
+    if (sent < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    client->output.erase(0, static_cast<size_t>(sent));
+  }
+  return true;
+}
+
+void ControlServer::CollectReplies() {
+  std::vector<std::pair<uint64_t, std::string>> replies;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    replies.swap(replies_);
+  }
+  for (auto& reply : replies) {
+    auto found = clients_.find(reply.first);
+    if (found == clients_.end()) {
+      // The client went away before its answer was ready.
+      continue;
+    }
+    found->second.output += reply.second;
+    found->second.busy = false;
+    DispatchNext(reply.first, &found->second);
+  }
+}
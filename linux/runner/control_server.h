@@ -0,0 +1,93 @@
+#ifndef RUNNER_CONTROL_SERVER_H_
+#define RUNNER_CONTROL_SERVER_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One line read from a control client: a VpnBridge method name followed by
+// its arguments, separated by whitespace, e.g. "startLocalProxy 10808".
+struct ControlRequest {
+  std::string verb;
+  std::vector<std::string> args;
+};
+
+// Returns |text| as a quoted JSON string.
+std::string JsonQuote(const std::string& text);
+
+// Serves the headless runner's control API on a Unix domain socket. Each
+// request line gets one reply line, either {"ok":true,"result":...} or
+// {"ok":false,"error":"..."}, in request order: a client may pipeline
+// requests, but the next one is only handed on once the previous one has
+// been answered. The socket is only accessible to the runner's user.
+class ControlServer {
+ public:
+  // Answers a request with the JSON |result|, or fails it with |error|
+  // when that is non-empty. Safe to call from any thread, once.
+  using Reply =
+      std::function<void(const std::string& result, const std::string& error)>;
+  // Runs on the server thread and must not block; slow work replies later.
+  using Handler = std::function<void(const ControlRequest& request, Reply)>;
+
+  ControlServer(const std::string& path, Handler handler);
+  ~ControlServer();
+
+  // Prevent copying.
+  ControlServer(ControlServer const&) = delete;
+  ControlServer& operator=(ControlServer const&) = delete;
+
+  // Binds the socket, replacing a stale one left by a previous run, and
+  // starts the server thread. Returns false when the socket is taken by a
+  // live server or cannot be created.
+  bool Start();
+
+  // Closes every client connection and removes the socket.
+  void Stop();
+
+  // $MIMIVPN_CONTROL_SOCKET, or mimivpn.sock in $XDG_RUNTIME_DIR, or a
+  // per-user path in /tmp.
+  static std::string DefaultPath();
+
+ private:
+  struct Client {
+    int fd = -1;
+    std::string input;
+    std::string output;
+    // A request was handed on and has not been answered yet.
+    bool busy = false;
+    // The peer has closed its end; close once the replies are out.
+    bool closing = false;
+  };
+
+  void Run();
+  void Accept();
+  // Reads from, and hands on the next request of, client |id|. Returns
+  // false when the client should be closed.
+  bool ReadClient(uint64_t id, Client* client);
+  void DispatchNext(uint64_t id, Client* client);
+  bool FlushClient(Client* client);
+  // Moves finished replies into their clients' output buffers.
+  void CollectReplies();
+  void Wake();
+
+  std::string path_;
+  Handler handler_;
+  int listen_fd_ = -1;
+  int wake_fd_ = -1;
+  std::thread thread_;
+
+  // Only touched on the server thread.
+  std::map<uint64_t, Client> clients_;
+  uint64_t next_client_id_ = 1;
+
+  std::mutex mutex_;
+  bool running_ = false;
+  // Reply lines by client, waiting for the server thread.
+  std::vector<std::pair<uint64_t, std::string>> replies_;
+};
+
+#endif  // RUNNER_CONTROL_SERVER_H_
@@ -0,0 +1,129 @@
+#include "dns_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "dns_message.h"
+
+DnsCache::DnsCache(const DnsCacheOptions& options) : options_(options) {
+  size_t shards = std::max<size_t>(1, options_.shards);
+  shard_capacity_ = std::max<size_t>(1, options_.capacity / shards);
+  for (size_t i = 0; i < shards; i++) {
+    shards_.emplace_back(new Shard());
+  }
+}
+
+DnsCache::~DnsCache() = default;
+
+DnsCache::Shard& DnsCache::ShardFor(const std::string& key) {
+  return *shards_[std::hash<std::string>()(key) % shards_.size()];
+}
+
+DnsCacheResult DnsCache::Lookup(const std::string& key, int64_t now_ms,
+                                std::vector<uint8_t>* response,
+                                bool* negative) {
+  Shard& shard = ShardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto found = shard.index.find(key);
+  if (found == shard.index.end()) {
+    return DnsCacheResult::kMiss;
+  }
+  auto entry = found->second;
+  if (now_ms >= entry->expires_ms) {
+    shard.index.erase(found);
+    shard.entries.erase(entry);
+    return DnsCacheResult::kMiss;
+  }
+  shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+  entry->hits++;
+
+  *response = entry->response;
+  *negative = entry->negative;
+  uint32_t elapsed_s =
+      static_cast<uint32_t>((now_ms - entry->stored_ms) / 1000);
+  for (uint16_t offset : entry->ttl_offsets) {
+    uint8_t* field = response->data() + offset;
+    uint32_t ttl = (static_cast<uint32_t>(field[0]) << 24) |
+                   (static_cast<uint32_t>(field[1]) << 16) |
+                   (static_cast<uint32_t>(field[2]) << 8) | field[3];
+    ttl = ttl > elapsed_s ? ttl - elapsed_s : 0;
+    field[0] = static_cast<uint8_t>(ttl >> 24);
+    field[1] = static_cast<uint8_t>(ttl >> 16);
+    field[2] = static_cast<uint8_t>(ttl >> 8);
+    field[3] = static_cast<uint8_t>(ttl);
+  }
+
+  if (!entry->negative && !entry->prefetch_requested &&
+      entry->hits >= options_.prefetch_min_hits &&
+      now_ms >= entry->prefetch_ms) {
+    entry->prefetch_requested = true;
+    return DnsCacheResult::kHitPrefetch;
+  }
+  return DnsCacheResult::kHit;
+}
+
+bool DnsCache::Insert(const std::string& key, const uint8_t* response,
+                      size_t length, int64_t now_ms) {
+  DnsRecordScan scan;
+  if (!ScanDnsResponse(response, length, &scan) || scan.truncated ||
+      (scan.rcode != kDnsRcodeNoError && scan.rcode != kDnsRcodeNxDomain)) {
+    return false;
+  }
+  uint32_t ttl_s;
+  if (scan.negative) {
+    ttl_s = scan.negative_ttl > 0 ? scan.negative_ttl
+                                  : options_.fallback_negative_ttl_s;
+    ttl_s = std::min(ttl_s, options_.max_negative_ttl_s);
+  } else {
+    ttl_s = std::max(options_.min_ttl_s,
+                     std::min(scan.min_ttl, options_.max_ttl_s));
+  }
+  if (ttl_s == 0) {
+    return false;
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.response.assign(response, response + length);
+  entry.ttl_offsets = std::move(scan.ttl_offsets);
+  entry.stored_ms = now_ms;
+  entry.expires_ms = now_ms + static_cast<int64_t>(ttl_s) * 1000;
+  entry.prefetch_ms =
+      entry.expires_ms -
+      static_cast<int64_t>(ttl_s) * 10 * options_.prefetch_percent;
+  entry.negative = scan.negative;
+
+  Shard& shard = ShardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto found = shard.index.find(key);
+  if (found != shard.index.end()) {
+    // A refresh keeps the popularity that triggered it.
+    entry.hits = found->second->hits;
+    shard.entries.erase(found->second);
+    shard.index.erase(found);
+  }
+  shard.entries.push_front(std::move(entry));
+  shard.index[key] = shard.entries.begin();
+  while (shard.entries.size() > shard_capacity_) {
+    shard.index.erase(shard.entries.back().key);
+    shard.entries.pop_back();
+  }
+  return true;
+}
+
+void DnsCache::Clear() {
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->index.clear();
+    shard->entries.clear();
+  }
+}
+
+size_t DnsCache::size() const {
+  size_t total = 0;
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total += shard->entries.size();
+  }
+  return total;
+}
@@ -0,0 +1,93 @@
+#ifndef RUNNER_DNS_CACHE_H_
+#define RUNNER_DNS_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct DnsCacheOptions {
+  // Responses kept across all shards.
+  size_t capacity = 4096;
+  // Independently locked parts; lookups for different names rarely contend.
+  size_t shards = 16;
+  // Bounds applied to the TTLs of positive answers.
+  uint32_t min_ttl_s = 0;
+  uint32_t max_ttl_s = 24 * 60 * 60;
+  // Negative answers are kept for their SOA-derived TTL, capped here, or
+  // for the fallback when the upstream sent no SOA.
+  uint32_t max_negative_ttl_s = 5 * 60;
+  uint32_t fallback_negative_ttl_s = 30;
+  // A hit within this share of an entry's TTL from expiry asks the caller
+  // to refresh it, once the entry has been hit this many times.
+  int prefetch_percent = 10;
+  uint32_t prefetch_min_hits = 2;
+};
+
+enum class DnsCacheResult {
+  kMiss,
+  kHit,
+  // A hit whose entry should be refreshed upstream now. Reported once per
+  // entry until it is replaced.
+  kHitPrefetch,
+};
+
+// A sharded LRU cache of DNS responses keyed by DnsQuestion::key. Entries
+// live for their smallest record TTL, and answers handed out have every TTL
+// counted down by the time spent in the cache. Safe to use from any thread.
+class DnsCache {
+ public:
+  explicit DnsCache(const DnsCacheOptions& options);
+  ~DnsCache();
+
+  // Prevent copying.
+  DnsCache(DnsCache const&) = delete;
+  DnsCache& operator=(DnsCache const&) = delete;
+
+  // Looks up |key| and, on a hit, stores the cached answer in |response|
+  // with its TTLs counted down to |now_ms|. |negative| is set for cached
+  // NXDOMAIN and NODATA answers.
+  DnsCacheResult Lookup(const std::string& key, int64_t now_ms,
+                        std::vector<uint8_t>* response, bool* negative);
+
+  // Caches |response| under |key|, replacing any previous entry. Responses
+  // that must not be reused, such as SERVFAIL or truncated ones, are
+  // ignored. Returns whether the response was stored.
+  bool Insert(const std::string& key, const uint8_t* response, size_t length,
+              int64_t now_ms);
+
+  void Clear();
+  size_t size() const;
+
+ private:
+  struct Entry {
+    std::string key;
+    std::vector<uint8_t> response;
+    std::vector<uint16_t> ttl_offsets;
+    int64_t stored_ms = 0;
+    int64_t expires_ms = 0;
+    int64_t prefetch_ms = 0;
+    uint32_t hits = 0;
+    bool negative = false;
+    bool prefetch_requested = false;
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    // Most recently used first.
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  };
+
+  Shard& ShardFor(const std::string& key);
+
+  DnsCacheOptions options_;
+  size_t shard_capacity_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+#endif  // RUNNER_DNS_CACHE_H_
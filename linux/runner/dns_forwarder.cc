@@ -0,0 +1,418 @@
+#include "dns_forwarder.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "dns_message.h"
+#include "log_ring.h"
+#include "net_util.h"
+
+namespace {
+
+// Upstream queries in flight at once; the ID space allows 65536.
+constexpr size_t kMaxPending = 4096;
+// Sends of one query, counting resends after a lost connection.
+constexpr int kMaxAttempts = 2;
+// Pause between attempts to reach an upstream that is down.
+constexpr int64_t kReconnectDelayMs = 1000;
+constexpr int kPollIntervalMs = 250;
+
+}  // namespace
+
+DnsForwarder::DnsForwarder(const DnsForwarderOptions& options)
+    : options_(options),
+      cache_(options.cache),
+      wake_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      socks_host_(options.socks_host),
+      socks_port_(options.socks_port) {}
+
+DnsForwarder::~DnsForwarder() {
+  Stop();
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+  }
+}
+
+void DnsForwarder::Start() {
+  if (thread_.joinable() || wake_fd_ < 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = true;
+  }
+  thread_ = std::thread([this] {
+    pthread_setname_np(pthread_self(), "vpn-dns");
+    Run();
+  });
+}
+
+void DnsForwarder::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  Wake();
+  thread_.join();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  pending_.clear();
+  pending_by_key_.clear();
+  unsent_.clear();
+}
+
+void DnsForwarder::Resolve(const uint8_t* query, size_t length,
+                           size_t max_length, ReplyCallback reply) {
+  DnsQuestion question;
+  if (!ParseDnsQuestion(query, length, &question)) {
+    // Not a plain lookup; left unanswered as before.
+    return;
+  }
+  Waiter waiter;
+  waiter.query.assign(query, query + length);
+  waiter.question_end = question.question_end;
+  waiter.max_length = std::min(max_length, question.udp_limit);
+  waiter.reply = std::move(reply);
+
+  int64_t now = MonotonicNowMs();
+  std::vector<uint8_t> cached;
+  bool negative = false;
+  DnsCacheResult result =
+      cache_.Lookup(question.key, now, &cached, &negative);
+  if (result != DnsCacheResult::kMiss) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stats_.queries++;
+      stats_.cache_hits++;
+      if (negative) {
+        stats_.negative_hits++;
+      }
+      if (result == DnsCacheResult::kHitPrefetch &&
+          pending_by_key_.count(question.key) == 0 &&
+          QueueLocked(question.key, query, length, nullptr)) {
+        stats_.prefetches++;
+      }
+    }
+    Answer(waiter, cached.data(), cached.size());
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.queries++;
+    auto found = pending_by_key_.find(question.key);
+    if (found != pending_by_key_.end()) {
+      pending_[found->second].waiters.push_back(std::move(waiter));
+      stats_.coalesced++;
+      return;
+    }
+    if (QueueLocked(question.key, query, length, &waiter)) {
+      return;
+    }
+  }
+  Fail(waiter);
+}
+
+bool DnsForwarder::QueueLocked(const std::string& key, const uint8_t* query,
+                               size_t length, Waiter* waiter) {
+  if (!running_ || pending_.size() >= kMaxPending) {
+    return false;
+  }
+  uint16_t id = next_id_++;
+  while (pending_.count(id) != 0) {
+    id = next_id_++;
+  }
+  Pending& pending = pending_[id];
+  pending.key = key;
+  pending.query.assign(query, query + length);
+  pending.query[0] = static_cast<uint8_t>(id >> 8);
+  pending.query[1] = static_cast<uint8_t>(id);
+  pending.deadline_ms = MonotonicNowMs() + options_.timeout_ms;
+  if (waiter != nullptr) {
+    pending.waiters.push_back(std::move(*waiter));
+  }
+  pending_by_key_[key] = id;
+  unsent_.push_back(id);
+  Wake();
+  return true;
+}
+
+void DnsForwarder::SetProxy(const std::string& host, uint16_t port) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    socks_host_ = host;
+    socks_port_ = port;
+    proxy_changed_ = true;
+  }
+  Wake();
+}
+
+DnsForwarderStats DnsForwarder::stats() const {
+  DnsForwarderStats stats;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats = stats_;
+    stats.upstream_avg_ms = upstream_rtt_.mean();
+    stats.upstream_p50_ms = upstream_rtt_.Quantile(0.5);
+    stats.upstream_p95_ms = upstream_rtt_.Quantile(0.95);
+  }
+  stats.cache_entries = cache_.size();
+  return stats;
+}
+
+void DnsForwarder::Wake() {
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+    // The counter is already non-zero, so the thread wakes anyway.
+  }
+}
+
+void DnsForwarder::Run() {
+  int fd = -1;
+  int64_t retry_ms = 0;
+  std::vector<Waiter> failed;
+  for (;;) {
+    bool have_work;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!running_) {
+        break;
+      }
+      if (proxy_changed_) {
+        proxy_changed_ = false;
+        if (fd >= 0) {
+          close(fd);
+          fd = -1;
+          failed = RequeueSent();
+        }
+      }
+      have_work = !unsent_.empty();
+    }
+    for (const Waiter& waiter : failed) {
+      Fail(waiter);
+    }
+    failed.clear();
+
+    int64_t now = MonotonicNowMs();
+    if (fd < 0 && have_work && now >= retry_ms) {
+      fd = OpenUpstream();
+      if (fd < 0) {
+        retry_ms = now + kReconnectDelayMs;
+      }
+    }
+    if (fd >= 0 && !SendQueued(fd)) {
+      close(fd);
+      fd = -1;
+      std::lock_guard<std::mutex> lock(mutex_);
+      failed = RequeueSent();
+      continue;
+    }
+
+    struct pollfd fds[2] = {{wake_fd_, POLLIN, 0}, {fd, POLLIN, 0}};
+    int ready = poll(fds, fd >= 0 ? 2 : 1, kPollIntervalMs);
+    if (ready < 0 && errno != EINTR) {
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      uint64_t count;
+      if (read(wake_fd_, &count, sizeof(count)) < 0) {
+        // Nothing to drain.
+      }
+    }
+    if (fd >= 0 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) &&
+        !ReadResponses(fd)) {
+      close(fd);
+      fd = -1;
+      std::lock_guard<std::mutex> lock(mutex_);
+      failed = RequeueSent();
+    }
+    ExpireQueries(MonotonicNowMs());
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+int DnsForwarder::OpenUpstream() {
+  std::string host;
+  uint16_t port;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    host = socks_host_;
+    port = socks_port_;
+  }
+  int fd = ConnectTcp(host, port, options_.timeout_ms);
+  if (fd >= 0 && !Socks5Connect(fd, options_.server_host,
+                                options_.server_port, options_.timeout_ms)) {
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0) {
+    WriteLog(LogLevel::kWarning, "dns",
+             "Could not reach " + options_.server_host + " through " + host +
+                 ":" + std::to_string(port));
+    return -1;
+  }
+  receive_buffer_.clear();
+  return fd;
+}
+
+bool DnsForwarder::SendQueued(int fd) {
+  // Every queued query goes out in one write, each with the two-byte
+  // length prefix DNS over TCP uses (RFC 1035 section 4.2.2).
+  std::vector<uint8_t> batch;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = MonotonicNowMs();
+    for (uint16_t id : unsent_) {
+      auto found = pending_.find(id);
+      if (found == pending_.end()) {
+        continue;
+      }
+      Pending& pending = found->second;
+      size_t length = pending.query.size();
+      batch.push_back(static_cast<uint8_t>(length >> 8));
+      batch.push_back(static_cast<uint8_t>(length));
+      batch.insert(batch.end(), pending.query.begin(), pending.query.end());
+      pending.sent_ms = now;
+      pending.attempts++;
+      stats_.upstream_queries++;
+    }
+    unsent_.clear();
+  }
+  return batch.empty() ||
+         WriteFull(fd, batch.data(), batch.size(),
+                   MonotonicNowMs() + options_.timeout_ms);
+}
+
+bool DnsForwarder::ReadResponses(int fd) {
+  uint8_t chunk[16 * 1024];
+  for (;;) {
+    ssize_t received = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+    if (received == 0) {
+      return false;
+    }
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN) {
+        return false;
+      }
+      break;
+    }
+    receive_buffer_.insert(receive_buffer_.end(), chunk, chunk + received);
+  }
+
+  size_t offset = 0;
+  while (receive_buffer_.size() - offset >= 2) {
+    size_t length = (static_cast<size_t>(receive_buffer_[offset]) << 8) |
+                    receive_buffer_[offset + 1];
+    if (receive_buffer_.size() - offset - 2 < length) {
+      break;
+    }
+    const uint8_t* response = receive_buffer_.data() + offset + 2;
+    if (length >= kDnsHeaderSize) {
+      Complete(static_cast<uint16_t>((response[0] << 8) | response[1]),
+               response, length);
+    }
+    offset += 2 + length;
+  }
+  receive_buffer_.erase(receive_buffer_.begin(),
+                        receive_buffer_.begin() + offset);
+  return true;
+}
+
+void DnsForwarder::Complete(uint16_t upstream_id, const uint8_t* response,
+                            size_t length) {
+  Pending pending;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = pending_.find(upstream_id);
+    // Unknown IDs belong to queries that already timed out.
+    if (found == pending_.end() || found->second.sent_ms == 0) {
+      return;
+    }
+    pending = std::move(found->second);
+    pending_.erase(found);
+    pending_by_key_.erase(pending.key);
+    upstream_rtt_.Add(
+        static_cast<double>(MonotonicNowMs() - pending.sent_ms));
+  }
+  cache_.Insert(pending.key, response, length, MonotonicNowMs());
+  for (const Waiter& waiter : pending.waiters) {
+    Answer(waiter, response, length);
+  }
+}
+
+void DnsForwarder::ExpireQueries(int64_t now_ms) {
+  std::vector<Waiter> failed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      if (now_ms < it->second.deadline_ms) {
+        ++it;
+        continue;
+      }
+      for (Waiter& waiter : it->second.waiters) {
+        failed.push_back(std::move(waiter));
+      }
+      unsent_.erase(std::remove(unsent_.begin(), unsent_.end(), it->first),
+                    unsent_.end());
+      pending_by_key_.erase(it->second.key);
+      stats_.upstream_failures++;
+      it = pending_.erase(it);
+    }
+  }
+  for (const Waiter& waiter : failed) {
+    Fail(waiter);
+  }
+}
+
+std::vector<DnsForwarder::Waiter> DnsForwarder::RequeueSent() {
+  std::vector<Waiter> failed;
+  unsent_.clear();
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    if (it->second.attempts >= kMaxAttempts) {
+      for (Waiter& waiter : it->second.waiters) {
+        failed.push_back(std::move(waiter));
+      }
+      pending_by_key_.erase(it->second.key);
+      stats_.upstream_failures++;
+      it = pending_.erase(it);
+      continue;
+    }
+    unsent_.push_back(it->first);
+    ++it;
+  }
+  return failed;
+}
+
+void DnsForwarder::Answer(const Waiter& waiter, const uint8_t* response,
+                          size_t length) {
+  if (length <= waiter.max_length) {
+    std::vector<uint8_t> answer(response, response + length);
+    AdoptDnsQuery(waiter.query.data(), waiter.question_end, &answer);
+    waiter.reply(answer.data(), answer.size());
+    return;
+  }
+  std::vector<uint8_t> truncated =
+      BuildDnsReply(waiter.query.data(), waiter.question_end,
+                    response[3] & 0x0f, true);
+  waiter.reply(truncated.data(), truncated.size());
+}
+
+void DnsForwarder::Fail(const Waiter& waiter) {
+  std::vector<uint8_t> reply = BuildDnsReply(
+      waiter.query.data(), waiter.question_end, kDnsRcodeServFail, false);
+  waiter.reply(reply.data(), reply.size());
+}
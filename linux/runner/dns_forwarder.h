@@ -0,0 +1,150 @@
+#ifndef RUNNER_DNS_FORWARDER_H_
+#define RUNNER_DNS_FORWARDER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "dns_cache.h"
+#include "streaming_stats.h"
+
+struct DnsForwarderOptions {
+  // The resolver queries are sent to, reached through the SOCKS proxy.
+  std::string server_host = "1.1.1.1";
+  uint16_t server_port = 53;
+  std::string socks_host = "127.0.0.1";
+  uint16_t socks_port = 5000;
+
+  // Clients get SERVFAIL when the upstream has not answered by then.
+  int timeout_ms = 4000;
+  DnsCacheOptions cache;
+};
+
+struct DnsForwarderStats {
+  uint64_t queries = 0;
+  uint64_t cache_hits = 0;
+  // Hits served from a cached NXDOMAIN or NODATA answer.
+  uint64_t negative_hits = 0;
+  // Misses that joined an identical query already in flight.
+  uint64_t coalesced = 0;
+  uint64_t prefetches = 0;
+  uint64_t upstream_queries = 0;
+  uint64_t upstream_failures = 0;
+  size_t cache_entries = 0;
+  // Upstream round trips in milliseconds.
+  double upstream_avg_ms = 0;
+  double upstream_p50_ms = 0;
+  double upstream_p95_ms = 0;
+};
+
+// A caching DNS forwarder for the tunnel. Queries are answered from a
+// DnsCache when possible; misses for the same name are coalesced into one
+// upstream query, popular names are refreshed shortly before they expire,
+// and everything that does reach the upstream is pipelined over a single
+// DNS-over-TCP connection through the SOCKS proxy, so lookups share one
+// tunnel connection instead of paying for a new one each.
+class DnsForwarder {
+ public:
+  // Receives the response for one query. Runs on the caller's thread for
+  // cache hits and on the forwarder thread otherwise.
+  using ReplyCallback =
+      std::function<void(const uint8_t* response, size_t length)>;
+
+  explicit DnsForwarder(const DnsForwarderOptions& options);
+  ~DnsForwarder();
+
+  // Prevent copying.
+  DnsForwarder(DnsForwarder const&) = delete;
+  DnsForwarder& operator=(DnsForwarder const&) = delete;
+
+  void Start();
+
+  // Stops the forwarder thread. Queries still in flight are dropped
+  // without a reply.
+  void Stop();
+
+  // Answers the DNS message |query|. Responses larger than |max_length|,
+  // or than the client advertised, are replaced by a truncated reply so
+  // the client retries over TCP. Safe to call from any thread.
+  void Resolve(const uint8_t* query, size_t length, size_t max_length,
+               ReplyCallback reply);
+
+  // Sends upstream queries through the SOCKS proxy at |host|:|port| from
+  // now on. Safe to call from any thread.
+  void SetProxy(const std::string& host, uint16_t port);
+
+  DnsForwarderStats stats() const;
+
+ private:
+  struct Waiter {
+    std::vector<uint8_t> query;
+    size_t question_end;
+    size_t max_length;
+    ReplyCallback reply;
+  };
+
+  // One upstream query and the clients waiting for it.
+  struct Pending {
+    std::string key;
+    std::vector<uint8_t> query;
+    std::vector<Waiter> waiters;
+    int64_t deadline_ms = 0;
+    int64_t sent_ms = 0;
+    int attempts = 0;
+  };
+
+  void Run();
+  int OpenUpstream();
+  // These return false when the upstream connection failed.
+  bool SendQueued(int fd);
+  bool ReadResponses(int fd);
+  void Complete(uint16_t upstream_id, const uint8_t* response, size_t length);
+  void ExpireQueries(int64_t now_ms);
+  // Queues every query sent on a lost connection again, or drops it when
+  // it has been tried too often. Must hold |mutex_|; returns the waiters of
+  // the dropped queries, to be failed once it is released.
+  std::vector<Waiter> RequeueSent();
+
+  static void Answer(const Waiter& waiter, const uint8_t* response,
+                     size_t length);
+  static void Fail(const Waiter& waiter);
+
+  // Starts an upstream query for |key|, with |waiter| as its first client
+  // unless it is a prefetch. Returns false when too many queries are in
+  // flight. Must hold |mutex_|.
+  bool QueueLocked(const std::string& key, const uint8_t* query,
+                   size_t length, Waiter* waiter);
+  void Wake();
+
+  DnsForwarderOptions options_;
+  DnsCache cache_;
+
+  int wake_fd_;
+  std::thread thread_;
+
+  mutable std::mutex mutex_;
+  bool running_ = false;
+  std::string socks_host_;
+  uint16_t socks_port_;
+  bool proxy_changed_ = false;
+  uint16_t next_id_ = 0;
+  std::map<uint16_t, Pending> pending_;
+  std::unordered_map<std::string, uint16_t> pending_by_key_;
+  // Upstream IDs not yet written to the connection, oldest first.
+  std::deque<uint16_t> unsent_;
+  StreamingStats upstream_rtt_;
+  DnsForwarderStats stats_;
+
+  // The connection's partial response; only touched on the forwarder
+  // thread.
+  std::vector<uint8_t> receive_buffer_;
+};
+
+#endif  // RUNNER_DNS_FORWARDER_H_
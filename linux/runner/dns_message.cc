@@ -0,0 +1,201 @@
+#include "dns_message.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr uint16_t kTypeSoa = 6;
+constexpr uint16_t kTypeOpt = 41;
+constexpr uint16_t kEdnsDoBit = 0x8000;
+constexpr size_t kMaxNameLength = 255;
+
+uint16_t Load16(const uint8_t* p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t Load32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+// TTLs with the top bit set are treated as zero (RFC 2181 section 8).
+uint32_t LoadTtl(const uint8_t* p) {
+  uint32_t ttl = Load32(p);
+  return ttl > 0x7fffffff ? 0 : ttl;
+}
+
+// Returns the offset just past the possibly compressed name at |offset|,
+// or 0 when it runs off the end of the message.
+size_t SkipName(const uint8_t* message, size_t length, size_t offset) {
+  while (offset < length) {
+    uint8_t label = message[offset];
+    if (label == 0) {
+      return offset + 1;
+    }
+    if ((label & 0xc0) == 0xc0) {
+      return offset + 2 <= length ? offset + 2 : 0;
+    }
+    if ((label & 0xc0) != 0) {
+      return 0;
+    }
+    offset += 1 + label;
+  }
+  return 0;
+}
+
+}  // namespace
+
+bool ParseDnsQuestion(const uint8_t* message, size_t length,
+                      DnsQuestion* question) {
+  if (length < kDnsHeaderSize) {
+    return false;
+  }
+  bool response = (message[2] & 0x80) != 0;
+  uint8_t opcode = (message[2] >> 3) & 0x0f;
+  if (response || opcode != 0 || Load16(message + 4) != 1) {
+    return false;
+  }
+  question->id = Load16(message);
+
+  // Queries carry the name uncompressed.
+  std::string key;
+  size_t offset = kDnsHeaderSize;
+  for (;;) {
+    if (offset >= length) {
+      return false;
+    }
+    uint8_t label = message[offset];
+    if (label > 63 || offset + 1 + label > length) {
+      return false;
+    }
+    key.push_back(static_cast<char>(label));
+    for (size_t i = 1; i <= label; i++) {
+      char c = static_cast<char>(message[offset + i]);
+      key.push_back(c >= 'A' && c <= 'Z' ? static_cast<char>(c + 32) : c);
+    }
+    offset += 1 + label;
+    // The limit counts the root label too.
+    if (key.size() > kMaxNameLength) {
+      return false;
+    }
+    if (label == 0) {
+      break;
+    }
+  }
+  if (offset + 4 > length) {
+    return false;
+  }
+  key.append(reinterpret_cast<const char*>(message + offset), 4);
+  offset += 4;
+  question->question_end = offset;
+
+  // The OPT record sits in the additional section, past any records a
+  // client put in the other two.
+  bool dnssec_ok = false;
+  size_t udp_limit = kDnsClassicUdpSize;
+  size_t records = static_cast<size_t>(Load16(message + 6)) +
+                   Load16(message + 8) + Load16(message + 10);
+  for (size_t i = 0; i < records; i++) {
+    offset = SkipName(message, length, offset);
+    if (offset == 0 || offset + 10 > length) {
+      return false;
+    }
+    uint16_t type = Load16(message + offset);
+    size_t rdata_length = Load16(message + offset + 8);
+    if (type == kTypeOpt) {
+      udp_limit = std::max<size_t>(udp_limit, Load16(message + offset + 2));
+      dnssec_ok = (Load16(message + offset + 6) & kEdnsDoBit) != 0;
+    }
+    offset += 10 + rdata_length;
+    if (offset > length) {
+      return false;
+    }
+  }
+
+  bool checking_disabled = (message[3] & 0x10) != 0;
+  key.push_back(static_cast<char>((checking_disabled ? 1 : 0) |
+                                  (dnssec_ok ? 2 : 0)));
+  question->key = std::move(key);
+  question->udp_limit = udp_limit;
+  return true;
+}
+
+bool ScanDnsResponse(const uint8_t* message, size_t length,
+                     DnsRecordScan* scan) {
+  if (length < kDnsHeaderSize || length > 0xffff) {
+    return false;
+  }
+  scan->rcode = message[3] & 0x0f;
+  scan->truncated = (message[2] & 0x02) != 0;
+  scan->ttl_offsets.clear();
+  scan->min_ttl = 0;
+  scan->negative_ttl = 0;
+
+  size_t questions = Load16(message + 4);
+  size_t answers = Load16(message + 6);
+  size_t authorities = Load16(message + 8);
+  size_t additionals = Load16(message + 10);
+  scan->negative = scan->rcode == kDnsRcodeNxDomain ||
+                   (scan->rcode == kDnsRcodeNoError && answers == 0);
+
+  size_t offset = kDnsHeaderSize;
+  for (size_t i = 0; i < questions; i++) {
+    offset = SkipName(message, length, offset);
+    if (offset == 0 || offset + 4 > length) {
+      return false;
+    }
+    offset += 4;
+  }
+
+  bool have_ttl = false;
+  size_t records = answers + authorities + additionals;
+  for (size_t i = 0; i < records; i++) {
+    offset = SkipName(message, length, offset);
+    if (offset == 0 || offset + 10 > length) {
+      return false;
+    }
+    uint16_t type = Load16(message + offset);
+    uint32_t ttl = LoadTtl(message + offset + 4);
+    size_t rdata_length = Load16(message + offset + 8);
+    size_t rdata_end = offset + 10 + rdata_length;
+    if (rdata_end > length) {
+      return false;
+    }
+    if (type != kTypeOpt) {
+      scan->ttl_offsets.push_back(static_cast<uint16_t>(offset + 4));
+      scan->min_ttl = have_ttl ? std::min(scan->min_ttl, ttl) : ttl;
+      have_ttl = true;
+    }
+    bool authority = i >= answers && i < answers + authorities;
+    if (authority && type == kTypeSoa && rdata_length >= 22) {
+      uint32_t minimum = LoadTtl(message + rdata_end - 4);
+      scan->negative_ttl = std::min(ttl, minimum);
+    }
+    offset = rdata_end;
+  }
+  return true;
+}
+
+void AdoptDnsQuery(const uint8_t* query, size_t question_end,
+                   std::vector<uint8_t>* response) {
+  if (response->size() < question_end) {
+    return;
+  }
+  memcpy(response->data(), query, 2);
+  memcpy(response->data() + kDnsHeaderSize, query + kDnsHeaderSize,
+         question_end - kDnsHeaderSize);
+}
+
+std::vector<uint8_t> BuildDnsReply(const uint8_t* query, size_t question_end,
+                                   uint8_t rcode, bool truncated) {
+  std::vector<uint8_t> reply(query, query + question_end);
+  // QR, the query's opcode and RD, and TC when asked for.
+  reply[2] = static_cast<uint8_t>(0x80 | (query[2] & 0x79) |
+                                  (truncated ? 0x02 : 0));
+  // RA, the query's CD bit and the code.
+  reply[3] = static_cast<uint8_t>(0x80 | (query[3] & 0x10) | (rcode & 0x0f));
+  memset(reply.data() + 6, 0, 6);
+  return reply;
+}
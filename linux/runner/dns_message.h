@@ -0,0 +1,66 @@
+#ifndef RUNNER_DNS_MESSAGE_H_
+#define RUNNER_DNS_MESSAGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Just enough of the DNS wire format (RFC 1035) for a caching forwarder:
+// questions are read to build cache keys, and responses are scanned for
+// their TTLs without decoding the records themselves.
+
+constexpr size_t kDnsHeaderSize = 12;
+// The UDP payload limit of a client that does not advertise EDNS.
+constexpr size_t kDnsClassicUdpSize = 512;
+
+constexpr uint8_t kDnsRcodeNoError = 0;
+constexpr uint8_t kDnsRcodeServFail = 2;
+constexpr uint8_t kDnsRcodeNxDomain = 3;
+
+struct DnsQuestion {
+  uint16_t id = 0;
+  // Offset just past the question section.
+  size_t question_end = 0;
+  // Lower-cased name, type, class and the CD bit; identical lookups share a
+  // key regardless of the name's case.
+  std::string key;
+  // Largest UDP response the client accepts.
+  size_t udp_limit = kDnsClassicUdpSize;
+};
+
+// Reads a standard query with exactly one question. Returns false for
+// anything else, which is then forwarded without caching.
+bool ParseDnsQuestion(const uint8_t* message, size_t length,
+                      DnsQuestion* question);
+
+struct DnsRecordScan {
+  uint8_t rcode = 0;
+  bool truncated = false;
+  // Offsets of every TTL field except the OPT pseudo-record's.
+  std::vector<uint16_t> ttl_offsets;
+  // Smallest TTL among the records; 0 when there are none.
+  uint32_t min_ttl = 0;
+  // True for NXDOMAIN and for NOERROR without answers (NODATA).
+  bool negative = false;
+  // For negative answers, the SOA TTL capped by its MINIMUM field (RFC
+  // 2308); 0 when the authority section has no SOA.
+  uint32_t negative_ttl = 0;
+};
+
+// Walks every record of |message|. Returns false when it is malformed.
+bool ScanDnsResponse(const uint8_t* message, size_t length,
+                     DnsRecordScan* scan);
+
+// Makes |response| answer the client query |query|: its ID and question
+// bytes are copied over, which keeps the client's spelling of the name. The
+// question sections must have the same length.
+void AdoptDnsQuery(const uint8_t* query, size_t question_end,
+                   std::vector<uint8_t>* response);
+
+// Builds a response to |query| carrying only its question and |rcode|, with
+// the TC bit when |truncated|.
+std::vector<uint8_t> BuildDnsReply(const uint8_t* query, size_t question_end,
+                                   uint8_t rcode, bool truncated);
+
+#endif  // RUNNER_DNS_MESSAGE_H_
@@ -0,0 +1,175 @@
+#include "failover_scheduler.h"
+
+#include <pthread.h>
+
+#include <chrono>
+
+#include "log_ring.h"
+#include "net_util.h"
+
+namespace {
+
+// Score cost of each percent of loss, in milliseconds of RTT.
+constexpr int64_t kLossPenaltyMs = 50;
+// Probes a standby needs before it can be switched to.
+constexpr size_t kMinStandbySamples = 2;
+
+}  // namespace
+
+FailoverScheduler::FailoverScheduler(const FailoverOptions& options,
+                                     std::vector<FailoverCandidate> candidates,
+                                     size_t active,
+                                     LatencySource active_latency,
+                                     TrafficSource traffic,
+                                     SwitchCallback on_switch)
+    : options_(options),
+      candidates_(std::move(candidates)),
+      active_latency_(std::move(active_latency)),
+      traffic_(std::move(traffic)),
+      on_switch_(std::move(on_switch)),
+      active_(active) {
+  monitors_.resize(candidates_.size());
+}
+
+FailoverScheduler::~FailoverScheduler() { Stop(); }
+
+void FailoverScheduler::Start() {
+  if (thread_.joinable()) {
+    return;
+  }
+  for (size_t i = 0; i < candidates_.size(); i++) {
+    if (i != active_.load()) {
+      StartStandbyMonitor(i);
+    }
+  }
+  last_switch_ms_ = MonotonicNowMs();
+  last_traffic_ms_ = last_switch_ms_;
+  stopping_ = false;
+  thread_ = std::thread(&FailoverScheduler::Run, this);
+}
+
+void FailoverScheduler::Stop() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+  }
+  monitors_.clear();
+}
+
+void FailoverScheduler::Run() {
+  pthread_setname_np(pthread_self(), "vpn-failover");
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    wake_.wait_for(lock, std::chrono::milliseconds(options_.check_interval_ms),
+                   [this] { return stopping_; });
+    if (stopping_) {
+      break;
+    }
+    lock.unlock();
+    Check();
+    lock.lock();
+  }
+}
+
+void FailoverScheduler::Check() {
+  int64_t now = MonotonicNowMs();
+  LatencySnapshot current = active_latency_();
+
+  // Count each probe of the active upstream once, however often we check.
+  if (current.updated_ms != last_probe_ms_) {
+    last_probe_ms_ = current.updated_ms;
+    bool degraded = !current.last_ok ||
+                    current.avg_rtt_ms >= options_.rtt_degraded_ms ||
+                    current.loss_percent >= options_.loss_degraded_percent;
+    degraded_count_ = degraded ? degraded_count_ + 1 : 0;
+  }
+
+  // Flows that receive nothing while the proxy stops answering mean traffic
+  // is already stalled, which is worth acting on straight away.
+  bool stalled = false;
+  Tun2SocksStats traffic;
+  if (traffic_ && traffic_(&traffic)) {
+    if (traffic.bytes_down != last_bytes_down_ || traffic.active_flows == 0) {
+      last_bytes_down_ = traffic.bytes_down;
+      last_traffic_ms_ = now;
+    }
+    stalled = current.updated_ms > 0 && !current.last_ok &&
+              now - last_traffic_ms_ >= options_.stall_ms;
+  }
+
+  if (!stalled && degraded_count_ < options_.degraded_probes) {
+    return;
+  }
+  if (now - last_switch_ms_ < options_.hold_down_ms) {
+    return;
+  }
+
+  size_t best = candidates_.size();
+  int64_t best_score = -1;
+  for (size_t i = 0; i < monitors_.size(); i++) {
+    if (!monitors_[i]) {
+      continue;
+    }
+    LatencySnapshot standby = monitors_[i]->Snapshot();
+    int64_t score = Score(standby);
+    if (score >= 0 && standby.samples >= kMinStandbySamples &&
+        (best_score < 0 || score < best_score)) {
+      best = i;
+      best_score = score;
+    }
+  }
+  if (best == candidates_.size()) {
+    return;
+  }
+  int64_t current_score = Score(current);
+  if (current_score >= 0 &&
+      best_score * 100 >
+          current_score * (100 - options_.min_improvement_percent)) {
+    return;
+  }
+
+  std::string reason;
+  if (stalled) {
+    reason = "traffic stalled";
+  } else if (!current.last_ok) {
+    reason = "probes failing";
+  } else {
+    reason = "rtt " + std::to_string(current.avg_rtt_ms) + " ms, loss " +
+             std::to_string(static_cast<int>(current.loss_percent)) + "%";
+  }
+
+  size_t previous = active_.exchange(best);
+  monitors_[best].reset();
+  StartStandbyMonitor(previous);
+  degraded_count_ = 0;
+  last_switch_ms_ = now;
+  last_traffic_ms_ = now;
+  last_probe_ms_ = 0;
+
+  WriteLog(LogLevel::kWarning, "failover",
+           "Switching from " + candidates_[previous].label + " to " +
+               candidates_[best].label + " (" + reason + ")");
+  if (on_switch_) {
+    on_switch_(best, reason);
+  }
+}
+
+void FailoverScheduler::StartStandbyMonitor(size_t index) {
+  LatencyMonitorOptions probe = options_.standby_probe;
+  probe.socks_host = candidates_[index].socks_host;
+  probe.socks_port = candidates_[index].socks_port;
+  monitors_[index].reset(new LatencyMonitor(probe, nullptr));
+  monitors_[index]->Start();
+}
+
+int64_t FailoverScheduler::Score(const LatencySnapshot& snapshot) {
+  if (snapshot.samples == 0 || !snapshot.last_ok) {
+    return -1;
+  }
+  return snapshot.avg_rtt_ms + snapshot.jitter_ms +
+         static_cast<int64_t>(snapshot.loss_percent) * kLossPenaltyMs;
+}
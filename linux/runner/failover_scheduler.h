@@ -0,0 +1,116 @@
+#ifndef RUNNER_FAILOVER_SCHEDULER_H_
+#define RUNNER_FAILOVER_SCHEDULER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latency_monitor.h"
+#include "tun2socks.h"
+
+// An upstream the tunnel can run through: a local SOCKS5 endpoint the proxy
+// core serves for one config.
+struct FailoverCandidate {
+  std::string label;
+  std::string socks_host = "127.0.0.1";
+  uint16_t socks_port = 0;
+  // The proxy server the endpoint's core dials, routed around the tunnel
+  // while this upstream is active. Empty when unknown.
+  std::string server_host;
+};
+
+struct FailoverOptions {
+  int check_interval_ms = 1000;
+
+  // How standby candidates are probed; the SOCKS endpoint is filled in per
+  // candidate.
+  LatencyMonitorOptions standby_probe;
+
+  // The active upstream counts as degraded for a probe that fails or that
+  // leaves the window at or above either of these.
+  int64_t rtt_degraded_ms = 1000;
+  double loss_degraded_percent = 20;
+  // Consecutive degraded probes before switching.
+  int degraded_probes = 2;
+
+  // A standby must score at least this much better than the active upstream.
+  int min_improvement_percent = 30;
+  // No further switch for this long after one.
+  int hold_down_ms = 30000;
+  // Switch without waiting for |degraded_probes| when the last probe failed
+  // and flows have received nothing for this long.
+  int stall_ms = 3000;
+};
+
+// Keeps a tunnel on the best of several upstreams while it is connected.
+// The active upstream is judged from the latency monitor that already
+// watches it and from the TUN traffic counters; every other candidate is
+// probed continuously so the proxy core's session to it stays warm and its
+// figures are current. When the active upstream degrades and a standby is
+// clearly better, the switch callback moves new flows over while existing
+// flows finish where they are.
+class FailoverScheduler {
+ public:
+  // Returns the active upstream's current latency figures.
+  using LatencySource = std::function<LatencySnapshot()>;
+  // Fills in the TUN counters; returns false while no device is up.
+  using TrafficSource = std::function<bool(Tun2SocksStats* stats)>;
+  // Runs on the scheduler thread once |index| has become active.
+  using SwitchCallback =
+      std::function<void(size_t index, const std::string& reason)>;
+
+  FailoverScheduler(const FailoverOptions& options,
+                    std::vector<FailoverCandidate> candidates, size_t active,
+                    LatencySource active_latency, TrafficSource traffic,
+                    SwitchCallback on_switch);
+  ~FailoverScheduler();
+
+  // Prevent copying.
+  FailoverScheduler(FailoverScheduler const&) = delete;
+  FailoverScheduler& operator=(FailoverScheduler const&) = delete;
+
+  // Starts probing the standbys and checking the active upstream.
+  void Start();
+
+  // Stops the thread and every standby probe.
+  void Stop();
+
+  size_t active() const { return active_.load(); }
+
+ private:
+  void Run();
+  void Check();
+  void StartStandbyMonitor(size_t index);
+  // Lower is better; negative when |snapshot| is not usable.
+  static int64_t Score(const LatencySnapshot& snapshot);
+
+  FailoverOptions options_;
+  std::vector<FailoverCandidate> candidates_;
+  LatencySource active_latency_;
+  TrafficSource traffic_;
+  SwitchCallback on_switch_;
+  std::atomic<size_t> active_;
+  std::thread thread_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+
+  // Only touched on the scheduler thread. |monitors_| is indexed like
+  // |candidates_| and empty at the active index.
+  std::vector<std::unique_ptr<LatencyMonitor>> monitors_;
+  int64_t last_probe_ms_ = 0;
+  int degraded_count_ = 0;
+  int64_t last_switch_ms_ = 0;
+  uint64_t last_bytes_down_ = 0;
+  int64_t last_traffic_ms_ = 0;
+};
+
+#endif  // RUNNER_FAILOVER_SCHEDULER_H_
@@ -0,0 +1,63 @@
+#ifndef RUNNER_FLOW_KEY_H_
+#define RUNNER_FLOW_KEY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "packet_headers.h"
+
+// Identifies a relayed flow by its 5-tuple as seen on the TUN device:
+// "client" is the local application, "remote" the destination it dialed.
+struct FlowKey {
+  uint8_t family;
+  uint8_t protocol;
+  uint16_t client_port;
+  uint16_t remote_port;
+  uint8_t client[16];
+  uint8_t remote[16];
+
+  // Builds the key for a packet travelling from the client to the remote.
+  static FlowKey FromPacket(const PacketInfo& info) {
+    FlowKey key;
+    memset(&key, 0, sizeof(key));
+    key.family = static_cast<uint8_t>(info.family);
+    key.protocol = info.protocol;
+    key.client_port = info.src_port;
+    key.remote_port = info.dst_port;
+    size_t length = AddressLength(info.family);
+    memcpy(key.client, info.src, length);
+    memcpy(key.remote, info.dst, length);
+    return key;
+  }
+
+  bool operator==(const FlowKey& other) const {
+    return memcmp(this, &other, sizeof(*this)) == 0;
+  }
+};
+
+struct FlowKeyHash {
+  size_t operator()(const FlowKey& key) const {
+    // Keys are zero-padded, so hashing all of their bytes is stable. They
+    // are mixed a word at a time and finished with a full avalanche, as
+    // FlowTable takes its tag and its group from different bits.
+    static_assert(sizeof(FlowKey) == 38, "FlowKey layout changed");
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&key);
+    uint64_t hash = 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < 32; i += 8) {
+      uint64_t word;
+      memcpy(&word, bytes + i, sizeof(word));
+      hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+      hash ^= hash >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + 32, sizeof(key) - 32);
+    hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return static_cast<size_t>(hash);
+  }
+};
+
+#endif  // RUNNER_FLOW_KEY_H_
@@ -0,0 +1,303 @@
+#ifndef RUNNER_FLOW_TABLE_H_
+#define RUNNER_FLOW_TABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "flow_key.h"
+
+// Sixteen control bytes of a FlowTable, matched all at once: with SSE2 or
+// NEON where available, otherwise eight at a time in a 64-bit word.
+class FlowTableGroup {
+ public:
+  static constexpr size_t kWidth = 16;
+
+  explicit FlowTableGroup(const int8_t* control) {
+#if defined(__SSE2__)
+    bytes_ = _mm_loadu_si128(reinterpret_cast<const __m128i*>(control));
+#elif defined(__aarch64__)
+    bytes_ = vld1q_s8(control);
+#else
+    memcpy(words_, control, sizeof(words_));
+#endif
+  }
+
+  // Bit i is set when byte i equals |tag|.
+  uint32_t Match(int8_t tag) const {
+#if defined(__SSE2__)
+    return static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(bytes_, _mm_set1_epi8(tag))));
+#elif defined(__aarch64__)
+    return MoveMask(vceqq_s8(bytes_, vdupq_n_s8(tag)));
+#else
+    uint64_t pattern = 0x0101010101010101ull * static_cast<uint8_t>(tag);
+    return ZeroBytes(words_[0] ^ pattern) |
+           (ZeroBytes(words_[1] ^ pattern) << 8);
+#endif
+  }
+
+  // Bit i is set when byte i is empty or deleted; both have the top bit
+  // set, which a full slot's tag never has.
+  uint32_t MatchFree() const {
+#if defined(__SSE2__)
+    return static_cast<uint32_t>(_mm_movemask_epi8(bytes_));
+#elif defined(__aarch64__)
+    return MoveMask(vcltzq_s8(bytes_));
+#else
+    return HighBits(words_[0]) | (HighBits(words_[1]) << 8);
+#endif
+  }
+
+ private:
+#if defined(__SSE2__)
+  __m128i bytes_;
+#elif defined(__aarch64__)
+  static uint32_t MoveMask(uint8x16_t mask) {
+    // One bit per byte: weight the lanes, then add each half up.
+    static const uint8_t kWeights[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                         1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(mask, vld1q_u8(kWeights));
+    return vaddv_u8(vget_low_u8(bits)) |
+           (static_cast<uint32_t>(vaddv_u8(vget_high_u8(bits))) << 8);
+  }
+  int8x16_t bytes_;
+#else
+  // Packs the top bit of each byte of |word| into the low eight bits.
+  static uint32_t HighBits(uint64_t word) {
+    word &= 0x8080808080808080ull;
+    return static_cast<uint32_t>((word * 0x02040810204081ull) >> 56);
+  }
+  // Marks the zero bytes of |word|; exact, unlike the usual shortcut.
+  static uint32_t ZeroBytes(uint64_t word) {
+    uint64_t low = 0x7f7f7f7f7f7f7f7full;
+    return HighBits(~(((word & low) + low) | word | low));
+  }
+  uint64_t words_[2];
+#endif
+};
+
+// Maps flow 5-tuples to |Value|s in one flat allocation sized for a fixed
+// number of flows, so memory stays bounded however many flows a client
+// opens. Open addressing over groups of sixteen slots: a control byte per
+// slot holds seven bits of the key's hash, and a lookup compares a whole
+// group's tags in one instruction before touching any key, so a miss
+// usually reads a single cache line. Insert, lookup and erase are O(1).
+// Not thread-safe.
+//
+// Values are constructed on insert and may move when the table compacts
+// its deleted slots, so keep pointers to them, not into them.
+template <typename Value>
+class FlowTable {
+ public:
+  // Sized for |max_flows| entries at most seven-eighths full. The memory
+  // is reserved here, and its pages are only committed as slots are used.
+  explicit FlowTable(size_t max_flows) : max_flows_(max_flows) {
+    size_t groups = 1;
+    while (groups * FlowTableGroup::kWidth * 7 / 8 < max_flows) {
+      groups *= 2;
+    }
+    group_mask_ = groups - 1;
+    slot_count_ = groups * FlowTableGroup::kWidth;
+    control_ = new int8_t[slot_count_];
+    memset(control_, kEmpty, slot_count_);
+    slots_ = static_cast<Slot*>(::operator new(slot_count_ * sizeof(Slot)));
+  }
+
+  ~FlowTable() {
+    Clear();
+    ::operator delete(slots_);
+    delete[] control_;
+  }
+
+  // Prevent copying.
+  FlowTable(FlowTable const&) = delete;
+  FlowTable& operator=(FlowTable const&) = delete;
+
+  // Returns the value for |key|, or nullptr.
+  Value* Find(const FlowKey& key) {
+    size_t index = IndexOf(key);
+    return index == kNotFound ? nullptr : &slots_[index].value;
+  }
+
+  // Adds |key| with |value|. Returns the stored value, or nullptr when
+  // |key| is already present or the table holds its maximum of flows.
+  Value* Insert(const FlowKey& key, Value value) {
+    if (size_ >= max_flows_ || IndexOf(key) != kNotFound) {
+      return nullptr;
+    }
+    if (deleted_ > 0 && size_ + deleted_ >= slot_count_ * 7 / 8) {
+      DropDeleted();
+    }
+    size_t hash = FlowKeyHash()(key);
+    size_t index = FindFree(hash);
+    if (control_[index] == kDeleted) {
+      deleted_--;
+    }
+    control_[index] = Tag(hash);
+    new (&slots_[index]) Slot{key, std::move(value)};
+    size_++;
+    return &slots_[index].value;
+  }
+
+  // Removes |key|. Returns false when it is not present.
+  bool Erase(const FlowKey& key) {
+    size_t index = IndexOf(key);
+    if (index == kNotFound) {
+      return false;
+    }
+    slots_[index].~Slot();
+    // A group that still has an empty slot has never been probed past,
+    // so the slot can become empty again; otherwise probes must go on.
+    FlowTableGroup bytes(control_ + (index & ~(FlowTableGroup::kWidth - 1)));
+    if (bytes.Match(kEmpty) != 0) {
+      control_[index] = kEmpty;
+    } else {
+      control_[index] = kDeleted;
+      deleted_++;
+    }
+    size_--;
+    return true;
+  }
+
+  // Calls |visit|(key, value) for every entry. |visit| must not insert or
+  // erase.
+  template <typename Visitor>
+  void ForEach(Visitor visit) {
+    for (size_t i = 0; i < slot_count_; i++) {
+      if (control_[i] >= 0) {
+        visit(static_cast<const FlowKey&>(slots_[i].key), slots_[i].value);
+      }
+    }
+  }
+
+  void Clear() {
+    for (size_t i = 0; i < slot_count_; i++) {
+      if (control_[i] >= 0) {
+        slots_[i].~Slot();
+      }
+    }
+    memset(control_, kEmpty, slot_count_);
+    size_ = 0;
+    deleted_ = 0;
+  }
+
+  size_t size() const { return size_; }
+  size_t max_flows() const { return max_flows_; }
+  // Bytes reserved for the table.
+  size_t memory_bytes() const {
+    return slot_count_ * (sizeof(Slot) + sizeof(int8_t));
+  }
+
+ private:
+  static constexpr int8_t kEmpty = -128;
+  static constexpr int8_t kDeleted = -2;
+  static constexpr size_t kNotFound = ~size_t{0};
+
+  struct Slot {
+    FlowKey key;
+    Value value;
+  };
+
+  // The low seven bits pick the tag, the rest the group, so the two are
+  // independent.
+  static int8_t Tag(size_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+  size_t GroupIndex(size_t hash) const { return (hash >> 7) & group_mask_; }
+
+  // The slot holding |key|, or kNotFound.
+  size_t IndexOf(const FlowKey& key) const {
+    size_t hash = FlowKeyHash()(key);
+    int8_t tag = Tag(hash);
+    size_t group = GroupIndex(hash);
+    for (size_t step = 1;; step++) {
+      size_t base = group * FlowTableGroup::kWidth;
+      FlowTableGroup bytes(control_ + base);
+      for (uint32_t match = bytes.Match(tag); match != 0;
+           match &= match - 1) {
+        size_t index = base + static_cast<size_t>(__builtin_ctz(match));
+        if (slots_[index].key == key) {
+          return index;
+        }
+      }
+      // A group with an empty slot ends every probe that reaches it.
+      if (bytes.Match(kEmpty) != 0 || step > group_mask_) {
+        return kNotFound;
+      }
+      group = (group + step) & group_mask_;
+    }
+  }
+
+  // The first empty or deleted slot on |hash|'s probe sequence. The table
+  // is never full, so there always is one.
+  size_t FindFree(size_t hash) const {
+    size_t group = GroupIndex(hash);
+    for (size_t step = 1;; step++) {
+      FlowTableGroup bytes(control_ + group * FlowTableGroup::kWidth);
+      uint32_t free = bytes.MatchFree();
+      if (free != 0) {
+        return group * FlowTableGroup::kWidth + __builtin_ctz(free);
+      }
+      group = (group + step) & group_mask_;
+    }
+  }
+
+  // Rehashes in place to turn deleted slots back into empty ones, once
+  // they make up enough of the table to lengthen probes: every entry is
+  // marked deleted, then each is moved to the first free slot of its probe
+  // sequence, swapping with entries not yet placed.
+  void DropDeleted() {
+    for (size_t i = 0; i < slot_count_; i++) {
+      control_[i] = control_[i] == kDeleted ? kEmpty
+                    : control_[i] >= 0      ? kDeleted
+                                            : control_[i];
+    }
+    for (size_t i = 0; i < slot_count_; i++) {
+      if (control_[i] != kDeleted) {
+        continue;
+      }
+      size_t hash = FlowKeyHash()(slots_[i].key);
+      size_t target = FindFree(hash);
+      size_t width = FlowTableGroup::kWidth;
+      if (target / width == i / width) {
+        // Already in the first group with room.
+        control_[i] = Tag(hash);
+        continue;
+      }
+      if (control_[target] == kEmpty) {
+        new (&slots_[target]) Slot(std::move(slots_[i]));
+        slots_[i].~Slot();
+        control_[target] = Tag(hash);
+        control_[i] = kEmpty;
+        continue;
+      }
+      // |target| holds an entry still to be placed: swap, then place what
+      // landed here.
+      Slot held(std::move(slots_[target]));
+      slots_[target].~Slot();
+      new (&slots_[target]) Slot(std::move(slots_[i]));
+      slots_[i].~Slot();
+      new (&slots_[i]) Slot(std::move(held));
+      control_[target] = Tag(hash);
+      i--;
+    }
+    deleted_ = 0;
+  }
+
+  size_t max_flows_;
+  size_t group_mask_ = 0;
+  size_t slot_count_ = 0;
+  size_t size_ = 0;
+  size_t deleted_ = 0;
+  int8_t* control_ = nullptr;
+  Slot* slots_ = nullptr;
+};
+
+#endif  // RUNNER_FLOW_TABLE_H_
@@ -0,0 +1,159 @@
+#include "headless.h"
+
+#include <signal.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include "control_server.h"
+#include "log_ring.h"
+#include "progress_event.h"
+#include "vpn_engine.h"
+
+namespace {
+
+std::string JsonBool(bool value) { return value ? "true" : "false"; }
+
+std::string JsonNumber(double value) {
+  if (!std::isfinite(value)) {
+    return "0";
+  }
+  char text[32];
+  snprintf(text, sizeof(text), "%.6g", value);
+  return text;
+}
+
+// The getLatencyStats map of the plugin, as JSON.
+std::string LatencyJson(const LatencySnapshot& snapshot) {
+  int64_t rtt_ms = snapshot.last_ok ? snapshot.last_rtt_ms : 0;
+  return "{\"rttMs\":" + std::to_string(rtt_ms) +
+         ",\"avgMs\":" + std::to_string(snapshot.avg_rtt_ms) +
+         ",\"minMs\":" + std::to_string(snapshot.min_rtt_ms) +
+         ",\"jitterMs\":" + std::to_string(snapshot.jitter_ms) +
+         ",\"lossPercent\":" + JsonNumber(snapshot.loss_percent) +
+         ",\"samples\":" + std::to_string(snapshot.samples) +
+         ",\"ok\":" + JsonBool(snapshot.last_ok) + "}";
+}
+
+// The getDnsStats map of the plugin, as JSON.
+std::string DnsStatsJson(const DnsForwarderStats& stats) {
+  double hit_rate =
+      stats.queries > 0 ? 100.0 * stats.cache_hits / stats.queries : 0;
+  return "{\"queries\":" + std::to_string(stats.queries) +
+         ",\"hits\":" + std::to_string(stats.cache_hits) +
+         ",\"negativeHits\":" + std::to_string(stats.negative_hits) +
+         ",\"coalesced\":" + std::to_string(stats.coalesced) +
+         ",\"prefetches\":" + std::to_string(stats.prefetches) +
+         ",\"upstreamQueries\":" + std::to_string(stats.upstream_queries) +
+         ",\"upstreamFailures\":" + std::to_string(stats.upstream_failures) +
+         ",\"entries\":" + std::to_string(stats.cache_entries) +
+         ",\"hitRate\":" + JsonNumber(hit_rate) +
+         ",\"upstreamAvgMs\":" + JsonNumber(stats.upstream_avg_ms) +
+         ",\"upstreamP50Ms\":" + JsonNumber(stats.upstream_p50_ms) +
+         ",\"upstreamP95Ms\":" + JsonNumber(stats.upstream_p95_ms) + "}";
+}
+
+// Serves |request| from |engine| under the method names VpnBridge uses on
+// com.mimivpn.vpn.
+void HandleRequest(VpnEngine* engine, const ControlRequest& request,
+                   ControlServer::Reply reply) {
+  const std::string& verb = request.verb;
+  if (verb == "connect") {
+    engine->Connect(
+        [reply](bool connected) { reply(JsonBool(connected), ""); });
+  } else if (verb == "disconnect") {
+    engine->Disconnect(
+        [reply](bool disconnected) { reply(JsonBool(disconnected), ""); });
+  } else if (verb == "stopVPN") {
+    engine->StopVpn(
+        [reply](const std::string& result) { reply(JsonQuote(result), ""); });
+  } else if (verb == "getVpnStatus") {
+    reply(JsonQuote(VpnStatusName(engine->status())), "");
+  } else if (verb == "isTunnelRunning") {
+    reply(JsonBool(engine->IsTunnelRunning()), "");
+  } else if (verb == "isVPNPrepared") {
+    reply(JsonBool(engine->IsPrepared()), "");
+  } else if (verb == "calculatePing") {
+    engine->CalculatePing(
+        [reply](int64_t ping_ms) { reply(std::to_string(ping_ms), ""); });
+  } else if (verb == "getLatencyStats") {
+    reply(LatencyJson(engine->latency()), "");
+  } else if (verb == "getDnsStats") {
+    reply(DnsStatsJson(engine->dns_stats()), "");
+  } else if (verb == "startTun2socks") {
+    engine->StartTun2Socks(
+        [reply](bool started) { reply(JsonBool(started), ""); });
+  } else if (verb == "stopTun2Socks") {
+    engine->StopTun2Socks([reply] { reply("null", ""); });
+  } else if (verb == "startLocalProxy") {
+    int port = request.args.empty() ? 0 : atoi(request.args[0].c_str());
+    if (port < 0 || port > 65535) {
+      reply("", "Invalid port");
+      return;
+    }
+    engine->StartLocalProxy(static_cast<uint16_t>(port),
+                            [reply](uint16_t bound_port) {
+                              reply(std::to_string(bound_port), "");
+                            });
+  } else if (verb == "stopLocalProxy") {
+    engine->StopLocalProxy([reply] { reply("null", ""); });
+  } else {
+    reply("", "Unknown method: " + verb);
+  }
+}
+
+}  // namespace
+
+bool IsHeadlessRequested(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--headless") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int RunHeadless() {
+  // Blocked before any thread starts, so every thread inherits the mask and
+  // the signals are only taken by sigwait() below.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::unique_ptr<VpnEngine> engine(new VpnEngine(
+      VpnEngineOptions::FromEnvironment(),
+      [](const ProgressEvent& event) {
+        std::string line = ProgressEventLine(event);
+        WriteLog(LogLevel::kInfo, "engine", line);
+        fprintf(stderr, "%s\n", line.c_str());
+      },
+      nullptr, nullptr));
+
+  std::string path = ControlServer::DefaultPath();
+  ControlServer server(path, [&engine](const ControlRequest& request,
+                                       ControlServer::Reply reply) {
+    HandleRequest(engine.get(), request, std::move(reply));
+  });
+  if (!server.Start()) {
+    fprintf(stderr, "mimivpn: could not serve %s\n", path.c_str());
+    return EXIT_FAILURE;
+  }
+  fprintf(stderr, "mimivpn: headless, control socket %s\n", path.c_str());
+
+  int signal_number = 0;
+  sigwait(&signals, &signal_number);
+  fprintf(stderr, "mimivpn: %s, shutting down\n", strsignal(signal_number));
+
+  // No request can arrive once the server has stopped. Replies from the
+  // engine's last callbacks are then dropped, so the server outlives it.
+  server.Stop();
+  engine.reset();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,13 @@
+#ifndef RUNNER_HEADLESS_H_
+#define RUNNER_HEADLESS_H_
+
+// Returns whether the command line asks for the headless daemon, that is
+// holds --headless.
+bool IsHeadlessRequested(int argc, char** argv);
+
+// Runs the native tunnel, prober and latency monitor without GTK or
+// Flutter until SIGINT or SIGTERM, serving the VpnBridge verbs on the
+// ControlServer socket. Returns the process exit code.
+int RunHeadless();
+
+#endif  // RUNNER_HEADLESS_H_
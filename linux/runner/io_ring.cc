@@ -0,0 +1,197 @@
+#include "io_ring.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef IORING_SETUP_SUBMIT_ALL
+#define IORING_SETUP_SUBMIT_ALL (1U << 7)
+#endif
+#ifndef IORING_SETUP_COOP_TASKRUN
+#define IORING_SETUP_COOP_TASKRUN (1U << 8)
+#endif
+#ifndef IORING_SETUP_SINGLE_ISSUER
+#define IORING_SETUP_SINGLE_ISSUER (1U << 12)
+#endif
+#ifndef IORING_SETUP_DEFER_TASKRUN
+#define IORING_SETUP_DEFER_TASKRUN (1U << 13)
+#endif
+
+namespace {
+
+int Setup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int Enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+          const void* arg, size_t arg_size) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, arg, arg_size));
+}
+
+int Register(int fd, unsigned opcode, const void* arg, unsigned count) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+}  // namespace
+
+IoRing::IoRing() = default;
+
+IoRing::~IoRing() {
+  // The kernel tears a closed ring down in the background, with the fixed
+  // files still open until it is done. Unregistering them first closes
+  // them now, so a TUN device goes away with its last queue.
+  if (files_registered_) {
+    Register(fd_, IORING_UNREGISTER_FILES, nullptr, 0);
+  }
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (rings_ != nullptr) {
+    munmap(rings_, rings_size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool IoRing::Init(unsigned entries) {
+  // Most flags first: completions are only run when this thread asks for
+  // them, instead of interrupting it (6.1); then cooperative task work
+  // (5.19); then none.
+  const unsigned kFlagSets[] = {
+      IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER |
+          IORING_SETUP_DEFER_TASKRUN,
+      IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN,
+      0,
+  };
+  io_uring_params params;
+  for (unsigned flags : kFlagSets) {
+    memset(&params, 0, sizeof(params));
+    params.flags = flags;
+    fd_ = Setup(entries, &params);
+    if (fd_ >= 0) {
+      defer_taskrun_ = (flags & IORING_SETUP_DEFER_TASKRUN) != 0;
+      break;
+    }
+    if (errno != EINVAL) {
+      return false;
+    }
+  }
+  if (fd_ < 0) {
+    return false;
+  }
+  // Waiting with a timeout needs IORING_FEAT_EXT_ARG (5.11); multishot
+  // poll has no flag of its own and came with IORING_FEAT_RSRC_TAGS (5.13).
+  const unsigned kRequired = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                             IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+  if ((params.features & kRequired) != kRequired) {
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  rings_size_ = std::max(
+      params.sq_off.array + params.sq_entries * sizeof(unsigned),
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+  rings_ = mmap(nullptr, rings_size_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (rings_ == MAP_FAILED) {
+    rings_ = nullptr;
+    return false;
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  uint8_t* base = static_cast<uint8_t*>(rings_);
+  sq_entries_ = params.sq_entries;
+  sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+  sq_tail_shared_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+  sq_tail_ = *sq_tail_shared_;
+  // Submission slots map one to one onto entries, so the indirection
+  // array is filled once.
+  unsigned* array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; i++) {
+    array[i] = i;
+  }
+  cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+  return true;
+}
+
+bool IoRing::RegisterFiles(const int* fds, unsigned count) {
+  files_registered_ = Register(fd_, IORING_REGISTER_FILES, fds, count) == 0;
+  return files_registered_;
+}
+
+bool IoRing::RegisterBuffer(void* base, size_t length) {
+  struct iovec buffer = {base, length};
+  return Register(fd_, IORING_REGISTER_BUFFERS, &buffer, 1) == 0;
+}
+
+io_uring_sqe* IoRing::Prepare() {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sq_tail_ - head >= sq_entries_) {
+    if (!Submit(0, 0)) {
+      return nullptr;
+    }
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_tail_ - head >= sq_entries_) {
+      return nullptr;
+    }
+  }
+  io_uring_sqe* sqe = &sqes_[sq_tail_ & sq_mask_];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_tail_++;
+  to_submit_++;
+  return sqe;
+}
+
+bool IoRing::Submit(unsigned wait_for, int timeout_ms) {
+  __atomic_store_n(sq_tail_shared_, sq_tail_, __ATOMIC_RELEASE);
+  unsigned flags = 0;
+  // Deferred completions are only posted from inside io_uring_enter(),
+  // so every call collects them, even one that does not wait.
+  if (wait_for > 0 || defer_taskrun_) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+  const void* arg = nullptr;
+  size_t arg_size = 0;
+  struct __kernel_timespec timeout;
+  io_uring_getevents_arg wait;
+  if (wait_for > 0 && timeout_ms >= 0) {
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    memset(&wait, 0, sizeof(wait));
+    wait.ts = reinterpret_cast<uintptr_t>(&timeout);
+    flags |= IORING_ENTER_EXT_ARG;
+    arg = &wait;
+    arg_size = sizeof(wait);
+  }
+  if (flags == 0 && to_submit_ == 0) {
+    return true;
+  }
+  int submitted = Enter(fd_, to_submit_, wait_for, flags, arg, arg_size);
+  if (submitted < 0) {
+    // A timeout, a signal, or a completion queue too full to take more:
+    // all of them leave the submissions queued for the next call.
+    return errno == ETIME || errno == EINTR || errno == EAGAIN ||
+           errno == EBUSY;
+  }
+  to_submit_ -= std::min(to_submit_, static_cast<unsigned>(submitted));
+  return true;
+}
@@ -0,0 +1,83 @@
+#ifndef RUNNER_IO_RING_H_
+#define RUNNER_IO_RING_H_
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// A minimal io_uring instance driven through the raw system calls: a
+// submission queue of operations and a completion queue of their results,
+// both shared with the kernel, so many operations cost a single
+// io_uring_enter(). Set up, submit and reap on one thread only.
+class IoRing {
+ public:
+  IoRing();
+  ~IoRing();
+
+  // Prevent copying.
+  IoRing(IoRing const&) = delete;
+  IoRing& operator=(IoRing const&) = delete;
+
+  // Sets up a ring with room for |entries| submissions. Returns false where
+  // io_uring is unavailable: kernels before 5.13, seccomp filters such as
+  // container defaults, or kernel.io_uring_disabled.
+  bool Init(unsigned entries);
+
+  // Registers |fds| as fixed files 0 to |count| - 1, which saves the file
+  // lookup on every operation (IOSQE_FIXED_FILE).
+  bool RegisterFiles(const int* fds, unsigned count);
+
+  // Registers |length| bytes at |base| as fixed buffer 0 for
+  // IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED. The pages are pinned
+  // for the life of the ring.
+  bool RegisterBuffer(void* base, size_t length);
+
+  // Returns a zeroed submission entry to fill in, submitting what is
+  // already queued first if the queue is full.
+  io_uring_sqe* Prepare();
+
+  // Submits the prepared entries and waits until |wait_for| completions
+  // are ready or |timeout_ms| has passed (< 0 waits without limit). Returns
+  // false when the ring itself failed.
+  bool Submit(unsigned wait_for, int timeout_ms);
+
+  // Calls |handle|(cqe) for every completion that is ready.
+  template <typename Handler>
+  void Reap(Handler handle) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      handle(cqes_[head & cq_mask_]);
+      head++;
+      // Released one at a time, so a handler that submits more work finds
+      // the slot free.
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+  }
+
+  bool is_open() const { return fd_ >= 0; }
+
+ private:
+  int fd_ = -1;
+  void* rings_ = nullptr;
+  size_t rings_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned sq_entries_ = 0;
+  // Entries prepared since the last Submit().
+  unsigned to_submit_ = 0;
+  unsigned sq_tail_ = 0;
+  bool defer_taskrun_ = false;
+  bool files_registered_ = false;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_shared_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+#endif  // RUNNER_IO_RING_H_
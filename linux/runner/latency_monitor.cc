@@ -0,0 +1,173 @@
+#include "latency_monitor.h"
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+#include "net_util.h"
+
+LatencyMonitor::LatencyMonitor(const LatencyMonitorOptions& options,
+                               ChangeCallback on_change)
+    : options_(options), on_change_(std::move(on_change)) {
+  options_.window = std::max<size_t>(options_.window, 1);
+  options_.interval_ms = std::max(options_.interval_ms, 100);
+}
+
+LatencyMonitor::~LatencyMonitor() { Stop(); }
+
+void LatencyMonitor::Start() {
+  if (thread_.joinable()) {
+    return;
+  }
+  stopping_ = false;
+  thread_ = std::thread(&LatencyMonitor::Run, this);
+}
+
+void LatencyMonitor::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    if (probe_fd_ >= 0) {
+      shutdown(probe_fd_, SHUT_RDWR);
+    }
+  }
+  wake_.notify_all();
+  thread_.join();
+}
+
+LatencySnapshot LatencyMonitor::Snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return snapshot_;
+}
+
+void LatencyMonitor::Run() {
+  pthread_setname_np(pthread_self(), "vpn-latency");
+  for (;;) {
+    int64_t rtt_ms = Probe();
+
+    LatencySnapshot snapshot;
+    bool notable = false;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (stopping_) {
+        return;
+      }
+      Record(rtt_ms);
+      snapshot = snapshot_;
+      notable = IsNotable(snapshot);
+      if (notable) {
+        reported_ = snapshot;
+        has_reported_ = true;
+      }
+    }
+    if (notable && on_change_) {
+      on_change_(snapshot);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    wake_.wait_for(lock, std::chrono::milliseconds(options_.interval_ms),
+                   [this] { return stopping_; });
+    if (stopping_) {
+      return;
+    }
+  }
+}
+
+int64_t LatencyMonitor::Probe() {
+  int64_t start = MonotonicNowNs();
+  int fd = ConnectTcp(options_.socks_host, options_.socks_port,
+                      options_.timeout_ms);
+  if (fd < 0) {
+    return -1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      close(fd);
+      return -1;
+    }
+    probe_fd_ = fd;
+  }
+  bool ok = Socks5Connect(fd, options_.target_host, options_.target_port,
+                          options_.timeout_ms);
+  int64_t elapsed_ms = (MonotonicNowNs() - start + 999999) / 1000000;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    probe_fd_ = -1;
+  }
+  close(fd);
+  return ok ? elapsed_ms : -1;
+}
+
+void LatencyMonitor::Record(int64_t rtt_ms) {
+  if (window_.size() < options_.window) {
+    window_.push_back(rtt_ms);
+  } else {
+    window_[next_slot_] = rtt_ms;
+  }
+  next_slot_ = (next_slot_ + 1) % options_.window;
+  snapshot_ = ComputeSnapshot();
+  snapshot_.last_ok = rtt_ms >= 0;
+  if (rtt_ms >= 0) {
+    snapshot_.last_rtt_ms = rtt_ms;
+  }
+  snapshot_.updated_ms = MonotonicNowMs();
+}
+
+LatencySnapshot LatencyMonitor::ComputeSnapshot() const {
+  LatencySnapshot snapshot = snapshot_;
+  snapshot.samples = window_.size();
+
+  // Walk the window oldest first so jitter compares neighbours in time.
+  size_t oldest = window_.size() < options_.window ? 0 : next_slot_;
+  size_t successes = 0;
+  int64_t sum = 0;
+  int64_t min = 0;
+  int64_t jitter_sum = 0;
+  int64_t previous = -1;
+  size_t pairs = 0;
+  for (size_t i = 0; i < window_.size(); i++) {
+    int64_t rtt = window_[(oldest + i) % window_.size()];
+    if (rtt < 0) {
+      continue;
+    }
+    min = successes == 0 ? rtt : std::min(min, rtt);
+    sum += rtt;
+    successes++;
+    if (previous >= 0) {
+      jitter_sum += std::llabs(rtt - previous);
+      pairs++;
+    }
+    previous = rtt;
+  }
+
+  snapshot.min_rtt_ms = min;
+  snapshot.avg_rtt_ms = successes > 0 ? sum / successes : 0;
+  snapshot.jitter_ms = pairs > 0 ? jitter_sum / pairs : 0;
+  snapshot.loss_percent =
+      window_.empty()
+          ? 0
+          : static_cast<double>(window_.size() - successes) * 100 /
+                window_.size();
+  return snapshot;
+}
+
+bool LatencyMonitor::IsNotable(const LatencySnapshot& snapshot) const {
+  if (!has_reported_ || snapshot.last_ok != reported_.last_ok) {
+    return true;
+  }
+  if (std::abs(snapshot.loss_percent - reported_.loss_percent) >=
+      options_.loss_step_percent) {
+    return true;
+  }
+  int64_t delta = std::llabs(snapshot.last_rtt_ms - reported_.last_rtt_ms);
+  return delta > options_.rtt_step_ms &&
+         delta * 100 > reported_.last_rtt_ms * options_.rtt_step_percent;
+}
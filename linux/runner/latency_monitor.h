@@ -0,0 +1,101 @@
+#ifndef RUNNER_LATENCY_MONITOR_H_
+#define RUNNER_LATENCY_MONITOR_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct LatencyMonitorOptions {
+  // The local SOCKS5 endpoint probes go through.
+  std::string socks_host = "127.0.0.1";
+  uint16_t socks_port = 5000;
+
+  // Each probe is a SOCKS CONNECT to this destination, timed from the TCP
+  // connect to the proxy's reply, so it measures the whole tunnel without
+  // moving any payload.
+  std::string target_host = "1.1.1.1";
+  uint16_t target_port = 80;
+
+  int interval_ms = 2000;
+  int timeout_ms = 3000;
+  // Probes the rolling statistics cover.
+  size_t window = 30;
+
+  // A change callback fires when the latest RTT moves by more than both of
+  // these from the last reported one, when a probe fails after a success or
+  // the other way round, or when loss moves by |loss_step_percent|.
+  int64_t rtt_step_ms = 10;
+  int rtt_step_percent = 20;
+  double loss_step_percent = 10;
+};
+
+struct LatencySnapshot {
+  // Probes in the window, failed ones included.
+  size_t samples = 0;
+  // Latest successful RTT; 0 until one succeeds.
+  int64_t last_rtt_ms = 0;
+  int64_t min_rtt_ms = 0;
+  int64_t avg_rtt_ms = 0;
+  // Mean absolute difference between consecutive successful RTTs.
+  int64_t jitter_ms = 0;
+  double loss_percent = 0;
+  // Whether the most recent probe succeeded.
+  bool last_ok = false;
+  // MonotonicNowMs() of the most recent probe; 0 before the first.
+  int64_t updated_ms = 0;
+};
+
+// Probes the tunnel on its own thread at a fixed interval and keeps rolling
+// RTT, jitter and loss figures over the last |window| probes, so the current
+// latency can be answered without a network round trip.
+class LatencyMonitor {
+ public:
+  using ChangeCallback = std::function<void(const LatencySnapshot& snapshot)>;
+
+  // |on_change| runs on the monitor thread.
+  LatencyMonitor(const LatencyMonitorOptions& options,
+                 ChangeCallback on_change);
+  ~LatencyMonitor();
+
+  // Prevent copying.
+  LatencyMonitor(LatencyMonitor const&) = delete;
+  LatencyMonitor& operator=(LatencyMonitor const&) = delete;
+
+  // Starts probing; the first probe runs immediately.
+  void Start();
+
+  // Stops the thread, aborting a probe in flight.
+  void Stop();
+
+  LatencySnapshot Snapshot() const;
+
+ private:
+  void Run();
+  int64_t Probe();
+  void Record(int64_t rtt_ms);
+  LatencySnapshot ComputeSnapshot() const;
+  bool IsNotable(const LatencySnapshot& snapshot) const;
+
+  LatencyMonitorOptions options_;
+  ChangeCallback on_change_;
+  std::thread thread_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  // The socket of the probe in flight, so Stop() can abort it.
+  int probe_fd_ = -1;
+  // Ring of the last |window| RTTs; -1 marks a failed probe.
+  std::vector<int64_t> window_;
+  size_t next_slot_ = 0;
+  LatencySnapshot snapshot_;
+  LatencySnapshot reported_;
+  bool has_reported_ = false;
+};
+
+#endif  // RUNNER_LATENCY_MONITOR_H_
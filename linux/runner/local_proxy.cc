@@ -0,0 +1,963 @@
+#include "local_proxy.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+#include "log_ring.h"
+#include "net_util.h"
+
+namespace {
+
+constexpr int kMaxEvents = 256;
+constexpr int kMaxLoops = 16;
+constexpr int64_t kSweepIntervalMs = 1000;
+// Largest client handshake accepted: a SOCKS5 greeting and request, or the
+// header block of an HTTP CONNECT.
+constexpr size_t kHandshakeLimit = 4096;
+// Empty pipes each loop keeps for later connections.
+constexpr size_t kPipeCacheSize = 64;
+// Upper bound for a single splice(); the pipe capacity limits it anyway.
+constexpr size_t kSpliceChunk = 1 << 20;
+
+// SOCKS5 reply codes.
+constexpr uint8_t kSocksGeneralFailure = 0x01;
+constexpr uint8_t kSocksCommandNotSupported = 0x07;
+constexpr uint8_t kSocksAddressNotSupported = 0x08;
+
+const char kHttpEstablished[] = "HTTP/1.1 200 Connection established\r\n\r\n";
+const char kHttpBadRequest[] =
+    "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+const char kHttpNotAllowed[] =
+    "HTTP/1.1 405 Method Not Allowed\r\nAllow: CONNECT\r\n"
+    "Connection: close\r\n\r\n";
+const char kHttpBadGateway[] =
+    "HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n";
+
+// Distinguishes the listening and stop descriptors from connections in
+// epoll. A connection's upstream socket is tagged with its pointer plus
+// kUpstreamBit, which is free because connections are 8-byte aligned.
+char kListenTag;
+char kStopTag;
+constexpr uintptr_t kUpstreamBit = 1;
+
+bool ParseNumericAddress(const std::string& host, uint16_t port,
+                         struct sockaddr_storage* address,
+                         socklen_t* length) {
+  memset(address, 0, sizeof(*address));
+  auto* v4 = reinterpret_cast<struct sockaddr_in*>(address);
+  if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(port);
+    *length = sizeof(*v4);
+    return true;
+  }
+  auto* v6 = reinterpret_cast<struct sockaddr_in6*>(address);
+  if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(port);
+    *length = sizeof(*v6);
+    return true;
+  }
+  return false;
+}
+
+// Binds a non-blocking listener that shares its port with the listeners of
+// the other loops.
+int ListenShared(const struct sockaddr_storage& address, socklen_t length) {
+  int fd = socket(address.ss_family,
+                  SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+      bind(fd, reinterpret_cast<const struct sockaddr*>(&address), length) !=
+          0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Every relayed connection costs two sockets and four pipe ends, so the
+// usual soft limit of 1024 descriptors would cap the proxy far below
+// |max_connections|.
+void RaiseFileLimit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+// Encodes the "host:port" or "[v6]:port" target of an HTTP CONNECT as the
+// address part of a SOCKS5 request, from ATYP on. Returns its length, or 0
+// when |target| is malformed.
+size_t EncodeTarget(const std::string& target, uint8_t* out) {
+  std::string host;
+  size_t colon;
+  if (!target.empty() && target[0] == '[') {
+    size_t close = target.find(']');
+    if (close == std::string::npos || close + 1 >= target.size() ||
+        target[close + 1] != ':') {
+      return 0;
+    }
+    host = target.substr(1, close - 1);
+    colon = close + 1;
+  } else {
+    colon = target.rfind(':');
+    if (colon == std::string::npos) {
+      return 0;
+    }
+    host = target.substr(0, colon);
+  }
+  const char* digits = target.c_str() + colon + 1;
+  char* end = nullptr;
+  long port = strtol(digits, &end, 10);
+  if (host.empty() || end == digits || *end != '\0' || port <= 0 ||
+      port > 65535) {
+    return 0;
+  }
+
+  size_t length = 0;
+  if (inet_pton(AF_INET, host.c_str(), out + 1) == 1) {
+    out[0] = 0x01;
+    length = 1 + 4;
+  } else if (inet_pton(AF_INET6, host.c_str(), out + 1) == 1) {
+    out[0] = 0x04;
+    length = 1 + 16;
+  } else if (host.size() <= 255) {
+    out[0] = 0x03;
+    out[1] = static_cast<uint8_t>(host.size());
+    memcpy(out + 2, host.data(), host.size());
+    length = 2 + host.size();
+  } else {
+    return 0;
+  }
+  out[length++] = static_cast<uint8_t>(port >> 8);
+  out[length++] = static_cast<uint8_t>(port);
+  return length;
+}
+
+enum class ProxyState {
+  kHandshake,
+  kConnecting,
+  kUpstreamHandshake,
+  kRelaying,
+};
+
+enum class ClientProtocol {
+  kUnknown,
+  kSocks,
+  kHttp,
+};
+
+enum class HandshakeResult {
+  kNeedMore,
+  kReady,
+  kFailed,
+};
+
+// One direction of a relayed connection. Data is spliced from the source
+// socket into the pipe and from the pipe into the destination; |buffered|
+// is what the pipe currently holds.
+struct Relay {
+  int pipe[2] = {-1, -1};
+  size_t buffered = 0;
+  bool eof = false;
+  bool shut = false;
+};
+
+struct Connection {
+  int client_fd = -1;
+  int upstream_fd = -1;
+  ProxyState state = ProxyState::kHandshake;
+  ClientProtocol protocol = ClientProtocol::kUnknown;
+  bool closed = false;
+  int64_t deadline_ms = 0;
+
+  // Bytes read from the client before the tunnel is up. Anything past the
+  // handshake itself is forwarded once it is.
+  std::unique_ptr<uint8_t[]> handshake{new uint8_t[kHandshakeLimit]};
+  size_t handshake_length = 0;
+  size_t early_offset = 0;
+  bool method_sent = false;
+
+  // Pipelined greeting and CONNECT for the upstream.
+  uint8_t request[3 + 3 + 2 + 255 + 2];
+  size_t request_length = 0;
+
+  uint8_t reply[2 + 4 + 1 + 255 + 2];
+  size_t reply_received = 0;
+  size_t reply_expected = 7;
+
+  Relay up;    // Client to upstream.
+  Relay down;  // Upstream to client.
+};
+
+}  // namespace
+
+class LocalProxy::EventLoop {
+ public:
+  EventLoop(LocalProxy* owner, const LocalProxyOptions& options,
+            size_t max_connections)
+      : owner_(owner), options_(options), max_connections_(max_connections) {}
+  ~EventLoop();
+
+  // Prevent copying.
+  EventLoop(EventLoop const&) = delete;
+  EventLoop& operator=(EventLoop const&) = delete;
+
+  // Takes ownership of |listen_fd| and starts the loop thread.
+  bool Start(int listen_fd, int index);
+  void Stop();
+
+ private:
+  void Run();
+  void Accept();
+  void OnClientEvent(Connection* connection, uint32_t events);
+  void OnUpstreamEvent(Connection* connection, uint32_t events);
+
+  void ReadHandshake(Connection* connection);
+  HandshakeResult ParseSocks(Connection* connection);
+  HandshakeResult ParseHttp(Connection* connection);
+  void ConnectUpstream(Connection* connection);
+  void ReadReply(Connection* connection);
+  void StartRelay(Connection* connection);
+  void Pump(Connection* connection);
+  bool Move(int from, int to, Relay* relay);
+
+  // Answers the client with a failure in its own protocol and closes.
+  void Fail(Connection* connection, uint8_t socks_code,
+            const char* http_status);
+  bool SendToClient(Connection* connection, const void* data, size_t length);
+  void Close(Connection* connection);
+  void Sweep(int64_t now_ms);
+
+  bool AcquirePipe(Relay* relay);
+  void ReleasePipe(Relay* relay);
+
+  LocalProxy* owner_;
+  LocalProxyOptions options_;
+  size_t max_connections_;
+  int listen_fd_ = -1;
+  int epoll_fd_ = -1;
+  int stop_fd_ = -1;
+  std::thread thread_;
+  bool accept_paused_ = false;
+
+  std::unordered_map<Connection*, std::unique_ptr<Connection>> connections_;
+  std::vector<std::unique_ptr<Connection>> closed_;
+  std::vector<Relay> pipe_cache_;
+};
+
+LocalProxy::EventLoop::~EventLoop() {
+  Stop();
+  for (auto& entry : connections_) {
+    Connection* connection = entry.second.get();
+    close(connection->client_fd);
+    if (connection->upstream_fd >= 0) {
+      close(connection->upstream_fd);
+    }
+    for (Relay* relay : {&connection->up, &connection->down}) {
+      if (relay->pipe[0] >= 0) {
+        pipe_cache_.push_back(*relay);
+      }
+    }
+  }
+  for (Relay& relay : pipe_cache_) {
+    close(relay.pipe[0]);
+    close(relay.pipe[1]);
+  }
+  for (int fd : {listen_fd_, epoll_fd_, stop_fd_}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+bool LocalProxy::EventLoop::Start(int listen_fd, int index) {
+  listen_fd_ = listen_fd;
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (epoll_fd_ < 0 || stop_fd_ < 0) {
+    return false;
+  }
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &kListenTag;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event) != 0) {
+    return false;
+  }
+  event.events = EPOLLIN;
+  event.data.ptr = &kStopTag;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &event) != 0) {
+    return false;
+  }
+
+  thread_ = std::thread([this, index] {
+    std::string name = "vpn-proxy" + std::to_string(index);
+    pthread_setname_np(pthread_self(), name.c_str());
+    Run();
+  });
+  return true;
+}
+
+void LocalProxy::EventLoop::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  uint64_t one = 1;
+  if (write(stop_fd_, &one, sizeof(one)) != sizeof(one)) {
+    return;
+  }
+  thread_.join();
+}
+
+void LocalProxy::EventLoop::Run() {
+  struct epoll_event events[kMaxEvents];
+  int64_t next_sweep_ms = MonotonicNowMs() + kSweepIntervalMs;
+
+  for (;;) {
+    int timeout = static_cast<int>(
+        std::max<int64_t>(0, next_sweep_ms - MonotonicNowMs()));
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    if (count < 0 && errno != EINTR) {
+      return;
+    }
+    for (int i = 0; i < count; i++) {
+      void* tag = events[i].data.ptr;
+      if (tag == &kStopTag) {
+        return;
+      }
+      if (tag == &kListenTag) {
+        Accept();
+        continue;
+      }
+      uintptr_t bits = reinterpret_cast<uintptr_t>(tag);
+      auto* connection = reinterpret_cast<Connection*>(bits & ~kUpstreamBit);
+      if (connection->closed) {
+        continue;
+      }
+      if (bits & kUpstreamBit) {
+        OnUpstreamEvent(connection, events[i].events);
+      } else {
+        OnClientEvent(connection, events[i].events);
+      }
+    }
+
+    int64_t now = MonotonicNowMs();
+    if (now >= next_sweep_ms) {
+      Sweep(now);
+      next_sweep_ms = now + kSweepIntervalMs;
+    }
+    // Connections closed this round may still have had events queued above.
+    closed_.clear();
+  }
+}
+
+void LocalProxy::EventLoop::Accept() {
+  // Edge-triggered: drain the backlog, or stop at the limit and come back
+  // when a connection closes.
+  for (;;) {
+    if (connections_.size() >= max_connections_) {
+      accept_paused_ = true;
+      return;
+    }
+    int fd = accept4(listen_fd_, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno == EMFILE || errno == ENFILE) {
+        WriteLog(LogLevel::kWarning, "proxy", "Out of file descriptors");
+        accept_paused_ = !connections_.empty();
+      }
+      return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    std::unique_ptr<Connection> connection(new Connection());
+    connection->client_fd = fd;
+    connection->deadline_ms =
+        MonotonicNowMs() + options_.handshake_timeout_ms;
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = connection.get();
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+      close(fd);
+      continue;
+    }
+    Connection* raw = connection.get();
+    connections_[raw] = std::move(connection);
+    owner_->active_connections_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void LocalProxy::EventLoop::OnClientEvent(Connection* connection,
+                                          uint32_t events) {
+  if (events & EPOLLERR) {
+    Close(connection);
+    return;
+  }
+  switch (connection->state) {
+    case ProxyState::kHandshake:
+      ReadHandshake(connection);
+      break;
+    case ProxyState::kConnecting:
+    case ProxyState::kUpstreamHandshake:
+      // Early data and a half-close are picked up once relaying starts.
+      if ((events & EPOLLHUP) != 0) {
+        Close(connection);
+      }
+      break;
+    case ProxyState::kRelaying:
+      Pump(connection);
+      break;
+  }
+}
+
+void LocalProxy::EventLoop::OnUpstreamEvent(Connection* connection,
+                                            uint32_t events) {
+  switch (connection->state) {
+    case ProxyState::kConnecting: {
+      if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) == 0) {
+        return;
+      }
+      int error = 0;
+      socklen_t error_length = sizeof(error);
+      getsockopt(connection->upstream_fd, SOL_SOCKET, SO_ERROR, &error,
+                 &error_length);
+      if (error != 0 || (events & EPOLLERR) ||
+          send(connection->upstream_fd, connection->request,
+               connection->request_length, MSG_NOSIGNAL) !=
+              static_cast<ssize_t>(connection->request_length)) {
+        Fail(connection, kSocksGeneralFailure, kHttpBadGateway);
+        return;
+      }
+      connection->state = ProxyState::kUpstreamHandshake;
+      ReadReply(connection);
+      break;
+    }
+    case ProxyState::kUpstreamHandshake:
+      ReadReply(connection);
+      break;
+    case ProxyState::kRelaying:
+      if (events & EPOLLERR) {
+        Close(connection);
+        return;
+      }
+      Pump(connection);
+      break;
+    case ProxyState::kHandshake:
+      break;
+  }
+}
+
+void LocalProxy::EventLoop::ReadHandshake(Connection* connection) {
+  uint8_t* buffer = connection->handshake.get();
+  bool eof = false;
+  while (connection->handshake_length < kHandshakeLimit) {
+    ssize_t received =
+        recv(connection->client_fd, buffer + connection->handshake_length,
+             kHandshakeLimit - connection->handshake_length, 0);
+    if (received > 0) {
+      connection->handshake_length += static_cast<size_t>(received);
+    } else if (received == 0) {
+      eof = true;
+      break;
+    } else if (errno == EAGAIN) {
+      break;
+    } else if (errno != EINTR) {
+      Close(connection);
+      return;
+    }
+  }
+  if (connection->handshake_length == 0) {
+    if (eof) {
+      Close(connection);
+    }
+    return;
+  }
+
+  if (connection->protocol == ClientProtocol::kUnknown) {
+    connection->protocol =
+        buffer[0] == 0x05 ? ClientProtocol::kSocks : ClientProtocol::kHttp;
+  }
+  HandshakeResult result = connection->protocol == ClientProtocol::kSocks
+                               ? ParseSocks(connection)
+                               : ParseHttp(connection);
+  switch (result) {
+    case HandshakeResult::kReady:
+      // A client that already half-closed is noticed by the relay.
+      ConnectUpstream(connection);
+      break;
+    case HandshakeResult::kNeedMore:
+      if (connection->handshake_length == kHandshakeLimit) {
+        Fail(connection, kSocksGeneralFailure, kHttpBadRequest);
+      } else if (eof) {
+        Close(connection);
+      }
+      break;
+    case HandshakeResult::kFailed:
+      // Answered and closed where the handshake was rejected.
+      Close(connection);
+      break;
+  }
+}
+
+HandshakeResult LocalProxy::EventLoop::ParseSocks(Connection* connection) {
+  const uint8_t* in = connection->handshake.get();
+  size_t length = connection->handshake_length;
+  if (length < 2) {
+    return HandshakeResult::kNeedMore;
+  }
+  size_t greeting = 2 + in[1];
+  if (length < greeting) {
+    return HandshakeResult::kNeedMore;
+  }
+  if (!connection->method_sent) {
+    bool no_auth = memchr(in + 2, 0x00, in[1]) != nullptr;
+    const uint8_t method[] = {0x05, static_cast<uint8_t>(no_auth ? 0 : 0xff)};
+    if (!SendToClient(connection, method, sizeof(method)) || !no_auth) {
+      return HandshakeResult::kFailed;
+    }
+    connection->method_sent = true;
+  }
+
+  const uint8_t* request = in + greeting;
+  size_t available = length - greeting;
+  if (available < 5) {
+    return HandshakeResult::kNeedMore;
+  }
+  if (request[0] != 0x05) {
+    return HandshakeResult::kFailed;
+  }
+  size_t address_length;
+  switch (request[3]) {
+    case 0x01:
+      address_length = 1 + 4;
+      break;
+    case 0x04:
+      address_length = 1 + 16;
+      break;
+    case 0x03:
+      address_length = 2 + request[4];
+      break;
+    default:
+      Fail(connection, kSocksAddressNotSupported, nullptr);
+      return HandshakeResult::kFailed;
+  }
+  size_t total = 3 + address_length + 2;
+  if (available < total) {
+    return HandshakeResult::kNeedMore;
+  }
+  if (request[1] != 0x01) {
+    Fail(connection, kSocksCommandNotSupported, nullptr);
+    return HandshakeResult::kFailed;
+  }
+
+  // Our own greeting, then the client's request as it came.
+  const uint8_t greeting_out[] = {0x05, 0x01, 0x00};
+  memcpy(connection->request, greeting_out, sizeof(greeting_out));
+  memcpy(connection->request + sizeof(greeting_out), request, total);
+  connection->request[sizeof(greeting_out) + 2] = 0x00;
+  connection->request_length = sizeof(greeting_out) + total;
+  connection->early_offset = greeting + total;
+  return HandshakeResult::kReady;
+}
+
+HandshakeResult LocalProxy::EventLoop::ParseHttp(Connection* connection) {
+  const char* in = reinterpret_cast<const char*>(connection->handshake.get());
+  size_t length = connection->handshake_length;
+  const char terminator[] = "\r\n\r\n";
+  const char* end = std::search(in, in + length, terminator, terminator + 4);
+  if (end == in + length) {
+    return HandshakeResult::kNeedMore;
+  }
+
+  // Request line: METHOD SP target SP version.
+  const char* line_end = std::search(in, end + 2, terminator, terminator + 2);
+  std::string line(in, line_end);
+  size_t first = line.find(' ');
+  size_t second =
+      first == std::string::npos ? first : line.find(' ', first + 1);
+  if (second == std::string::npos) {
+    Fail(connection, 0, kHttpBadRequest);
+    return HandshakeResult::kFailed;
+  }
+  if (line.compare(0, first, "CONNECT") != 0) {
+    Fail(connection, 0, kHttpNotAllowed);
+    return HandshakeResult::kFailed;
+  }
+  std::string target = line.substr(first + 1, second - first - 1);
+
+  const uint8_t header[] = {0x05, 0x01, 0x00, 0x05, 0x01, 0x00};
+  memcpy(connection->request, header, sizeof(header));
+  size_t address_length =
+      EncodeTarget(target, connection->request + sizeof(header));
+  if (address_length == 0) {
+    Fail(connection, 0, kHttpBadRequest);
+    return HandshakeResult::kFailed;
+  }
+  connection->request_length = sizeof(header) + address_length;
+  connection->early_offset = static_cast<size_t>(end - in) + 4;
+  return HandshakeResult::kReady;
+}
+
+void LocalProxy::EventLoop::ConnectUpstream(Connection* connection) {
+  struct sockaddr_storage address;
+  socklen_t length = 0;
+  if (!owner_->Upstream(&address, &length)) {
+    Fail(connection, kSocksGeneralFailure, kHttpBadGateway);
+    return;
+  }
+  int fd = socket(address.ss_family,
+                  SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    Fail(connection, kSocksGeneralFailure, kHttpBadGateway);
+    return;
+  }
+  connection->upstream_fd = fd;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&address), length) != 0 &&
+      errno != EINPROGRESS) {
+    Fail(connection, kSocksGeneralFailure, kHttpBadGateway);
+    return;
+  }
+
+  // Registered once for everything; adding a connected socket reports it
+  // writable right away.
+  struct epoll_event event = {};
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = reinterpret_cast<void*>(
+      reinterpret_cast<uintptr_t>(connection) | kUpstreamBit);
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+    Fail(connection, kSocksGeneralFailure, kHttpBadGateway);
+    return;
+  }
+  connection->state = ProxyState::kConnecting;
+}
+
+void LocalProxy::EventLoop::ReadReply(Connection* connection) {
+  // Read exactly the reply so early data from the remote stays queued in
+  // the socket for the relay.
+  ssize_t received =
+      recv(connection->upstream_fd,
+           connection->reply + connection->reply_received,
+           connection->reply_expected - connection->reply_received, 0);
+  if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (received <= 0) {
+    Fail(connection, kSocksGeneralFailure, kHttpBadGateway);
+    return;
+  }
+  connection->reply_received += static_cast<size_t>(received);
+  const uint8_t* reply = connection->reply;
+  size_t count = connection->reply_received;
+  if ((count >= 2 && (reply[0] != 0x05 || reply[1] != 0x00)) ||
+      (count >= 4 && reply[2] != 0x05)) {
+    Fail(connection, kSocksGeneralFailure, kHttpBadGateway);
+    return;
+  }
+  if (count >= 4 && reply[3] != 0x00) {
+    // Pass the upstream's reason on to SOCKS clients.
+    Fail(connection, reply[3], kHttpBadGateway);
+    return;
+  }
+  if (count == 7 && connection->reply_expected == 7) {
+    switch (reply[5]) {
+      case 0x01:
+        connection->reply_expected = 6 + 4 + 2;
+        break;
+      case 0x04:
+        connection->reply_expected = 6 + 16 + 2;
+        break;
+      case 0x03:
+        connection->reply_expected = 6 + 1 + reply[6] + 2;
+        break;
+      default:
+        Fail(connection, kSocksGeneralFailure, kHttpBadGateway);
+        return;
+    }
+  }
+  if (count < connection->reply_expected) {
+    // More of the reply may already be waiting, and with edge triggering
+    // there is no second notification for it.
+    ReadReply(connection);
+    return;
+  }
+  StartRelay(connection);
+}
+
+void LocalProxy::EventLoop::StartRelay(Connection* connection) {
+  bool sent;
+  if (connection->protocol == ClientProtocol::kSocks) {
+    const uint8_t success[] = {0x05, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+    sent = SendToClient(connection, success, sizeof(success));
+  } else {
+    sent = SendToClient(connection, kHttpEstablished,
+                        sizeof(kHttpEstablished) - 1);
+  }
+  if (!sent) {
+    Close(connection);
+    return;
+  }
+
+  // Client bytes that followed the handshake go out first. They are at
+  // most a few KB on a fresh socket, so one send() takes them.
+  size_t early = connection->handshake_length - connection->early_offset;
+  if (early > 0 &&
+      send(connection->upstream_fd,
+           connection->handshake.get() + connection->early_offset, early,
+           MSG_NOSIGNAL) != static_cast<ssize_t>(early)) {
+    Close(connection);
+    return;
+  }
+  connection->handshake.reset();
+
+  if (!AcquirePipe(&connection->up) || !AcquirePipe(&connection->down)) {
+    Close(connection);
+    return;
+  }
+  connection->state = ProxyState::kRelaying;
+  Pump(connection);
+}
+
+void LocalProxy::EventLoop::Pump(Connection* connection) {
+  if (!Move(connection->client_fd, connection->upstream_fd,
+            &connection->up) ||
+      !Move(connection->upstream_fd, connection->client_fd,
+            &connection->down)) {
+    Close(connection);
+    return;
+  }
+  if (connection->up.shut && connection->down.shut) {
+    Close(connection);
+  }
+}
+
+bool LocalProxy::EventLoop::Move(int from, int to, Relay* relay) {
+  // Edge-triggered: keep going until either socket would block, so the next
+  // readiness change is guaranteed to produce an event.
+  for (;;) {
+    while (relay->buffered > 0) {
+      ssize_t moved = splice(relay->pipe[0], nullptr, to, nullptr,
+                             relay->buffered,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (moved > 0) {
+        relay->buffered -= static_cast<size_t>(moved);
+        continue;
+      }
+      if (moved < 0 && errno == EINTR) {
+        continue;
+      }
+      // EAGAIN: the destination is full; its EPOLLOUT brings us back.
+      return moved < 0 && errno == EAGAIN;
+    }
+    if (relay->eof) {
+      if (!relay->shut) {
+        shutdown(to, SHUT_WR);
+        relay->shut = true;
+      }
+      return true;
+    }
+
+    // The pipe is empty here, so EAGAIN can only mean the source is dry.
+    ssize_t moved = splice(from, nullptr, relay->pipe[1], nullptr,
+                           kSpliceChunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved > 0) {
+      relay->buffered = static_cast<size_t>(moved);
+    } else if (moved == 0) {
+      relay->eof = true;
+    } else if (errno == EAGAIN) {
+      return true;
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+}
+
+void LocalProxy::EventLoop::Fail(Connection* connection, uint8_t socks_code,
+                                 const char* http_status) {
+  if (connection->protocol == ClientProtocol::kSocks) {
+    const uint8_t reply[] = {0x05, socks_code, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+    SendToClient(connection, reply, sizeof(reply));
+  } else if (http_status != nullptr) {
+    SendToClient(connection, http_status, strlen(http_status));
+  }
+  Close(connection);
+}
+
+bool LocalProxy::EventLoop::SendToClient(Connection* connection,
+                                         const void* data, size_t length) {
+  return send(connection->client_fd, data, length, MSG_NOSIGNAL) ==
+         static_cast<ssize_t>(length);
+}
+
+void LocalProxy::EventLoop::Close(Connection* connection) {
+  if (connection->closed) {
+    return;
+  }
+  connection->closed = true;
+  close(connection->client_fd);
+  if (connection->upstream_fd >= 0) {
+    close(connection->upstream_fd);
+  }
+  ReleasePipe(&connection->up);
+  ReleasePipe(&connection->down);
+
+  auto found = connections_.find(connection);
+  closed_.push_back(std::move(found->second));
+  connections_.erase(found);
+  owner_->active_connections_.fetch_sub(1, std::memory_order_relaxed);
+
+  if (accept_paused_) {
+    accept_paused_ = false;
+    Accept();
+  }
+}
+
+void LocalProxy::EventLoop::Sweep(int64_t now_ms) {
+  std::vector<Connection*> expired;
+  for (auto& entry : connections_) {
+    Connection* connection = entry.first;
+    if (connection->state != ProxyState::kRelaying &&
+        now_ms >= connection->deadline_ms) {
+      expired.push_back(connection);
+    }
+  }
+  for (Connection* connection : expired) {
+    Close(connection);
+  }
+}
+
+bool LocalProxy::EventLoop::AcquirePipe(Relay* relay) {
+  if (!pipe_cache_.empty()) {
+    *relay = pipe_cache_.back();
+    pipe_cache_.pop_back();
+    return true;
+  }
+  if (pipe2(relay->pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+    relay->pipe[0] = relay->pipe[1] = -1;
+    return false;
+  }
+  if (options_.pipe_size > 0) {
+    fcntl(relay->pipe[1], F_SETPIPE_SZ, options_.pipe_size);
+  }
+  return true;
+}
+
+void LocalProxy::EventLoop::ReleasePipe(Relay* relay) {
+  if (relay->pipe[0] < 0) {
+    return;
+  }
+  // A pipe still holding data from a dead connection cannot be reused.
+  if (relay->buffered == 0 && pipe_cache_.size() < kPipeCacheSize) {
+    pipe_cache_.push_back(Relay());
+    pipe_cache_.back().pipe[0] = relay->pipe[0];
+    pipe_cache_.back().pipe[1] = relay->pipe[1];
+  } else {
+    close(relay->pipe[0]);
+    close(relay->pipe[1]);
+  }
+  relay->pipe[0] = relay->pipe[1] = -1;
+}
+
+LocalProxy::LocalProxy(const LocalProxyOptions& options)
+    : options_(options),
+      upstream_host_(options.socks_host),
+      upstream_port_(options.socks_port) {}
+
+LocalProxy::~LocalProxy() { Stop(); }
+
+bool LocalProxy::Start() {
+  if (!loops_.empty()) {
+    return true;
+  }
+  struct sockaddr_storage address;
+  socklen_t length = 0;
+  if (!ParseNumericAddress(options_.listen_host, options_.port, &address,
+                           &length)) {
+    return false;
+  }
+  RaiseFileLimit();
+
+  int count = options_.loops > 0
+                  ? options_.loops
+                  : static_cast<int>(std::thread::hardware_concurrency());
+  count = std::max(1, std::min(count, kMaxLoops));
+  size_t share = std::max<size_t>(
+      1, options_.max_connections / static_cast<size_t>(count));
+
+  for (int i = 0; i < count; i++) {
+    int fd = ListenShared(address, length);
+    if (fd < 0) {
+      Stop();
+      return false;
+    }
+    if (i == 0) {
+      // Later listeners must join the port the first one actually got.
+      length = sizeof(address);
+      getsockname(fd, reinterpret_cast<struct sockaddr*>(&address), &length);
+      port_ = ntohs(
+          address.ss_family == AF_INET
+              ? reinterpret_cast<struct sockaddr_in*>(&address)->sin_port
+              : reinterpret_cast<struct sockaddr_in6*>(&address)->sin6_port);
+    }
+    std::unique_ptr<EventLoop> loop(new EventLoop(this, options_, share));
+    bool started = loop->Start(fd, i);
+    loops_.push_back(std::move(loop));
+    if (!started) {
+      Stop();
+      return false;
+    }
+  }
+  WriteLog(LogLevel::kInfo, "proxy",
+           "Listening on " + options_.listen_host + ":" +
+               std::to_string(port_) + " with " + std::to_string(count) +
+               " loops");
+  return true;
+}
+
+void LocalProxy::Stop() {
+  for (auto& loop : loops_) {
+    loop->Stop();
+  }
+  loops_.clear();
+  active_connections_.store(0, std::memory_order_relaxed);
+}
+
+void LocalProxy::SetUpstream(const std::string& host, uint16_t port) {
+  std::lock_guard<std::mutex> lock(upstream_mutex_);
+  upstream_host_ = host;
+  upstream_port_ = port;
+}
+
+bool LocalProxy::Upstream(struct sockaddr_storage* address,
+                          socklen_t* length) {
+  std::lock_guard<std::mutex> lock(upstream_mutex_);
+  return ParseNumericAddress(upstream_host_, upstream_port_, address, length);
+}
@@ -0,0 +1,91 @@
+#ifndef RUNNER_LOCAL_PROXY_H_
+#define RUNNER_LOCAL_PROXY_H_
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct LocalProxyOptions {
+  // Where applications reach the proxy.
+  std::string listen_host = "127.0.0.1";
+  uint16_t port = 10808;
+
+  // The proxy core's SOCKS5 endpoint; must be a numeric address.
+  std::string socks_host = "127.0.0.1";
+  uint16_t socks_port = 5000;
+
+  // Event loops, each with its own listening socket. 0 runs one per core.
+  int loops = 0;
+  // Open client connections allowed, split evenly between the loops. A
+  // loop at its share leaves further clients in the listen backlog until
+  // one of its connections closes.
+  size_t max_connections = 4096;
+  // Clients that have not finished their handshake by then are dropped.
+  int handshake_timeout_ms = 10000;
+  // Capacity of each relay pipe in bytes. 0 keeps the kernel default.
+  int pipe_size = 0;
+};
+
+// A SOCKS5 and HTTP CONNECT server on loopback for the proxy-only mode,
+// where applications use the proxy directly instead of the TUN device. Each
+// accepted connection is tunnelled through a SOCKS5 CONNECT to the proxy
+// core, after which payload moves between the two sockets with splice()
+// through a pair of pipes and never enters userspace.
+//
+// Every loop owns a SO_REUSEPORT listener and an edge-triggered epoll set,
+// so the kernel spreads new clients across cores and a connection is only
+// ever touched by the thread that accepted it.
+class LocalProxy {
+ public:
+  explicit LocalProxy(const LocalProxyOptions& options);
+  ~LocalProxy();
+
+  // Prevent copying.
+  LocalProxy(LocalProxy const&) = delete;
+  LocalProxy& operator=(LocalProxy const&) = delete;
+
+  // Binds the listeners and starts the loops. Returns false if the port
+  // could not be bound or a loop could not be set up.
+  bool Start();
+
+  // Stops the loops and closes every connection.
+  void Stop();
+
+  // Tunnels connections accepted from now on through |host|:|port|.
+  // Established connections keep their upstream. Safe to call from any
+  // thread.
+  void SetUpstream(const std::string& host, uint16_t port);
+
+  // The port actually bound, which differs from the requested one when
+  // that was 0.
+  uint16_t port() const { return port_; }
+
+  size_t active_connections() const {
+    return active_connections_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  class EventLoop;
+
+  // Fills |address| with the current upstream. Returns false when the
+  // upstream is not a numeric address.
+  bool Upstream(struct sockaddr_storage* address, socklen_t* length);
+
+  LocalProxyOptions options_;
+  uint16_t port_ = 0;
+  std::vector<std::unique_ptr<EventLoop>> loops_;
+
+  std::mutex upstream_mutex_;
+  std::string upstream_host_;
+  uint16_t upstream_port_ = 0;
+
+  std::atomic<size_t> active_connections_{0};
+};
+
+#endif  // RUNNER_LOCAL_PROXY_H_
@@ -0,0 +1,214 @@
+#include "log_ring.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr size_t kDefaultCapacity = 4096;
+
+int64_t WallClockMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+// Formats |record| as "2024-01-31 12:00:00.000 INFO source: message\n".
+std::string FormatRecord(const LogRecord& record) {
+  time_t seconds = static_cast<time_t>(record.time_ms / 1000);
+  struct tm local;
+  localtime_r(&seconds, &local);
+  char stamp[32];
+  size_t length = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+  snprintf(stamp + length, sizeof(stamp) - length, ".%03d",
+           static_cast<int>(record.time_ms % 1000));
+
+  std::string line = stamp;
+  line += ' ';
+  for (const char* c = LogLevelName(record.level); *c != '\0'; c++) {
+    line += static_cast<char>(*c - ('a' - 'A'));
+  }
+  line += ' ';
+  line += record.source;
+  line += ": ";
+  line += record.message;
+  line += '\n';
+  return line;
+}
+
+}  // namespace
+
+// Fills 256 bytes. |state| is 2 * sequence once the record with
+// that sequence is complete and odd while a writer is filling the slot.
+struct LogRing::Slot {
+  std::atomic<uint64_t> state{0};
+  int64_t time_ms;
+  LogLevel level;
+  uint8_t source_length;
+  uint16_t message_length;
+  char source[LogRing::kMaxSource];
+  char message[LogRing::kMaxMessage];
+};
+
+constexpr size_t LogRing::kMaxSource;
+constexpr size_t LogRing::kMaxMessage;
+
+const char* LogLevelName(LogLevel level) {
+  switch (level) {
+    case LogLevel::kDebug:
+      return "debug";
+    case LogLevel::kWarning:
+      return "warning";
+    case LogLevel::kError:
+      return "error";
+    case LogLevel::kInfo:
+      break;
+  }
+  return "info";
+}
+
+LogLevel LogLevelFromName(const char* name) {
+  if (strcmp(name, "debug") == 0) {
+    return LogLevel::kDebug;
+  }
+  if (strcmp(name, "warning") == 0) {
+    return LogLevel::kWarning;
+  }
+  if (strcmp(name, "error") == 0) {
+    return LogLevel::kError;
+  }
+  return LogLevel::kInfo;
+}
+
+LogRing::LogRing(size_t capacity) {
+  size_t rounded = 1;
+  while (rounded < capacity) {
+    rounded <<= 1;
+  }
+  slots_.reset(new Slot[rounded]);
+  mask_ = rounded - 1;
+}
+
+LogRing::~LogRing() {}
+
+LogRing& LogRing::Default() {
+  static LogRing* ring = new LogRing(kDefaultCapacity);
+  return *ring;
+}
+
+void LogRing::Write(LogLevel level, const char* source,
+                    const std::string& message) {
+  uint64_t sequence = next_sequence_.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = slots_[sequence & mask_];
+
+  // The slot must hold a complete record from an earlier lap. Not
+  // necessarily the previous one, which may itself have been dropped. If a
+  // writer is still busy with it, or a later lap already took it, this
+  // record is dropped rather than waiting.
+  uint64_t previous = slot.state.load(std::memory_order_relaxed);
+  do {
+    if ((previous & 1) != 0 || previous >= 2 * sequence) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  } while (!slot.state.compare_exchange_weak(previous, 2 * sequence + 1,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed));
+  // Keep the stores below from becoming visible before the odd state.
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot.time_ms = WallClockMs();
+  slot.level = level;
+  size_t source_length = std::min(strlen(source), kMaxSource);
+  memcpy(slot.source, source, source_length);
+  slot.source_length = static_cast<uint8_t>(source_length);
+  size_t message_length = std::min(message.size(), kMaxMessage);
+  memcpy(slot.message, message.data(), message_length);
+  slot.message_length = static_cast<uint16_t>(message_length);
+
+  slot.state.store(2 * sequence, std::memory_order_release);
+}
+
+std::vector<LogRecord> LogRing::Read(uint64_t after, size_t limit) const {
+  std::vector<LogRecord> records;
+  uint64_t end = next_sequence_.load(std::memory_order_acquire);
+  uint64_t begin = std::max(after + 1, first_visible_.load());
+  if (end > capacity()) {
+    begin = std::max(begin, end - capacity());
+  }
+
+  for (uint64_t sequence = begin; sequence < end && records.size() < limit;
+       sequence++) {
+    const Slot& slot = slots_[sequence & mask_];
+    uint64_t state = slot.state.load(std::memory_order_acquire);
+    if (state != 2 * sequence) {
+      // Still being written, dropped or already overwritten.
+      continue;
+    }
+    LogRecord record;
+    record.sequence = sequence;
+    record.time_ms = slot.time_ms;
+    record.level = slot.level;
+    record.source.assign(slot.source,
+                         std::min<size_t>(slot.source_length, kMaxSource));
+    record.message.assign(slot.message,
+                          std::min<size_t>(slot.message_length, kMaxMessage));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.state.load(std::memory_order_relaxed) != state) {
+      continue;
+    }
+    records.push_back(std::move(record));
+  }
+  return records;
+}
+
+void LogRing::Clear() {
+  first_visible_.store(next_sequence_.load());
+}
+
+bool LogRing::ExportToFile(const std::string& path) const {
+  std::vector<LogRecord> records = Read(0, capacity());
+  std::vector<std::string> lines;
+  lines.reserve(records.size());
+  size_t total = 0;
+  for (const LogRecord& record : records) {
+    lines.push_back(FormatRecord(record));
+    total += lines.back().size();
+  }
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  if (total == 0) {
+    close(fd);
+    return true;
+  }
+  if (ftruncate(fd, static_cast<off_t>(total)) != 0) {
+    close(fd);
+    return false;
+  }
+  void* mapping = mmap(nullptr, total, PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  char* out = static_cast<char*>(mapping);
+  for (const std::string& line : lines) {
+    memcpy(out, line.data(), line.size());
+    out += line.size();
+  }
+  bool synced = msync(mapping, total, MS_SYNC) == 0;
+  munmap(mapping, total);
+  return synced;
+}
+
+void WriteLog(LogLevel level, const char* source, const std::string& message) {
+  LogRing::Default().Write(level, source, message);
+}
@@ -0,0 +1,93 @@
+#ifndef RUNNER_LOG_RING_H_
+#define RUNNER_LOG_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class LogLevel : uint8_t {
+  kDebug,
+  kInfo,
+  kWarning,
+  kError,
+};
+
+// Returns the lower-case name Dart uses for |level|, e.g. "warning".
+const char* LogLevelName(LogLevel level);
+
+// Parses a name returned by LogLevelName(); unknown names are kInfo.
+LogLevel LogLevelFromName(const char* name);
+
+struct LogRecord {
+  // Increases by one per write, starting at 1.
+  uint64_t sequence = 0;
+  // Wall-clock time in milliseconds since the epoch.
+  int64_t time_ms = 0;
+  LogLevel level = LogLevel::kInfo;
+  std::string source;
+  std::string message;
+};
+
+// A fixed-capacity ring of log records that any number of threads can write
+// to without taking a lock, so the tunnel, probe and speed test threads can
+// log from their hot paths. Once full, each write replaces the oldest
+// record; memory use never grows after construction.
+//
+// Writers claim a sequence number with one atomic increment and publish the
+// slot through a per-slot sequence word. Readers copy a slot and recheck
+// that word, skipping records that were overwritten while being read.
+class LogRing {
+ public:
+  // Longer sources and messages are truncated.
+  static constexpr size_t kMaxSource = 15;
+  static constexpr size_t kMaxMessage = 216;
+
+  // |capacity| is rounded up to a power of two.
+  explicit LogRing(size_t capacity);
+  ~LogRing();
+
+  // Prevent copying.
+  LogRing(LogRing const&) = delete;
+  LogRing& operator=(LogRing const&) = delete;
+
+  // The process-wide ring the runner's subsystems log to.
+  static LogRing& Default();
+
+  void Write(LogLevel level, const char* source, const std::string& message);
+
+  // Returns up to |limit| records with a sequence above |after|, oldest
+  // first. Pass the last sequence returned to read the next page.
+  std::vector<LogRecord> Read(uint64_t after, size_t limit) const;
+
+  // Hides every record written so far from later reads.
+  void Clear();
+
+  // Writes every retained record to |path| as text, one line each, through
+  // a shared mapping of the file. Returns false on I/O failure.
+  bool ExportToFile(const std::string& path) const;
+
+  // Records lost because a writer lapped another writer still filling the
+  // same slot, or was itself lapped before it could claim its slot.
+  uint64_t dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+ private:
+  struct Slot;
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_;
+  std::atomic<uint64_t> next_sequence_{1};
+  std::atomic<uint64_t> first_visible_{1};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+// Logs |message| to LogRing::Default().
+void WriteLog(LogLevel level, const char* source, const std::string& message);
+
+#endif  // RUNNER_LOG_RING_H_
@@ -1,6 +1,12 @@
+#include "headless.h"
 #include "my_application.h"
+#include "startup_trace.h"
 
 int main(int argc, char** argv) {
+  StartupTrace::Default().Mark("main");
+  if (IsHeadlessRequested(argc, argv)) {
+    return RunHeadless();
+  }
   g_autoptr(MyApplication) app = my_application_new();
   return g_application_run(G_APPLICATION(app), argc, argv);
 }
@@ -1,11 +1,14 @@
 #include "my_application.h"
 
 #include <flutter_linux/flutter_linux.h>
+#include <string.h>
 #ifdef GDK_WINDOWING_X11
 #include <gdk/gdkx.h>
 #endif
 
 #include "flutter/generated_plugin_registrant.h"
+#include "startup_trace.h"
+#include "vpn_plugin.h"
 
 struct _MyApplication {
   GtkApplication parent_instance;
@@ -14,9 +17,25 @@ struct _MyApplication {
 
 G_DEFINE_TYPE(MyApplication, my_application, GTK_TYPE_APPLICATION)
 
+// Shows the window once Flutter has drawn into it, so it never appears
+// blank, and saves the startup trace up to this point.
+static void first_frame_cb(MyApplication* self, FlView* view) {
+  StartupTrace::Default().Mark("first_frame");
+  gtk_widget_show(gtk_widget_get_toplevel(GTK_WIDGET(view)));
+  StartupTrace::Default().WriteToFile(StartupTrace::DefaultPath());
+}
+
 // Implements GApplication::activate.
 static void my_application_activate(GApplication* application) {
   MyApplication* self = MY_APPLICATION(application);
+  // A later launch without an action brings the existing window forward.
+  GtkWindow* existing =
+      gtk_application_get_active_window(GTK_APPLICATION(application));
+  if (existing != nullptr) {
+    gtk_window_present(existing);
+    return;
+  }
+  StartupTrace::Default().Mark("activate");
   GtkWindow* window =
       GTK_WINDOW(gtk_application_window_new(GTK_APPLICATION(application)));
 
@@ -48,7 +67,7 @@ static void my_application_activate(GApplication* application) {
   }
 
   gtk_window_set_default_size(window, 1280, 720);
-  gtk_widget_show(GTK_WIDGET(window));
+  StartupTrace::Default().Mark("window_created");
 
   g_autoptr(FlDartProject) project = fl_dart_project_new();
   fl_dart_project_set_dart_entrypoint_arguments(project, self->dart_entrypoint_arguments);
@@ -56,17 +75,91 @@ static void my_application_activate(GApplication* application) {
   FlView* view = fl_view_new(project);
   gtk_widget_show(GTK_WIDGET(view));
   gtk_container_add(GTK_CONTAINER(window), GTK_WIDGET(view));
+  StartupTrace::Default().Mark("view_created");
+
+  // Realizing the view starts the engine without mapping the window, so
+  // the Dart isolate boots while the window stays hidden until there is a
+  // frame to show. Flutter releases without the first-frame signal show the
+  // window straight away, as before.
+  if (g_signal_lookup("first-frame", fl_view_get_type()) != 0) {
+    g_signal_connect_swapped(view, "first-frame", G_CALLBACK(first_frame_cb),
+                             self);
+    gtk_widget_realize(GTK_WIDGET(view));
+  } else {
+    gtk_widget_show(GTK_WIDGET(window));
+  }
+  StartupTrace::Default().Mark("engine_started");
 
   fl_register_plugins(FL_PLUGIN_REGISTRY(view));
+  g_autoptr(FlPluginRegistrar) vpn_registrar =
+      fl_plugin_registry_get_registrar_for_plugin(FL_PLUGIN_REGISTRY(view),
+                                                  "VpnPlugin");
+  vpn_plugin_register_with_registrar(vpn_registrar);
+  StartupTrace::Default().Mark("plugins_registered");
 
   gtk_widget_grab_focus(GTK_WIDGET(view));
 }
 
+// Runs a quick action in the primary instance, whether it was given on
+// this instance's command line or forwarded over D-Bus by a later launch.
+static void quick_action_cb(GSimpleAction* action, GVariant* parameter,
+                            gpointer user_data) {
+  const gchar* server =
+      parameter != nullptr ? g_variant_get_string(parameter, nullptr) : nullptr;
+  vpn_plugin_handle_quick_action(g_action_get_name(G_ACTION(action)), server);
+}
+
+static const GActionEntry kQuickActions[] = {
+    {"connect", quick_action_cb, nullptr, nullptr, nullptr, {0}},
+    {"disconnect", quick_action_cb, nullptr, nullptr, nullptr, {0}},
+    {"toggle", quick_action_cb, nullptr, nullptr, nullptr, {0}},
+    {"select-server", quick_action_cb, "s", nullptr, nullptr, {0}},
+};
+
+// Removes a --connect, --disconnect, --toggle or --select-server=NAME (or
+// --select-server NAME) option from |arguments|, storing the action name
+// in |action| and the server in |server|. Other arguments are left for
+// Dart.
+static void take_quick_action(gchar** arguments, gchar** action,
+                              gchar** server) {
+  gchar** out = arguments;
+  for (gchar** argument = arguments; *argument != nullptr; argument++) {
+    const gchar* option = *argument;
+    if (g_strcmp0(option, "--connect") == 0 ||
+        g_strcmp0(option, "--disconnect") == 0 ||
+        g_strcmp0(option, "--toggle") == 0) {
+      g_free(*action);
+      *action = g_strdup(option + 2);
+      g_free(*argument);
+    } else if (g_str_has_prefix(option, "--select-server=")) {
+      g_free(*action);
+      g_free(*server);
+      *action = g_strdup("select-server");
+      *server = g_strdup(option + strlen("--select-server="));
+      g_free(*argument);
+    } else if (g_strcmp0(option, "--select-server") == 0 &&
+               argument[1] != nullptr) {
+      g_free(*action);
+      g_free(*server);
+      *action = g_strdup("select-server");
+      *server = argument[1];
+      g_free(*argument);
+      argument++;
+    } else {
+      *out++ = *argument;
+    }
+  }
+  *out = nullptr;
+}
+
 // Implements GApplication::local_command_line.
 static gboolean my_application_local_command_line(GApplication* application, gchar*** arguments, int* exit_status) {
   MyApplication* self = MY_APPLICATION(application);
   // Strip out the first argument as it is the binary name.
   self->dart_entrypoint_arguments = g_strdupv(*arguments + 1);
+  g_autofree gchar* action = nullptr;
+  g_autofree gchar* server = nullptr;
+  take_quick_action(self->dart_entrypoint_arguments, &action, &server);
 
   g_autoptr(GError) error = nullptr;
   if (!g_application_register(application, nullptr, &error)) {
@@ -74,18 +167,43 @@ static gboolean my_application_local_command_line(GApplication* application, gch
      *exit_status = 1;
      return TRUE;
   }
-
-  g_application_activate(application);
   *exit_status = 0;
 
+  GVariant* parameter = server != nullptr ? g_variant_new_string(server)
+                                          : nullptr;
+  if (g_application_get_is_remote(application)) {
+    // Another instance owns the engine: hand it the action, or ask it to
+    // show its window, and exit without starting Flutter.
+    if (action != nullptr) {
+      g_action_group_activate_action(G_ACTION_GROUP(application), action,
+                                     parameter);
+    } else {
+      g_application_activate(application);
+    }
+    GDBusConnection* connection =
+        g_application_get_dbus_connection(application);
+    if (connection != nullptr) {
+      g_dbus_connection_flush_sync(connection, nullptr, nullptr);
+    }
+    return TRUE;
+  }
+
+  g_application_activate(application);
+  if (action != nullptr) {
+    g_action_group_activate_action(G_ACTION_GROUP(application), action,
+                                   parameter);
+  }
   return TRUE;
 }
 
 // Implements GApplication::startup.
 static void my_application_startup(GApplication* application) {
-  //MyApplication* self = MY_APPLICATION(object);
-
-  // Perform any actions required at application startup.
+  // Only the primary instance starts up, so later launches that forward an
+  // action never load the VPN state. It is opened off the main thread
+  // while GTK builds the window.
+  vpn_plugin_prewarm();
+  g_action_map_add_action_entries(G_ACTION_MAP(application), kQuickActions,
+                                  G_N_ELEMENTS(kQuickActions), application);
 
   G_APPLICATION_CLASS(my_application_parent_class)->startup(application);
 }
@@ -123,8 +241,15 @@ MyApplication* my_application_new() {
   // the application to be recognized beyond its binary name.
   g_set_prgname(APPLICATION_ID);
 
+  // Unique: a later launch forwards its action to the running instance
+  // over D-Bus instead of starting a second engine and tunnel.
+#if GLIB_CHECK_VERSION(2, 74, 0)
+  GApplicationFlags flags = G_APPLICATION_DEFAULT_FLAGS;
+#else
+  GApplicationFlags flags = G_APPLICATION_FLAGS_NONE;
+#endif
   return MY_APPLICATION(g_object_new(my_application_get_type(),
                                      "application-id", APPLICATION_ID,
-                                     "flags", G_APPLICATION_NON_UNIQUE,
+                                     "flags", flags,
                                      nullptr));
 }
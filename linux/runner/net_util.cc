@@ -0,0 +1,305 @@
+#include "net_util.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Waits until |fd| is ready for |events| or |deadline_ms| passes.
+bool WaitFor(int fd, short events, int64_t deadline_ms) {
+  for (;;) {
+    int64_t remaining = deadline_ms - MonotonicNowMs();
+    if (remaining <= 0) {
+      errno = ETIMEDOUT;
+      return false;
+    }
+    struct pollfd pfd = {fd, events, 0};
+    int ready = poll(&pfd, 1, static_cast<int>(remaining));
+    if (ready > 0) {
+      return true;
+    }
+    if (ready < 0 && errno != EINTR) {
+      return false;
+    }
+  }
+}
+
+// Resolves |host|:|port| into |storage|. Numeric addresses never touch the
+// resolver.
+bool ResolveAddress(const std::string& host, uint16_t port,
+                    struct sockaddr_storage* storage, socklen_t* length) {
+  memset(storage, 0, sizeof(*storage));
+  auto* v4 = reinterpret_cast<struct sockaddr_in*>(storage);
+  if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(port);
+    *length = sizeof(*v4);
+    return true;
+  }
+  auto* v6 = reinterpret_cast<struct sockaddr_in6*>(storage);
+  if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(port);
+    *length = sizeof(*v6);
+    return true;
+  }
+
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* results = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &results) != 0 ||
+      results == nullptr) {
+    return false;
+  }
+  memcpy(storage, results->ai_addr, results->ai_addrlen);
+  *length = results->ai_addrlen;
+  freeaddrinfo(results);
+  if (storage->ss_family == AF_INET) {
+    v4->sin_port = htons(port);
+  } else {
+    v6->sin6_port = htons(port);
+  }
+  return true;
+}
+
+}  // namespace
+
+int64_t MonotonicNowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+int64_t MonotonicNowMs() { return MonotonicNowNs() / 1000000; }
+
+bool SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+std::vector<std::string> ResolveHostAddresses(const std::string& host) {
+  std::vector<std::string> addresses;
+  struct in6_addr numeric;
+  if (inet_pton(AF_INET, host.c_str(), &numeric) == 1 ||
+      inet_pton(AF_INET6, host.c_str(), &numeric) == 1) {
+    addresses.push_back(host);
+    return addresses;
+  }
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* results = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &results) != 0) {
+    return addresses;
+  }
+  for (struct addrinfo* result = results; result != nullptr;
+       result = result->ai_next) {
+    char text[INET6_ADDRSTRLEN] = {};
+    const void* address =
+        result->ai_family == AF_INET
+            ? static_cast<const void*>(
+                  &reinterpret_cast<struct sockaddr_in*>(result->ai_addr)
+                       ->sin_addr)
+            : static_cast<const void*>(
+                  &reinterpret_cast<struct sockaddr_in6*>(result->ai_addr)
+                       ->sin6_addr);
+    if ((result->ai_family == AF_INET || result->ai_family == AF_INET6) &&
+        inet_ntop(result->ai_family, address, text, sizeof(text)) !=
+            nullptr) {
+      std::string value(text);
+      if (std::find(addresses.begin(), addresses.end(), value) ==
+          addresses.end()) {
+        addresses.push_back(value);
+      }
+    }
+  }
+  freeaddrinfo(results);
+  return addresses;
+}
+
+int ConnectTcp(const std::string& host, uint16_t port, int timeout_ms) {
+  struct sockaddr_storage address;
+  socklen_t length = 0;
+  if (!ResolveAddress(host, port, &address, &length)) {
+    return -1;
+  }
+
+  int fd = socket(address.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                  0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&address), length) != 0) {
+    if (errno != EINPROGRESS ||
+        !WaitFor(fd, POLLOUT, MonotonicNowMs() + timeout_ms)) {
+      close(fd);
+      return -1;
+    }
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length);
+    if (error != 0) {
+      close(fd);
+      errno = error;
+      return -1;
+    }
+  }
+
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+  return fd;
+}
+
+int ListenTcp(const std::string& host, uint16_t port, uint16_t* bound_port) {
+  struct sockaddr_storage address;
+  socklen_t length = 0;
+  if (!ResolveAddress(host, port, &address, &length)) {
+    return -1;
+  }
+
+  int fd = socket(address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), length) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  if (bound_port != nullptr) {
+    length = sizeof(address);
+    getsockname(fd, reinterpret_cast<struct sockaddr*>(&address), &length);
+    *bound_port = ntohs(
+        address.ss_family == AF_INET
+            ? reinterpret_cast<struct sockaddr_in*>(&address)->sin_port
+            : reinterpret_cast<struct sockaddr_in6*>(&address)->sin6_port);
+  }
+  return fd;
+}
+
+bool ReadFull(int fd, void* buffer, size_t length, int64_t deadline_ms) {
+  auto* out = static_cast<uint8_t*>(buffer);
+  while (length > 0) {
+    if (!WaitFor(fd, POLLIN, deadline_ms)) {
+      return false;
+    }
+    ssize_t received = recv(fd, out, length, 0);
+    if (received == 0) {
+      errno = ECONNRESET;
+      return false;
+    }
+    if (received < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return false;
+    }
+    out += received;
+    length -= static_cast<size_t>(received);
+  }
+  return true;
+}
+
+bool WriteFull(int fd, const void* buffer, size_t length, int64_t deadline_ms) {
+  auto* in = static_cast<const uint8_t*>(buffer);
+  while (length > 0) {
+    if (!WaitFor(fd, POLLOUT, deadline_ms)) {
+      return false;
+    }
+    ssize_t sent = send(fd, in, length, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return false;
+    }
+    in += sent;
+    length -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+bool Socks5Connect(int fd, const std::string& host, uint16_t port,
+                   int timeout_ms) {
+  int64_t deadline = MonotonicNowMs() + timeout_ms;
+
+  // Greeting: version 5, one method, "no authentication".
+  std::vector<uint8_t> request = {0x05, 0x01, 0x00};
+  // Request: version 5, CONNECT, reserved.
+  request.insert(request.end(), {0x05, 0x01, 0x00});
+  uint8_t address[16];
+  if (inet_pton(AF_INET, host.c_str(), address) == 1) {
+    request.push_back(0x01);
+    request.insert(request.end(), address, address + 4);
+  } else if (inet_pton(AF_INET6, host.c_str(), address) == 1) {
+    request.push_back(0x04);
+    request.insert(request.end(), address, address + 16);
+  } else {
+    if (host.empty() || host.size() > 255) {
+      return false;
+    }
+    request.push_back(0x03);
+    request.push_back(static_cast<uint8_t>(host.size()));
+    request.insert(request.end(), host.begin(), host.end());
+  }
+  request.push_back(static_cast<uint8_t>(port >> 8));
+  request.push_back(static_cast<uint8_t>(port & 0xff));
+
+  if (!WriteFull(fd, request.data(), request.size(), deadline)) {
+    return false;
+  }
+
+  uint8_t method_reply[2];
+  if (!ReadFull(fd, method_reply, sizeof(method_reply), deadline) ||
+      method_reply[0] != 0x05 || method_reply[1] != 0x00) {
+    return false;
+  }
+
+  uint8_t reply[4];
+  if (!ReadFull(fd, reply, sizeof(reply), deadline) || reply[0] != 0x05 ||
+      reply[1] != 0x00) {
+    return false;
+  }
+
+  // Skip the bound address; callers never need it.
+  size_t remaining = 0;
+  switch (reply[3]) {
+    case 0x01:
+      remaining = 4 + 2;
+      break;
+    case 0x04:
+      remaining = 16 + 2;
+      break;
+    case 0x03: {
+      uint8_t name_length = 0;
+      if (!ReadFull(fd, &name_length, 1, deadline)) {
+        return false;
+      }
+      remaining = name_length + 2u;
+      break;
+    }
+    default:
+      return false;
+  }
+  uint8_t bound[258];
+  return ReadFull(fd, bound, remaining, deadline);
+}
@@ -0,0 +1,50 @@
+#ifndef RUNNER_NET_UTIL_H_
+#define RUNNER_NET_UTIL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Small socket helpers shared by the native VPN subsystems. All functions are
+// thread-safe and report failure through their return value; errno is left as
+// set by the failing call.
+
+// Returns CLOCK_MONOTONIC in nanoseconds.
+int64_t MonotonicNowNs();
+
+// Returns CLOCK_MONOTONIC in milliseconds.
+int64_t MonotonicNowMs();
+
+// Puts |fd| into non-blocking mode. Returns false on failure.
+bool SetNonBlocking(int fd);
+
+// Resolves |host| to every IPv4 and IPv6 address it has, in numeric form.
+// A numeric |host| never touches the resolver. Empty on failure.
+std::vector<std::string> ResolveHostAddresses(const std::string& host);
+
+// Opens a blocking TCP connection to |host|:|port|, giving up after
+// |timeout_ms|. |host| may be a numeric address or a name. Returns the
+// connected socket, or -1 on failure.
+int ConnectTcp(const std::string& host, uint16_t port, int timeout_ms);
+
+// Binds a TCP listening socket to |host|:|port|. A |port| of 0 picks an
+// ephemeral port; the chosen port is written to |bound_port| when it is not
+// null. Returns the listening socket, or -1 on failure.
+int ListenTcp(const std::string& host, uint16_t port, uint16_t* bound_port);
+
+// Reads exactly |length| bytes from blocking socket |fd| into |buffer|,
+// waiting at most until |deadline_ms| (MonotonicNowMs() based).
+bool ReadFull(int fd, void* buffer, size_t length, int64_t deadline_ms);
+
+// Writes all |length| bytes of |buffer| to blocking socket |fd|, waiting at
+// most until |deadline_ms| (MonotonicNowMs() based).
+bool WriteFull(int fd, const void* buffer, size_t length, int64_t deadline_ms);
+
+// Performs a SOCKS5 no-auth CONNECT handshake to |host|:|port| on the already
+// connected proxy socket |fd|. The greeting and the request are pipelined in
+// a single write. Returns true when the proxy reports success.
+bool Socks5Connect(int fd, const std::string& host, uint16_t port,
+                   int timeout_ms);
+
+#endif  // RUNNER_NET_UTIL_H_
@@ -0,0 +1,399 @@
+#include "network_watcher.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include "log_ring.h"
+#include "net_util.h"
+
+namespace {
+
+// Not in every libc's <net/if_arp.h>; used by cellular modems.
+constexpr int kArphrdRawIp = 519;
+constexpr int kReceiveBufferBytes = 1 << 20;
+
+std::string ReadSmallFile(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::string();
+  }
+  char buffer[1024];
+  ssize_t length = read(fd, buffer, sizeof(buffer));
+  close(fd);
+  return length > 0 ? std::string(buffer, static_cast<size_t>(length))
+                    : std::string();
+}
+
+bool Exists(const std::string& path) { return access(path.c_str(), F_OK) == 0; }
+
+// Classifies |name| from sysfs the way NetworkManager would type it.
+NetworkKind Classify(const std::string& name) {
+  std::string base = "/sys/class/net/" + name;
+  std::string devtype;
+  std::string uevent = ReadSmallFile(base + "/uevent");
+  size_t start = uevent.find("DEVTYPE=");
+  if (start != std::string::npos) {
+    start += 8;
+    devtype = uevent.substr(start, uevent.find('\n', start) - start);
+  }
+  if (devtype == "wlan" || Exists(base + "/wireless") ||
+      Exists(base + "/phy80211")) {
+    return NetworkKind::kWifi;
+  }
+  if (devtype == "wwan") {
+    return NetworkKind::kMobile;
+  }
+  if (devtype == "wireguard" || Exists(base + "/tun_flags")) {
+    return NetworkKind::kVpn;
+  }
+  switch (atoi(ReadSmallFile(base + "/type").c_str())) {
+    case ARPHRD_ETHER:
+      return NetworkKind::kEthernet;
+    case kArphrdRawIp:
+      return NetworkKind::kMobile;
+    case ARPHRD_NONE:
+      // Point-to-point tunnels without a link layer.
+      return NetworkKind::kVpn;
+    default:
+      return NetworkKind::kOther;
+  }
+}
+
+// Dumps |type| objects of |family| and passes each reply to |on_message|.
+bool Dump(int fd, uint16_t type, uint8_t family, size_t body_length,
+          const std::function<void(const nlmsghdr*)>& on_message) {
+  static std::atomic<uint32_t> next_sequence{1};
+  alignas(nlmsghdr) uint8_t request[NLMSG_SPACE(sizeof(rtmsg))] = {};
+  auto* header = reinterpret_cast<nlmsghdr*>(request);
+  header->nlmsg_len = NLMSG_LENGTH(body_length);
+  header->nlmsg_type = type;
+  header->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  header->nlmsg_seq = next_sequence++;
+  // rtmsg and ifaddrmsg both start with the family.
+  *static_cast<uint8_t*>(NLMSG_DATA(header)) = family;
+  struct sockaddr_nl kernel = {};
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(fd, header, header->nlmsg_len, 0,
+             reinterpret_cast<struct sockaddr*>(&kernel),
+             sizeof(kernel)) < 0) {
+    return false;
+  }
+
+  alignas(nlmsghdr) uint8_t buffer[16384];
+  for (;;) {
+    ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    int remaining = static_cast<int>(length);
+    for (auto* reply = reinterpret_cast<const nlmsghdr*>(buffer);
+         NLMSG_OK(reply, remaining); reply = NLMSG_NEXT(reply, remaining)) {
+      if (reply->nlmsg_seq != header->nlmsg_seq) {
+        continue;
+      }
+      if (reply->nlmsg_type == NLMSG_DONE) {
+        return true;
+      }
+      if (reply->nlmsg_type == NLMSG_ERROR) {
+        return false;
+      }
+      on_message(reply);
+    }
+  }
+}
+
+std::string FormatAddress(int family, const void* data) {
+  char text[INET6_ADDRSTRLEN];
+  return inet_ntop(family, data, text, sizeof(text)) != nullptr
+             ? std::string(text)
+             : std::string();
+}
+
+struct DefaultRoute {
+  int family = AF_UNSPEC;
+  int interface_index = 0;
+  uint32_t metric = 0;
+  std::string gateway;
+};
+
+// IPv4 first, as that is what most proxy servers are reached over, then
+// the lowest metric.
+bool Preferred(const DefaultRoute& a, const DefaultRoute& b) {
+  if (a.family != b.family) {
+    return a.family == AF_INET;
+  }
+  return a.metric < b.metric;
+}
+
+}  // namespace
+
+const char* NetworkKindName(NetworkKind kind) {
+  switch (kind) {
+    case NetworkKind::kNone:
+      return "none";
+    case NetworkKind::kEthernet:
+      return "ethernet";
+    case NetworkKind::kWifi:
+      return "wifi";
+    case NetworkKind::kMobile:
+      return "mobile";
+    case NetworkKind::kVpn:
+      return "vpn";
+    case NetworkKind::kOther:
+      return "other";
+  }
+  return "other";
+}
+
+bool NetworkState::SameNetwork(const NetworkState& other) const {
+  return online == other.online && interface == other.interface &&
+         kind == other.kind && gateway == other.gateway &&
+         addresses == other.addresses;
+}
+
+NetworkWatcher::NetworkWatcher(const NetworkWatcherOptions& options,
+                               ChangeCallback on_change)
+    : options_(options), on_change_(std::move(on_change)) {}
+
+NetworkWatcher::~NetworkWatcher() { Stop(); }
+
+bool NetworkWatcher::Start() {
+  if (thread_.joinable()) {
+    return true;
+  }
+  netlink_fd_ = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                       NETLINK_ROUTE);
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  struct sockaddr_nl local = {};
+  local.nl_family = AF_NETLINK;
+  local.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+                    RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+  if (netlink_fd_ < 0 || wake_fd_ < 0 ||
+      bind(netlink_fd_, reinterpret_cast<struct sockaddr*>(&local),
+           sizeof(local)) != 0) {
+    WriteLog(LogLevel::kWarning, "network",
+             "Cannot watch network changes: " + std::string(strerror(errno)));
+    Stop();
+    return false;
+  }
+  // A dock or undock can bring a few hundred notifications at once.
+  int size = kReceiveBufferBytes;
+  setsockopt(netlink_fd_, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  // Subscribed first, so a change during the read is not missed.
+  NetworkState state = Read(options_.ignored_interfaces);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    state_ = state;
+  }
+  thread_ = std::thread([this] { Run(); });
+  return true;
+}
+
+void NetworkWatcher::Stop() {
+  if (thread_.joinable()) {
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) == sizeof(one)) {
+      thread_.join();
+    } else {
+      thread_.detach();
+    }
+  }
+  if (netlink_fd_ >= 0) {
+    close(netlink_fd_);
+    netlink_fd_ = -1;
+  }
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+    wake_fd_ = -1;
+  }
+}
+
+NetworkState NetworkWatcher::state() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return state_;
+}
+
+NetworkState NetworkWatcher::Read(const std::vector<std::string>& ignored) {
+  NetworkState state;
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    return state;
+  }
+
+  std::vector<DefaultRoute> routes;
+  Dump(fd, RTM_GETROUTE, AF_UNSPEC, sizeof(rtmsg), [&](const nlmsghdr* reply) {
+    const rtmsg* route = static_cast<const rtmsg*>(NLMSG_DATA(reply));
+    // Carrier loss leaves IPv4 routes in place, flagged.
+    if (reply->nlmsg_type != RTM_NEWROUTE || route->rtm_dst_len != 0 ||
+        route->rtm_type != RTN_UNICAST ||
+        (route->rtm_flags & RTNH_F_LINKDOWN) != 0) {
+      return;
+    }
+    DefaultRoute candidate;
+    candidate.family = route->rtm_family;
+    uint32_t table = route->rtm_table;
+    int length = RTM_PAYLOAD(reply);
+    for (const rtattr* attr = RTM_RTA(route); RTA_OK(attr, length);
+         attr = RTA_NEXT(attr, length)) {
+      switch (attr->rta_type) {
+        case RTA_TABLE:
+          table = *static_cast<const uint32_t*>(RTA_DATA(attr));
+          break;
+        case RTA_OIF:
+          candidate.interface_index =
+              *static_cast<const int*>(RTA_DATA(attr));
+          break;
+        case RTA_PRIORITY:
+          candidate.metric = *static_cast<const uint32_t*>(RTA_DATA(attr));
+          break;
+        case RTA_GATEWAY:
+          candidate.gateway = FormatAddress(route->rtm_family, RTA_DATA(attr));
+          break;
+        case RTA_MULTIPATH: {
+          // The first hop stands for the group.
+          const auto* hop = static_cast<const rtnexthop*>(RTA_DATA(attr));
+          if (RTA_PAYLOAD(attr) >= sizeof(*hop) &&
+              (hop->rtnh_flags & RTNH_F_LINKDOWN) == 0) {
+            candidate.interface_index = hop->rtnh_ifindex;
+          }
+          break;
+        }
+      }
+    }
+    if (table == RT_TABLE_MAIN && candidate.interface_index > 0) {
+      routes.push_back(candidate);
+    }
+  });
+  std::sort(routes.begin(), routes.end(), Preferred);
+
+  for (const DefaultRoute& route : routes) {
+    char name[IF_NAMESIZE];
+    if (if_indextoname(static_cast<unsigned>(route.interface_index), name) ==
+            nullptr ||
+        std::find(ignored.begin(), ignored.end(), name) != ignored.end()) {
+      continue;
+    }
+    std::string operstate =
+        ReadSmallFile(std::string("/sys/class/net/") + name + "/operstate");
+    if (operstate.compare(0, 4, "down") == 0) {
+      continue;
+    }
+    state.online = true;
+    state.interface = name;
+    state.kind = Classify(name);
+    state.gateway = route.gateway;
+
+    Dump(fd, RTM_GETADDR, AF_UNSPEC, sizeof(ifaddrmsg),
+         [&](const nlmsghdr* reply) {
+           const ifaddrmsg* address =
+               static_cast<const ifaddrmsg*>(NLMSG_DATA(reply));
+           if (reply->nlmsg_type != RTM_NEWADDR ||
+               static_cast<int>(address->ifa_index) != route.interface_index ||
+               address->ifa_scope != RT_SCOPE_UNIVERSE) {
+             return;
+           }
+           // On point-to-point links IFA_ADDRESS is the peer and
+           // IFA_LOCAL the interface's own address.
+           std::string local;
+           int length = IFA_PAYLOAD(reply);
+           for (const rtattr* attr = IFA_RTA(address); RTA_OK(attr, length);
+                attr = RTA_NEXT(attr, length)) {
+             if (attr->rta_type == IFA_LOCAL ||
+                 (attr->rta_type == IFA_ADDRESS && local.empty())) {
+               local = FormatAddress(address->ifa_family, RTA_DATA(attr));
+             }
+           }
+           if (!local.empty()) {
+             state.addresses.push_back(local);
+           }
+         });
+    std::sort(state.addresses.begin(), state.addresses.end());
+    break;
+  }
+  close(fd);
+  return state;
+}
+
+void NetworkWatcher::Run() {
+  bool pending = false;
+  int64_t first_ms = 0;
+  int64_t last_ms = 0;
+  alignas(nlmsghdr) uint8_t buffer[16384];
+  for (;;) {
+    int64_t due_ms = std::min(last_ms + options_.debounce_ms,
+                              first_ms + options_.max_delay_ms);
+    int timeout = -1;
+    if (pending) {
+      timeout = static_cast<int>(
+          std::max<int64_t>(0, due_ms - MonotonicNowMs()));
+    }
+    struct pollfd fds[2] = {{netlink_fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+    if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+      return;
+    }
+    if (fds[1].revents != 0) {
+      return;
+    }
+    if (fds[0].revents != 0) {
+      // The notifications only say that something changed; the state is
+      // read back whole once they settle. An overrun means the same.
+      for (;;) {
+        ssize_t length = recv(netlink_fd_, buffer, sizeof(buffer), 0);
+        if (length < 0 && (errno == ENOBUFS || errno == EINTR)) {
+          continue;
+        }
+        if (length <= 0) {
+          break;
+        }
+      }
+      last_ms = MonotonicNowMs();
+      if (!pending) {
+        pending = true;
+        first_ms = last_ms;
+      }
+      continue;
+    }
+    if (!pending || MonotonicNowMs() < due_ms) {
+      continue;
+    }
+    pending = false;
+
+    NetworkState state = Read(options_.ignored_interfaces);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Most bursts, the tunnel's own routes included, leave the default
+      // route where it was.
+      if (state.SameNetwork(state_)) {
+        continue;
+      }
+      state.generation = state_.generation + 1;
+      state_ = state;
+    }
+    WriteLog(LogLevel::kInfo, "network",
+             state.online ? std::string("Default route via ") +
+                                state.interface + " (" +
+                                NetworkKindName(state.kind) + ")"
+                          : std::string("No default route"));
+    if (on_change_) {
+      on_change_(state);
+    }
+  }
+}
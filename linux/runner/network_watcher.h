@@ -0,0 +1,94 @@
+#ifndef RUNNER_NETWORK_WATCHER_H_
+#define RUNNER_NETWORK_WATCHER_H_
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What carries the default route, in the terms connectivity_plus uses.
+enum class NetworkKind {
+  kNone,
+  kEthernet,
+  kWifi,
+  kMobile,
+  kVpn,
+  kOther,
+};
+
+// Returns the lower-case name Dart expects for |kind|, e.g. "ethernet".
+const char* NetworkKindName(NetworkKind kind);
+
+struct NetworkState {
+  // There is a default route through an interface that is up.
+  bool online = false;
+  // The interface of the preferred default route, IPv4 before IPv6.
+  std::string interface;
+  NetworkKind kind = NetworkKind::kNone;
+  // The default route's gateway and the interface's addresses, sorted. A
+  // roam between access points keeps the interface but changes these.
+  std::string gateway;
+  std::vector<std::string> addresses;
+  // Bumped for every change reported.
+  uint64_t generation = 0;
+
+  // Equal apart from |generation|.
+  bool SameNetwork(const NetworkState& other) const;
+};
+
+struct NetworkWatcherOptions {
+  // Interfaces never taken for the default one, such as the tunnel's own
+  // device, whose half-default routes are not default routes anyway.
+  std::vector<std::string> ignored_interfaces;
+  // The state is read again once netlink has been quiet for this long...
+  int debounce_ms = 40;
+  // ...or this long after the first event of a burst, whichever is first.
+  int max_delay_ms = 200;
+};
+
+// Follows the host's network through rtnetlink: link, IPv4 and IPv6
+// address and route notifications wake a thread that, once a burst has
+// settled, reads the default route and classifies its interface from
+// sysfs. Changes are reported within tens of milliseconds, where polling
+// would notice them only when traffic stalls.
+class NetworkWatcher {
+ public:
+  // Runs on the watcher thread.
+  using ChangeCallback = std::function<void(const NetworkState& state)>;
+
+  NetworkWatcher(const NetworkWatcherOptions& options,
+                 ChangeCallback on_change);
+  ~NetworkWatcher();
+
+  // Prevent copying.
+  NetworkWatcher(NetworkWatcher const&) = delete;
+  NetworkWatcher& operator=(NetworkWatcher const&) = delete;
+
+  // Subscribes to the notifications, reads the current state and starts
+  // the thread. False when netlink is unavailable.
+  bool Start();
+
+  void Stop();
+
+  // The state as of the last change; read once by Start().
+  NetworkState state() const;
+
+  // Reads the current state from the kernel, blocking.
+  static NetworkState Read(const std::vector<std::string>& ignored);
+
+ private:
+  void Run();
+
+  NetworkWatcherOptions options_;
+  ChangeCallback on_change_;
+  int netlink_fd_ = -1;
+  int wake_fd_ = -1;
+  std::thread thread_;
+
+  mutable std::mutex mutex_;
+  NetworkState state_;
+};
+
+#endif  // RUNNER_NETWORK_WATCHER_H_
@@ -0,0 +1,242 @@
+#include "packet_headers.h"
+
+#include <sys/socket.h>
+
+#include <cstring>
+
+namespace {
+
+uint16_t Load16(const uint8_t* p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t Load32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+void Store16(uint8_t* p, uint16_t value) {
+  p[0] = static_cast<uint8_t>(value >> 8);
+  p[1] = static_cast<uint8_t>(value);
+}
+
+void Store32(uint8_t* p, uint32_t value) {
+  p[0] = static_cast<uint8_t>(value >> 24);
+  p[1] = static_cast<uint8_t>(value >> 16);
+  p[2] = static_cast<uint8_t>(value >> 8);
+  p[3] = static_cast<uint8_t>(value);
+}
+
+// Writes the IPv4 or IPv6 header in front of a transport segment of
+// |segment_length| bytes.
+void WriteIpHeader(uint8_t* ip, int family, const uint8_t* src,
+                   const uint8_t* dst, uint8_t protocol,
+                   size_t segment_length) {
+  if (family == AF_INET6) {
+    Store32(ip, 0x60000000);
+    Store16(ip + 4, static_cast<uint16_t>(segment_length));
+    ip[6] = protocol;
+    ip[7] = 64;
+    memcpy(ip + 8, src, 16);
+    memcpy(ip + 24, dst, 16);
+  } else {
+    ip[0] = 0x45;
+    ip[1] = 0;
+    Store16(ip + 2, static_cast<uint16_t>(kIpv4HeaderSize + segment_length));
+    Store16(ip + 4, 0);
+    // Don't fragment.
+    Store16(ip + 6, 0x4000);
+    ip[8] = 64;
+    ip[9] = protocol;
+    Store16(ip + 10, 0);
+    memcpy(ip + 12, src, 4);
+    memcpy(ip + 16, dst, 4);
+    uint16_t ip_checksum =
+        ChecksumFinish(ChecksumAdd(ip, kIpv4HeaderSize, 0));
+    memcpy(ip + 10, &ip_checksum, sizeof(ip_checksum));
+  }
+}
+
+}  // namespace
+
+size_t AddressLength(int family) { return family == AF_INET6 ? 16 : 4; }
+
+bool ParsePacket(const uint8_t* packet, size_t length, PacketInfo* info) {
+  if (length < 1) {
+    return false;
+  }
+
+  size_t l3_length = 0;
+  switch (packet[0] >> 4) {
+    case 4: {
+      size_t header_length = (packet[0] & 0x0f) * 4u;
+      if (length < kIpv4HeaderSize || header_length < kIpv4HeaderSize ||
+          length < header_length) {
+        return false;
+      }
+      // Fragments cannot be relayed without reassembly.
+      if ((Load16(packet + 6) & 0x3fff) != 0) {
+        return false;
+      }
+      l3_length = Load16(packet + 2);
+      if (l3_length < header_length || l3_length > length) {
+        return false;
+      }
+      info->family = AF_INET;
+      info->protocol = packet[9];
+      info->src = packet + 12;
+      info->dst = packet + 16;
+      info->l4_offset = header_length;
+      break;
+    }
+    case 6: {
+      if (length < kIpv6HeaderSize) {
+        return false;
+      }
+      l3_length = kIpv6HeaderSize + Load16(packet + 4);
+      if (l3_length > length) {
+        return false;
+      }
+      info->family = AF_INET6;
+      info->protocol = packet[6];
+      info->src = packet + 8;
+      info->dst = packet + 24;
+      info->l4_offset = kIpv6HeaderSize;
+      break;
+    }
+    default:
+      return false;
+  }
+
+  const uint8_t* l4 = packet + info->l4_offset;
+  size_t l4_length = l3_length - info->l4_offset;
+  if (info->protocol == kIpProtoTcp) {
+    if (l4_length < kTcpHeaderSize) {
+      return false;
+    }
+    size_t header_length = (l4[12] >> 4) * 4u;
+    if (header_length < kTcpHeaderSize || header_length > l4_length) {
+      return false;
+    }
+    info->src_port = Load16(l4);
+    info->dst_port = Load16(l4 + 2);
+    info->seq = Load32(l4 + 4);
+    info->ack = Load32(l4 + 8);
+    info->tcp_flags = l4[13];
+    info->window = Load16(l4 + 14);
+    info->tcp_options = l4 + kTcpHeaderSize;
+    info->tcp_options_length = header_length - kTcpHeaderSize;
+    info->payload_offset = info->l4_offset + header_length;
+    info->payload_length = l4_length - header_length;
+    return true;
+  }
+  if (info->protocol == kIpProtoUdp) {
+    if (l4_length < kUdpHeaderSize) {
+      return false;
+    }
+    size_t udp_length = Load16(l4 + 4);
+    if (udp_length < kUdpHeaderSize || udp_length > l4_length) {
+      return false;
+    }
+    info->src_port = Load16(l4);
+    info->dst_port = Load16(l4 + 2);
+    info->payload_offset = info->l4_offset + kUdpHeaderSize;
+    info->payload_length = udp_length - kUdpHeaderSize;
+    return true;
+  }
+  return false;
+}
+
+void ParsePackets(const uint8_t* const* packets, const size_t* lengths,
+                  size_t count, PacketInfo* infos, bool* parsed) {
+  constexpr size_t kPrefetchAhead = 4;
+  for (size_t i = 0; i < count && i < kPrefetchAhead; i++) {
+    __builtin_prefetch(packets[i]);
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (i + kPrefetchAhead < count) {
+      __builtin_prefetch(packets[i + kPrefetchAhead]);
+    }
+    parsed[i] = ParsePacket(packets[i], lengths[i], &infos[i]);
+  }
+}
+
+uint32_t PseudoHeaderSum(int family, const uint8_t* src, const uint8_t* dst,
+                         uint8_t protocol, uint32_t l4_length) {
+  size_t address_length = AddressLength(family);
+  uint32_t sum = ChecksumAdd(src, address_length, 0);
+  sum = ChecksumAdd(dst, address_length, sum);
+  uint8_t trailer[8] = {0};
+  if (family == AF_INET6) {
+    Store32(trailer, l4_length);
+    trailer[7] = protocol;
+    return ChecksumAdd(trailer, 8, sum);
+  }
+  trailer[1] = protocol;
+  Store16(trailer + 2, static_cast<uint16_t>(l4_length));
+  return ChecksumAdd(trailer, 4, sum);
+}
+
+uint8_t* WriteTcpHeaders(uint8_t* payload, size_t payload_length,
+                         const TcpSegmentSpec& spec, size_t* packet_length) {
+  size_t tcp_length = kTcpHeaderSize + spec.options_length;
+  size_t ip_length =
+      spec.family == AF_INET6 ? kIpv6HeaderSize : kIpv4HeaderSize;
+  uint8_t* tcp = payload - tcp_length;
+  uint8_t* ip = tcp - ip_length;
+  size_t segment_length = tcp_length + payload_length;
+
+  Store16(tcp, spec.src_port);
+  Store16(tcp + 2, spec.dst_port);
+  Store32(tcp + 4, spec.seq);
+  Store32(tcp + 8, spec.ack);
+  tcp[12] = static_cast<uint8_t>((tcp_length / 4) << 4);
+  tcp[13] = spec.flags;
+  Store16(tcp + 14, spec.window);
+  Store16(tcp + 16, 0);
+  Store16(tcp + 18, 0);
+  if (spec.options_length > 0) {
+    memcpy(tcp + kTcpHeaderSize, spec.options, spec.options_length);
+  }
+
+  uint32_t sum = PseudoHeaderSum(spec.family, spec.src, spec.dst, kIpProtoTcp,
+                                 static_cast<uint32_t>(segment_length));
+  uint16_t checksum =
+      spec.partial_checksum
+          ? static_cast<uint16_t>(sum)
+          : ChecksumFinish(ChecksumAdd(tcp, segment_length, sum));
+  memcpy(tcp + 16, &checksum, sizeof(checksum));
+
+  WriteIpHeader(ip, spec.family, spec.src, spec.dst, kIpProtoTcp,
+                segment_length);
+  *packet_length = ip_length + segment_length;
+  return ip;
+}
+
+uint8_t* WriteUdpHeaders(uint8_t* payload, size_t payload_length,
+                         const UdpDatagramSpec& spec, size_t* packet_length) {
+  size_t ip_length =
+      spec.family == AF_INET6 ? kIpv6HeaderSize : kIpv4HeaderSize;
+  uint8_t* udp = payload - kUdpHeaderSize;
+  uint8_t* ip = udp - ip_length;
+  size_t datagram_length = kUdpHeaderSize + payload_length;
+
+  Store16(udp, spec.src_port);
+  Store16(udp + 2, spec.dst_port);
+  Store16(udp + 4, static_cast<uint16_t>(datagram_length));
+  Store16(udp + 6, 0);
+  uint32_t sum = PseudoHeaderSum(spec.family, spec.src, spec.dst, kIpProtoUdp,
+                                 static_cast<uint32_t>(datagram_length));
+  uint16_t checksum = ChecksumFinish(ChecksumAdd(udp, datagram_length, sum));
+  // A computed zero is sent as all ones; zero means "no checksum".
+  if (checksum == 0) {
+    checksum = 0xffff;
+  }
+  memcpy(udp + 6, &checksum, sizeof(checksum));
+
+  WriteIpHeader(ip, spec.family, spec.src, spec.dst, kIpProtoUdp,
+                datagram_length);
+  *packet_length = ip_length + datagram_length;
+  return ip;
+}
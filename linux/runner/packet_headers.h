@@ -0,0 +1,111 @@
+#ifndef RUNNER_PACKET_HEADERS_H_
+#define RUNNER_PACKET_HEADERS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "packet_kernels.h"
+
+// IPv4/IPv6 + TCP/UDP header parsing and construction for the TUN packet
+// engine. All multi-byte fields in the structures below are in host order.
+
+constexpr size_t kIpv4HeaderSize = 20;
+constexpr size_t kIpv6HeaderSize = 40;
+constexpr size_t kTcpHeaderSize = 20;
+constexpr size_t kUdpHeaderSize = 8;
+
+// Space reserved in front of every payload so the engine can write headers
+// in place instead of copying the payload behind them. Fits an IPv6 header
+// plus a TCP header with the largest option block, rounded up so payloads
+// stay cache-line aligned.
+constexpr size_t kPacketHeadroom = 128;
+
+constexpr uint8_t kIpProtoTcp = 6;
+constexpr uint8_t kIpProtoUdp = 17;
+
+constexpr uint8_t kTcpFin = 0x01;
+constexpr uint8_t kTcpSyn = 0x02;
+constexpr uint8_t kTcpRst = 0x04;
+constexpr uint8_t kTcpPsh = 0x08;
+constexpr uint8_t kTcpAck = 0x10;
+
+// A parsed view into a packet; pointers refer to the packet itself.
+struct PacketInfo {
+  // AF_INET or AF_INET6.
+  int family;
+  uint8_t protocol;
+  const uint8_t* src;
+  const uint8_t* dst;
+  size_t l4_offset;
+  size_t payload_offset;
+  size_t payload_length;
+  uint16_t src_port;
+  uint16_t dst_port;
+
+  // TCP only.
+  uint32_t seq;
+  uint32_t ack;
+  uint8_t tcp_flags;
+  uint16_t window;
+  const uint8_t* tcp_options;
+  size_t tcp_options_length;
+};
+
+// Parses the IP header and, for TCP and UDP, the transport header of
+// |packet|. Returns false for truncated or unsupported packets (fragments,
+// IPv6 extension headers, other protocols).
+bool ParsePacket(const uint8_t* packet, size_t length, PacketInfo* info);
+
+// ParsePacket() over the |count| packets of a read batch, in one pass that
+// prefetches each packet's headers ahead of parsing them. |parsed|[i] is
+// set to the result for packet i.
+void ParsePackets(const uint8_t* const* packets, const size_t* lengths,
+                  size_t count, PacketInfo* infos, bool* parsed);
+
+// Address length in bytes for |family|.
+size_t AddressLength(int family);
+
+// The running sum of the IPv4/IPv6 pseudo header for |protocol| with a
+// transport segment of |l4_length| bytes.
+uint32_t PseudoHeaderSum(int family, const uint8_t* src, const uint8_t* dst,
+                         uint8_t protocol, uint32_t l4_length);
+
+struct TcpSegmentSpec {
+  int family;
+  const uint8_t* src;
+  const uint8_t* dst;
+  uint16_t src_port;
+  uint16_t dst_port;
+  uint32_t seq;
+  uint32_t ack;
+  uint8_t flags;
+  uint16_t window;
+  // Options must be padded to a multiple of four bytes.
+  const uint8_t* options;
+  size_t options_length;
+  // Leave the TCP checksum for the receiver to complete over the segment,
+  // with only the pseudo header summed in, as checksum offload expects.
+  bool partial_checksum = false;
+};
+
+// Writes IP and TCP headers for |spec| immediately in front of |payload|,
+// which must be preceded by at least kPacketHeadroom writable bytes, and
+// fills in both checksums, the TCP one partially if |spec| asks for that.
+// Returns the start of the packet and stores its total length in
+// |packet_length|.
+uint8_t* WriteTcpHeaders(uint8_t* payload, size_t payload_length,
+                         const TcpSegmentSpec& spec, size_t* packet_length);
+
+struct UdpDatagramSpec {
+  int family;
+  const uint8_t* src;
+  const uint8_t* dst;
+  uint16_t src_port;
+  uint16_t dst_port;
+};
+
+// Same as WriteTcpHeaders() for a UDP datagram.
+uint8_t* WriteUdpHeaders(uint8_t* payload, size_t payload_length,
+                         const UdpDatagramSpec& spec, size_t* packet_length);
+
+#endif  // RUNNER_PACKET_HEADERS_H_
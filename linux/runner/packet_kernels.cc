@@ -0,0 +1,206 @@
+#include "packet_kernels.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Folds a wide one's complement sum down to sixteen bits.
+uint32_t Fold(uint64_t wide) {
+  while (wide >> 16) {
+    wide = (wide & 0xffff) + (wide >> 16);
+  }
+  return static_cast<uint32_t>(wide);
+}
+
+// The vector kernels all sum 32-bit words into 64-bit lanes, like the
+// scalar one, so no carry is ever lost and one fold at the end suffices;
+// the tail shorter than a vector block is left to the scalar kernel.
+
+#if defined(__x86_64__)
+// SSE2 is part of x86-64, so this needs no check.
+uint32_t ChecksumAddSse2(const void* data, size_t length, uint32_t sum) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i low = zero;
+  __m128i high = zero;
+  while (length >= 32) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+    low = _mm_add_epi64(low, _mm_unpacklo_epi32(a, zero));
+    high = _mm_add_epi64(high, _mm_unpackhi_epi32(a, zero));
+    low = _mm_add_epi64(low, _mm_unpacklo_epi32(b, zero));
+    high = _mm_add_epi64(high, _mm_unpackhi_epi32(b, zero));
+    p += 32;
+    length -= 32;
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes),
+                   _mm_add_epi64(low, high));
+  uint64_t wide = uint64_t{sum} + Fold(lanes[0]) + Fold(lanes[1]);
+  return ChecksumAddScalar(p, length, Fold(wide));
+}
+
+__attribute__((target("avx2"))) uint32_t ChecksumAddAvx2(const void* data,
+                                                         size_t length,
+                                                         uint32_t sum) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i low = zero;
+  __m256i high = zero;
+  while (length >= 64) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+    low = _mm256_add_epi64(low, _mm256_unpacklo_epi32(a, zero));
+    high = _mm256_add_epi64(high, _mm256_unpackhi_epi32(a, zero));
+    low = _mm256_add_epi64(low, _mm256_unpacklo_epi32(b, zero));
+    high = _mm256_add_epi64(high, _mm256_unpackhi_epi32(b, zero));
+    p += 64;
+    length -= 64;
+  }
+  if (length >= 32) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    low = _mm256_add_epi64(low, _mm256_unpacklo_epi32(a, zero));
+    high = _mm256_add_epi64(high, _mm256_unpackhi_epi32(a, zero));
+    p += 32;
+    length -= 32;
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes),
+                      _mm256_add_epi64(low, high));
+  uint64_t wide = uint64_t{sum} + Fold(lanes[0]) + Fold(lanes[1]) +
+                  Fold(lanes[2]) + Fold(lanes[3]);
+  return ChecksumAddScalar(p, length, Fold(wide));
+}
+#elif defined(__aarch64__)
+// NEON is part of AArch64, so this needs no check.
+uint32_t ChecksumAddNeon(const void* data, size_t length, uint32_t sum) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  uint64x2_t low = vdupq_n_u64(0);
+  uint64x2_t high = vdupq_n_u64(0);
+  while (length >= 32) {
+    // Pairwise add-and-accumulate widens each pair of words into a lane.
+    low = vpadalq_u32(low, vreinterpretq_u32_u8(vld1q_u8(p)));
+    high = vpadalq_u32(high, vreinterpretq_u32_u8(vld1q_u8(p + 16)));
+    p += 32;
+    length -= 32;
+  }
+  uint64x2_t lanes = vaddq_u64(low, high);
+  uint64_t wide = uint64_t{sum} + Fold(vgetq_lane_u64(lanes, 0)) +
+                  Fold(vgetq_lane_u64(lanes, 1));
+  return ChecksumAddScalar(p, length, Fold(wide));
+}
+#endif
+
+ChecksumKernel PickKernel() {
+  std::vector<ChecksumKernel> kernels = SupportedChecksumKernels();
+  return kernels.back();
+}
+
+void Store16(uint8_t* p, uint16_t value) {
+  p[0] = static_cast<uint8_t>(value >> 8);
+  p[1] = static_cast<uint8_t>(value);
+}
+
+void Store32(uint8_t* p, uint32_t value) {
+  p[0] = static_cast<uint8_t>(value >> 24);
+  p[1] = static_cast<uint8_t>(value >> 16);
+  p[2] = static_cast<uint8_t>(value >> 8);
+  p[3] = static_cast<uint8_t>(value);
+}
+
+}  // namespace
+
+uint32_t ChecksumAddScalar(const void* data, size_t length, uint32_t sum) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  uint64_t wide = sum;
+  while (length >= 4) {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    wide += word;
+    p += 4;
+    length -= 4;
+  }
+  if (length >= 2) {
+    uint16_t half;
+    memcpy(&half, p, sizeof(half));
+    wide += half;
+    p += 2;
+    length -= 2;
+  }
+  if (length > 0) {
+    // Pad the odd byte with a zero byte, in memory order.
+    uint16_t half = 0;
+    memcpy(&half, p, 1);
+    wide += half;
+  }
+  return Fold(wide);
+}
+
+std::vector<ChecksumKernel> SupportedChecksumKernels() {
+  std::vector<ChecksumKernel> kernels;
+  kernels.push_back({"scalar", ChecksumAddScalar});
+#if defined(__x86_64__)
+  kernels.push_back({"sse2", ChecksumAddSse2});
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({"avx2", ChecksumAddAvx2});
+  }
+#elif defined(__aarch64__)
+  kernels.push_back({"neon", ChecksumAddNeon});
+#endif
+  return kernels;
+}
+
+const ChecksumKernel& ActiveChecksumKernel() {
+  static const ChecksumKernel kernel = PickKernel();
+  return kernel;
+}
+
+uint32_t ChecksumAdd(const void* data, size_t length, uint32_t sum) {
+  // Short inputs, such as pseudo headers, are not worth a vector pass.
+  if (length < 64) {
+    return ChecksumAddScalar(data, length, sum);
+  }
+  return ActiveChecksumKernel().add(data, length, sum);
+}
+
+uint16_t ChecksumFinish(uint32_t sum) {
+  return static_cast<uint16_t>(~Fold(sum));
+}
+
+uint16_t ChecksumReplace(uint16_t checksum, const void* old_data,
+                         const void* new_data, size_t length) {
+  // RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m').
+  const uint8_t* old_bytes = static_cast<const uint8_t*>(old_data);
+  uint64_t wide = static_cast<uint16_t>(~checksum);
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    uint16_t word;
+    memcpy(&word, old_bytes + i, sizeof(word));
+    wide += static_cast<uint16_t>(~word);
+  }
+  return ChecksumFinish(ChecksumAddScalar(new_data, length, Fold(wide)));
+}
+
+void RewriteTcpAckWindow(uint8_t* tcp, uint32_t ack, uint16_t window,
+                         bool partial_checksum) {
+  if (partial_checksum) {
+    Store32(tcp + 8, ack);
+    Store16(tcp + 14, window);
+    return;
+  }
+  uint16_t checksum;
+  memcpy(&checksum, tcp + 16, sizeof(checksum));
+  uint8_t fresh[4];
+  Store32(fresh, ack);
+  checksum = ChecksumReplace(checksum, tcp + 8, fresh, 4);
+  memcpy(tcp + 8, fresh, 4);
+  Store16(fresh, window);
+  checksum = ChecksumReplace(checksum, tcp + 14, fresh, 2);
+  memcpy(tcp + 14, fresh, 2);
+  memcpy(tcp + 16, &checksum, sizeof(checksum));
+}
@@ -0,0 +1,49 @@
+#ifndef RUNNER_PACKET_KERNELS_H_
+#define RUNNER_PACKET_KERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-packet arithmetic of the TUN engine: the internet checksum, with
+// vector kernels picked at runtime for the CPU, and incremental updates
+// for headers rewritten in place (RFC 1624).
+
+// An implementation of ChecksumAdd().
+struct ChecksumKernel {
+  const char* name;
+  uint32_t (*add)(const void* data, size_t length, uint32_t sum);
+};
+
+// Adds |data| to the one's complement running |sum|. The data is summed in
+// memory order, so the result can be stored into a header without swapping.
+// Runs the fastest kernel this CPU supports.
+uint32_t ChecksumAdd(const void* data, size_t length, uint32_t sum);
+
+// Folds |sum| and returns its complement, ready to store in a header.
+uint16_t ChecksumFinish(uint32_t sum);
+
+// The portable reference that every vector kernel must agree with.
+uint32_t ChecksumAddScalar(const void* data, size_t length, uint32_t sum);
+
+// The kernel ChecksumAdd() runs, chosen once on first use.
+const ChecksumKernel& ActiveChecksumKernel();
+
+// Every kernel this CPU can run, the scalar one first.
+std::vector<ChecksumKernel> SupportedChecksumKernels();
+
+// Returns the header |checksum| updated for |length| bytes at
+// |old_data| having been replaced by |new_data|, without summing the rest
+// of the packet. |length| must be even and the bytes must start at an even
+// offset of the checksummed data. Both checksums are in memory order, as
+// stored in the header.
+uint16_t ChecksumReplace(uint16_t checksum, const void* old_data,
+                         const void* new_data, size_t length);
+
+// Stores |ack| and |window| into the TCP header at |tcp| and patches its
+// checksum to match, as for a segment sent again with fresher values. A
+// |partial_checksum| only covers the pseudo header, so it stays as it is.
+void RewriteTcpAckWindow(uint8_t* tcp, uint32_t ack, uint16_t window,
+                         bool partial_checksum);
+
+#endif  // RUNNER_PACKET_KERNELS_H_
@@ -0,0 +1,41 @@
+#include "packet_pool.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+constexpr size_t kCacheLineSize = 64;
+
+}  // namespace
+
+PacketPool::PacketPool(size_t count, size_t buffer_size)
+    : count_(count),
+      buffer_size_((buffer_size + kCacheLineSize - 1) & ~(kCacheLineSize - 1)) {
+  storage_ = static_cast<uint8_t*>(
+      aligned_alloc(kCacheLineSize, count_ * buffer_size_));
+  if (storage_ == nullptr) {
+    throw std::bad_alloc();
+  }
+  free_.reserve(count_);
+  // Hand out low addresses first so a lightly loaded engine stays within a
+  // small, cache-warm part of the pool.
+  for (size_t i = count_; i > 0; i--) {
+    free_.push_back(static_cast<uint32_t>(i - 1));
+  }
+}
+
+PacketPool::~PacketPool() { free(storage_); }
+
+uint8_t* PacketPool::Acquire() {
+  if (free_.empty()) {
+    return nullptr;
+  }
+  uint32_t index = free_.back();
+  free_.pop_back();
+  return storage_ + index * buffer_size_;
+}
+
+void PacketPool::Release(uint8_t* buffer) {
+  free_.push_back(static_cast<uint32_t>((buffer - storage_) / buffer_size_));
+}
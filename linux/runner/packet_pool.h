@@ -0,0 +1,44 @@
+#ifndef RUNNER_PACKET_POOL_H_
+#define RUNNER_PACKET_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A fixed set of equally sized packet buffers carved out of one allocation
+// at construction. Acquire and Release are O(1) and never allocate. A pool is
+// owned by a single packet worker and is not thread-safe.
+class PacketPool {
+ public:
+  // Creates |count| buffers of at least |buffer_size| bytes each. Buffers are
+  // cache-line aligned.
+  PacketPool(size_t count, size_t buffer_size);
+  ~PacketPool();
+
+  // Prevent copying.
+  PacketPool(PacketPool const&) = delete;
+  PacketPool& operator=(PacketPool const&) = delete;
+
+  // Returns a free buffer, or nullptr when the pool is exhausted.
+  uint8_t* Acquire();
+
+  // Returns |buffer|, which must have come from this pool, to the free list.
+  void Release(uint8_t* buffer);
+
+  size_t buffer_size() const { return buffer_size_; }
+  size_t capacity() const { return count_; }
+  size_t available() const { return free_.size(); }
+
+  // The one allocation every buffer is carved from, for registering with
+  // the kernel.
+  uint8_t* storage() const { return storage_; }
+  size_t storage_size() const { return count_ * buffer_size_; }
+
+ private:
+  size_t count_;
+  size_t buffer_size_;
+  uint8_t* storage_;
+  std::vector<uint32_t> free_;
+};
+
+#endif  // RUNNER_PACKET_POOL_H_
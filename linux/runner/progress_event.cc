@@ -0,0 +1,68 @@
+#include "progress_event.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+// Longer texts are truncated to fit the length field.
+constexpr size_t kMaxText = std::numeric_limits<uint16_t>::max();
+
+}  // namespace
+
+constexpr uint8_t ProgressBatch::kFormatVersion;
+
+std::string ProgressEventLine(const ProgressEvent& event) {
+  switch (event.type) {
+    case ProgressEventType::kConfigCount:
+      return "Data: Config Numbers: " + std::to_string(event.value);
+    case ProgressEventType::kConfigIndex:
+      return "Data: Config index: " + std::to_string(event.value);
+    case ProgressEventType::kConfigLabel:
+      return "Data: Config label: " + event.text;
+    case ProgressEventType::kConnected:
+      return "Data: VPN connected";
+    case ProgressEventType::kFailed:
+      return "Data: VPN failed";
+    case ProgressEventType::kCancelled:
+      return "Data: VPN cancelled";
+    case ProgressEventType::kGroupFailed:
+      return "Data: VPN group failed";
+    case ProgressEventType::kStopped:
+      return "Data: VPN stopped";
+    case ProgressEventType::kServiceDestroyed:
+      return "VPN Service Destroyed";
+    case ProgressEventType::kConfigSwitched:
+      return "Data: VPN switched: " + event.text;
+    case ProgressEventType::kLog:
+      break;
+  }
+  return event.text;
+}
+
+bool ProgressBatch::Add(const ProgressEvent& event) {
+  size_t text_length = std::min(event.text.size(), kMaxText);
+  uint32_t value = static_cast<uint32_t>(event.value);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool was_empty = buffer_.empty();
+  if (was_empty) {
+    buffer_.push_back(kFormatVersion);
+  }
+  buffer_.push_back(static_cast<uint8_t>(event.type));
+  for (int shift = 0; shift < 32; shift += 8) {
+    buffer_.push_back(static_cast<uint8_t>(value >> shift));
+  }
+  buffer_.push_back(static_cast<uint8_t>(text_length));
+  buffer_.push_back(static_cast<uint8_t>(text_length >> 8));
+  buffer_.insert(buffer_.end(), event.text.begin(),
+                 event.text.begin() + text_length);
+  return was_empty;
+}
+
+std::vector<uint8_t> ProgressBatch::Take() {
+  std::vector<uint8_t> batch;
+  std::lock_guard<std::mutex> lock(mutex_);
+  batch.swap(buffer_);
+  return batch;
+}
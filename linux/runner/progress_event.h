@@ -0,0 +1,65 @@
+#ifndef RUNNER_PROGRESS_EVENT_H_
+#define RUNNER_PROGRESS_EVENT_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Events sent on com.defyx.progress_events. The values are part of the wire
+// format shared with lib/modules/core/progress_event.dart.
+enum class ProgressEventType : uint8_t {
+  // A free-form line for the log; |text| holds it.
+  kLog = 0,
+  kConfigCount = 1,
+  kConfigIndex = 2,
+  kConfigLabel = 3,
+  kConnected = 4,
+  kFailed = 5,
+  kCancelled = 6,
+  kGroupFailed = 7,
+  kStopped = 8,
+  kServiceDestroyed = 9,
+  // The connected tunnel moved to another upstream. |value| identifies it
+  // and |text| holds its label.
+  kConfigSwitched = 10,
+};
+
+struct ProgressEvent {
+  ProgressEventType type = ProgressEventType::kLog;
+  int32_t value = 0;
+  std::string text;
+};
+
+// Returns the "Data: ..." line the proxy core emits for |event| on other
+// platforms, which is what gets logged.
+std::string ProgressEventLine(const ProgressEvent& event);
+
+// Collects events from any thread into one binary batch. Each record is the
+// type byte, the value as a little-endian int32, the text length as a
+// little-endian uint16 and the UTF-8 text; a batch is a format version byte
+// followed by records.
+class ProgressBatch {
+ public:
+  static constexpr uint8_t kFormatVersion = 1;
+
+  ProgressBatch() = default;
+
+  // Prevent copying.
+  ProgressBatch(ProgressBatch const&) = delete;
+  ProgressBatch& operator=(ProgressBatch const&) = delete;
+
+  // Appends |event|. Returns true when the batch was empty, meaning the
+  // caller should schedule a Take().
+  bool Add(const ProgressEvent& event);
+
+  // Returns the encoded batch and starts a new one. Empty if nothing was
+  // added since the last call.
+  std::vector<uint8_t> Take();
+
+ private:
+  std::mutex mutex_;
+  std::vector<uint8_t> buffer_;
+};
+
+#endif  // RUNNER_PROGRESS_EVENT_H_
@@ -0,0 +1,309 @@
+#include "responsiveness_test.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "log_ring.h"
+#include "net_util.h"
+
+namespace {
+
+constexpr size_t kMaxResponseHead = 16 * 1024;
+// Load requests per phase; the phase ends on time long before these run out.
+constexpr int kMaxLoadRequests = 1000;
+// Share of the slowest probes left out of each latency.
+constexpr double kTrimmedShare = 0.1;
+
+// Returns the value of header |name| in the response head |head|, or "".
+std::string HeaderValue(const std::string& head, const char* name) {
+  size_t name_length = strlen(name);
+  size_t line = head.find("\r\n");
+  while (line != std::string::npos && line + 2 < head.size()) {
+    size_t start = line + 2;
+    size_t end = head.find("\r\n", start);
+    if (end == std::string::npos) {
+      end = head.size();
+    }
+    if (end - start > name_length && head[start + name_length] == ':' &&
+        strncasecmp(head.c_str() + start, name, name_length) == 0) {
+      size_t value = head.find_first_not_of(' ', start + name_length + 1);
+      return value < end ? head.substr(value, end - value) : "";
+    }
+    line = end;
+  }
+  return std::string();
+}
+
+// Mean of |latencies| without the slowest |kTrimmedShare|, or 0 if empty.
+double TrimmedMean(std::vector<double> latencies) {
+  if (latencies.empty()) {
+    return 0;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  size_t kept = latencies.size() -
+                static_cast<size_t>(latencies.size() * kTrimmedShare);
+  double sum = 0;
+  for (size_t i = 0; i < kept; i++) {
+    sum += latencies[i];
+  }
+  return sum / kept;
+}
+
+}  // namespace
+
+ResponsivenessTest::ResponsivenessTest(
+    const SpeedTestOptions& options,
+    const ResponsivenessOptions& responsiveness)
+    : options_(options),
+      responsiveness_(responsiveness),
+      probe_request_("GET /__down?bytes=0 HTTP/1.1\r\nHost: " + options.host +
+                     "\r\nAccept: */*\r\n\r\n"),
+      cancel_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {}
+
+ResponsivenessTest::~ResponsivenessTest() {
+  CloseProbe();
+  if (cancel_fd_ >= 0) {
+    close(cancel_fd_);
+  }
+}
+
+void ResponsivenessTest::Cancel() {
+  cancelled_.store(true);
+  {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    if (load_ != nullptr) {
+      load_->Cancel();
+    }
+  }
+  uint64_t one = 1;
+  if (cancel_fd_ < 0 || write(cancel_fd_, &one, sizeof(one)) != sizeof(one)) {
+    return;
+  }
+}
+
+ResponsivenessResult ResponsivenessTest::Run(
+    const SpeedTest::ProgressCallback& on_progress) {
+  ResponsivenessResult result;
+  if (cancel_fd_ < 0) {
+    return result;
+  }
+
+  std::vector<double> idle;
+  int64_t next_ms = MonotonicNowMs();
+  for (int i = 0; i < responsiveness_.idle_probes && !cancelled_; i++) {
+    WaitUntil(next_ms);
+    next_ms = MonotonicNowMs() + responsiveness_.probe_interval_ms;
+    double latency = Probe();
+    if (latency >= 0) {
+      idle.push_back(latency);
+    }
+  }
+  lost_probes_ = 0;
+  std::vector<double> download = ProbeUnderLoad(
+      SpeedTestDirection::kDownload, &result.download_mbps, on_progress);
+  std::vector<double> upload = ProbeUnderLoad(
+      SpeedTestDirection::kUpload, &result.upload_mbps, on_progress);
+  CloseProbe();
+  if (cancelled_) {
+    return result;
+  }
+
+  std::vector<double> loaded = download;
+  loaded.insert(loaded.end(), upload.begin(), upload.end());
+  result.idle_latency_ms = TrimmedMean(idle);
+  result.download_latency_ms = TrimmedMean(download);
+  result.upload_latency_ms = TrimmedMean(upload);
+  result.loaded_latency_ms = TrimmedMean(loaded);
+  result.probes = static_cast<int>(loaded.size());
+  result.lost_probes = lost_probes_;
+  result.ok = !idle.empty() && !loaded.empty();
+  if (!result.ok) {
+    WriteLog(LogLevel::kWarning, "responsiveness",
+             "No latency probes answered by " + options_.host);
+    return result;
+  }
+  result.rpm = result.loaded_latency_ms > 0
+                   ? 60000 / result.loaded_latency_ms
+                   : 0;
+  // Below zero is noise: load does not make a path faster.
+  result.inflation_percent = std::max(
+      0.0, 100 * (result.loaded_latency_ms - result.idle_latency_ms) /
+               std::max(result.idle_latency_ms, 1e-3));
+  return result;
+}
+
+std::vector<double> ResponsivenessTest::ProbeUnderLoad(
+    SpeedTestDirection direction, double* mbps,
+    const SpeedTest::ProgressCallback& on_progress) {
+  std::vector<double> latencies;
+  SpeedTest load(options_);
+  {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    if (cancelled_) {
+      return latencies;
+    }
+    load_ = &load;
+  }
+  // The load reports from its own thread; progress is passed on from this
+  // one, after each probe.
+  std::atomic<double> load_mbps{0};
+  std::thread loader([&] {
+    load.Run(direction, responsiveness_.load_bytes, kMaxLoadRequests,
+             [&load_mbps](double speed) { load_mbps.store(speed); });
+  });
+
+  int64_t start_ms = MonotonicNowMs();
+  int64_t end_ms = start_ms + responsiveness_.load_ms;
+  int64_t next_ms = start_ms;
+  double mbps_sum = 0;
+  int mbps_count = 0;
+  while (!cancelled_) {
+    WaitUntil(next_ms);
+    if (cancelled_ || MonotonicNowMs() >= end_ms) {
+      break;
+    }
+    next_ms = MonotonicNowMs() + responsiveness_.probe_interval_ms;
+    bool ramped = MonotonicNowMs() - start_ms >= responsiveness_.ramp_ms;
+    double latency = Probe();
+    double speed = load_mbps.load();
+    if (on_progress && speed > 0) {
+      on_progress(speed);
+    }
+    if (!ramped || MonotonicNowMs() > end_ms) {
+      continue;
+    }
+    if (latency >= 0) {
+      latencies.push_back(latency);
+    } else if (!cancelled_) {
+      lost_probes_++;
+    }
+    if (speed > 0) {
+      mbps_sum += speed;
+      mbps_count++;
+    }
+  }
+
+  load.Cancel();
+  loader.join();
+  {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    load_ = nullptr;
+  }
+  *mbps = mbps_count > 0 ? mbps_sum / mbps_count : 0;
+  return latencies;
+}
+
+double ResponsivenessTest::Probe() {
+  if (probe_fd_ < 0 && !OpenProbe()) {
+    return -1;
+  }
+  int64_t start_ns = MonotonicNowNs();
+  int64_t deadline_ms = MonotonicNowMs() + responsiveness_.probe_timeout_ms;
+  if (send(probe_fd_, probe_request_.data(), probe_request_.size(),
+           MSG_NOSIGNAL) != static_cast<ssize_t>(probe_request_.size())) {
+    CloseProbe();
+    return -1;
+  }
+
+  // The response is timed to its head; a bytes=0 body is empty, but any
+  // body is read off so the connection can be reused.
+  std::string response;
+  double latency_ms = -1;
+  int64_t body_left = 0;
+  char chunk[4096];
+  while (latency_ms < 0 || body_left > 0) {
+    int64_t now_ms = MonotonicNowMs();
+    if (now_ms >= deadline_ms || cancelled_) {
+      CloseProbe();
+      return -1;
+    }
+    struct pollfd ready[2] = {{probe_fd_, POLLIN, 0}, {cancel_fd_, POLLIN, 0}};
+    int count = poll(ready, 2, static_cast<int>(deadline_ms - now_ms));
+    if (count < 0 && errno != EINTR) {
+      CloseProbe();
+      return -1;
+    }
+    if (count <= 0 || ready[0].revents == 0) {
+      continue;
+    }
+    ssize_t received = recv(probe_fd_, chunk, sizeof(chunk), MSG_DONTWAIT);
+    if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+      continue;
+    }
+    if (received <= 0) {
+      CloseProbe();
+      return -1;
+    }
+    if (latency_ms >= 0) {
+      body_left -= std::min<int64_t>(body_left, received);
+      continue;
+    }
+    size_t scanned = response.size();
+    response.append(chunk, static_cast<size_t>(received));
+    size_t end = response.find("\r\n\r\n", scanned > 3 ? scanned - 3 : 0);
+    if (end == std::string::npos) {
+      if (response.size() > kMaxResponseHead) {
+        CloseProbe();
+        return -1;
+      }
+      continue;
+    }
+    latency_ms = (MonotonicNowNs() - start_ns) / 1e6;
+    std::string head = response.substr(0, end + 4);
+    if (head.compare(0, 9, "HTTP/1.1 ") != 0 ||
+        head.compare(9, 3, "200") != 0) {
+      CloseProbe();
+      return -1;
+    }
+    if (strcasecmp(HeaderValue(head, "Connection").c_str(), "close") == 0) {
+      CloseProbe();
+      return latency_ms;
+    }
+    int64_t leftover = static_cast<int64_t>(response.size() - head.size());
+    body_left = std::max<int64_t>(
+        0,
+        strtoll(HeaderValue(head, "Content-Length").c_str(), nullptr, 10) -
+            leftover);
+  }
+  return latency_ms;
+}
+
+bool ResponsivenessTest::OpenProbe() {
+  probe_fd_ = ConnectTcp(options_.host, options_.port,
+                         responsiveness_.probe_timeout_ms);
+  if (probe_fd_ < 0) {
+    return false;
+  }
+  int one = 1;
+  setsockopt(probe_fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return true;
+}
+
+void ResponsivenessTest::CloseProbe() {
+  if (probe_fd_ >= 0) {
+    close(probe_fd_);
+    probe_fd_ = -1;
+  }
+}
+
+void ResponsivenessTest::WaitUntil(int64_t until_ms) {
+  for (;;) {
+    int64_t now_ms = MonotonicNowMs();
+    if (now_ms >= until_ms || cancelled_) {
+      return;
+    }
+    struct pollfd ready = {cancel_fd_, POLLIN, 0};
+    poll(&ready, 1, static_cast<int>(until_ms - now_ms));
+  }
+}
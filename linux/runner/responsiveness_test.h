@@ -0,0 +1,99 @@
+#ifndef RUNNER_RESPONSIVENESS_TEST_H_
+#define RUNNER_RESPONSIVENESS_TEST_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "speed_test.h"
+
+struct ResponsivenessOptions {
+  // Probes taken before any load, for the idle baseline.
+  int idle_probes = 10;
+  // How long each direction is saturated for.
+  int load_ms = 8000;
+  // Probes in the first part of each load phase are not counted, while the
+  // load streams are still ramping up and the queues filling.
+  int ramp_ms = 1500;
+  // Spacing of probe starts; a slow probe delays the next one.
+  int probe_interval_ms = 100;
+  // A probe unanswered for this long counts as lost.
+  int probe_timeout_ms = 3000;
+  // Bytes per load request. Requests are repeated until |load_ms| is up.
+  int64_t load_bytes = 100 * 1000 * 1000;
+};
+
+struct ResponsivenessResult {
+  bool ok = false;
+  double idle_latency_ms = 0;
+  // Latency while the download and the upload saturate the path.
+  double download_latency_ms = 0;
+  double upload_latency_ms = 0;
+  // Over every loaded probe.
+  double loaded_latency_ms = 0;
+  // Round trips per minute under load, 60000 / |loaded_latency_ms|.
+  double rpm = 0;
+  // How much load inflates latency over idle, in percent.
+  double inflation_percent = 0;
+  // Throughput the load reached.
+  double download_mbps = 0;
+  double upload_mbps = 0;
+  // Loaded probes answered and lost.
+  int probes = 0;
+  int lost_probes = 0;
+};
+
+// Measures working latency: how a connection's round trip time holds up
+// while it is saturated, which is the bufferbloat separate latency and
+// throughput phases never see. Latency probes, each a small HTTP request on
+// a keep-alive connection of their own, run first on an idle path and then
+// while a SpeedTest saturates it, downloading and then uploading, on a
+// helper thread. Each latency is the mean of its probes without the slowest
+// tenth, as the IETF responsiveness draft computes RPM.
+class ResponsivenessTest {
+ public:
+  ResponsivenessTest(const SpeedTestOptions& options,
+                     const ResponsivenessOptions& responsiveness);
+  ~ResponsivenessTest();
+
+  // Prevent copying.
+  ResponsivenessTest(ResponsivenessTest const&) = delete;
+  ResponsivenessTest& operator=(ResponsivenessTest const&) = delete;
+
+  // Runs the idle, download and upload phases, calling |on_progress| on
+  // this thread with the load's running throughput. Returns early, with
+  // |ok| false, once Cancel() is called.
+  ResponsivenessResult Run(const SpeedTest::ProgressCallback& on_progress);
+
+  // Makes Run() return promptly. Safe to call from any thread.
+  void Cancel();
+
+ private:
+  // Probes under |direction|'s load for |load_ms|. Returns the latencies
+  // past the ramp and sets |mbps| to the load's mean throughput.
+  std::vector<double> ProbeUnderLoad(
+      SpeedTestDirection direction, double* mbps,
+      const SpeedTest::ProgressCallback& on_progress);
+  // One probe round trip in milliseconds, or < 0 if it failed.
+  double Probe();
+  bool OpenProbe();
+  void CloseProbe();
+  // Sleeps until |until_ms| (MonotonicNowMs() based) or a Cancel().
+  void WaitUntil(int64_t until_ms);
+
+  SpeedTestOptions options_;
+  ResponsivenessOptions responsiveness_;
+  std::string probe_request_;
+  int probe_fd_ = -1;
+  int cancel_fd_;
+  std::atomic<bool> cancelled_{false};
+  int lost_probes_ = 0;
+
+  // The load running on the helper thread, for Cancel().
+  std::mutex load_mutex_;
+  SpeedTest* load_ = nullptr;
+};
+
+#endif  // RUNNER_RESPONSIVENESS_TEST_H_
@@ -0,0 +1,222 @@
+#include "rtnetlink.h"
+
+#include <errno.h>
+#include <linux/fib_rules.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Tags the host routes AddHostRoutes() installs, so DeleteHostRoutes() never
+// takes a route someone else added for the same address.
+constexpr uint8_t kHostRouteProtocol = 0x6d;
+
+size_t AddressLength(int family) { return family == AF_INET6 ? 16 : 4; }
+
+}  // namespace
+
+class Rtnetlink::Request {
+ public:
+  Request(uint16_t type, uint16_t flags, size_t body_length) {
+    static std::atomic<uint32_t> next_sequence{1};
+    memset(buffer_, 0, sizeof(buffer_));
+    header()->nlmsg_len = NLMSG_LENGTH(body_length);
+    header()->nlmsg_type = type;
+    header()->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    header()->nlmsg_seq = next_sequence++;
+  }
+
+  nlmsghdr* header() { return reinterpret_cast<nlmsghdr*>(buffer_); }
+  void* body() { return NLMSG_DATA(header()); }
+  uint32_t sequence() { return header()->nlmsg_seq; }
+
+  void Add(uint16_t type, const void* data, size_t length) {
+    size_t offset = NLMSG_ALIGN(header()->nlmsg_len);
+    if (offset + RTA_SPACE(length) > sizeof(buffer_)) {
+      return;
+    }
+    auto* attr = reinterpret_cast<rtattr*>(buffer_ + offset);
+    attr->rta_type = type;
+    attr->rta_len = static_cast<uint16_t>(RTA_LENGTH(length));
+    memcpy(RTA_DATA(attr), data, length);
+    header()->nlmsg_len = static_cast<uint32_t>(offset + RTA_SPACE(length));
+  }
+
+  void AddU32(uint16_t type, uint32_t value) {
+    Add(type, &value, sizeof(value));
+  }
+
+ private:
+  alignas(nlmsghdr) uint8_t buffer_[1024];
+};
+
+Rtnetlink::Rtnetlink() {
+  fd_ = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+}
+
+Rtnetlink::~Rtnetlink() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool Rtnetlink::ChangeRule(int family, bool add, uint32_t mark,
+                           uint32_t table, uint32_t priority) {
+  Request request(add ? RTM_NEWRULE : RTM_DELRULE,
+                  add ? NLM_F_CREATE | NLM_F_EXCL : 0, sizeof(fib_rule_hdr));
+  auto* rule = static_cast<fib_rule_hdr*>(request.body());
+  rule->family = static_cast<uint8_t>(family);
+  rule->action = FR_ACT_TO_TBL;
+  request.AddU32(FRA_FWMARK, mark);
+  request.AddU32(FRA_FWMASK, 0xffffffff);
+  request.AddU32(FRA_TABLE, table);
+  request.AddU32(FRA_PRIORITY, priority);
+  int error = Transact(&request);
+  return error == 0 || (add ? error == EEXIST : error == ENOENT);
+}
+
+int Rtnetlink::CopyDefaultRoutes(int family, uint32_t table) {
+  return CloneDefaultRoutes(family, table, nullptr);
+}
+
+void Rtnetlink::FlushDefaultRoutes(int family, uint32_t table) {
+  // Each delete takes one route; the table holds a handful at most.
+  for (int i = 0; i < 16; i++) {
+    Request request(RTM_DELROUTE, 0, sizeof(rtmsg));
+    rtmsg* route = static_cast<rtmsg*>(request.body());
+    route->rtm_family = static_cast<uint8_t>(family);
+    route->rtm_scope = RT_SCOPE_NOWHERE;
+    request.AddU32(RTA_TABLE, table);
+    if (Transact(&request) != 0) {
+      return;
+    }
+  }
+}
+
+int Rtnetlink::AddHostRoutes(int family, const void* address) {
+  return CloneDefaultRoutes(family, RT_TABLE_MAIN, address);
+}
+
+void Rtnetlink::DeleteHostRoutes(int family, const void* address) {
+  // One route per default route it was copied from.
+  for (int i = 0; i < 16; i++) {
+    Request request(RTM_DELROUTE, 0, sizeof(rtmsg));
+    rtmsg* route = static_cast<rtmsg*>(request.body());
+    route->rtm_family = static_cast<uint8_t>(family);
+    route->rtm_dst_len = static_cast<uint8_t>(AddressLength(family) * 8);
+    route->rtm_protocol = kHostRouteProtocol;
+    route->rtm_scope = RT_SCOPE_NOWHERE;
+    request.Add(RTA_DST, address, AddressLength(family));
+    request.AddU32(RTA_TABLE, RT_TABLE_MAIN);
+    if (Transact(&request) != 0) {
+      return;
+    }
+  }
+}
+
+int Rtnetlink::CloneDefaultRoutes(int family, uint32_t table,
+                                  const void* destination) {
+  std::vector<std::vector<uint8_t>> routes;
+  Request dump(RTM_GETROUTE, NLM_F_DUMP, sizeof(rtmsg));
+  static_cast<rtmsg*>(dump.body())->rtm_family = static_cast<uint8_t>(family);
+  if (!Send(&dump)) {
+    return 0;
+  }
+  // Keeps the attributes of each unicast default route in the main table.
+  ReadDump(dump.sequence(), [&](const nlmsghdr* header) {
+    const rtmsg* route = static_cast<const rtmsg*>(NLMSG_DATA(header));
+    if (route->rtm_dst_len != 0 || route->rtm_type != RTN_UNICAST ||
+        route->rtm_table != RT_TABLE_MAIN) {
+      return;
+    }
+    routes.emplace_back(reinterpret_cast<const uint8_t*>(header),
+                        reinterpret_cast<const uint8_t*>(header) +
+                            header->nlmsg_len);
+  });
+
+  int copied = 0;
+  for (const std::vector<uint8_t>& message : routes) {
+    const auto* header = reinterpret_cast<const nlmsghdr*>(message.data());
+    const rtmsg* source = static_cast<const rtmsg*>(NLMSG_DATA(header));
+    Request request(RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE,
+                    sizeof(rtmsg));
+    rtmsg* route = static_cast<rtmsg*>(request.body());
+    *route = *source;
+    route->rtm_table = RT_TABLE_UNSPEC;
+    request.AddU32(RTA_TABLE, table);
+    if (destination != nullptr) {
+      route->rtm_dst_len = static_cast<uint8_t>(AddressLength(family) * 8);
+      route->rtm_protocol = kHostRouteProtocol;
+      request.Add(RTA_DST, destination, AddressLength(family));
+    }
+    int length = RTM_PAYLOAD(header);
+    for (const rtattr* attr = RTM_RTA(source); RTA_OK(attr, length);
+         attr = RTA_NEXT(attr, length)) {
+      if (attr->rta_type == RTA_GATEWAY || attr->rta_type == RTA_OIF ||
+          attr->rta_type == RTA_PRIORITY ||
+          attr->rta_type == RTA_MULTIPATH) {
+        request.Add(attr->rta_type, RTA_DATA(attr), RTA_PAYLOAD(attr));
+      }
+    }
+    if (Transact(&request) == 0) {
+      copied++;
+    }
+  }
+  return copied;
+}
+
+bool Rtnetlink::Send(Request* request) {
+  struct sockaddr_nl kernel = {};
+  kernel.nl_family = AF_NETLINK;
+  return sendto(fd_, request->header(), request->header()->nlmsg_len, 0,
+                reinterpret_cast<struct sockaddr*>(&kernel),
+                sizeof(kernel)) >= 0;
+}
+
+int Rtnetlink::Transact(Request* request) {
+  if (!Send(request)) {
+    return errno;
+  }
+  int error = EIO;
+  ReadDump(request->sequence(), nullptr, &error);
+  return error;
+}
+
+void Rtnetlink::ReadDump(
+    uint32_t sequence, const std::function<void(const nlmsghdr*)>& on_message,
+    int* error) {
+  alignas(nlmsghdr) uint8_t buffer[16384];
+  for (;;) {
+    ssize_t length = recv(fd_, buffer, sizeof(buffer), 0);
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    int remaining = static_cast<int>(length);
+    for (auto* header = reinterpret_cast<nlmsghdr*>(buffer);
+         NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+      if (header->nlmsg_seq != sequence) {
+        continue;
+      }
+      if (header->nlmsg_type == NLMSG_DONE) {
+        return;
+      }
+      if (header->nlmsg_type == NLMSG_ERROR) {
+        if (error != nullptr) {
+          *error = -static_cast<nlmsgerr*>(NLMSG_DATA(header))->error;
+        }
+        return;
+      }
+      if (on_message) {
+        on_message(header);
+      }
+    }
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef RUNNER_RTNETLINK_H_
+#define RUNNER_RTNETLINK_H_
+
+#include <linux/netlink.h>
+
+#include <cstdint>
+#include <functional>
+
+// A minimal rtnetlink client for the few rule and route changes the tunnel
+// makes. Every call blocks until the kernel has answered.
+class Rtnetlink {
+ public:
+  Rtnetlink();
+  ~Rtnetlink();
+
+  // Prevent copying.
+  Rtnetlink(Rtnetlink const&) = delete;
+  Rtnetlink& operator=(Rtnetlink const&) = delete;
+
+  bool ok() const { return fd_ >= 0; }
+
+  // Adds or removes the rule sending |mark|ed packets to |table|.
+  bool ChangeRule(int family, bool add, uint32_t mark, uint32_t table,
+                  uint32_t priority);
+
+  // Copies the main table's default routes for |family| into |table|.
+  // Returns the number copied.
+  int CopyDefaultRoutes(int family, uint32_t table);
+
+  // Removes every default route from |table|.
+  void FlushDefaultRoutes(int family, uint32_t table);
+
+  // Routes |address|, 4 or 16 bytes as |family| requires, through the main
+  // table's default routes, so it keeps leaving through the physical
+  // network once the tunnel's half-default routes are in. Returns the
+  // number of routes added.
+  int AddHostRoutes(int family, const void* address);
+
+  // Removes the routes AddHostRoutes() added for |address|.
+  void DeleteHostRoutes(int family, const void* address);
+
+ private:
+  class Request;
+
+  // Copies the main table's default routes for |family| into |table|, as
+  // routes to |destination| when it is not null.
+  int CloneDefaultRoutes(int family, uint32_t table, const void* destination);
+
+  bool Send(Request* request);
+
+  // Sends |request| and returns the errno the kernel acknowledged it with,
+  // 0 on success.
+  int Transact(Request* request);
+
+  // Reads replies to |sequence| until the dump ends or the request is
+  // acknowledged, passing each data message to |on_message| if set.
+  void ReadDump(uint32_t sequence,
+                const std::function<void(const nlmsghdr*)>& on_message,
+                int* error = nullptr);
+
+  int fd_;
+};
+
+#endif  // RUNNER_RTNETLINK_H_
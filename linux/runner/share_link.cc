@@ -0,0 +1,422 @@
+#include "share_link.h"
+
+namespace {
+
+using Encoding = ShareLinkField::Encoding;
+
+int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+void AppendPercentDecoded(std::string_view input, std::string* output) {
+  for (size_t i = 0; i < input.size(); i++) {
+    if (input[i] == '%' && i + 2 < input.size() &&
+        HexValue(input[i + 1]) >= 0 && HexValue(input[i + 2]) >= 0) {
+      output->push_back(static_cast<char>(HexValue(input[i + 1]) * 16 +
+                                          HexValue(input[i + 2])));
+      i += 2;
+    } else {
+      output->push_back(input[i]);
+    }
+  }
+}
+
+void AppendUtf8(uint32_t code_point, std::string* output) {
+  if (code_point < 0x80) {
+    output->push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    output->push_back(static_cast<char>(0xc0 | (code_point >> 6)));
+    output->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  } else if (code_point < 0x10000) {
+    output->push_back(static_cast<char>(0xe0 | (code_point >> 12)));
+    output->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+    output->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  } else {
+    output->push_back(static_cast<char>(0xf0 | (code_point >> 18)));
+    output->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3f)));
+    output->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+    output->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  }
+}
+
+// Reads the four hex digits of a \u escape at |input|[|i|]. Returns -1 if
+// they are not all there.
+int32_t ReadHex4(std::string_view input, size_t i) {
+  if (i + 4 > input.size()) {
+    return -1;
+  }
+  int32_t value = 0;
+  for (size_t j = i; j < i + 4; j++) {
+    int digit = HexValue(input[j]);
+    if (digit < 0) {
+      return -1;
+    }
+    value = value * 16 + digit;
+  }
+  return value;
+}
+
+// Undoes JSON string escapes; broken ones are copied as they are.
+void AppendJsonUnescaped(std::string_view input, std::string* output) {
+  for (size_t i = 0; i < input.size(); i++) {
+    if (input[i] != '\\' || i + 1 == input.size()) {
+      output->push_back(input[i]);
+      continue;
+    }
+    char escape = input[++i];
+    switch (escape) {
+      case 'b':
+        output->push_back('\b');
+        break;
+      case 'f':
+        output->push_back('\f');
+        break;
+      case 'n':
+        output->push_back('\n');
+        break;
+      case 'r':
+        output->push_back('\r');
+        break;
+      case 't':
+        output->push_back('\t');
+        break;
+      case 'u': {
+        int32_t unit = ReadHex4(input, i + 1);
+        if (unit < 0) {
+          output->push_back('\\');
+          output->push_back('u');
+          break;
+        }
+        i += 4;
+        uint32_t code_point = static_cast<uint32_t>(unit);
+        // Characters past the first plane, such as flag emoji, come as
+        // a surrogate pair.
+        if (unit >= 0xd800 && unit < 0xdc00 && i + 2 < input.size() &&
+            input[i + 1] == '\\' && input[i + 2] == 'u') {
+          int32_t low = ReadHex4(input, i + 3);
+          if (low >= 0xdc00 && low < 0xe000) {
+            code_point = 0x10000 + ((static_cast<uint32_t>(unit) - 0xd800)
+                                    << 10) +
+                         (static_cast<uint32_t>(low) - 0xdc00);
+            i += 6;
+          }
+        }
+        AppendUtf8(code_point, output);
+        break;
+      }
+      default:
+        // \" \\ \/ stand for themselves.
+        output->push_back(escape);
+        break;
+    }
+  }
+}
+
+bool ParsePort(std::string_view text, uint16_t* port) {
+  if (text.empty() || text.size() > 5) {
+    return false;
+  }
+  uint32_t value = 0;
+  for (char c : text) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    value = value * 10 + static_cast<uint32_t>(c - '0');
+  }
+  if (value == 0 || value > 65535) {
+    return false;
+  }
+  *port = static_cast<uint16_t>(value);
+  return true;
+}
+
+// Splits "host:port" or "[v6]:port".
+const char* ParseHostPort(std::string_view authority, std::string_view* host,
+                          uint16_t* port) {
+  size_t colon;
+  if (!authority.empty() && authority[0] == '[') {
+    size_t close = authority.find(']');
+    if (close == std::string_view::npos || close + 1 >= authority.size() ||
+        authority[close + 1] != ':') {
+      return "malformed address";
+    }
+    *host = authority.substr(1, close - 1);
+    colon = close + 1;
+  } else {
+    colon = authority.rfind(':');
+    if (colon == std::string_view::npos) {
+      return "missing port";
+    }
+    *host = authority.substr(0, colon);
+  }
+  if (host->empty()) {
+    return "missing host";
+  }
+  return ParsePort(authority.substr(colon + 1), port) ? nullptr
+                                                      : "bad port";
+}
+
+bool IsJsonSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Returns the index just past the string whose opening quote is at
+// |json|[|i|], or npos if it never closes.
+size_t SkipJsonString(std::string_view json, size_t i) {
+  for (i++; i < json.size(); i++) {
+    if (json[i] == '\\') {
+      i++;
+    } else if (json[i] == '"') {
+      return i + 1;
+    }
+  }
+  return std::string_view::npos;
+}
+
+// Calls |visit|(key, value, quoted) for each member of the flat JSON
+// object |json|, in one pass. String values come without their quotes and
+// still escaped; nested objects and arrays are skipped. Returns false if
+// |json| is not an object.
+template <typename Visitor>
+bool ForEachJsonMember(std::string_view json, Visitor visit) {
+  size_t i = 0;
+  auto skip_space = [&] {
+    while (i < json.size() && IsJsonSpace(json[i])) {
+      i++;
+    }
+  };
+  skip_space();
+  if (i == json.size() || json[i++] != '{') {
+    return false;
+  }
+  for (;;) {
+    skip_space();
+    if (i < json.size() && json[i] == '}') {
+      return true;
+    }
+    if (i == json.size() || json[i] != '"') {
+      return false;
+    }
+    size_t key_end = SkipJsonString(json, i);
+    if (key_end == std::string_view::npos) {
+      return false;
+    }
+    std::string_view key = json.substr(i + 1, key_end - i - 2);
+    i = key_end;
+    skip_space();
+    if (i == json.size() || json[i++] != ':') {
+      return false;
+    }
+    skip_space();
+    if (i == json.size()) {
+      return false;
+    }
+    size_t start = i;
+    if (json[i] == '"') {
+      i = SkipJsonString(json, i);
+      if (i == std::string_view::npos) {
+        return false;
+      }
+      visit(key, json.substr(start + 1, i - start - 2), true);
+    } else if (json[i] == '{' || json[i] == '[') {
+      int depth = 0;
+      while (i < json.size()) {
+        char c = json[i];
+        if (c == '"') {
+          i = SkipJsonString(json, i);
+          if (i == std::string_view::npos) {
+            return false;
+          }
+          continue;
+        }
+        depth += c == '{' || c == '[' ? 1 : c == '}' || c == ']' ? -1 : 0;
+        i++;
+        if (depth == 0) {
+          break;
+        }
+      }
+    } else {
+      while (i < json.size() && json[i] != ',' && json[i] != '}' &&
+             !IsJsonSpace(json[i])) {
+        i++;
+      }
+      visit(key, json.substr(start, i - start), false);
+    }
+    skip_space();
+    if (i < json.size() && json[i] == ',') {
+      i++;
+    }
+  }
+}
+
+const char* TokenizeVmess(std::string_view payload, std::string* scratch,
+                          ShareLinkTokens* tokens) {
+  if (!DecodeBase64(payload, scratch)) {
+    return "bad base64";
+  }
+  std::string_view port;
+  ShareLinkField host_header;
+  bool ok = ForEachJsonMember(
+      *scratch, [&](std::string_view key, std::string_view value,
+                    bool quoted) {
+        ShareLinkField field = {
+            value, quoted ? Encoding::kJson : Encoding::kPlain};
+        if (key == "add") {
+          tokens->host = field;
+        } else if (key == "port") {
+          port = value;
+        } else if (key == "tls") {
+          tokens->tls = value == "tls" || value == "reality";
+        } else if (key == "sni") {
+          tokens->server_name = field;
+        } else if (key == "host") {
+          host_header = field;
+        } else if (key == "ps") {
+          tokens->name = field;
+        }
+      });
+  if (!ok) {
+    return "malformed vmess payload";
+  }
+  if (tokens->server_name.text.empty()) {
+    tokens->server_name = host_header;
+  }
+  if (tokens->host.text.empty()) {
+    return "missing host";
+  }
+  return ParsePort(port, &tokens->port) ? nullptr : "bad port";
+}
+
+}  // namespace
+
+const char* TokenizeShareLink(std::string_view link, std::string* scratch,
+                              ShareLinkTokens* tokens) {
+  *tokens = ShareLinkTokens();
+  size_t separator = link.find("://");
+  if (separator == std::string_view::npos) {
+    return "not a share link";
+  }
+  tokens->scheme = link.substr(0, separator);
+  std::string_view rest = link.substr(separator + 3);
+  size_t fragment = rest.find('#');
+  if (fragment != std::string_view::npos) {
+    tokens->name = {rest.substr(fragment + 1), Encoding::kPercent};
+    rest = rest.substr(0, fragment);
+  }
+
+  if (tokens->scheme == "vmess") {
+    return TokenizeVmess(rest, scratch, tokens);
+  }
+  if (tokens->scheme != "vless" && tokens->scheme != "trojan" &&
+      tokens->scheme != "ss") {
+    return "unsupported scheme";
+  }
+
+  std::string_view query;
+  size_t question = rest.find('?');
+  if (question != std::string_view::npos) {
+    query = rest.substr(question + 1);
+    rest = rest.substr(0, question);
+  }
+  // The user info ends at the last '@' before the path, or failing that the
+  // last '@' at all, for user info that itself holds a '/'.
+  size_t at = rest.substr(0, rest.find('/')).rfind('@');
+  if (at == std::string_view::npos) {
+    at = rest.rfind('@');
+  }
+  if (at == std::string_view::npos) {
+    // Legacy ss:// links encode "method:password@host:port" whole.
+    while (!rest.empty() && rest.back() == '/') {
+      rest.remove_suffix(1);
+    }
+    if (tokens->scheme != "ss") {
+      return "missing user info";
+    }
+    if (!DecodeBase64(rest, scratch)) {
+      return "bad base64";
+    }
+    rest = *scratch;
+    at = rest.rfind('@');
+    if (at == std::string_view::npos) {
+      return "missing user info";
+    }
+  }
+  std::string_view authority = rest.substr(at + 1);
+  authority = authority.substr(0, authority.find('/'));
+  const char* error =
+      ParseHostPort(authority, &tokens->host.text, &tokens->port);
+  if (error != nullptr) {
+    return error;
+  }
+
+  std::string_view security;
+  ShareLinkField peer;
+  while (!query.empty()) {
+    size_t end = query.find('&');
+    std::string_view pair = query.substr(0, end);
+    query = end == std::string_view::npos ? std::string_view()
+                                          : query.substr(end + 1);
+    size_t equals = pair.find('=');
+    if (equals == std::string_view::npos) {
+      continue;
+    }
+    std::string_view key = pair.substr(0, equals);
+    ShareLinkField value = {pair.substr(equals + 1), Encoding::kPercent};
+    if (key == "security") {
+      security = value.text;
+    } else if (key == "sni") {
+      tokens->server_name = value;
+    } else if (key == "peer") {
+      peer = value;
+    }
+  }
+  if (tokens->server_name.text.empty()) {
+    tokens->server_name = peer;
+  }
+  if (tokens->scheme == "trojan") {
+    tokens->tls = security != "none";
+  } else {
+    tokens->tls =
+        security == "tls" || security == "reality" || security == "xtls";
+  }
+  return nullptr;
+}
+
+void AppendShareLinkField(const ShareLinkField& field, std::string* output) {
+  switch (field.encoding) {
+    case Encoding::kPlain:
+      output->append(field.text.data(), field.text.size());
+      break;
+    case Encoding::kPercent:
+      AppendPercentDecoded(field.text, output);
+      break;
+    case Encoding::kJson:
+      AppendJsonUnescaped(field.text, output);
+      break;
+  }
+}
+
+bool ParseShareLinkEndpoint(std::string_view link,
+                            ShareLinkEndpoint* endpoint) {
+  std::string scratch;
+  ShareLinkTokens tokens;
+  if (TokenizeShareLink(link, &scratch, &tokens) != nullptr) {
+    return false;
+  }
+  *endpoint = ShareLinkEndpoint();
+  endpoint->scheme = std::string(tokens.scheme);
+  AppendShareLinkField(tokens.host, &endpoint->host);
+  endpoint->port = tokens.port;
+  endpoint->tls = tokens.tls;
+  AppendShareLinkField(tokens.server_name, &endpoint->server_name);
+  return true;
+}
@@ -0,0 +1,65 @@
+#ifndef RUNNER_SHARE_LINK_H_
+#define RUNNER_SHARE_LINK_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "base64.h"
+
+// The server a proxy share link points at, as far as reaching it over the
+// network is concerned.
+struct ShareLinkEndpoint {
+  // "vless", "vmess", "trojan" or "ss".
+  std::string scheme;
+  std::string host;
+  uint16_t port = 0;
+  // The server expects a TLS (or REALITY) handshake on connect.
+  bool tls = false;
+  // SNI to present; empty means |host|.
+  std::string server_name;
+};
+
+// A string inside a share link, still in the link's own encoding.
+struct ShareLinkField {
+  enum class Encoding {
+    kPlain,
+    // URI percent-encoding, as in query values and fragments.
+    kPercent,
+    // The inside of a JSON string, as in vmess payloads.
+    kJson,
+  };
+
+  std::string_view text;
+  Encoding encoding = Encoding::kPlain;
+};
+
+// A share link taken apart without copying, for parsing many at once. The
+// views point into the link, or into the scratch buffer given to
+// TokenizeShareLink() for the base64 payloads of vmess and legacy ss links.
+struct ShareLinkTokens {
+  std::string_view scheme;
+  ShareLinkField host;
+  uint16_t port = 0;
+  bool tls = false;
+  // SNI to present; empty means |host|.
+  ShareLinkField server_name;
+  // The display name: the fragment, or a vmess payload's "ps".
+  ShareLinkField name;
+};
+
+// Extracts the endpoint from a vless://, vmess://, trojan:// or ss:// link.
+// Returns false for other schemes and malformed links.
+bool ParseShareLinkEndpoint(std::string_view link,
+                            ShareLinkEndpoint* endpoint);
+
+// Takes |link| apart in a single pass, decoding a base64 payload into
+// |scratch|, which must outlive |tokens|. Returns nullptr on success, or
+// why the link was rejected, e.g. "unsupported scheme" or "bad port".
+const char* TokenizeShareLink(std::string_view link, std::string* scratch,
+                              ShareLinkTokens* tokens);
+
+// Appends |field| to |output| with its encoding undone.
+void AppendShareLinkField(const ShareLinkField& field, std::string* output);
+
+#endif  // RUNNER_SHARE_LINK_H_
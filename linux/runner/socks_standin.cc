@@ -0,0 +1,326 @@
+#include "socks_standin.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "net_util.h"
+
+namespace {
+
+constexpr int kHandshakeTimeoutMs = 10000;
+constexpr int kConnectTimeoutMs = 10000;
+constexpr size_t kRelayBufferSize = 64 * 1024;
+
+// Sends a SOCKS5 reply with |status| and an all-zero IPv4 bound address.
+void SendReply(int fd, uint8_t status) {
+  const uint8_t reply[] = {0x05, status, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+  WriteFull(fd, reply, sizeof(reply), MonotonicNowMs() + kHandshakeTimeoutMs);
+}
+
+}  // namespace
+
+SocksStandIn::SocksStandIn() {}
+
+SocksStandIn::~SocksStandIn() { Stop(); }
+
+bool SocksStandIn::Start(uint16_t port) {
+  if (running()) {
+    return false;
+  }
+  listen_fd_ = ListenTcp("127.0.0.1", port, &port_);
+  if (listen_fd_ < 0) {
+    return false;
+  }
+  stopping_ = false;
+  accept_thread_ = std::thread(&SocksStandIn::AcceptLoop, this);
+  return true;
+}
+
+void SocksStandIn::Stop() {
+  if (!running()) {
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+    // Shutting the sockets down wakes every thread blocked on them.
+    shutdown(listen_fd_, SHUT_RDWR);
+    for (int fd : open_fds_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+  }
+  accept_thread_.join();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  sessions_done_.wait(lock, [this] { return active_sessions_ == 0; });
+  close(listen_fd_);
+  listen_fd_ = -1;
+  port_ = 0;
+}
+
+void SocksStandIn::AcceptLoop() {
+  pthread_setname_np(pthread_self(), "socks-standin");
+  for (;;) {
+    int client = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      close(client);
+      return;
+    }
+    open_fds_.insert(client);
+    active_sessions_++;
+    std::thread(&SocksStandIn::ServeClient, this, client).detach();
+  }
+}
+
+void SocksStandIn::ServeClient(int client_fd) {
+  int64_t deadline = MonotonicNowMs() + kHandshakeTimeoutMs;
+  int upstream_fd = -1;
+
+  uint8_t header[2];
+  uint8_t methods[255];
+  uint8_t request[4];
+  if (ReadFull(client_fd, header, sizeof(header), deadline) &&
+      header[0] == 0x05 &&
+      ReadFull(client_fd, methods, header[1], deadline) &&
+      WriteFull(client_fd, "\x05\x00", 2, deadline) &&
+      ReadFull(client_fd, request, sizeof(request), deadline) &&
+      request[0] == 0x05) {
+    std::string host;
+    uint8_t address[256];
+    bool valid = true;
+    switch (request[3]) {
+      case 0x01: {
+        char text[INET_ADDRSTRLEN];
+        valid = ReadFull(client_fd, address, 4, deadline) &&
+                inet_ntop(AF_INET, address, text, sizeof(text)) != nullptr;
+        host = valid ? text : "";
+        break;
+      }
+      case 0x04: {
+        char text[INET6_ADDRSTRLEN];
+        valid = ReadFull(client_fd, address, 16, deadline) &&
+                inet_ntop(AF_INET6, address, text, sizeof(text)) != nullptr;
+        host = valid ? text : "";
+        break;
+      }
+      case 0x03: {
+        uint8_t length = 0;
+        valid = ReadFull(client_fd, &length, 1, deadline) &&
+                ReadFull(client_fd, address, length, deadline);
+        host.assign(reinterpret_cast<char*>(address), valid ? length : 0);
+        break;
+      }
+      default:
+        valid = false;
+    }
+    uint8_t port_bytes[2];
+    valid = valid && ReadFull(client_fd, port_bytes, 2, deadline);
+
+    if (valid && request[1] == 0x03) {
+      ServeAssociation(client_fd);
+    } else if (!valid || request[1] != 0x01) {
+      // 0x07: command not supported.
+      SendReply(client_fd, 0x07);
+    } else {
+      uint16_t port =
+          static_cast<uint16_t>((port_bytes[0] << 8) | port_bytes[1]);
+      upstream_fd = ConnectTcp(host, port, kConnectTimeoutMs);
+      if (upstream_fd < 0) {
+        // 0x05: connection refused.
+        SendReply(client_fd, 0x05);
+      } else {
+        TrackFd(upstream_fd);
+        SendReply(client_fd, 0x00);
+        Relay(client_fd, upstream_fd);
+      }
+    }
+  }
+
+  if (upstream_fd >= 0) {
+    ReleaseFd(upstream_fd);
+  }
+  ReleaseFd(client_fd);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  active_sessions_--;
+  sessions_done_.notify_all();
+}
+
+void SocksStandIn::Relay(int a, int b) {
+  uint8_t buffer[kRelayBufferSize];
+  struct pollfd fds[2] = {{a, POLLIN, 0}, {b, POLLIN, 0}};
+  int open_directions = 2;
+  while (open_directions > 0) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].fd < 0 || fds[i].revents == 0) {
+        continue;
+      }
+      int peer = i == 0 ? b : a;
+      ssize_t received = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+      if (received < 0 && (errno == EINTR || errno == EAGAIN)) {
+        continue;
+      }
+      if (received <= 0 ||
+          !WriteFull(peer, buffer, static_cast<size_t>(received),
+                     MonotonicNowMs() + kConnectTimeoutMs)) {
+        // Propagate the half-close and stop polling this direction.
+        shutdown(peer, SHUT_WR);
+        fds[i].fd = -1;
+        open_directions--;
+        if (received < 0) {
+          return;
+        }
+      }
+    }
+  }
+}
+
+void SocksStandIn::ServeAssociation(int control_fd) {
+  int relay_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  int out_fds[2] = {socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0),
+                    socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0)};
+  struct sockaddr_in bound = {};
+  bound.sin_family = AF_INET;
+  bound.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t bound_length = sizeof(bound);
+  if (relay_fd < 0 ||
+      bind(relay_fd, reinterpret_cast<struct sockaddr*>(&bound),
+           sizeof(bound)) != 0 ||
+      getsockname(relay_fd, reinterpret_cast<struct sockaddr*>(&bound),
+                  &bound_length) != 0) {
+    // 0x01: general failure.
+    SendReply(control_fd, 0x01);
+  } else {
+    uint8_t reply[] = {0x05, 0x00, 0x00, 0x01, 127, 0, 0, 1, 0, 0};
+    memcpy(reply + 8, &bound.sin_port, 2);
+    WriteFull(control_fd, reply, sizeof(reply),
+              MonotonicNowMs() + kHandshakeTimeoutMs);
+
+    // Datagrams from the client carry a SOCKS header naming their
+    // destination; replies get one naming where they came from.
+    uint8_t buffer[kRelayBufferSize];
+    struct sockaddr_storage client = {};
+    socklen_t client_length = 0;
+    struct pollfd fds[4] = {{control_fd, POLLIN, 0},
+                            {relay_fd, POLLIN, 0},
+                            {out_fds[0], POLLIN, 0},
+                            {out_fds[1], POLLIN, 0}};
+    for (;;) {
+      if (poll(fds, 4, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      if (fds[0].revents != 0) {
+        // The association ends with its TCP connection.
+        break;
+      }
+      if (fds[1].revents & POLLIN) {
+        client_length = sizeof(client);
+        ssize_t received =
+            recvfrom(relay_fd, buffer, sizeof(buffer), 0,
+                     reinterpret_cast<struct sockaddr*>(&client),
+                     &client_length);
+        struct sockaddr_storage target = {};
+        socklen_t target_length = 0;
+        size_t header = 0;
+        if (received >= 10 && buffer[2] == 0 && buffer[3] == 0x01) {
+          auto* v4 = reinterpret_cast<struct sockaddr_in*>(&target);
+          v4->sin_family = AF_INET;
+          memcpy(&v4->sin_addr, buffer + 4, 4);
+          memcpy(&v4->sin_port, buffer + 8, 2);
+          target_length = sizeof(*v4);
+          header = 10;
+        } else if (received >= 22 && buffer[2] == 0 && buffer[3] == 0x04) {
+          auto* v6 = reinterpret_cast<struct sockaddr_in6*>(&target);
+          v6->sin6_family = AF_INET6;
+          memcpy(&v6->sin6_addr, buffer + 4, 16);
+          memcpy(&v6->sin6_port, buffer + 20, 2);
+          target_length = sizeof(*v6);
+          header = 22;
+        }
+        int out_fd = out_fds[target.ss_family == AF_INET6 ? 1 : 0];
+        if (header != 0 && out_fd >= 0) {
+          sendto(out_fd, buffer + header,
+                 static_cast<size_t>(received) - header, 0,
+                 reinterpret_cast<struct sockaddr*>(&target), target_length);
+        }
+      }
+      for (int i = 0; i < 2; i++) {
+        if (!(fds[2 + i].revents & POLLIN)) {
+          continue;
+        }
+        struct sockaddr_storage source = {};
+        socklen_t source_length = sizeof(source);
+        size_t header = i == 0 ? 10 : 22;
+        ssize_t received =
+            recvfrom(out_fds[i], buffer + header, sizeof(buffer) - header, 0,
+                     reinterpret_cast<struct sockaddr*>(&source),
+                     &source_length);
+        if (received < 0 || client_length == 0) {
+          continue;
+        }
+        memset(buffer, 0, 3);
+        if (i == 0) {
+          auto* v4 = reinterpret_cast<struct sockaddr_in*>(&source);
+          buffer[3] = 0x01;
+          memcpy(buffer + 4, &v4->sin_addr, 4);
+          memcpy(buffer + 8, &v4->sin_port, 2);
+        } else {
+          auto* v6 = reinterpret_cast<struct sockaddr_in6*>(&source);
+          buffer[3] = 0x04;
+          memcpy(buffer + 4, &v6->sin6_addr, 16);
+          memcpy(buffer + 20, &v6->sin6_port, 2);
+        }
+        sendto(relay_fd, buffer, header + static_cast<size_t>(received), 0,
+               reinterpret_cast<struct sockaddr*>(&client), client_length);
+      }
+    }
+  }
+
+  for (int fd : {relay_fd, out_fds[0], out_fds[1]}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+void SocksStandIn::TrackFd(int fd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  open_fds_.insert(fd);
+  if (stopping_) {
+    shutdown(fd, SHUT_RDWR);
+  }
+}
+
+void SocksStandIn::ReleaseFd(int fd) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_fds_.erase(fd);
+  }
+  close(fd);
+}
@@ -0,0 +1,61 @@
+#ifndef RUNNER_SOCKS_STANDIN_H_
+#define RUNNER_SOCKS_STANDIN_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <thread>
+
+// A minimal loopback SOCKS5 server that connects directly to the requested
+// destination. It stands in for the proxy core so the tunnel, ping and relay
+// paths can be exercised on a machine without a real server. Only the
+// no-auth CONNECT and UDP ASSOCIATE commands are supported.
+class SocksStandIn {
+ public:
+  SocksStandIn();
+  ~SocksStandIn();
+
+  // Prevent copying.
+  SocksStandIn(SocksStandIn const&) = delete;
+  SocksStandIn& operator=(SocksStandIn const&) = delete;
+
+  // Starts accepting on 127.0.0.1:|port|; 0 picks a free port. Returns false
+  // if the port cannot be bound or the server is already running.
+  bool Start(uint16_t port);
+
+  // Closes the listener and every open session, then waits for the session
+  // threads to exit.
+  void Stop();
+
+  bool running() const { return listen_fd_ >= 0; }
+
+  // The bound port; valid while running.
+  uint16_t port() const { return port_; }
+
+ private:
+  void AcceptLoop();
+  void ServeClient(int client_fd);
+
+  // Relays bytes between |a| and |b| until both directions are closed.
+  static void Relay(int a, int b);
+
+  // Serves a UDP association for the client on |control_fd| until it
+  // closes that connection.
+  void ServeAssociation(int control_fd);
+
+  void TrackFd(int fd);
+  void ReleaseFd(int fd);
+
+  int listen_fd_ = -1;
+  uint16_t port_ = 0;
+  std::thread accept_thread_;
+
+  std::mutex mutex_;
+  std::condition_variable sessions_done_;
+  std::set<int> open_fds_;
+  int active_sessions_ = 0;
+  bool stopping_ = false;
+};
+
+#endif  // RUNNER_SOCKS_STANDIN_H_
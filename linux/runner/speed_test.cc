@@ -0,0 +1,408 @@
+#include "speed_test.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "log_ring.h"
+#include "net_util.h"
+
+namespace {
+
+constexpr size_t kBufferSize = 256 * 1024;
+constexpr size_t kMaxResponseHead = 16 * 1024;
+constexpr int kMaxEvents = 16;
+
+// Distinguishes the cancel descriptor from streams in epoll.
+char kCancelTag;
+
+// Returns the value of header |name| in the response head |head|, or "".
+std::string HeaderValue(const std::string& head, const char* name) {
+  size_t name_length = strlen(name);
+  size_t line = head.find("\r\n");
+  while (line != std::string::npos && line + 2 < head.size()) {
+    size_t start = line + 2;
+    size_t end = head.find("\r\n", start);
+    if (end == std::string::npos) {
+      end = head.size();
+    }
+    if (end - start > name_length && head[start + name_length] == ':' &&
+        strncasecmp(head.c_str() + start, name, name_length) == 0) {
+      size_t value = head.find_first_not_of(' ', start + name_length + 1);
+      return value < end ? head.substr(value, end - value) : "";
+    }
+    line = end;
+  }
+  return std::string();
+}
+
+double ToMbps(int64_t bytes, int64_t duration_ns) {
+  return duration_ns > 0
+             ? static_cast<double>(bytes) * 8 * 1000 / duration_ns
+             : 0;
+}
+
+}  // namespace
+
+// One keep-alive connection carrying a request per sample.
+struct SpeedTest::Stream {
+  int fd = -1;
+  std::string request;
+  size_t request_sent = 0;
+  int64_t body_to_send = 0;
+  std::string response_head;
+  bool head_done = false;
+  int64_t body_to_receive = 0;
+  bool close_after = false;
+  bool active = false;
+  uint32_t interest = 0;
+
+  bool finished() const {
+    return request_sent == request.size() && body_to_send == 0 &&
+           head_done && body_to_receive == 0;
+  }
+};
+
+SpeedTest::SpeedTest(const SpeedTestOptions& options)
+    : options_(options),
+      epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      cancel_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      buffer_(new uint8_t[kBufferSize]) {
+  options_.streams = std::max(1, std::min(options_.streams, 32));
+  if (epoll_fd_ >= 0 && cancel_fd_ >= 0) {
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &kCancelTag;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, cancel_fd_, &event);
+  }
+  // Upload bodies are sent from the same buffer; random bytes keep any
+  // compression on the path from flattering the result.
+  std::mt19937 random(std::random_device{}());
+  for (size_t i = 0; i < kBufferSize; i += sizeof(uint32_t)) {
+    uint32_t word = random();
+    memcpy(buffer_.get() + i, &word, sizeof(word));
+  }
+}
+
+SpeedTest::~SpeedTest() {
+  CloseStreams();
+  if (cancel_fd_ >= 0) {
+    close(cancel_fd_);
+  }
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+void SpeedTest::Cancel() {
+  cancelled_.store(true);
+  uint64_t one = 1;
+  if (cancel_fd_ < 0 || write(cancel_fd_, &one, sizeof(one)) != sizeof(one)) {
+    return;
+  }
+}
+
+std::vector<SpeedSample> SpeedTest::Run(SpeedTestDirection direction,
+                                        int64_t bytes, int count,
+                                        const ProgressCallback& on_progress) {
+  std::vector<SpeedSample> samples;
+  if (epoll_fd_ < 0 || cancel_fd_ < 0 || bytes <= 0) {
+    return samples;
+  }
+  for (int i = 0; i < count && !cancelled_; i++) {
+    if (!OpenStreams()) {
+      WriteLog(LogLevel::kWarning, "speedtest",
+               "Could not connect to " + options_.host);
+      samples.push_back(SpeedSample());
+      continue;
+    }
+    SpeedSample sample = RunSample(direction, bytes, on_progress);
+    if (!sample.ok) {
+      CloseStreams();
+      if (!cancelled_) {
+        WriteLog(LogLevel::kWarning, "speedtest",
+                 "Sample of " + std::to_string(bytes) + " bytes failed");
+      }
+    }
+    if (!cancelled_) {
+      samples.push_back(sample);
+    }
+  }
+  CloseStreams();
+  return samples;
+}
+
+bool SpeedTest::OpenStreams() {
+  for (int i = 0; i < options_.streams; i++) {
+    if (static_cast<size_t>(i) >= streams_.size()) {
+      streams_.emplace_back(new Stream());
+    }
+    Stream* stream = streams_[i].get();
+    if (stream->fd >= 0) {
+      continue;
+    }
+    if (cancelled_) {
+      return false;
+    }
+    stream->fd = ConnectTcp(options_.host, options_.port,
+                            options_.connect_timeout_ms);
+    if (stream->fd < 0 || !SetNonBlocking(stream->fd)) {
+      CloseStreams();
+      return false;
+    }
+    int one = 1;
+    setsockopt(stream->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct epoll_event event = {};
+    event.data.ptr = stream;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stream->fd, &event);
+    stream->interest = 0;
+  }
+  return true;
+}
+
+void SpeedTest::CloseStreams() {
+  for (auto& stream : streams_) {
+    if (stream->fd >= 0) {
+      close(stream->fd);
+      stream->fd = -1;
+    }
+  }
+}
+
+SpeedSample SpeedTest::RunSample(SpeedTestDirection direction, int64_t bytes,
+                                 const ProgressCallback& on_progress) {
+  SpeedSample sample;
+  bool upload = direction == SpeedTestDirection::kUpload;
+  int64_t stream_count =
+      std::min<int64_t>(options_.streams, std::max<int64_t>(1, bytes));
+  for (int64_t i = 0; i < options_.streams; i++) {
+    Stream* stream = streams_[i].get();
+    stream->active = i < stream_count;
+    if (!stream->active) {
+      continue;
+    }
+    // The first stream takes the remainder of an uneven split.
+    int64_t share = bytes / stream_count + (i == 0 ? bytes % stream_count : 0);
+    if (upload) {
+      stream->request = "POST /__up HTTP/1.1\r\nHost: " + options_.host +
+                        "\r\nContent-Type: application/octet-stream"
+                        "\r\nContent-Length: " +
+                        std::to_string(share) + "\r\n\r\n";
+      stream->body_to_send = share;
+    } else {
+      stream->request = "GET /__down?bytes=" + std::to_string(share) +
+                        " HTTP/1.1\r\nHost: " + options_.host +
+                        "\r\nAccept: */*\r\n\r\n";
+      stream->body_to_send = 0;
+    }
+    stream->request_sent = 0;
+    stream->response_head.clear();
+    stream->head_done = false;
+    stream->body_to_receive = 0;
+    stream->close_after = false;
+  }
+
+  int64_t start_ns = MonotonicNowNs();
+  int64_t deadline_ms = MonotonicNowMs() + options_.sample_timeout_ms;
+  int64_t next_progress_ns = 0;
+  // Throughput is timed from the first payload byte to the last. The bytes
+  // that arrived with the first read were in flight before that instant, so
+  // they are left out of the download rate.
+  int64_t first_ns = 0;
+  int64_t last_ns = 0;
+  int64_t first_bytes = 0;
+  int64_t moved = 0;
+
+  for (;;) {
+    bool all_finished = true;
+    for (int64_t i = 0; i < stream_count; i++) {
+      Stream* stream = streams_[i].get();
+      uint32_t interest = 0;
+      if (stream->request_sent < stream->request.size() ||
+          stream->body_to_send > 0) {
+        interest = EPOLLOUT;
+      } else if (!stream->finished()) {
+        interest = EPOLLIN;
+      }
+      all_finished = all_finished && interest == 0;
+      if (interest != stream->interest) {
+        struct epoll_event event = {};
+        event.events = interest;
+        event.data.ptr = stream;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, stream->fd, &event);
+        stream->interest = interest;
+      }
+    }
+    if (all_finished) {
+      break;
+    }
+
+    int64_t now_ms = MonotonicNowMs();
+    if (now_ms >= deadline_ms || cancelled_) {
+      return sample;
+    }
+    struct epoll_event events[kMaxEvents];
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents,
+                           static_cast<int>(deadline_ms - now_ms));
+    if (count < 0 && errno != EINTR) {
+      return sample;
+    }
+
+    for (int e = 0; e < count; e++) {
+      if (events[e].data.ptr == &kCancelTag) {
+        return sample;
+      }
+      Stream* stream = static_cast<Stream*>(events[e].data.ptr);
+      if (!stream->active || stream->finished()) {
+        continue;
+      }
+
+      if (stream->request_sent < stream->request.size()) {
+        ssize_t sent =
+            send(stream->fd, stream->request.data() + stream->request_sent,
+                 stream->request.size() - stream->request_sent,
+                 MSG_NOSIGNAL | (stream->body_to_send > 0 ? MSG_MORE : 0));
+        if (sent < 0 && errno != EAGAIN && errno != EINTR) {
+          return sample;
+        }
+        stream->request_sent += sent > 0 ? static_cast<size_t>(sent) : 0;
+        continue;
+      }
+
+      if (stream->body_to_send > 0) {
+        size_t chunk = static_cast<size_t>(std::min<int64_t>(
+            stream->body_to_send, static_cast<int64_t>(kBufferSize)));
+        ssize_t sent = send(stream->fd, buffer_.get(), chunk, MSG_NOSIGNAL);
+        if (sent < 0 && errno != EAGAIN && errno != EINTR) {
+          return sample;
+        }
+        if (sent > 0) {
+          if (first_ns == 0) {
+            first_ns = MonotonicNowNs();
+          }
+          stream->body_to_send -= sent;
+          moved += sent;
+        }
+        continue;
+      }
+
+      if (!stream->head_done) {
+        ssize_t received =
+            recv(stream->fd, buffer_.get(), kMaxResponseHead, 0);
+        if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+          continue;
+        }
+        if (received <= 0) {
+          return sample;
+        }
+        size_t scanned = stream->response_head.size();
+        stream->response_head.append(reinterpret_cast<char*>(buffer_.get()),
+                                     static_cast<size_t>(received));
+        size_t end = stream->response_head.find(
+            "\r\n\r\n", scanned > 3 ? scanned - 3 : 0);
+        if (end == std::string::npos) {
+          if (stream->response_head.size() > kMaxResponseHead) {
+            return sample;
+          }
+          continue;
+        }
+        const std::string& head = stream->response_head;
+        if (head.compare(0, 9, "HTTP/1.1 ") != 0 ||
+            head.compare(9, 3, "200") != 0) {
+          return sample;
+        }
+        stream->head_done = true;
+        stream->body_to_receive =
+            strtoll(HeaderValue(head, "Content-Length").c_str(), nullptr, 10);
+        stream->close_after =
+            strcasecmp(HeaderValue(head, "Connection").c_str(), "close") == 0;
+        int64_t leftover = static_cast<int64_t>(head.size() - end - 4);
+        if (leftover > stream->body_to_receive) {
+          return sample;
+        }
+        stream->body_to_receive -= leftover;
+        int64_t now_ns = MonotonicNowNs();
+        if (!upload && leftover > 0) {
+          if (first_ns == 0) {
+            first_ns = now_ns;
+            first_bytes = leftover;
+          }
+          last_ns = now_ns;
+          moved += leftover;
+        }
+        if (upload && stream->body_to_receive == 0) {
+          last_ns = now_ns;
+        }
+        continue;
+      }
+
+      // Body bytes, either the download payload or the short upload reply.
+      size_t want = static_cast<size_t>(std::min<int64_t>(
+          stream->body_to_receive, static_cast<int64_t>(kBufferSize)));
+      bool discard = options_.discard_payload && !upload;
+      ssize_t received =
+          recv(stream->fd, discard ? nullptr : buffer_.get(), want,
+               discard ? MSG_TRUNC : 0);
+      if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+        continue;
+      }
+      if (received <= 0) {
+        return sample;
+      }
+      stream->body_to_receive -= received;
+      int64_t now_ns = MonotonicNowNs();
+      if (!upload) {
+        if (first_ns == 0) {
+          first_ns = now_ns;
+          first_bytes = received;
+        }
+        last_ns = now_ns;
+        moved += received;
+      } else if (stream->body_to_receive == 0) {
+        last_ns = now_ns;
+      }
+    }
+
+    int64_t now_ns = MonotonicNowNs();
+    if (on_progress && first_ns != 0 && now_ns >= next_progress_ns &&
+        now_ns - start_ns >= 50 * 1000000LL) {
+      on_progress(
+          ToMbps(moved - (upload ? 0 : first_bytes), now_ns - first_ns));
+      next_progress_ns = now_ns + options_.progress_interval_ms * 1000000LL;
+    }
+  }
+
+  for (int64_t i = 0; i < stream_count; i++) {
+    if (streams_[i]->close_after) {
+      close(streams_[i]->fd);
+      streams_[i]->fd = -1;
+    }
+  }
+
+  sample.bytes = moved;
+  if (upload) {
+    // The upload is done once the server has acknowledged every body.
+    sample.duration_ns = last_ns - first_ns;
+    sample.mbps = ToMbps(moved, sample.duration_ns);
+  } else if (last_ns - first_ns >= 1000000) {
+    sample.duration_ns = last_ns - first_ns;
+    sample.mbps = ToMbps(moved - first_bytes, sample.duration_ns);
+  } else {
+    // Everything arrived in a burst; fall back to the request round trip.
+    sample.duration_ns = last_ns - start_ns;
+    sample.mbps = ToMbps(moved, sample.duration_ns);
+  }
+  sample.ok = sample.duration_ns > 0;
+  return sample;
+}
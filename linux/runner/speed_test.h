@@ -0,0 +1,87 @@
+#ifndef RUNNER_SPEED_TEST_H_
+#define RUNNER_SPEED_TEST_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class SpeedTestDirection {
+  kDownload,
+  kUpload,
+};
+
+struct SpeedTestOptions {
+  // Server speaking the Cloudflare /__down and /__up protocol over plain
+  // HTTP/1.1.
+  std::string host = "speed.cloudflare.com";
+  uint16_t port = 80;
+  // Parallel TCP streams each sample's bytes are split across.
+  int streams = 4;
+  int connect_timeout_ms = 30000;
+  // Deadline for a whole sample, from its first request byte.
+  int sample_timeout_ms = 60000;
+  // Minimum spacing of progress callbacks.
+  int progress_interval_ms = 100;
+  // Drop downloaded bytes in the kernel with MSG_TRUNC instead of copying
+  // them into the reused receive buffer.
+  bool discard_payload = false;
+};
+
+struct SpeedSample {
+  bool ok = false;
+  double mbps = 0;
+  // Payload bytes moved by every stream together.
+  int64_t bytes = 0;
+  // The interval the throughput was computed over.
+  int64_t duration_ns = 0;
+};
+
+// Measures throughput against a speed-test server the way the Dart services
+// do, but with several keep-alive streams per sample driven from one epoll
+// loop on the caller's thread. Time is taken from CLOCK_MONOTONIC and, for
+// downloads, on the receiving side: from the first body byte to the last,
+// so connection setup and the request round trip are not counted as
+// transfer time. All streams share one preallocated buffer.
+class SpeedTest {
+ public:
+  // Receives the running throughput of the current sample in Mbps.
+  using ProgressCallback = std::function<void(double mbps)>;
+
+  explicit SpeedTest(const SpeedTestOptions& options);
+  ~SpeedTest();
+
+  // Prevent copying.
+  SpeedTest(SpeedTest const&) = delete;
+  SpeedTest& operator=(SpeedTest const&) = delete;
+
+  // Runs |count| samples of |bytes| each in |direction|, back to back on the
+  // same connections, calling |on_progress| on this thread. A failed sample
+  // is reported with |ok| false and the connections are reopened for the
+  // next one. Returns early, with the samples taken so far, once Cancel()
+  // is called.
+  std::vector<SpeedSample> Run(SpeedTestDirection direction, int64_t bytes,
+                               int count, const ProgressCallback& on_progress);
+
+  // Makes Run() return promptly. Safe to call from any thread.
+  void Cancel();
+
+ private:
+  struct Stream;
+
+  bool OpenStreams();
+  void CloseStreams();
+  SpeedSample RunSample(SpeedTestDirection direction, int64_t bytes,
+                        const ProgressCallback& on_progress);
+
+  SpeedTestOptions options_;
+  int epoll_fd_;
+  int cancel_fd_;
+  std::atomic<bool> cancelled_{false};
+  std::vector<std::unique_ptr<Stream>> streams_;
+  std::unique_ptr<uint8_t[]> buffer_;
+};
+
+#endif  // RUNNER_SPEED_TEST_H_
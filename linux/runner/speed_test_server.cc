@@ -0,0 +1,234 @@
+#include "speed_test_server.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "net_util.h"
+
+namespace {
+
+constexpr int kIdleTimeoutMs = 30000;
+constexpr size_t kMaxHeaderSize = 16 * 1024;
+constexpr size_t kChunkSize = 256 * 1024;
+// Larger downloads are refused, matching the public endpoint's limit.
+constexpr int64_t kMaxDownloadBytes = 1000 * 1000 * 1000;
+
+// Zeros to send from; the payload content does not matter.
+const uint8_t kZeros[kChunkSize] = {};
+
+// Returns the value of header |name| in |headers|, or "".
+std::string HeaderValue(const std::string& headers, const char* name) {
+  size_t name_length = strlen(name);
+  size_t line = headers.find("\r\n");
+  while (line != std::string::npos && line + 2 < headers.size()) {
+    size_t start = line + 2;
+    size_t end = headers.find("\r\n", start);
+    if (end == std::string::npos) {
+      end = headers.size();
+    }
+    if (end - start > name_length && headers[start + name_length] == ':' &&
+        strncasecmp(headers.c_str() + start, name, name_length) == 0) {
+      size_t value = headers.find_first_not_of(' ', start + name_length + 1);
+      return value < end ? headers.substr(value, end - value) : "";
+    }
+    line = end;
+  }
+  return std::string();
+}
+
+// Reads until the blank line ending a request head. Bytes read past it are
+// left in |*head| after |*head_length|.
+bool ReadRequestHead(int fd, std::string* head, size_t* head_length) {
+  char buffer[4096];
+  for (;;) {
+    size_t end = head->find("\r\n\r\n");
+    if (end != std::string::npos) {
+      *head_length = end + 4;
+      return true;
+    }
+    if (head->size() > kMaxHeaderSize) {
+      return false;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, kIdleTimeoutMs) <= 0) {
+      return false;
+    }
+    ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    head->append(buffer, static_cast<size_t>(received));
+  }
+}
+
+bool SendResponseHead(int fd, const char* status, int64_t content_length) {
+  std::string head = std::string("HTTP/1.1 ") + status +
+                     "\r\nContent-Type: application/octet-stream"
+                     "\r\nCache-Control: no-store"
+                     "\r\nContent-Length: " +
+                     std::to_string(content_length) + "\r\n\r\n";
+  return WriteFull(fd, head.data(), head.size(),
+                   MonotonicNowMs() + kIdleTimeoutMs);
+}
+
+// Discards |length| body bytes without copying them out of the kernel.
+bool DiscardBody(int fd, int64_t length) {
+  while (length > 0) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, kIdleTimeoutMs) <= 0) {
+      return false;
+    }
+    size_t chunk = static_cast<size_t>(
+        std::min<int64_t>(length, static_cast<int64_t>(kChunkSize)));
+    ssize_t received = recv(fd, nullptr, chunk, MSG_TRUNC);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    length -= received;
+  }
+  return true;
+}
+
+}  // namespace
+
+SpeedTestServer::SpeedTestServer() {}
+
+SpeedTestServer::~SpeedTestServer() { Stop(); }
+
+bool SpeedTestServer::Start(uint16_t port) {
+  if (running()) {
+    return false;
+  }
+  listen_fd_ = ListenTcp("127.0.0.1", port, &port_);
+  if (listen_fd_ < 0) {
+    return false;
+  }
+  stopping_ = false;
+  accept_thread_ = std::thread(&SpeedTestServer::AcceptLoop, this);
+  return true;
+}
+
+void SpeedTestServer::Stop() {
+  if (!running()) {
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+    // Shutting the sockets down wakes every thread blocked on them.
+    shutdown(listen_fd_, SHUT_RDWR);
+    for (int fd : open_fds_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+  }
+  accept_thread_.join();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  sessions_done_.wait(lock, [this] { return active_sessions_ == 0; });
+  close(listen_fd_);
+  listen_fd_ = -1;
+  port_ = 0;
+}
+
+void SpeedTestServer::AcceptLoop() {
+  pthread_setname_np(pthread_self(), "speedtest-srv");
+  for (;;) {
+    int client = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      close(client);
+      return;
+    }
+    open_fds_.insert(client);
+    active_sessions_++;
+    std::thread(&SpeedTestServer::ServeClient, this, client).detach();
+  }
+}
+
+void SpeedTestServer::ServeClient(int client_fd) {
+  // Responses are written as a head and then the body; without this the
+  // tail of a short body waits on the client's delayed ACK.
+  int one = 1;
+  setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  std::string buffer;
+  for (;;) {
+    size_t head_length = 0;
+    if (!ReadRequestHead(client_fd, &buffer, &head_length)) {
+      break;
+    }
+    std::string head = buffer.substr(0, head_length);
+    buffer.erase(0, head_length);
+
+    int64_t content_length =
+        strtoll(HeaderValue(head, "Content-Length").c_str(), nullptr, 10);
+    bool ok = true;
+    if (head.compare(0, 12, "GET /__down?") == 0) {
+      size_t bytes_param = head.find("bytes=");
+      size_t line_end = head.find("\r\n");
+      int64_t bytes = bytes_param < line_end
+                          ? strtoll(head.c_str() + bytes_param + 6, nullptr,
+                                    10)
+                          : 0;
+      if (bytes < 0 || bytes > kMaxDownloadBytes) {
+        ok = SendResponseHead(client_fd, "400 Bad Request", 0);
+      } else {
+        ok = SendResponseHead(client_fd, "200 OK", bytes);
+        while (ok && bytes > 0) {
+          size_t chunk = static_cast<size_t>(
+              std::min<int64_t>(bytes, static_cast<int64_t>(kChunkSize)));
+          ok = WriteFull(client_fd, kZeros, chunk,
+                         MonotonicNowMs() + kIdleTimeoutMs);
+          bytes -= static_cast<int64_t>(chunk);
+        }
+      }
+    } else if (head.compare(0, 10, "POST /__up") == 0) {
+      // Part of the body may already sit in |buffer|.
+      int64_t buffered = std::min<int64_t>(
+          content_length, static_cast<int64_t>(buffer.size()));
+      buffer.erase(0, static_cast<size_t>(buffered));
+      ok = DiscardBody(client_fd, content_length - buffered) &&
+           SendResponseHead(client_fd, "200 OK", 0);
+    } else {
+      ok = SendResponseHead(client_fd, "404 Not Found", 0);
+    }
+
+    if (!ok || strcasecmp(HeaderValue(head, "Connection").c_str(),
+                          "close") == 0) {
+      break;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_fds_.erase(client_fd);
+    active_sessions_--;
+    sessions_done_.notify_all();
+  }
+  close(client_fd);
+}
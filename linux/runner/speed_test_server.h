@@ -0,0 +1,52 @@
+#ifndef RUNNER_SPEED_TEST_SERVER_H_
+#define RUNNER_SPEED_TEST_SERVER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <thread>
+
+// A loopback HTTP/1.1 server answering the two speed-test endpoints the
+// Cloudflare protocol uses: GET /__down?bytes=N returns N bytes and
+// POST /__up swallows its body. It lets SpeedTestEngine be exercised and
+// benchmarked without a network. Connections are kept alive between
+// requests, each on its own thread.
+class SpeedTestServer {
+ public:
+  SpeedTestServer();
+  ~SpeedTestServer();
+
+  // Prevent copying.
+  SpeedTestServer(SpeedTestServer const&) = delete;
+  SpeedTestServer& operator=(SpeedTestServer const&) = delete;
+
+  // Starts accepting on 127.0.0.1:|port|; 0 picks a free port. Returns false
+  // if the port cannot be bound or the server is already running.
+  bool Start(uint16_t port);
+
+  // Closes the listener and every open connection, then waits for the
+  // connection threads to exit.
+  void Stop();
+
+  bool running() const { return listen_fd_ >= 0; }
+
+  // The bound port; valid while running.
+  uint16_t port() const { return port_; }
+
+ private:
+  void AcceptLoop();
+  void ServeClient(int client_fd);
+
+  int listen_fd_ = -1;
+  uint16_t port_ = 0;
+  std::thread accept_thread_;
+
+  std::mutex mutex_;
+  std::condition_variable sessions_done_;
+  std::set<int> open_fds_;
+  int active_sessions_ = 0;
+  bool stopping_ = false;
+};
+
+#endif  // RUNNER_SPEED_TEST_SERVER_H_
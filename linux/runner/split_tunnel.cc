@@ -0,0 +1,349 @@
+#include "split_tunnel.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "log_ring.h"
+#include "rtnetlink.h"
+
+extern char** environ;
+
+namespace {
+
+constexpr char kNftTable[] = "mimivpn_split";
+constexpr char kSrcValidMark[] =
+    "/proc/sys/net/ipv4/conf/all/src_valid_mark";
+
+std::string ReadSmallFile(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::string();
+  }
+  char buffer[4096];
+  ssize_t length = read(fd, buffer, sizeof(buffer));
+  close(fd);
+  return length > 0 ? std::string(buffer, static_cast<size_t>(length))
+                    : std::string();
+}
+
+bool WriteSmallFile(const std::string& path, const std::string& value) {
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = write(fd, value.data(), value.size()) ==
+            static_cast<ssize_t>(value.size());
+  close(fd);
+  return ok;
+}
+
+std::string Trim(const std::string& value) {
+  size_t end = value.find_last_not_of(" \n\r\t");
+  return end == std::string::npos ? std::string() : value.substr(0, end + 1);
+}
+
+std::string Basename(const std::string& path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Runs the nft tool with |script| on its standard input.
+bool RunNft(const std::string& script) {
+  int pipe_fds[2];
+  if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+    return false;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, pipe_fds[0], STDIN_FILENO);
+  char arg0[] = "nft";
+  char arg1[] = "-f";
+  char arg2[] = "-";
+  char* argv[] = {arg0, arg1, arg2, nullptr};
+  pid_t pid;
+  int spawned = posix_spawnp(&pid, "nft", &actions, nullptr, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(pipe_fds[0]);
+  if (spawned != 0) {
+    close(pipe_fds[1]);
+    return false;
+  }
+  bool written = write(pipe_fds[1], script.data(), script.size()) ==
+                 static_cast<ssize_t>(script.size());
+  close(pipe_fds[1]);
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  return written && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+}  // namespace
+
+SplitTunnel::SplitTunnel(const SplitTunnelOptions& options)
+    : options_(options) {}
+
+SplitTunnel::~SplitTunnel() { Stop(); }
+
+bool SplitTunnel::Start(const std::vector<std::string>& apps) {
+  if (running()) {
+    SetApps(apps);
+    return true;
+  }
+  // Pure cgroup v2 systems mount it at /sys/fs/cgroup, hybrid ones below.
+  for (const char* root : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"}) {
+    if (access((std::string(root) + "/cgroup.procs").c_str(), W_OK) == 0 &&
+        access((std::string(root) + "/cgroup.subtree_control").c_str(),
+               F_OK) == 0) {
+      cgroup_root_ = root;
+      break;
+    }
+  }
+  if (cgroup_root_.empty()) {
+    WriteLog(LogLevel::kError, "split", "No writable cgroup v2 hierarchy");
+    return false;
+  }
+  cgroup_path_ = cgroup_root_ + "/" + options_.cgroup_name;
+  if (mkdir(cgroup_path_.c_str(), 0755) != 0 && errno != EEXIST) {
+    WriteLog(LogLevel::kError, "split",
+             "Could not create " + cgroup_path_ + ": " + strerror(errno));
+    return false;
+  }
+  if (!SetUpRouting()) {
+    TearDownRouting();
+    rmdir(cgroup_path_.c_str());
+    return false;
+  }
+
+  apps_ = std::set<std::string>(apps.begin(), apps.end());
+  stopping_ = false;
+  thread_ = std::thread(&SplitTunnel::Run, this);
+  WriteLog(LogLevel::kInfo, "split",
+           "Bypassing the tunnel for " + std::to_string(apps.size()) +
+               " apps");
+  return true;
+}
+
+void SplitTunnel::SetApps(const std::vector<std::string>& apps) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    apps_ = std::set<std::string>(apps.begin(), apps.end());
+  }
+  wake_.notify_all();
+}
+
+void SplitTunnel::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  thread_.join();
+  RestoreAll();
+  TearDownRouting();
+  if (rmdir(cgroup_path_.c_str()) != 0) {
+    WriteLog(LogLevel::kWarning, "split",
+             "Could not remove " + cgroup_path_ + ": " + strerror(errno));
+  }
+}
+
+void SplitTunnel::RefreshRoutes() {
+  if (!running()) {
+    return;
+  }
+  Rtnetlink netlink;
+  if (!netlink.ok()) {
+    return;
+  }
+  int copied = 0;
+  for (int family : {AF_INET, AF_INET6}) {
+    netlink.FlushDefaultRoutes(family, options_.table);
+    copied += netlink.CopyDefaultRoutes(family, options_.table);
+  }
+  WriteLog(LogLevel::kInfo, "split",
+           "Recopied " + std::to_string(copied) + " default routes to table " +
+               std::to_string(options_.table));
+}
+
+void SplitTunnel::Run() {
+  pthread_setname_np(pthread_self(), "vpn-split");
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    lock.unlock();
+    Rescan();
+    lock.lock();
+    wake_.wait_for(lock, std::chrono::milliseconds(options_.rescan_interval_ms),
+                   [this] { return stopping_; });
+  }
+}
+
+void SplitTunnel::Rescan() {
+  std::set<std::string> apps;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    apps = apps_;
+  }
+  std::string ours = "/" + options_.cgroup_name;
+
+  DIR* proc = opendir("/proc");
+  if (proc == nullptr) {
+    return;
+  }
+  while (struct dirent* entry = readdir(proc)) {
+    char* end = nullptr;
+    long pid = strtol(entry->d_name, &end, 10);
+    if (pid <= 0 || *end != '\0') {
+      continue;
+    }
+    std::string base = "/proc/" + std::string(entry->d_name);
+    // The unified hierarchy's line is "0::<path>".
+    std::string cgroup = ReadSmallFile(base + "/cgroup");
+    size_t line = cgroup.find("0::");
+    if (line == std::string::npos) {
+      continue;
+    }
+    std::string current =
+        Trim(cgroup.substr(line + 3, cgroup.find('\n', line) - line - 3));
+    bool inside = current == ours;
+
+    char exe[4096];
+    ssize_t exe_length = readlink((base + "/exe").c_str(), exe, sizeof(exe));
+    std::string path =
+        exe_length > 0 ? std::string(exe, static_cast<size_t>(exe_length))
+                       : std::string();
+    std::string comm = Trim(ReadSmallFile(base + "/comm"));
+    bool listed = apps.count(comm) > 0 ||
+                  (!path.empty() &&
+                   (apps.count(path) > 0 || apps.count(Basename(path)) > 0));
+
+    if (listed && !inside) {
+      if (WriteSmallFile(cgroup_path_ + "/cgroup.procs",
+                         std::to_string(pid))) {
+        moved_[static_cast<int>(pid)] = current;
+      }
+    } else if (!listed && inside && moved_.count(static_cast<int>(pid))) {
+      // Only processes we moved in go back out; children that inherited
+      // the cgroup from a listed parent stay with it.
+      WriteSmallFile(cgroup_root_ + moved_[static_cast<int>(pid)] +
+                         "/cgroup.procs",
+                     std::to_string(pid));
+      moved_.erase(static_cast<int>(pid));
+    }
+  }
+  closedir(proc);
+
+  // Forget processes that have exited.
+  for (auto it = moved_.begin(); it != moved_.end();) {
+    if (kill(it->first, 0) != 0 && errno == ESRCH) {
+      it = moved_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void SplitTunnel::RestoreAll() {
+  std::string procs = ReadSmallFile(cgroup_path_ + "/cgroup.procs");
+  size_t start = 0;
+  while (start < procs.size()) {
+    size_t end = procs.find('\n', start);
+    if (end == std::string::npos) {
+      end = procs.size();
+    }
+    int pid = atoi(procs.substr(start, end - start).c_str());
+    start = end + 1;
+    if (pid <= 0) {
+      continue;
+    }
+    // Children that inherited the cgroup follow their parent's origin when
+    // it is known; otherwise they go to the root.
+    auto it = moved_.find(pid);
+    std::string target =
+        it != moved_.end() ? cgroup_root_ + it->second : cgroup_root_;
+    if (!WriteSmallFile(target + "/cgroup.procs", std::to_string(pid))) {
+      WriteSmallFile(cgroup_root_ + "/cgroup.procs", std::to_string(pid));
+    }
+  }
+  moved_.clear();
+}
+
+bool SplitTunnel::SetUpRouting() {
+  char mark[16];
+  snprintf(mark, sizeof(mark), "0x%x", options_.mark);
+  // Marks sockets of the cgroup on the way out, keeps the mark on the
+  // connection and puts it back on replies.
+  std::string script =
+      std::string("table inet ") + kNftTable + " {\n" +
+      "  chain output {\n"
+      "    type route hook output priority mangle; policy accept;\n"
+      "    socket cgroupv2 level 1 \"" + options_.cgroup_name +
+      "\" meta mark set " + mark + " ct mark set meta mark\n"
+      "  }\n"
+      "  chain prerouting {\n"
+      "    type filter hook prerouting priority mangle; policy accept;\n"
+      "    ct mark " + mark + " meta mark set ct mark\n"
+      "  }\n"
+      "}\n";
+  if (!RunNft(script)) {
+    WriteLog(LogLevel::kError, "split", "Could not install nftables rules");
+    return false;
+  }
+
+  Rtnetlink netlink;
+  if (!netlink.ok()) {
+    return false;
+  }
+  int copied = netlink.CopyDefaultRoutes(AF_INET, options_.table);
+  if (copied == 0) {
+    WriteLog(LogLevel::kError, "split", "No default route to bypass through");
+    return false;
+  }
+  copied += netlink.CopyDefaultRoutes(AF_INET6, options_.table);
+  if (!netlink.ChangeRule(AF_INET, true, options_.mark, options_.table,
+                          options_.rule_priority) ||
+      !netlink.ChangeRule(AF_INET6, true, options_.mark, options_.table,
+                          options_.rule_priority)) {
+    WriteLog(LogLevel::kError, "split", "Could not add routing rules");
+    return false;
+  }
+
+  // Replies arrive on the physical interface while the main table routes
+  // their source into the tunnel; with src_valid_mark the restored mark is
+  // taken into account by reverse-path filtering.
+  saved_src_valid_mark_ = Trim(ReadSmallFile(kSrcValidMark));
+  WriteSmallFile(kSrcValidMark, "1");
+  WriteLog(LogLevel::kInfo, "split",
+           "Copied " + std::to_string(copied) + " default routes to table " +
+               std::to_string(options_.table));
+  return true;
+}
+
+void SplitTunnel::TearDownRouting() {
+  Rtnetlink netlink;
+  if (netlink.ok()) {
+    for (int family : {AF_INET, AF_INET6}) {
+      netlink.ChangeRule(family, false, options_.mark, options_.table,
+                         options_.rule_priority);
+      netlink.FlushDefaultRoutes(family, options_.table);
+    }
+  }
+  RunNft(std::string("delete table inet ") + kNftTable + "\n");
+  if (!saved_src_valid_mark_.empty()) {
+    WriteSmallFile(kSrcValidMark, saved_src_valid_mark_);
+    saved_src_valid_mark_.clear();
+  }
+}
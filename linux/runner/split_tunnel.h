@@ -0,0 +1,89 @@
+#ifndef RUNNER_SPLIT_TUNNEL_H_
+#define RUNNER_SPLIT_TUNNEL_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct SplitTunnelOptions {
+  // Created under the cgroup v2 root.
+  std::string cgroup_name = "mimivpn-bypass";
+  // Firewall mark given to the cgroup's packets, and the routing table the
+  // mark selects.
+  uint32_t mark = 0x4d56;
+  uint32_t table = 0x4d56;
+  // Ahead of the main table, which holds the TUN device's routes.
+  uint32_t rule_priority = 100;
+  // How often running processes are matched against the app list, to catch
+  // apps started after Start().
+  int rescan_interval_ms = 2000;
+};
+
+// Sends the traffic of chosen apps around the tunnel in the kernel. Their
+// processes are moved into a dedicated cgroup whose sockets are marked by an
+// nftables rule; a policy rule sends marked packets to a routing table that
+// holds only the physical default routes, copied from the main table where
+// the TUN device's half-default routes shadow them. Bypassed packets never
+// reach the packet engine. Connection marks are restored on replies so
+// strict reverse-path filtering accepts them.
+//
+// Apps are named by executable, e.g. "firefox" or "/usr/bin/zoom"; child
+// processes follow their parent into the cgroup. Needs root, cgroup v2 and
+// the nft tool.
+class SplitTunnel {
+ public:
+  explicit SplitTunnel(const SplitTunnelOptions& options);
+  ~SplitTunnel();
+
+  // Prevent copying.
+  SplitTunnel(SplitTunnel const&) = delete;
+  SplitTunnel& operator=(SplitTunnel const&) = delete;
+
+  // Sets up the cgroup, firewall and routing and starts moving |apps| into
+  // the cgroup. Returns false and leaves nothing behind on failure.
+  bool Start(const std::vector<std::string>& apps);
+
+  // Replaces the bypassed apps. Processes of apps no longer listed go back
+  // to their original cgroup.
+  void SetApps(const std::vector<std::string>& apps);
+
+  // Returns every process to its original cgroup and removes the rules.
+  void Stop();
+
+  // Copies the physical default routes again after the network changed,
+  // so bypassed traffic leaves through the new gateway.
+  void RefreshRoutes();
+
+  bool running() const { return thread_.joinable(); }
+
+ private:
+  void Run();
+  // Moves running processes of the listed apps into the cgroup and the
+  // others back out.
+  void Rescan();
+  bool SetUpRouting();
+  void TearDownRouting();
+  void RestoreAll();
+
+  SplitTunnelOptions options_;
+  std::string cgroup_root_;
+  std::string cgroup_path_;
+  std::string saved_src_valid_mark_;
+  std::thread thread_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  std::set<std::string> apps_;
+
+  // Original cgroup of each process moved in, relative to the root. Only
+  // touched on the rescan thread, or after it has stopped.
+  std::map<int, std::string> moved_;
+};
+
+#endif  // RUNNER_SPLIT_TUNNEL_H_
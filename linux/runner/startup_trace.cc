@@ -0,0 +1,147 @@
+#include "startup_trace.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+int64_t BootTimeNowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_BOOTTIME, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Returns when this process was started, on the CLOCK_BOOTTIME scale, or
+// -1 when /proc does not say. The kernel keeps it in clock ticks, so it is
+// only good to 10 ms or so, which still beats starting the clock in main().
+int64_t ProcessStartNs() {
+  int fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  char stat[1024];
+  ssize_t length = read(fd, stat, sizeof(stat) - 1);
+  close(fd);
+  if (length <= 0) {
+    return -1;
+  }
+  stat[length] = '\0';
+
+  // The command name may hold spaces and parentheses; fields are counted
+  // from the last ')', after which comes field 3. starttime is field 22.
+  const char* field = strrchr(stat, ')');
+  if (field == nullptr) {
+    return -1;
+  }
+  for (int i = 2; i < 22 && field != nullptr; i++) {
+    field = strchr(field + 1, ' ');
+  }
+  long ticks_per_second = sysconf(_SC_CLK_TCK);
+  if (field == nullptr || ticks_per_second <= 0) {
+    return -1;
+  }
+  unsigned long long ticks = strtoull(field + 1, nullptr, 10);
+  return static_cast<int64_t>(ticks) * (1000000000 / ticks_per_second);
+}
+
+// Escapes |text| for a JSON string.
+std::string JsonEscape(const std::string& text) {
+  std::string escaped;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped.push_back('\\');
+      escaped.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      escaped += code;
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
+
+}  // namespace
+
+StartupTrace::StartupTrace() {
+  int64_t now = BootTimeNowNs();
+  int64_t start = ProcessStartNs();
+  origin_ns_ = start >= 0 && start <= now ? start : now;
+}
+
+StartupTrace& StartupTrace::Default() {
+  static StartupTrace* trace = new StartupTrace();
+  return *trace;
+}
+
+void StartupTrace::Mark(const std::string& name) {
+  double ms = (BootTimeNowNs() - origin_ns_) / 1e6;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const StartupPhase& phase : phases_) {
+    if (phase.name == name) {
+      return;
+    }
+  }
+  phases_.push_back(StartupPhase{name, ms});
+}
+
+std::vector<StartupPhase> StartupTrace::phases() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return phases_;
+}
+
+bool StartupTrace::WriteToFile(const std::string& path) const {
+  // One instant event per phase, on one track.
+  std::string json = "{\"traceEvents\":[";
+  std::vector<StartupPhase> marks = phases();
+  for (size_t i = 0; i < marks.size(); i++) {
+    char timestamp[32];
+    snprintf(timestamp, sizeof(timestamp), "%.0f", marks[i].ms * 1000);
+    json += i == 0 ? "\n" : ",\n";
+    json += "{\"name\":\"" + JsonEscape(marks[i].name) +
+            "\",\"ph\":\"i\",\"s\":\"p\",\"pid\":" +
+            std::to_string(getpid()) + ",\"tid\":0,\"ts\":" + timestamp + "}";
+  }
+  json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+  for (size_t slash = path.find('/', 1); slash != std::string::npos;
+       slash = path.find('/', slash + 1)) {
+    mkdir(path.substr(0, slash).c_str(), 0700);
+  }
+  std::string temp_path = path + ".tmp";
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0600);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = write(fd, json.data(), json.size()) ==
+                 static_cast<ssize_t>(json.size());
+  close(fd);
+  if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string StartupTrace::DefaultPath() {
+  if (const char* path = getenv("MIMIVPN_STARTUP_TRACE")) {
+    return path;
+  }
+  std::string cache;
+  if (const char* xdg = getenv("XDG_CACHE_HOME")) {
+    cache = xdg;
+  } else if (const char* home = getenv("HOME")) {
+    cache = std::string(home) + "/.cache";
+  } else {
+    cache = "/tmp";
+  }
+  return cache + "/mimivpn/startup-trace.json";
+}
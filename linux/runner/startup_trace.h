@@ -0,0 +1,54 @@
+#ifndef RUNNER_STARTUP_TRACE_H_
+#define RUNNER_STARTUP_TRACE_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct StartupPhase {
+  std::string name;
+  // Milliseconds since the process was started, so the time the loader
+  // spends before main() is counted too.
+  double ms = 0;
+};
+
+// Monotonic timestamps for the phases of a cold start, from exec to the
+// first Flutter frame and on to the first connection. Safe to use from any
+// thread.
+class StartupTrace {
+ public:
+  StartupTrace();
+
+  // Prevent copying.
+  StartupTrace(StartupTrace const&) = delete;
+  StartupTrace& operator=(StartupTrace const&) = delete;
+
+  // The process-wide trace the runner and Dart mark phases on.
+  static StartupTrace& Default();
+
+  // Records that |name| was reached now. Only the first mark of a name
+  // counts, so phases that can repeat, such as connecting, report the
+  // first time.
+  void Mark(const std::string& name);
+
+  // Returns the marks so far, oldest first.
+  std::vector<StartupPhase> phases() const;
+
+  // Writes the marks to |path| as Chrome trace events, which
+  // chrome://tracing and Perfetto open directly. Returns false on I/O
+  // failure.
+  bool WriteToFile(const std::string& path) const;
+
+  // $MIMIVPN_STARTUP_TRACE, or startup-trace.json in the cache directory.
+  static std::string DefaultPath();
+
+ private:
+  // CLOCK_BOOTTIME reading, in nanoseconds, of the process start.
+  int64_t origin_ns_;
+
+  mutable std::mutex mutex_;
+  std::vector<StartupPhase> phases_;
+};
+
+#endif  // RUNNER_STARTUP_TRACE_H_
@@ -0,0 +1,101 @@
+#include "streaming_stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Each bucket spans a factor of kGrowth, which bounds the quantile error.
+constexpr double kGrowth = 1.01;
+
+size_t BucketCount() {
+  static const size_t count =
+      static_cast<size_t>(std::ceil(
+          std::log(StreamingStats::kMaxValue / StreamingStats::kMinValue) /
+          std::log(kGrowth))) +
+      1;
+  return count;
+}
+
+}  // namespace
+
+constexpr double StreamingStats::kMinValue;
+constexpr double StreamingStats::kMaxValue;
+
+StreamingStats::StreamingStats() : buckets_(BucketCount(), 0) {}
+
+size_t StreamingStats::BucketFor(double value) {
+  if (!(value > kMinValue)) {
+    return 0;
+  }
+  static const double inverse_log_growth = 1 / std::log(kGrowth);
+  size_t bucket = static_cast<size_t>(std::log(value / kMinValue) *
+                                      inverse_log_growth);
+  return std::min(bucket, BucketCount() - 1);
+}
+
+double StreamingStats::BucketValue(size_t bucket) {
+  // The geometric middle of the bucket.
+  return kMinValue * std::pow(kGrowth, bucket + 0.5);
+}
+
+void StreamingStats::Add(double value) {
+  if (std::isnan(value)) {
+    return;
+  }
+  buckets_[BucketFor(value)]++;
+  if (count_ == 0) {
+    min_ = value;
+    max_ = value;
+  } else {
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+    jitter_sum_ += std::fabs(value - last_);
+  }
+  last_ = value;
+  sum_ += value;
+  count_++;
+}
+
+void StreamingStats::AddExpected(uint64_t count) { expected_ += count; }
+
+void StreamingStats::Reset() {
+  std::fill(buckets_.begin(), buckets_.end(), 0);
+  count_ = 0;
+  expected_ = 0;
+  min_ = 0;
+  max_ = 0;
+  sum_ = 0;
+  last_ = 0;
+  jitter_sum_ = 0;
+}
+
+double StreamingStats::Quantile(double q) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  q = std::max(0.0, std::min(q, 1.0));
+  uint64_t rank = static_cast<uint64_t>(std::llround(q * (count_ - 1)));
+  // The extremes are tracked exactly.
+  if (rank == 0) {
+    return min_;
+  }
+  if (rank == count_ - 1) {
+    return max_;
+  }
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets_.size(); i++) {
+    seen += buckets_[i];
+    if (seen > rank) {
+      return std::max(min_, std::min(BucketValue(i), max_));
+    }
+  }
+  return max_;
+}
+
+double StreamingStats::loss_percent() const {
+  if (expected_ == 0 || count_ >= expected_) {
+    return 0;
+  }
+  return static_cast<double>(expected_ - count_) * 100 / expected_;
+}
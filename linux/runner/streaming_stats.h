@@ -0,0 +1,63 @@
+#ifndef RUNNER_STREAMING_STATS_H_
+#define RUNNER_STREAMING_STATS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Summary statistics over an unbounded series of positive samples, such as
+// speeds in Mbps or latencies in milliseconds, in constant memory. Samples
+// are counted in a fixed log-scaled histogram whose buckets are 1% wide, so
+// adding a sample is O(1) and a quantile costs one pass over the buckets
+// regardless of how many samples were seen. Quantiles are exact to within
+// that 1%; the count, min, max, mean and jitter are exact.
+class StreamingStats {
+ public:
+  StreamingStats();
+
+  // Records |value|. Values below kMinValue share the lowest bucket and
+  // values above kMaxValue the highest.
+  void Add(double value);
+
+  // Raises the number of samples that were expected, e.g. pings sent, so
+  // loss_percent() can report the ones that never arrived.
+  void AddExpected(uint64_t count);
+
+  void Reset();
+
+  // The value below which |q| (0..1) of the samples fall, using the same
+  // nearest-rank rule as the Dart services: rank round(q * (count - 1)).
+  // Returns 0 when empty.
+  double Quantile(double q) const;
+
+  uint64_t count() const { return count_; }
+  double min() const { return count_ > 0 ? min_ : 0; }
+  double max() const { return count_ > 0 ? max_ : 0; }
+  double mean() const { return count_ > 0 ? sum_ / count_ : 0; }
+
+  // Mean absolute difference between consecutive samples.
+  double jitter() const {
+    return count_ > 1 ? jitter_sum_ / (count_ - 1) : 0;
+  }
+
+  // Share of expected samples that were never added, 0..100.
+  double loss_percent() const;
+
+  static constexpr double kMinValue = 1e-3;
+  static constexpr double kMaxValue = 1e7;
+
+ private:
+  static size_t BucketFor(double value);
+  static double BucketValue(size_t bucket);
+
+  std::vector<uint32_t> buckets_;
+  uint64_t count_ = 0;
+  uint64_t expected_ = 0;
+  double min_ = 0;
+  double max_ = 0;
+  double sum_ = 0;
+  double last_ = 0;
+  double jitter_sum_ = 0;
+};
+
+#endif  // RUNNER_STREAMING_STATS_H_
@@ -0,0 +1,168 @@
+#include "subscription.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "base64.h"
+#include "share_link.h"
+
+namespace {
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Served subscriptions often end in a line break, or " \r\n".
+std::string_view Trim(std::string_view text) {
+  while (!text.empty() && IsSpace(text.front())) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && IsSpace(text.back())) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+SubscriptionString Append(std::string_view text, std::string* strings) {
+  SubscriptionString string;
+  string.offset = static_cast<uint32_t>(strings->size());
+  strings->append(text.data(), text.size());
+  string.length = static_cast<uint32_t>(text.size());
+  return string;
+}
+
+SubscriptionString AppendField(const ShareLinkField& field,
+                               std::string* strings) {
+  SubscriptionString string;
+  string.offset = static_cast<uint32_t>(strings->size());
+  AppendShareLinkField(field, strings);
+  string.length = static_cast<uint32_t>(strings->size() - string.offset);
+  return string;
+}
+
+// Host names are case-insensitive, so "Example.com" and "example.com" are
+// the same server.
+void AppendLowercase(std::string_view text, std::string* output) {
+  for (char c : text) {
+    output->push_back(c >= 'A' && c <= 'Z' ? static_cast<char>(c + 32) : c);
+  }
+}
+
+// The endpoints seen so far: keys packed into one buffer and found through
+// a linear-probing table of their indices, so inserting allocates nothing.
+class EndpointSet {
+ public:
+  // Sized for up to |capacity| endpoints, which keeps the table at most
+  // half full.
+  explicit EndpointSet(size_t capacity) {
+    size_t slots = 16;
+    while (slots < capacity * 2) {
+      slots *= 2;
+    }
+    slots_.assign(slots, kEmpty);
+    keys_.reserve(capacity);
+    buffer_.reserve(capacity * 48);
+  }
+
+  // Returns false if the endpoint was seen before.
+  bool Insert(std::string_view scheme, std::string_view host, uint16_t port,
+              bool tls, std::string_view server_name) {
+    SubscriptionString key;
+    key.offset = static_cast<uint32_t>(buffer_.size());
+    buffer_.append(scheme.data(), scheme.size());
+    buffer_.push_back('|');
+    AppendLowercase(host, &buffer_);
+    buffer_.push_back(static_cast<char>(port >> 8));
+    buffer_.push_back(static_cast<char>(port));
+    buffer_.push_back(tls ? '+' : '-');
+    AppendLowercase(server_name, &buffer_);
+    key.length = static_cast<uint32_t>(buffer_.size() - key.offset);
+
+    std::string_view text = View(key);
+    size_t mask = slots_.size() - 1;
+    for (size_t i = std::hash<std::string_view>()(text) & mask;;
+         i = (i + 1) & mask) {
+      if (slots_[i] == kEmpty) {
+        slots_[i] = static_cast<uint32_t>(keys_.size());
+        keys_.push_back(key);
+        return true;
+      }
+      if (View(keys_[slots_[i]]) == text) {
+        buffer_.resize(key.offset);
+        return false;
+      }
+    }
+  }
+
+ private:
+  static constexpr uint32_t kEmpty = UINT32_MAX;
+
+  std::string_view View(SubscriptionString key) const {
+    return std::string_view(buffer_).substr(key.offset, key.length);
+  }
+
+  std::string buffer_;
+  std::vector<SubscriptionString> keys_;
+  std::vector<uint32_t> slots_;
+};
+
+}  // namespace
+
+ParsedSubscription ParseSubscription(std::string_view text) {
+  ParsedSubscription parsed;
+  std::string decoded;
+  if (Trim(text).find("://") == std::string_view::npos) {
+    if (!DecodeBase64(Trim(text), &decoded)) {
+      return parsed;
+    }
+    text = decoded;
+  }
+  parsed.ok = true;
+  // Most of the arena is links and hosts, which together stay under the
+  // size of the text.
+  parsed.strings.reserve(text.size() + text.size() / 2);
+  size_t lines = std::count(text.begin(), text.end(), '\n') + 1;
+  parsed.configs.reserve(lines);
+
+  EndpointSet endpoints(lines);
+  std::string scratch;
+  uint32_t line = 0;
+  while (!text.empty()) {
+    line++;
+    size_t end = text.find('\n');
+    std::string_view link = Trim(text.substr(0, end));
+    text = end == std::string_view::npos ? std::string_view()
+                                         : text.substr(end + 1);
+    if (link.empty()) {
+      continue;
+    }
+
+    ShareLinkTokens tokens;
+    const char* error = TokenizeShareLink(link, &scratch, &tokens);
+    if (error != nullptr) {
+      parsed.errors.push_back({line, error});
+      continue;
+    }
+
+    size_t mark = parsed.strings.size();
+    SubscriptionConfig config;
+    config.line = line;
+    config.port = tokens.port;
+    config.tls = tokens.tls;
+    config.host = AppendField(tokens.host, &parsed.strings);
+    config.server_name = AppendField(tokens.server_name, &parsed.strings);
+    if (!endpoints.Insert(tokens.scheme, parsed.View(config.host),
+                          config.port, config.tls,
+                          parsed.View(config.server_name))) {
+      parsed.strings.resize(mark);
+      parsed.duplicates++;
+      continue;
+    }
+
+    config.link = Append(link, &parsed.strings);
+    config.name = AppendField(tokens.name, &parsed.strings);
+    config.scheme = Append(tokens.scheme, &parsed.strings);
+    parsed.configs.push_back(config);
+  }
+  return parsed;
+}
@@ -0,0 +1,61 @@
+#ifndef RUNNER_SUBSCRIPTION_H_
+#define RUNNER_SUBSCRIPTION_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Parsing of provider subscriptions: a list of share links, one per line,
+// usually base64-encoded as a whole. Thousands of links are taken apart in
+// one call, with every decoded string packed into a single arena instead of
+// one allocation each.
+
+// A string in ParsedSubscription::strings.
+struct SubscriptionString {
+  uint32_t offset = 0;
+  uint32_t length = 0;
+};
+
+struct SubscriptionConfig {
+  // 1-based line of the link in the decoded subscription.
+  uint32_t line = 0;
+  // The share link itself.
+  SubscriptionString link;
+  // The display name; empty if the link has none.
+  SubscriptionString name;
+  SubscriptionString scheme;
+  SubscriptionString host;
+  // SNI to present; empty means |host|.
+  SubscriptionString server_name;
+  uint16_t port = 0;
+  bool tls = false;
+};
+
+// A line that is not a usable share link.
+struct SubscriptionError {
+  uint32_t line = 0;
+  // Static text such as "unsupported scheme".
+  const char* reason = nullptr;
+};
+
+struct ParsedSubscription {
+  // False if the subscription was base64 that did not decode.
+  bool ok = false;
+  std::string strings;
+  std::vector<SubscriptionConfig> configs;
+  std::vector<SubscriptionError> errors;
+  // Links dropped because an earlier one reaches the same endpoint: same
+  // scheme, host, port, TLS and SNI.
+  uint32_t duplicates = 0;
+
+  std::string_view View(SubscriptionString string) const {
+    return std::string_view(strings).substr(string.offset, string.length);
+  }
+};
+
+// Parses |text|, a subscription either as served (base64) or already
+// decoded. Blank lines are skipped.
+ParsedSubscription ParseSubscription(std::string_view text);
+
+#endif  // RUNNER_SUBSCRIPTION_H_
@@ -0,0 +1,381 @@
+// Correctness checks for the DNS wire format helpers behind the caching
+// forwarder: cache keys from queries, with and without EDNS, TTLs and
+// negative answers from responses, the replies built from a query, and
+// rejection of truncated and malformed messages.
+//
+//   cmake -DMIMIVPN_TESTS=ON ... && ctest --test-dir <build>/runner
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "dns_message.h"
+
+namespace {
+
+int failures = 0;
+
+void Check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::printf("FAIL: %s\n", what.c_str());
+    failures++;
+  }
+}
+
+constexpr uint16_t kTypeA = 1;
+constexpr uint16_t kTypeCname = 5;
+constexpr uint16_t kTypeSoa = 6;
+constexpr uint16_t kTypeAaaa = 28;
+constexpr uint16_t kTypeOpt = 41;
+constexpr uint16_t kClassIn = 1;
+
+// Builds DNS messages field by field.
+class Message {
+ public:
+  Message(uint16_t id, uint16_t flags, uint16_t questions, uint16_t answers,
+          uint16_t authorities, uint16_t additionals) {
+    U16(id);
+    U16(flags);
+    U16(questions);
+    U16(answers);
+    U16(authorities);
+    U16(additionals);
+  }
+
+  Message& U8(uint8_t value) {
+    bytes_.push_back(value);
+    return *this;
+  }
+  Message& U16(uint16_t value) {
+    return U8(static_cast<uint8_t>(value >> 8))
+        .U8(static_cast<uint8_t>(value));
+  }
+  Message& U32(uint32_t value) {
+    return U16(static_cast<uint16_t>(value >> 16))
+        .U16(static_cast<uint16_t>(value));
+  }
+
+  // |name| as labels, e.g. "example.com"; "" is the root.
+  Message& Name(const std::string& name) {
+    size_t start = 0;
+    while (start < name.size()) {
+      size_t dot = name.find('.', start);
+      if (dot == std::string::npos) {
+        dot = name.size();
+      }
+      U8(static_cast<uint8_t>(dot - start));
+      bytes_.insert(bytes_.end(), name.begin() + start, name.begin() + dot);
+      start = dot + 1;
+    }
+    return U8(0);
+  }
+
+  // A compression pointer to |offset|.
+  Message& Pointer(uint16_t offset) { return U16(0xc000 | offset); }
+
+  Message& Question(const std::string& name, uint16_t type) {
+    return Name(name).U16(type).U16(kClassIn);
+  }
+
+  // The fixed part of a record whose owner name was just written.
+  Message& Record(uint16_t type, uint32_t ttl, uint16_t rdata_length) {
+    return U16(type).U16(kClassIn).U32(ttl).U16(rdata_length);
+  }
+
+  // An OPT pseudo-record advertising |udp_size|.
+  Message& Opt(uint16_t udp_size, bool dnssec_ok) {
+    return U8(0).U16(kTypeOpt).U16(udp_size).U8(0).U8(0)
+        .U16(dnssec_ok ? 0x8000 : 0).U16(0);
+  }
+
+  // An SOA record for "example.com" at |owner|, with |minimum|.
+  Message& Soa(uint16_t owner, uint32_t ttl, uint32_t minimum) {
+    Pointer(owner).Record(kTypeSoa, ttl, 2 + 2 + 20);
+    Pointer(owner).Pointer(owner);
+    return U32(2024010101).U32(7200).U32(900).U32(1209600).U32(minimum);
+  }
+
+  size_t size() const { return bytes_.size(); }
+  const uint8_t* data() const { return bytes_.data(); }
+  std::vector<uint8_t>& bytes() { return bytes_; }
+
+ private:
+  std::vector<uint8_t> bytes_;
+};
+
+constexpr uint16_t kRd = 0x0100;
+constexpr uint16_t kCd = 0x0010;
+constexpr uint16_t kResponse = 0x8180;
+// Where the question starts, and so what a pointer to the query name holds.
+constexpr uint16_t kQuestionName = 12;
+
+bool ParseQuestion(const Message& message, DnsQuestion* question) {
+  return ParseDnsQuestion(message.data(), message.size(), question);
+}
+
+bool ParseQuestion(const Message& message) {
+  DnsQuestion question;
+  return ParseQuestion(message, &question);
+}
+
+void TestQuestions() {
+  DnsQuestion mixed;
+  Check(ParseQuestion(Message(0x1234, kRd, 1, 0, 0, 0)
+                          .Question("WWW.Example.COM", kTypeA),
+                      &mixed),
+        "plain query");
+  Check(mixed.id == 0x1234, "query id");
+  Check(mixed.question_end == 12 + 17 + 4, "question end");
+  Check(mixed.udp_limit == kDnsClassicUdpSize, "classic UDP limit");
+  std::string key("\3www\7example\3com\0\0\1\0\1\0", 22);
+  Check(mixed.key == key, "key is lower-cased name, type, class, flags");
+
+  DnsQuestion lower;
+  ParseQuestion(Message(0x9999, kRd, 1, 0, 0, 0)
+                    .Question("www.example.com", kTypeA),
+                &lower);
+  Check(lower.key == mixed.key, "case does not change the key");
+
+  DnsQuestion aaaa;
+  ParseQuestion(Message(0x1234, kRd, 1, 0, 0, 0)
+                    .Question("www.example.com", kTypeAaaa),
+                &aaaa);
+  Check(aaaa.key != mixed.key, "type is part of the key");
+
+  DnsQuestion checking_disabled;
+  ParseQuestion(Message(0x1234, kRd | kCd, 1, 0, 0, 0)
+                    .Question("www.example.com", kTypeA),
+                &checking_disabled);
+  Check(checking_disabled.key != mixed.key, "CD is part of the key");
+
+  DnsQuestion edns;
+  Check(ParseQuestion(Message(1, kRd, 1, 0, 0, 1)
+                          .Question("example.com", kTypeA)
+                          .Opt(4096, true),
+                      &edns),
+        "EDNS query");
+  Check(edns.udp_limit == 4096, "EDNS UDP limit");
+  Check(edns.question_end == 12 + 13 + 4, "EDNS question end");
+  Check(edns.key.back() == 2, "DO is part of the key");
+
+  DnsQuestion small_edns;
+  ParseQuestion(Message(1, kRd, 1, 0, 0, 1)
+                    .Question("example.com", kTypeA)
+                    .Opt(200, false),
+                &small_edns);
+  Check(small_edns.udp_limit == kDnsClassicUdpSize,
+        "EDNS below 512 keeps 512");
+
+  // The OPT record behind an answer a client put in its query.
+  DnsQuestion late_opt;
+  Check(ParseQuestion(Message(1, kRd, 1, 1, 0, 1)
+                          .Question("example.com", kTypeA)
+                          .Pointer(kQuestionName)
+                          .Record(kTypeA, 60, 4)
+                          .U32(0x0a000001)
+                          .Opt(1232, false),
+                      &late_opt),
+        "query with an answer");
+  Check(late_opt.udp_limit == 1232, "OPT after another record");
+
+  Check(ParseQuestion(Message(1, kRd, 1, 0, 0, 0).Question("", kTypeA)),
+        "root query");
+
+  Check(!ParseQuestion(Message(1, kRd, 0, 0, 0, 0)), "no question");
+  Check(!ParseQuestion(Message(1, kRd, 2, 0, 0, 0)
+                           .Question("a.example", kTypeA)
+                           .Question("b.example", kTypeA)),
+        "two questions");
+  Check(!ParseQuestion(Message(1, kResponse, 1, 0, 0, 0)
+                           .Question("example.com", kTypeA)),
+        "a response");
+  Check(!ParseQuestion(Message(1, 0x2000, 1, 0, 0, 0)
+                           .Question("example.com", kTypeA)),
+        "opcode 4");
+  Check(!ParseQuestion(Message(1, kRd, 1, 0, 0, 0)
+                           .Name("example.com")
+                           .U16(kTypeA)),
+        "no class");
+  Check(!ParseQuestion(Message(1, kRd, 1, 0, 0, 0).U8(7).U8('e')),
+        "label past the end");
+  Check(!ParseQuestion(Message(1, kRd, 1, 0, 0, 0)
+                           .Pointer(kQuestionName)
+                           .U16(kTypeA)
+                           .U16(kClassIn)),
+        "compressed query name");
+  Check(!ParseQuestion(Message(1, kRd, 1, 0, 0, 1)
+                           .Question("example.com", kTypeA)
+                           .U8(0)
+                           .U16(kTypeOpt)),
+        "OPT past the end");
+
+  std::string label(63, 'a');
+  std::string longest = label + "." + label + "." + label + "." +
+                        std::string(61, 'a');
+  Check(ParseQuestion(Message(1, kRd, 1, 0, 0, 0).Question(longest, kTypeA)),
+        "255-byte name");
+  Check(!ParseQuestion(Message(1, kRd, 1, 0, 0, 0)
+                           .Question(longest + "a", kTypeA)),
+        "256-byte name");
+  Check(!ParseQuestion(Message(1, kRd, 1, 0, 0, 0)
+                           .Question(label + "a", kTypeA)),
+        "64-byte label");
+
+  Message header_only(1, kRd, 1, 0, 0, 0);
+  Check(!ParseDnsQuestion(header_only.data(), kDnsHeaderSize - 1,
+                          &late_opt),
+        "short header");
+}
+
+bool Scan(const Message& message, DnsRecordScan* scan) {
+  return ScanDnsResponse(message.data(), message.size(), scan);
+}
+
+void TestResponses() {
+  // www.example.com CNAME example.com (300s), example.com A (60s), OPT.
+  Message answer(7, kResponse, 1, 2, 0, 1);
+  answer.Question("www.example.com", kTypeA);
+  size_t cname_ttl = answer.size() + 2 + 4;
+  answer.Pointer(kQuestionName).Record(kTypeCname, 300, 2)
+      .Pointer(kQuestionName + 4);
+  size_t a_ttl = answer.size() + 2 + 4;
+  answer.Pointer(kQuestionName + 4).Record(kTypeA, 60, 4).U32(0x5db8d822);
+  answer.Opt(1232, false);
+  DnsRecordScan scan;
+  Check(Scan(answer, &scan), "answer scans");
+  Check(scan.rcode == kDnsRcodeNoError && !scan.truncated && !scan.negative,
+        "answer flags");
+  Check(scan.ttl_offsets.size() == 2 && scan.ttl_offsets[0] == cname_ttl &&
+            scan.ttl_offsets[1] == a_ttl,
+        "TTL offsets skip OPT");
+  Check(scan.min_ttl == 60, "smallest TTL");
+
+  // RFC 2308: the SOA TTL, capped by its MINIMUM field.
+  Message nxdomain(8, kResponse | kDnsRcodeNxDomain, 1, 0, 1, 0);
+  nxdomain.Question("nope.example.com", kTypeA).Soa(kQuestionName + 5, 3600,
+                                                    900);
+  Check(Scan(nxdomain, &scan), "NXDOMAIN scans");
+  Check(scan.negative && scan.rcode == kDnsRcodeNxDomain, "NXDOMAIN");
+  Check(scan.negative_ttl == 900, "NXDOMAIN TTL is the SOA MINIMUM");
+  Check(scan.ttl_offsets.size() == 1 && scan.min_ttl == 3600,
+        "SOA TTL is rewritable");
+
+  Message nodata(9, kResponse, 1, 0, 1, 0);
+  nodata.Question("example.com", kTypeAaaa).Soa(kQuestionName, 300, 900);
+  Check(Scan(nodata, &scan), "NODATA scans");
+  Check(scan.negative && scan.negative_ttl == 300,
+        "NODATA TTL is the SOA TTL");
+
+  Message no_soa(10, kResponse | kDnsRcodeNxDomain, 1, 0, 0, 0);
+  no_soa.Question("nope.example.com", kTypeA);
+  Check(Scan(no_soa, &scan) && scan.negative && scan.negative_ttl == 0 &&
+            scan.min_ttl == 0 && scan.ttl_offsets.empty(),
+        "negative answer without SOA");
+
+  Message servfail(11, kResponse | kDnsRcodeServFail, 1, 0, 0, 0);
+  servfail.Question("example.com", kTypeA);
+  Check(Scan(servfail, &scan) && !scan.negative &&
+            scan.rcode == kDnsRcodeServFail,
+        "SERVFAIL is not negative");
+
+  Message truncated(12, kResponse | 0x0200, 1, 0, 0, 0);
+  truncated.Question("example.com", kTypeA);
+  Check(Scan(truncated, &scan) && scan.truncated, "TC bit");
+
+  // RFC 2181: a TTL with the top bit set means zero.
+  Message huge_ttl(13, kResponse, 1, 1, 0, 0);
+  huge_ttl.Question("example.com", kTypeA)
+      .Pointer(kQuestionName)
+      .Record(kTypeA, 0x80000000, 4)
+      .U32(1);
+  Check(Scan(huge_ttl, &scan) && scan.min_ttl == 0, "negative TTL is zero");
+
+  Message overrun(14, kResponse, 1, 1, 0, 0);
+  overrun.Question("example.com", kTypeA)
+      .Pointer(kQuestionName)
+      .Record(kTypeA, 60, 4)
+      .U16(1);
+  Check(!Scan(overrun, &scan), "RDATA past the end");
+
+  Message missing(15, kResponse, 1, 2, 0, 0);
+  missing.Question("example.com", kTypeA)
+      .Pointer(kQuestionName)
+      .Record(kTypeA, 60, 4)
+      .U32(1);
+  Check(!Scan(missing, &scan), "fewer records than counted");
+
+  Message bad_label(16, kResponse, 1, 0, 0, 0);
+  bad_label.U8(0x40).U8(0).U16(kTypeA).U16(kClassIn);
+  Check(!Scan(bad_label, &scan), "extended label type");
+
+  Message cut_pointer(17, kResponse, 1, 1, 0, 0);
+  cut_pointer.Question("example.com", kTypeA).U8(0xc0);
+  Check(!Scan(cut_pointer, &scan), "pointer cut short");
+
+  Message header_only(18, kResponse, 0, 0, 0, 0);
+  Check(!ScanDnsResponse(header_only.data(), kDnsHeaderSize - 1, &scan),
+        "short header");
+}
+
+void TestReplies() {
+  Message query(0xbeef, kRd | kCd, 1, 0, 0, 1);
+  query.Question("ExAmple.com", kTypeA).Opt(4096, false);
+  DnsQuestion question;
+  ParseQuestion(query, &question);
+
+  // A cached response to someone else's "example.com" query.
+  Message cached(0x0001, kResponse, 1, 1, 0, 0);
+  cached.Question("example.com", kTypeA)
+      .Pointer(kQuestionName)
+      .Record(kTypeA, 60, 4)
+      .U32(0x5db8d822);
+  std::vector<uint8_t> response = cached.bytes();
+  AdoptDnsQuery(query.data(), question.question_end, &response);
+  Check(response[0] == 0xbe && response[1] == 0xef, "adopted id");
+  Check(std::equal(query.data() + kDnsHeaderSize,
+                   query.data() + question.question_end,
+                   response.begin() + kDnsHeaderSize),
+        "adopted question keeps the client's case");
+  Check(std::equal(cached.bytes().begin() + question.question_end,
+                   cached.bytes().end(),
+                   response.begin() + question.question_end) &&
+            response[2] == cached.bytes()[2] &&
+            response[3] == cached.bytes()[3],
+        "records and flags untouched");
+
+  std::vector<uint8_t> reply = BuildDnsReply(
+      query.data(), question.question_end, kDnsRcodeServFail, false);
+  Check(reply.size() == question.question_end, "reply holds the question");
+  Check(reply[0] == 0xbe && reply[1] == 0xef, "reply id");
+  Check(reply[2] == 0x81 && reply[3] == (0x80 | 0x10 | kDnsRcodeServFail),
+        "reply flags: QR, RD, RA, CD, rcode");
+  Check(reply[4] == 0 && reply[5] == 1 && reply[6] == 0 && reply[7] == 0 &&
+            reply[8] == 0 && reply[9] == 0 && reply[10] == 0 &&
+            reply[11] == 0,
+        "reply counts: the question only");
+  DnsRecordScan scan;
+  Check(ScanDnsResponse(reply.data(), reply.size(), &scan) &&
+            scan.rcode == kDnsRcodeServFail,
+        "reply scans");
+
+  std::vector<uint8_t> truncated = BuildDnsReply(
+      query.data(), question.question_end, kDnsRcodeNoError, true);
+  Check(ScanDnsResponse(truncated.data(), truncated.size(), &scan) &&
+            scan.truncated && scan.rcode == kDnsRcodeNoError,
+        "truncated reply");
+}
+
+}  // namespace
+
+int main() {
+  TestQuestions();
+  TestResponses();
+  TestReplies();
+  if (failures > 0) {
+    std::printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  std::printf("dns_message_test: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,313 @@
+// Correctness checks for share link and subscription parsing: known vmess,
+// vless, trojan and ss links, subscriptions in both base64 alphabets with
+// and without padding, and malformed links and subscriptions. The expected
+// links and names are what ConfigService's Dart fallback parser
+// (_parseSubscriptionLinks) returns for the same input. The native parser
+// differs from it on purpose in three ways, each checked here: it rejects
+// schemes it cannot reach, it drops links to an endpoint already listed
+// rather than only repeated links, and it names vmess links by their "ps".
+//
+//   cmake -DMIMIVPN_TESTS=ON ... && ctest --test-dir <build>/runner
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "base64.h"
+#include "share_link.h"
+#include "subscription.h"
+
+namespace {
+
+int failures = 0;
+
+void Check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::printf("FAIL: %s\n", what.c_str());
+    failures++;
+  }
+}
+
+template <typename T>
+void CheckEqual(const T& actual, const T& expected, const std::string& what) {
+  Check(actual == expected, what);
+}
+
+void CheckEqual(std::string_view actual, std::string_view expected,
+                const std::string& what) {
+  Check(actual == expected, what + ": got \"" + std::string(actual) +
+                                "\", want \"" + std::string(expected) +
+                                "\"");
+}
+
+std::string EncodeBase64(const std::string& input, bool url_safe,
+                          bool padded) {
+  const char* alphabet =
+      url_safe
+          ? "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+          : "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string output;
+  uint32_t accumulator = 0;
+  int bits = 0;
+  for (char c : input) {
+    accumulator = (accumulator << 8) | static_cast<uint8_t>(c);
+    bits += 8;
+    while (bits >= 6) {
+      bits -= 6;
+      output.push_back(alphabet[(accumulator >> bits) & 63]);
+    }
+  }
+  if (bits > 0) {
+    output.push_back(alphabet[(accumulator << (6 - bits)) & 63]);
+  }
+  while (padded && output.size() % 4 != 0) {
+    output.push_back('=');
+  }
+  return output;
+}
+
+// A link and what parsing it should give.
+struct KnownLink {
+  std::string link;
+  // The name the Dart fallback gives the link: its fragment, decoded.
+  std::string dart_name;
+  std::string name;
+  std::string scheme;
+  std::string host;
+  uint16_t port;
+  bool tls;
+  std::string server_name;
+};
+
+// The payload is built so its standard base64 holds both '+' and '/'.
+const char kVmessJson[] =
+    "{\"v\":\"2\",\"ps\":\"\\u65e5\\u672c \\ud83c\\uddef\\ud83c\\uddf5 ?>>~\","
+    "\"add\":\"vm.example.com\",\"port\":\"443\","
+    "\"id\":\"b831381d-6324-4d53-ad4f-8cda48b30811\",\"aid\":\"0\","
+    "\"net\":\"ws\",\"host\":\"cdn.example.com\",\"path\":\"/ws?ed=2048\","
+    "\"tls\":\"tls\"}";
+
+std::vector<KnownLink> KnownLinks() {
+  return {
+      {"vless://b831381d-6324-4d53-ad4f-8cda48b30811@Example.com:443"
+       "?encryption=none&security=reality&sni=www.microsoft.com&fp=chrome"
+       "&type=tcp#Node%20One",
+       "Node One", "Node One", "vless", "Example.com", 443, true,
+       "www.microsoft.com"},
+      {"vless://b831381d-6324-4d53-ad4f-8cda48b30811@198.51.100.4:80"
+       "?type=ws&path=%2F#Plain",
+       "Plain", "Plain", "vless", "198.51.100.4", 80, false, ""},
+      {"trojan://p%40ss@[2001:db8::1]:8443?peer=cdn.example.org"
+       "#Trojan%E2%9C%93",
+       "Trojan✓", "Trojan✓", "trojan", "2001:db8::1", 8443, true,
+       "cdn.example.org"},
+      {"trojan://secret@trojan.example.net:443?security=none",
+       "", "", "trojan", "trojan.example.net", 443, false, ""},
+      // SIP002: only the user info is base64, here unpadded.
+      {"ss://YWVzLTI1Ni1nY206cGFzcw@203.0.113.7:8388/?plugin=obfs#SS",
+       "SS", "SS", "ss", "203.0.113.7", 8388, false, ""},
+      // Legacy: all of "method:password@host:port", URL-safe and unpadded.
+      {"ss://" +
+           EncodeBase64("chacha20-ietf-poly1305:s3cr?t>@ss.example.net:8389",
+                        true, false) +
+           "#Legacy",
+       "Legacy", "Legacy", "ss", "ss.example.net", 8389, false, ""},
+      // vmess links carry their name in the payload, not a fragment.
+      {"vmess://" + EncodeBase64(kVmessJson, false, true), "",
+       "日本 \U0001f1ef\U0001f1f5 ?>>~", "vmess", "vm.example.com", 443,
+       true, "cdn.example.com"},
+  };
+}
+
+void TestBase64() {
+  std::string text = kVmessJson;
+  std::string standard = EncodeBase64(text, false, true);
+  std::string url_safe = EncodeBase64(text, true, false);
+  Check(standard.find('+') != std::string::npos &&
+            standard.find('/') != std::string::npos,
+        "vmess payload exercises '+' and '/'");
+  for (const Base64Kernel& kernel : SupportedBase64Kernels()) {
+    std::string name = std::string("base64 ") + kernel.name;
+    std::string decoded;
+    Check(DecodeBase64With(kernel, standard, &decoded) && decoded == text,
+          name + ": standard, padded");
+    Check(DecodeBase64With(kernel, url_safe, &decoded) && decoded == text,
+          name + ": URL-safe, unpadded");
+    Check(DecodeBase64With(kernel, EncodeBase64(text, false, false),
+                           &decoded) &&
+              decoded == text,
+          name + ": standard, unpadded");
+    Check(DecodeBase64With(kernel, "aGVsbG8g\r\nd29y\nbGQ=", &decoded) &&
+              decoded == "hello world",
+          name + ": line breaks");
+    Check(!DecodeBase64With(kernel, "aGVs*G8=", &decoded),
+          name + ": rejects '*'");
+    Check(!DecodeBase64With(kernel, "aGVs bG8=", &decoded),
+          name + ": rejects an inner space");
+  }
+}
+
+void TestShareLinks() {
+  for (const KnownLink& known : KnownLinks()) {
+    ShareLinkEndpoint endpoint;
+    bool parsed = ParseShareLinkEndpoint(known.link, &endpoint);
+    Check(parsed, "parses " + known.link);
+    if (!parsed) {
+      continue;
+    }
+    CheckEqual(endpoint.scheme, known.scheme, known.link + " scheme");
+    CheckEqual(endpoint.host, known.host, known.link + " host");
+    CheckEqual(endpoint.port, known.port, known.link + " port");
+    CheckEqual(endpoint.tls, known.tls, known.link + " tls");
+    CheckEqual(endpoint.server_name, known.server_name,
+               known.link + " server_name");
+  }
+
+  struct Malformed {
+    std::string link;
+    const char* reason;
+  };
+  const Malformed kMalformed[] = {
+      {"just some text", "not a share link"},
+      {"https://example.com/sub", "unsupported scheme"},
+      {"vless://example.com:443", "missing user info"},
+      {"vless://id@example.com", "missing port"},
+      {"vless://id@:443", "missing host"},
+      {"vless://id@[2001:db8::1:443", "malformed address"},
+      {"trojan://secret@example.com:70000", "bad port"},
+      {"trojan://secret@example.com:0", "bad port"},
+      {"ss://not*base64#Broken", "bad base64"},
+      {"ss://" + EncodeBase64("aes-128-gcm:pass", false, true),
+       "missing user info"},
+      {"vmess://!!!", "bad base64"},
+      {"vmess://" + EncodeBase64("[\"add\",\"x\"]", false, true),
+       "malformed vmess payload"},
+      {"vmess://" + EncodeBase64("{\"port\":\"443\"}", false, true),
+       "missing host"},
+      {"vmess://" + EncodeBase64("{\"add\":\"x\",\"port\":\"http\"}", false,
+                                 true),
+       "bad port"},
+  };
+  for (const Malformed& malformed : kMalformed) {
+    std::string scratch;
+    ShareLinkTokens tokens;
+    const char* reason = TokenizeShareLink(malformed.link, &scratch, &tokens);
+    CheckEqual(std::string_view(reason ? reason : "accepted"),
+               std::string_view(malformed.reason), "rejects " + malformed.link);
+    ShareLinkEndpoint endpoint;
+    Check(!ParseShareLinkEndpoint(malformed.link, &endpoint),
+          "no endpoint for " + malformed.link);
+  }
+}
+
+// Checks |parsed| holds exactly |links|, in order, from the given lines.
+void CheckConfigs(const ParsedSubscription& parsed,
+                  const std::vector<KnownLink>& links,
+                  const std::vector<uint32_t>& lines,
+                  const std::string& what) {
+  Check(parsed.ok, what + ": ok");
+  CheckEqual(parsed.configs.size(), links.size(), what + ": config count");
+  for (size_t i = 0; i < parsed.configs.size() && i < links.size(); i++) {
+    const SubscriptionConfig& config = parsed.configs[i];
+    const KnownLink& known = links[i];
+    std::string label = what + " #" + std::to_string(i + 1);
+    CheckEqual(config.line, lines[i], label + " line");
+    CheckEqual(parsed.View(config.link), known.link, label + " link");
+    CheckEqual(parsed.View(config.name), known.name, label + " name");
+    CheckEqual(parsed.View(config.scheme), known.scheme, label + " scheme");
+    CheckEqual(parsed.View(config.host), known.host, label + " host");
+    CheckEqual(config.port, known.port, label + " port");
+    CheckEqual(config.tls, known.tls, label + " tls");
+    CheckEqual(parsed.View(config.server_name), known.server_name,
+               label + " server_name");
+    if (known.scheme != "vmess") {
+      CheckEqual(parsed.View(config.name), known.dart_name,
+                 label + " name matches the Dart parser");
+    }
+  }
+}
+
+void TestSubscriptions() {
+  std::vector<KnownLink> links = KnownLinks();
+  std::string text;
+  std::vector<uint32_t> lines;
+  for (size_t i = 0; i < links.size(); i++) {
+    // CRLF line ends and a blank line, as some providers serve them.
+    text += links[i].link + (i % 2 == 0 ? "\r\n" : "\n");
+    if (i == 2) {
+      text += "\r\n";
+    }
+    lines.push_back(static_cast<uint32_t>(i + 1 + (i > 2 ? 1 : 0)));
+  }
+
+  CheckConfigs(ParseSubscription(text), links, lines, "plain text");
+
+  // As served: base64 wrapped at 76 columns, the way base64(1) writes it.
+  std::string wrapped = EncodeBase64(text, false, true);
+  for (size_t i = 76; i < wrapped.size(); i += 77) {
+    wrapped.insert(i, "\n");
+  }
+  CheckConfigs(ParseSubscription(wrapped + "\n"), links, lines,
+               "standard base64");
+  CheckConfigs(ParseSubscription(EncodeBase64(text, true, false)), links,
+               lines, "URL-safe base64, unpadded");
+  CheckConfigs(ParseSubscription("  " + EncodeBase64(text, false, false) +
+                                 " \r\n"),
+               links, lines, "standard base64, unpadded");
+
+  // The Dart parser returns no configs for either.
+  ParsedSubscription garbage = ParseSubscription("this is *not* base64");
+  Check(!garbage.ok, "malformed subscription: not ok");
+  Check(garbage.configs.empty() && garbage.errors.empty(),
+        "malformed subscription: nothing parsed");
+  ParsedSubscription empty = ParseSubscription("");
+  Check(empty.ok && empty.configs.empty(), "empty subscription");
+
+  // Broken lines among good ones. The Dart parser keeps lines 2, 3, 5 and 7
+  // too, and drops only line 4 and the exact repeat on line 6.
+  std::string mixed = links[0].link + "\n" +
+                      "https://example.com/sub\n" +
+                      "vless://example.com:443\n" +
+                      "just some text\n" +
+                      "trojan://secret@example.com:70000#Bad\n" +
+                      links[0].link + "\n" +
+                      // Same endpoint as line 1, under another id and name.
+                      "vless://other-id@example.com:443?security=reality"
+                      "&sni=WWW.microsoft.com#Copy\n" +
+                      links[1].link;
+  ParsedSubscription parsed = ParseSubscription(EncodeBase64(mixed, true,
+                                                             true));
+  CheckConfigs(parsed, {links[0], links[1]}, {1, 8}, "mixed");
+  CheckEqual(parsed.duplicates, 2u, "mixed: duplicates");
+  struct ExpectedError {
+    uint32_t line;
+    std::string_view reason;
+  };
+  const std::vector<ExpectedError> kErrors = {
+      {2, "unsupported scheme"},
+      {3, "missing user info"},
+      {4, "not a share link"},
+      {5, "bad port"},
+  };
+  CheckEqual(parsed.errors.size(), kErrors.size(), "mixed: error count");
+  for (size_t i = 0; i < parsed.errors.size() && i < kErrors.size(); i++) {
+    CheckEqual(parsed.errors[i].line, kErrors[i].line,
+               "mixed: error " + std::to_string(i + 1) + " line");
+    CheckEqual(std::string_view(parsed.errors[i].reason), kErrors[i].reason,
+               "mixed: error " + std::to_string(i + 1) + " reason");
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestBase64();
+  TestShareLinks();
+  TestSubscriptions();
+  if (failures > 0) {
+    std::printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  std::printf("share_link_test: all checks passed\n");
+  return 0;
+}
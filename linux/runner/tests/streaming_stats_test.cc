@@ -0,0 +1,181 @@
+// Correctness checks for StreamingStats against the exact statistics the
+// Dart speed test computed before the native ones replaced them
+// (ResultsCalculatorService._calculatePercentile and friends): quantiles
+// within the 1% the histogram promises, and exact count, min, max, mean,
+// jitter and loss, over series shaped like speeds and latencies.
+//
+//   cmake -DMIMIVPN_TESTS=ON ... && ctest --test-dir <build>/runner
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "streaming_stats.h"
+
+namespace {
+
+int failures = 0;
+
+void Check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::printf("FAIL: %s\n", what.c_str());
+    failures++;
+  }
+}
+
+void CheckNear(double actual, double expected, double tolerance,
+               const std::string& what) {
+  Check(std::fabs(actual - expected) <= tolerance,
+        what + ": got " + std::to_string(actual) + ", want " +
+            std::to_string(expected));
+}
+
+// _calculatePercentile: the sorted sample at rank round(q * (n - 1)).
+double DartPercentile(std::vector<double> values, double q) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  int64_t index = std::llround(q * (values.size() - 1));
+  index = std::max<int64_t>(0, std::min<int64_t>(index, values.size() - 1));
+  return values[index];
+}
+
+// The mean absolute difference between consecutive samples.
+double DartJitter(const std::vector<double>& values) {
+  if (values.size() < 2) {
+    return 0;
+  }
+  double sum = 0;
+  for (size_t i = 1; i < values.size(); i++) {
+    sum += std::fabs(values[i] - values[i - 1]);
+  }
+  return sum / (values.size() - 1);
+}
+
+// Feeds |values| to a StreamingStats and compares every statistic with the
+// exact one.
+void CheckSeries(const std::vector<double>& values, const std::string& what) {
+  StreamingStats stats;
+  for (double value : values) {
+    stats.Add(value);
+  }
+  Check(stats.count() == values.size(), what + ": count");
+  if (values.empty()) {
+    CheckNear(stats.Quantile(0.5), 0, 0, what + ": empty p50");
+    CheckNear(stats.mean(), 0, 0, what + ": empty mean");
+    return;
+  }
+  double sum = 0;
+  for (double value : values) {
+    sum += value;
+  }
+  CheckNear(stats.min(), *std::min_element(values.begin(), values.end()), 0,
+            what + ": min");
+  CheckNear(stats.max(), *std::max_element(values.begin(), values.end()), 0,
+            what + ": max");
+  CheckNear(stats.mean(), sum / values.size(),
+            1e-9 * std::fabs(sum / values.size()), what + ": mean");
+  CheckNear(stats.jitter(), DartJitter(values),
+            1e-9 * DartJitter(values), what + ": jitter");
+  for (double q : {0.0, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0.99, 1.0}) {
+    double expected = DartPercentile(values, q);
+    // One bucket is 1% wide; anything at or below kMinValue shares the
+    // first one.
+    CheckNear(stats.Quantile(q), expected,
+              expected * 0.01 + StreamingStats::kMinValue * 1.01,
+              what + ": p" + std::to_string(static_cast<int>(q * 100)));
+  }
+}
+
+void TestSeries() {
+  std::mt19937 random(5);
+  CheckSeries({}, "empty");
+  CheckSeries({42}, "one sample");
+  CheckSeries({12.5, 3.25}, "two samples");
+  CheckSeries(std::vector<double>(1000, 87.0), "constant");
+
+  // Latencies in whole milliseconds, as the Dart services recorded them,
+  // zeros included.
+  std::vector<double> latencies;
+  std::poisson_distribution<int> latency(35);
+  for (int i = 0; i < 997; i++) {
+    latencies.push_back(i % 100 == 0 ? 0 : latency(random));
+  }
+  CheckSeries(latencies, "latencies");
+
+  // Speeds spread over decades, from a stalled link to a fast one.
+  std::vector<double> speeds;
+  std::lognormal_distribution<double> speed(3, 1.5);
+  for (int i = 0; i < 20000; i++) {
+    speeds.push_back(speed(random));
+  }
+  CheckSeries(speeds, "speeds");
+
+  // Ties around the ranks, where nearest-rank rounding matters.
+  std::vector<double> steps;
+  for (int i = 0; i < 11; i++) {
+    steps.push_back(i < 5 ? 10 : i < 9 ? 20 : 1000);
+  }
+  CheckSeries(steps, "steps");
+
+  std::vector<double> increasing;
+  for (int i = 1; i <= 101; i++) {
+    increasing.push_back(i);
+  }
+  CheckSeries(increasing, "1..101");
+  std::reverse(increasing.begin(), increasing.end());
+  CheckSeries(increasing, "101..1");
+}
+
+void TestEdges() {
+  StreamingStats stats;
+  stats.Add(NAN);
+  Check(stats.count() == 0, "NaN is ignored");
+
+  // Out of range samples keep their exact extremes and land in the edge
+  // buckets.
+  stats.Add(1e-9);
+  stats.Add(5e9);
+  stats.Add(1);
+  CheckNear(stats.min(), 1e-9, 0, "tiny min");
+  CheckNear(stats.max(), 5e9, 0, "huge max");
+  CheckNear(stats.Quantile(0.5), 1, 0.01, "in-range p50");
+  CheckNear(stats.Quantile(2), 5e9, 0, "q above 1 is the max");
+  CheckNear(stats.Quantile(-1), 1e-9, 0, "q below 0 is the min");
+
+  stats.Reset();
+  Check(stats.count() == 0, "reset count");
+  CheckNear(stats.Quantile(0.9), 0, 0, "reset p90");
+  CheckNear(stats.jitter(), 0, 0, "reset jitter");
+
+  // Loss as the Dart calculator reported it: pings sent against answered.
+  stats.AddExpected(40);
+  for (int i = 0; i < 30; i++) {
+    stats.Add(20 + i % 3);
+  }
+  CheckNear(stats.loss_percent(), 25, 1e-9, "loss");
+  stats.AddExpected(0);
+  for (int i = 0; i < 20; i++) {
+    stats.Add(20);
+  }
+  CheckNear(stats.loss_percent(), 0, 0, "more answers than pings");
+  stats.Reset();
+  CheckNear(stats.loss_percent(), 0, 0, "reset loss");
+}
+
+}  // namespace
+
+int main() {
+  TestSeries();
+  TestEdges();
+  if (failures > 0) {
+    std::printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  std::printf("streaming_stats_test: all checks passed\n");
+  return 0;
+}
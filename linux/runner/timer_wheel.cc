@@ -0,0 +1,181 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+uint64_t RotateRight(uint64_t bits, int count) {
+  count &= 63;
+  return count == 0 ? bits : (bits >> count) | (bits << (64 - count));
+}
+
+}  // namespace
+
+TimerWheel::TimerWheel(int64_t now_ms, int64_t tick_ms)
+    : origin_ms_(now_ms), tick_ms_(std::max<int64_t>(1, tick_ms)) {
+  for (auto& level : slots_) {
+    for (Timer& head : level) {
+      head.prev = &head;
+      head.next = &head;
+    }
+  }
+}
+
+void TimerWheel::Schedule(Timer* timer, int64_t deadline_ms) {
+  if (timer->scheduled()) {
+    Unlink(timer);
+    size_--;
+  }
+  timer->deadline_ms = deadline_ms;
+  // A tick in the past, or the one being served, fires on the next.
+  uint64_t tick = 0;
+  if (deadline_ms > origin_ms_) {
+    tick = static_cast<uint64_t>(
+        (deadline_ms - origin_ms_ + tick_ms_ - 1) / tick_ms_);
+  }
+  Place(timer, std::max(tick, now_tick_ + 1));
+  size_++;
+}
+
+void TimerWheel::Cancel(Timer* timer) {
+  if (!timer->scheduled()) {
+    return;
+  }
+  Unlink(timer);
+  size_--;
+}
+
+void TimerWheel::Advance(int64_t now_ms, std::vector<Timer*>* expired) {
+  uint64_t target = 0;
+  if (now_ms > origin_ms_) {
+    target = static_cast<uint64_t>((now_ms - origin_ms_) / tick_ms_);
+  }
+  while (now_tick_ < target) {
+    // Jump straight to the next occupied level-0 slot of this turn, or to
+    // the end of the turn, where the levels above move timers down.
+    uint64_t offset = now_tick_ & (kSlots - 1);
+    uint64_t ahead = offset == kSlots - 1
+                         ? 0
+                         : occupied_[0] & (~uint64_t{0} << (offset + 1));
+    uint64_t next = ahead != 0
+                        ? (now_tick_ - offset) +
+                              static_cast<uint64_t>(__builtin_ctzll(ahead))
+                        : (now_tick_ | (kSlots - 1)) + 1;
+    if (next > target) {
+      now_tick_ = target;
+      break;
+    }
+    now_tick_ = next;
+    if ((now_tick_ & (kSlots - 1)) == 0) {
+      Cascade(1);
+    }
+
+    int index = static_cast<int>(now_tick_ & (kSlots - 1));
+    Timer* head = &slots_[0][index];
+    while (head->next != head) {
+      Timer* timer = head->next;
+      head->next = timer->next;
+      timer->prev = nullptr;
+      timer->next = nullptr;
+      size_--;
+      expired->push_back(timer);
+    }
+    head->prev = head;
+    occupied_[0] &= ~(uint64_t{1} << index);
+  }
+}
+
+int64_t TimerWheel::NextDeadlineMs() const {
+  if (size_ == 0) {
+    return std::numeric_limits<int64_t>::max() / 2;
+  }
+  uint64_t offset = now_tick_ & (kSlots - 1);
+  uint64_t ahead = offset == kSlots - 1
+                       ? 0
+                       : occupied_[0] & (~uint64_t{0} << (offset + 1));
+  uint64_t tick = std::numeric_limits<uint64_t>::max();
+  if (ahead != 0) {
+    tick = (now_tick_ - offset) + static_cast<uint64_t>(__builtin_ctzll(ahead));
+  } else if (occupied_[0] != 0) {
+    // Only slots of the next turn are left.
+    tick = (now_tick_ - offset) + kSlots +
+           static_cast<uint64_t>(__builtin_ctzll(occupied_[0]));
+  }
+  // Each higher level next acts at the start of its next occupied slot.
+  for (int level = 1; level < kLevels; level++) {
+    if (occupied_[level] == 0) {
+      continue;
+    }
+    int shift = kSlotBits * level;
+    uint64_t current = now_tick_ >> shift;
+    int index = static_cast<int>(current & (kSlots - 1));
+    uint64_t rotated = RotateRight(occupied_[level], index + 1);
+    uint64_t start =
+        (current + 1 + static_cast<uint64_t>(__builtin_ctzll(rotated)))
+        << shift;
+    tick = std::min(tick, start);
+  }
+  return origin_ms_ + static_cast<int64_t>(tick) * tick_ms_;
+}
+
+void TimerWheel::Place(Timer* timer, uint64_t tick) {
+  const uint64_t horizon = (uint64_t{1} << (kSlotBits * kLevels)) - 1;
+  uint64_t delta = std::min(tick - now_tick_, horizon);
+  tick = now_tick_ + delta;
+  int level = 0;
+  while (level < kLevels - 1 &&
+         delta >= (uint64_t{1} << (kSlotBits * (level + 1)))) {
+    level++;
+  }
+  int index = static_cast<int>((tick >> (kSlotBits * level)) & (kSlots - 1));
+  Timer* head = &slots_[level][index];
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+  occupied_[level] |= uint64_t{1} << index;
+}
+
+void TimerWheel::Cascade(int level) {
+  int index = static_cast<int>((now_tick_ >> (kSlotBits * level)) &
+                               (kSlots - 1));
+  // At the end of this level's turn the level above moves first, as its
+  // timers may land in the slot about to be emptied.
+  if (index == 0 && level + 1 < kLevels) {
+    Cascade(level + 1);
+  }
+  Timer* head = &slots_[level][index];
+  Timer* timer = head->next;
+  head->prev = head;
+  head->next = head;
+  occupied_[level] &= ~(uint64_t{1} << index);
+  while (timer != head) {
+    Timer* next = timer->next;
+    uint64_t tick = 0;
+    if (timer->deadline_ms > origin_ms_) {
+      tick = static_cast<uint64_t>(
+          (timer->deadline_ms - origin_ms_ + tick_ms_ - 1) / tick_ms_);
+    }
+    Place(timer, std::max(tick, now_tick_));
+    timer = next;
+  }
+}
+
+void TimerWheel::Unlink(Timer* timer) {
+  Timer* prev = timer->prev;
+  Timer* next = timer->next;
+  prev->next = next;
+  next->prev = prev;
+  timer->prev = nullptr;
+  timer->next = nullptr;
+  // A slot left with only its head is no longer occupied.
+  if (prev == next) {
+    const Timer* first = &slots_[0][0];
+    if (std::less_equal<const Timer*>()(first, prev) &&
+        std::less<const Timer*>()(prev, first + kLevels * kSlots)) {
+      size_t slot = static_cast<size_t>(prev - first);
+      occupied_[slot / kSlots] &= ~(uint64_t{1} << (slot % kSlots));
+    }
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef RUNNER_TIMER_WHEEL_H_
+#define RUNNER_TIMER_WHEEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A hierarchical timing wheel: four levels of 64 slots, each level's slot
+// spanning a whole turn of the level below. Scheduling and cancelling are
+// O(1) whatever the number of timers, and advancing costs O(1) per tick
+// plus the timers that fire or move down a level, so idle expiry of very
+// many flows does not have to walk them all. Timers are intrusive and the
+// wheel never allocates. Not thread-safe.
+class TimerWheel {
+ public:
+  // Embedded in whatever it times; |owner| tells the caller which object a
+  // fired timer belongs to.
+  struct Timer {
+    Timer* prev = nullptr;
+    Timer* next = nullptr;
+    int64_t deadline_ms = 0;
+    void* owner = nullptr;
+
+    bool scheduled() const { return prev != nullptr; }
+  };
+
+  // Counts time from |now_ms| in ticks of |tick_ms|; timers fire up to one
+  // tick late, never early. The four levels cover 2^24 ticks ahead; later
+  // deadlines are clamped to that horizon.
+  TimerWheel(int64_t now_ms, int64_t tick_ms);
+
+  // Prevent copying.
+  TimerWheel(TimerWheel const&) = delete;
+  TimerWheel& operator=(TimerWheel const&) = delete;
+
+  // Arms |timer| to fire at |deadline_ms|, moving it if it is already
+  // scheduled. A deadline already passed fires on the next tick.
+  void Schedule(Timer* timer, int64_t deadline_ms);
+
+  // Disarms |timer|; does nothing if it is not scheduled.
+  void Cancel(Timer* timer);
+
+  // Moves the wheel to |now_ms| and appends the timers that are due, now
+  // unscheduled, to |expired|.
+  void Advance(int64_t now_ms, std::vector<Timer*>* expired);
+
+  // The earliest time Advance() may have something to do: the next
+  // scheduled tick, or the next time a higher level is due to move timers
+  // down. Far in the future when the wheel is empty.
+  int64_t NextDeadlineMs() const;
+
+  size_t size() const { return size_; }
+
+ private:
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 6;
+  static constexpr int kSlots = 1 << kSlotBits;
+
+  // Links |timer| into the slot for |tick|, which must not be in the past.
+  void Place(Timer* timer, uint64_t tick);
+  // Moves the timers of the level's current slot down the wheel.
+  void Cascade(int level);
+  void Unlink(Timer* timer);
+
+  int64_t origin_ms_;
+  int64_t tick_ms_;
+  uint64_t now_tick_ = 0;
+  size_t size_ = 0;
+  // Circular lists with a sentinel head per slot.
+  Timer slots_[kLevels][kSlots];
+  // Bit i of a level is set while its slot i holds timers.
+  uint64_t occupied_[kLevels] = {};
+};
+
+#endif  // RUNNER_TIMER_WHEEL_H_
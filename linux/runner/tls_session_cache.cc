@@ -0,0 +1,298 @@
+#include "tls_session_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/ssl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+constexpr char kMagic[8] = {'M', 'I', 'M', 'I', 'T', 'L', 'S', '\0'};
+
+// RFC 8446 section 4.6.1: tickets live at most seven days.
+constexpr int64_t kMaxLifetimeMs = 7 * 24 * 3600 * 1000LL;
+// Resumption is not worth a session that is about to expire in flight.
+constexpr int64_t kExpiryMarginMs = 10 * 1000;
+// Larger files are not a cache this class wrote.
+constexpr size_t kMaxFileLength = 16 * 1024 * 1024;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+};
+
+struct EntryHeader {
+  uint32_t key_length;
+  uint32_t der_length;
+  int64_t expires_ms;
+};
+
+int64_t WallNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+bool ReadAll(int fd, std::vector<uint8_t>* data) {
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) ||
+      static_cast<size_t>(info.st_size) > kMaxFileLength) {
+    return false;
+  }
+  data->resize(static_cast<size_t>(info.st_size));
+  size_t done = 0;
+  while (done < data->size()) {
+    ssize_t count = read(fd, data->data() + done, data->size() - done);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    done += static_cast<size_t>(count);
+  }
+  return true;
+}
+
+bool WriteAll(int fd, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    length -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+void MakeParentDirectories(const std::string& path) {
+  for (size_t slash = path.find('/', 1); slash != std::string::npos;
+       slash = path.find('/', slash + 1)) {
+    mkdir(path.substr(0, slash).c_str(), 0700);
+  }
+}
+
+template <typename T>
+void AppendPod(const T& value, std::vector<uint8_t>* buffer) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  buffer->insert(buffer->end(), bytes, bytes + sizeof(value));
+}
+
+}  // namespace
+
+constexpr uint32_t TlsSessionCache::kVersion;
+constexpr size_t TlsSessionCache::kMaxSessions;
+
+TlsSessionCache::TlsSessionCache() = default;
+
+TlsSessionCache::~TlsSessionCache() = default;
+
+bool TlsSessionCache::Open(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  path_ = path;
+  entries_.clear();
+  dirty_ = false;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd < 0) {
+    return false;
+  }
+  std::vector<uint8_t> data;
+  bool read_ok = ReadAll(fd, &data);
+  close(fd);
+  FileHeader header;
+  if (!read_ok || data.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion) {
+    return false;
+  }
+
+  int64_t now_ms = WallNowMs();
+  size_t offset = sizeof(header);
+  for (uint32_t i = 0; i < header.count; i++) {
+    EntryHeader entry_header;
+    if (data.size() - offset < sizeof(entry_header)) {
+      entries_.clear();
+      return false;
+    }
+    memcpy(&entry_header, data.data() + offset, sizeof(entry_header));
+    offset += sizeof(entry_header);
+    size_t length = static_cast<size_t>(entry_header.key_length) +
+                    entry_header.der_length;
+    if (data.size() - offset < length) {
+      entries_.clear();
+      return false;
+    }
+    const uint8_t* key = data.data() + offset;
+    const uint8_t* der = key + entry_header.key_length;
+    offset += length;
+    if (entry_header.expires_ms <= now_ms + kExpiryMarginMs) {
+      // Dropped; the next Save() leaves it out.
+      dirty_ = true;
+      continue;
+    }
+    Entry& entry = entries_[std::string(
+        reinterpret_cast<const char*>(key), entry_header.key_length)];
+    entry.der.assign(der, der + entry_header.der_length);
+    entry.expires_ms = entry_header.expires_ms;
+  }
+  return true;
+}
+
+bool TlsSessionCache::Save() {
+  std::vector<uint8_t> buffer;
+  std::string path;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!dirty_ || path_.empty()) {
+      return true;
+    }
+    DropExpired(WallNowMs());
+    FileHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.count = static_cast<uint32_t>(entries_.size());
+    AppendPod(header, &buffer);
+    for (const auto& item : entries_) {
+      EntryHeader entry_header = {};
+      entry_header.key_length = static_cast<uint32_t>(item.first.size());
+      entry_header.der_length = static_cast<uint32_t>(item.second.der.size());
+      entry_header.expires_ms = item.second.expires_ms;
+      AppendPod(entry_header, &buffer);
+      buffer.insert(buffer.end(), item.first.begin(), item.first.end());
+      buffer.insert(buffer.end(), item.second.der.begin(),
+                    item.second.der.end());
+    }
+    path = path_;
+    dirty_ = false;
+  }
+
+  MakeParentDirectories(path);
+  std::string temp_path = path + ".tmp";
+  int fd = open(temp_path.c_str(),
+                O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+  if (fd < 0) {
+    return false;
+  }
+  // An existing file keeps its mode across O_TRUNC; tighten it.
+  bool written = fchmod(fd, 0600) == 0 &&
+                 WriteAll(fd, buffer.data(), buffer.size()) && fsync(fd) == 0;
+  close(fd);
+  if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    std::lock_guard<std::mutex> lock(mutex_);
+    dirty_ = true;
+    return false;
+  }
+  return true;
+}
+
+ssl_session_st* TlsSessionCache::Take(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return nullptr;
+  }
+  Entry entry = std::move(it->second);
+  entries_.erase(it);
+  dirty_ = true;
+  if (entry.expires_ms <= WallNowMs() + kExpiryMarginMs) {
+    return nullptr;
+  }
+  const unsigned char* der = entry.der.data();
+  return d2i_SSL_SESSION(nullptr, &der, static_cast<long>(entry.der.size()));
+}
+
+void TlsSessionCache::Put(const std::string& key,
+                          const ssl_session_st* session) {
+  if (session == nullptr || !SSL_SESSION_is_resumable(session)) {
+    return;
+  }
+  int length = i2d_SSL_SESSION(const_cast<SSL_SESSION*>(session), nullptr);
+  if (length <= 0) {
+    return;
+  }
+  Entry entry;
+  entry.der.resize(static_cast<size_t>(length));
+  unsigned char* der = entry.der.data();
+  if (i2d_SSL_SESSION(const_cast<SSL_SESSION*>(session), &der) != length) {
+    return;
+  }
+  // TLS 1.3 tickets carry their own lifetime; TLS 1.2 sessions only the
+  // client's timeout.
+  int64_t lifetime_ms =
+      static_cast<int64_t>(SSL_SESSION_get_timeout(session)) * 1000;
+  uint64_t hint = SSL_SESSION_get_ticket_lifetime_hint(session);
+  if (hint > 0) {
+    lifetime_ms = std::min<int64_t>(lifetime_ms, hint * 1000);
+  }
+  int64_t issued_ms = static_cast<int64_t>(SSL_SESSION_get_time(session)) *
+                      1000;
+  entry.expires_ms = issued_ms + std::min(lifetime_ms, kMaxLifetimeMs);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t now_ms = WallNowMs();
+  if (entry.expires_ms <= now_ms + kExpiryMarginMs) {
+    return;
+  }
+  entries_[key] = std::move(entry);
+  dirty_ = true;
+  if (entries_.size() > kMaxSessions) {
+    DropExpired(now_ms);
+  }
+  if (entries_.size() > kMaxSessions) {
+    entries_.erase(std::min_element(
+        entries_.begin(), entries_.end(), [](const auto& a, const auto& b) {
+          return a.second.expires_ms < b.second.expires_ms;
+        }));
+  }
+}
+
+size_t TlsSessionCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+std::string TlsSessionCache::KeyFor(const std::string& host, uint16_t port,
+                                    const std::string& server_name) {
+  return server_name + "@" + host + ":" + std::to_string(port);
+}
+
+std::string TlsSessionCache::DefaultPath() {
+  if (const char* path = getenv("MIMIVPN_TLS_SESSIONS")) {
+    return path;
+  }
+  std::string cache;
+  if (const char* xdg = getenv("XDG_CACHE_HOME")) {
+    cache = xdg;
+  } else if (const char* home = getenv("HOME")) {
+    cache = std::string(home) + "/.cache";
+  } else {
+    cache = "/tmp";
+  }
+  return cache + "/mimivpn/tls_sessions.bin";
+}
+
+void TlsSessionCache::DropExpired(int64_t now_ms) {
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.expires_ms <= now_ms + kExpiryMarginMs) {
+      it = entries_.erase(it);
+      dirty_ = true;
+    } else {
+      ++it;
+    }
+  }
+}
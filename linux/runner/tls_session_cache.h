@@ -0,0 +1,80 @@
+#ifndef RUNNER_TLS_SESSION_CACHE_H_
+#define RUNNER_TLS_SESSION_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ssl_session_st;
+
+// TLS sessions kept per server across launches, so the next handshake with
+// a server resumes instead of repeating the key exchange and certificate.
+// Sessions are stored DER-encoded with their expiry, taken from the
+// server's ticket lifetime and capped at a week as TLS 1.3 requires, and
+// are persisted to a file only the user can read: a ticket lets its holder
+// resume as this client.
+//
+// Thread-safe.
+class TlsSessionCache {
+ public:
+  // Bumped whenever the file layout changes; older files are ignored.
+  static constexpr uint32_t kVersion = 1;
+  // Sessions beyond this many evict the one expiring soonest.
+  static constexpr size_t kMaxSessions = 1024;
+
+  TlsSessionCache();
+  ~TlsSessionCache();
+
+  // Prevent copying.
+  TlsSessionCache(TlsSessionCache const&) = delete;
+  TlsSessionCache& operator=(TlsSessionCache const&) = delete;
+
+  // Loads the sessions saved at |path| that have not expired. Returns
+  // false, leaving the cache empty but bound to |path|, when the file is
+  // missing or not a valid cache of this version.
+  bool Open(const std::string& path);
+
+  // Writes the cache back to its file if it changed since the last Open()
+  // or Save(). The file is replaced atomically with mode 0600.
+  bool Save();
+
+  // Removes and returns the session for |key|, or null if there is none
+  // that is still valid. The caller owns the result and frees it with
+  // SSL_SESSION_free(). Sessions are handed out once, as TLS 1.3 tickets
+  // should not be reused; the resumed handshake brings a fresh one.
+  ssl_session_st* Take(const std::string& key);
+
+  // Stores |session| for |key|, replacing any earlier one. Sessions that
+  // cannot be resumed are ignored. Does not take ownership.
+  void Put(const std::string& key, const ssl_session_st* session);
+
+  size_t size() const;
+
+  // The cache key for a server: TLS sessions are bound to the name they
+  // were negotiated for as well as to the address.
+  static std::string KeyFor(const std::string& host, uint16_t port,
+                            const std::string& server_name);
+
+  // $MIMIVPN_TLS_SESSIONS, or tls_sessions.bin in the user's cache
+  // directory.
+  static std::string DefaultPath();
+
+ private:
+  struct Entry {
+    std::vector<uint8_t> der;
+    // Wall-clock milliseconds since the epoch.
+    int64_t expires_ms = 0;
+  };
+
+  void DropExpired(int64_t now_ms);
+
+  mutable std::mutex mutex_;
+  std::string path_;
+  std::map<std::string, Entry> entries_;
+  bool dirty_ = false;
+};
+
+#endif  // RUNNER_TLS_SESSION_CACHE_H_
@@ -0,0 +1,187 @@
+#include "tun2socks.h"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include "log_ring.h"
+#include "net_util.h"
+#include "packet_kernels.h"
+#include "tun_offload.h"
+
+namespace {
+
+constexpr int kMaxQueues = 16;
+
+}  // namespace
+
+Tun2Socks::Tun2Socks(const Tun2SocksOptions& options) : options_(options) {}
+
+Tun2Socks::~Tun2Socks() { Stop(); }
+
+bool Tun2Socks::Start() {
+  if (running()) {
+    return true;
+  }
+
+  int queue_count = options_.queue_count;
+  if (queue_count <= 0) {
+    queue_count = static_cast<int>(std::thread::hardware_concurrency());
+  }
+  queue_count = std::max(1, std::min(queue_count, kMaxQueues));
+
+  if (!device_.Open(options_.device_name, queue_count, options_.offload) ||
+      !device_.Configure(options_.ipv4_address, options_.ipv4_prefix,
+                         options_.ipv6_address, options_.ipv6_prefix,
+                         options_.mtu)) {
+    device_.Close();
+    WriteLog(LogLevel::kError, "tun2socks",
+             "Could not configure " + options_.device_name);
+    return false;
+  }
+
+  std::string offloads = "no offload";
+  if (options_.offload) {
+    // Without any offload the kernel sends plain packets, but it still
+    // takes super-packets from the workers, so they keep theirs on.
+    unsigned flags = device_.EnableOffload();
+    offloads = (flags & TUN_F_TSO4) == 0 ? "checksum offload only"
+               : (flags & TUN_F_USO4) == 0 ? "TSO"
+                                           : "TSO and USO";
+    if (flags == 0) {
+      offloads = "no offload from the kernel";
+    }
+  }
+
+  if (options_.dns_forwarder) {
+    DnsForwarderOptions dns_options = options_.dns;
+    dns_options.socks_host = options_.socks_host;
+    dns_options.socks_port = options_.socks_port;
+    dns_.reset(new DnsForwarder(dns_options));
+    dns_->Start();
+  }
+
+  TunWorkerOptions worker_options;
+  worker_options.socks_host = options_.socks_host;
+  worker_options.socks_port = options_.socks_port;
+  worker_options.mtu = options_.mtu;
+  worker_options.pool_buffers = options_.pool_buffers_per_queue;
+  worker_options.max_flows = options_.max_flows_per_queue;
+  worker_options.dns = dns_.get();
+  worker_options.relay_udp = options_.relay_udp;
+  worker_options.offload = options_.offload;
+  worker_options.io_uring = options_.io_uring;
+
+  const std::vector<int>& queues = device_.queues();
+  for (size_t i = 0; i < queues.size(); i++) {
+    std::unique_ptr<TunWorker> worker(
+        new TunWorker(queues[i], worker_options));
+    if (!worker->Start(static_cast<int>(i))) {
+      Stop();
+      WriteLog(LogLevel::kError, "tun2socks",
+               "Could not start worker for queue " + std::to_string(i));
+      return false;
+    }
+    workers_.push_back(std::move(worker));
+  }
+
+  // Routes go in last so traffic only arrives once every queue is served,
+  // and the server's own route before the half-default routes capture it.
+  if (options_.add_default_routes) {
+    RouteServer(options_.server_host);
+  }
+  if (options_.add_default_routes &&
+      !device_.AddDefaultRoutes(!options_.ipv6_address.empty())) {
+    Stop();
+    WriteLog(LogLevel::kError, "tun2socks", "Could not add default routes");
+    return false;
+  }
+  if (dns_ && options_.set_system_dns &&
+      !device_.SetDns(options_.dns_address)) {
+    // Lookups the resolver sends into the device are still answered.
+    WriteLog(LogLevel::kWarning, "tun2socks",
+             "Could not point the system resolver at " +
+                 options_.dns_address);
+  }
+  WriteLog(LogLevel::kInfo, "tun2socks",
+           options_.device_name + " up with " +
+               std::to_string(queue_count) + " queues, " +
+               ActiveChecksumKernel().name + " checksums, " + offloads +
+               ", " + workers_[0]->io_backend());
+  return true;
+}
+
+void Tun2Socks::SetUpstream(const std::string& host, uint16_t port) {
+  for (const auto& worker : workers_) {
+    worker->SetProxy(host, port);
+  }
+  if (dns_) {
+    dns_->SetProxy(host, port);
+  }
+  WriteLog(LogLevel::kInfo, "tun2socks",
+           "New flows now go to " + host + ":" + std::to_string(port));
+}
+
+void Tun2Socks::RouteServer(const std::string& host) {
+  if (!options_.add_default_routes) {
+    return;
+  }
+  if (host.empty()) {
+    device_.RemoveExclusions();
+    server_host_.clear();
+    server_addresses_.clear();
+    WriteLog(LogLevel::kWarning, "tun2socks",
+             "No proxy server to route around " + options_.device_name +
+                 "; the core must keep its own traffic out of it");
+    return;
+  }
+  // Once the device routes everything, a name only resolves through the
+  // tunnel, so a known server keeps the addresses it had.
+  if (host != server_host_ || server_addresses_.empty()) {
+    std::vector<std::string> addresses = ResolveHostAddresses(host);
+    if (addresses.empty()) {
+      WriteLog(LogLevel::kError, "tun2socks", "Could not resolve " + host);
+      return;
+    }
+    server_host_ = host;
+    server_addresses_ = std::move(addresses);
+  }
+  if (!device_.ExcludeAddresses(server_addresses_)) {
+    WriteLog(LogLevel::kWarning, "tun2socks",
+             "No default route to reach " + host + " around " +
+                 options_.device_name);
+    return;
+  }
+  WriteLog(LogLevel::kInfo, "tun2socks",
+           "Routing " + host + " (" + std::to_string(server_addresses_.size()) +
+               " addresses) around " + options_.device_name);
+}
+
+void Tun2Socks::Stop() {
+  if (!workers_.empty()) {
+    Tun2SocksStats totals = stats();
+    WriteLog(LogLevel::kInfo, "tun2socks",
+             options_.device_name + " down after " +
+                 std::to_string(totals.bytes_up) + " bytes up, " +
+                 std::to_string(totals.bytes_down) + " bytes down");
+  }
+  // Workers, and the forwarder that writes replies to their queues, must
+  // be gone before the queue descriptors are closed.
+  workers_.clear();
+  dns_.reset();
+  device_.Close();
+}
+
+Tun2SocksStats Tun2Socks::stats() const {
+  Tun2SocksStats stats;
+  for (const auto& worker : workers_) {
+    stats.bytes_up += worker->bytes_up();
+    stats.bytes_down += worker->bytes_down();
+    stats.active_flows += worker->active_flows();
+  }
+  return stats;
+}
+
+DnsForwarderStats Tun2Socks::dns_stats() const {
+  return dns_ ? dns_->stats() : DnsForwarderStats();
+}
@@ -0,0 +1,121 @@
+#ifndef RUNNER_TUN2SOCKS_H_
+#define RUNNER_TUN2SOCKS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dns_forwarder.h"
+#include "tun_device.h"
+#include "tun_worker.h"
+
+struct Tun2SocksOptions {
+  std::string device_name = "mimivpn0";
+  std::string ipv4_address = "198.18.0.1";
+  int ipv4_prefix = 15;
+  std::string ipv6_address = "fc00::1";
+  int ipv6_prefix = 64;
+  int mtu = 1500;
+
+  // Route all traffic through the device. Off leaves routing to the caller.
+  bool add_default_routes = true;
+
+  // The proxy server the SOCKS endpoint's core dials. With the default
+  // routes in, it is routed around the device through the physical default
+  // route, or the core's own connection would loop back into the device.
+  // Empty leaves that to the core, e.g. one that marks its sockets.
+  std::string server_host;
+
+  std::string socks_host = "127.0.0.1";
+  uint16_t socks_port = 5000;
+
+  // Answer DNS queries entering the device from a caching forwarder that
+  // resolves through the SOCKS proxy, and have systemd-resolved send every
+  // lookup to |dns_address|, an otherwise unused address on the device's
+  // network, when |set_system_dns| is on.
+  bool dns_forwarder = true;
+  std::string dns_address = "198.18.0.2";
+  bool set_system_dns = true;
+  DnsForwarderOptions dns;
+
+  // Relay UDP other than DNS through SOCKS5 UDP ASSOCIATE.
+  bool relay_udp = true;
+
+  // Exchange super-packets of up to 64 KB with the kernel through
+  // virtio-net headers, with segmentation and checksums offloaded; see
+  // TunWorkerOptions::offload.
+  bool offload = true;
+
+  // Serve the queues through io_uring where the kernel allows it, and
+  // through epoll otherwise; see TunWorkerOptions::io_uring.
+  bool io_uring = true;
+
+  // TUN queues, each served by its own worker thread. 0 picks one per CPU.
+  int queue_count = 0;
+  size_t pool_buffers_per_queue = 4096;
+  // Flows each queue tracks at once; see TunWorkerOptions::max_flows.
+  size_t max_flows_per_queue = 65536;
+};
+
+struct Tun2SocksStats {
+  uint64_t bytes_up = 0;
+  uint64_t bytes_down = 0;
+  uint64_t active_flows = 0;
+};
+
+// Routes the host's TCP and UDP traffic and DNS lookups into the SOCKS5
+// proxy through a multi-queue TUN device. The kernel hashes each flow onto
+// one queue, so the workers run share-nothing and throughput scales with
+// the number of queues.
+class Tun2Socks {
+ public:
+  explicit Tun2Socks(const Tun2SocksOptions& options);
+  ~Tun2Socks();
+
+  // Prevent copying.
+  Tun2Socks(Tun2Socks const&) = delete;
+  Tun2Socks& operator=(Tun2Socks const&) = delete;
+
+  // Creates and configures the device and starts one worker per queue.
+  // Returns false and leaves nothing behind on failure.
+  bool Start();
+
+  // Stops the workers and removes the device.
+  void Stop();
+
+  // Sends new flows to the SOCKS proxy at |host|:|port| while existing flows
+  // finish on the proxy they started with, so the upstream can change
+  // without taking the device down. Safe to call from any thread while
+  // running.
+  void SetUpstream(const std::string& host, uint16_t port);
+
+  // Routes the proxy server at |host| around the device in place of the
+  // previous one, through the default route as it is now; call it again
+  // with the same host after the network changed, which reuses the
+  // addresses it resolved then. Does nothing without the default routes.
+  // Call from the thread that started the device.
+  void RouteServer(const std::string& host);
+
+  bool running() const { return !workers_.empty(); }
+
+  // Sums the counters of every worker. Safe to call from any thread while
+  // running.
+  Tun2SocksStats stats() const;
+
+  // The DNS forwarder's counters; all zero when it is disabled. Safe to
+  // call from any thread while running.
+  DnsForwarderStats dns_stats() const;
+
+ private:
+  Tun2SocksOptions options_;
+  TunDevice device_;
+  // The server routed around the device, and the addresses it resolved to.
+  std::string server_host_;
+  std::vector<std::string> server_addresses_;
+  std::unique_ptr<DnsForwarder> dns_;
+  std::vector<std::unique_ptr<TunWorker>> workers_;
+};
+
+#endif  // RUNNER_TUN2SOCKS_H_
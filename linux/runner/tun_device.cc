@@ -0,0 +1,263 @@
+#include "tun_device.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <net/route.h>
+#include <netinet/in.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "rtnetlink.h"
+#include "tun_offload.h"
+
+namespace {
+
+// Mirrors the kernel's struct in6_ifreq, which glibc does not export.
+struct In6Ifreq {
+  struct in6_addr addr;
+  uint32_t prefix_length;
+  int ifindex;
+};
+
+bool SetIpv4(int sock, const char* name, unsigned long request,
+             in_addr_t address) {
+  struct ifreq ifr = {};
+  strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+  auto* sin = reinterpret_cast<struct sockaddr_in*>(&ifr.ifr_addr);
+  sin->sin_family = AF_INET;
+  sin->sin_addr.s_addr = address;
+  return ioctl(sock, request, &ifr) == 0;
+}
+
+bool AddIpv4Route(int sock, const char* device, const char* network,
+                  const char* mask) {
+  struct rtentry route = {};
+  auto* dst = reinterpret_cast<struct sockaddr_in*>(&route.rt_dst);
+  auto* genmask = reinterpret_cast<struct sockaddr_in*>(&route.rt_genmask);
+  dst->sin_family = AF_INET;
+  genmask->sin_family = AF_INET;
+  inet_pton(AF_INET, network, &dst->sin_addr);
+  inet_pton(AF_INET, mask, &genmask->sin_addr);
+  route.rt_flags = RTF_UP;
+  route.rt_dev = const_cast<char*>(device);
+  return ioctl(sock, SIOCADDRT, &route) == 0 || errno == EEXIST;
+}
+
+bool AddIpv6Route(int sock, int ifindex, const char* network, int prefix) {
+  struct in6_rtmsg route = {};
+  inet_pton(AF_INET6, network, &route.rtmsg_dst);
+  route.rtmsg_dst_len = static_cast<uint16_t>(prefix);
+  route.rtmsg_metric = 1;
+  route.rtmsg_flags = RTF_UP;
+  route.rtmsg_ifindex = ifindex;
+  return ioctl(sock, SIOCADDRT, &route) == 0 || errno == EEXIST;
+}
+
+// Parses |text| as an IPv4 or IPv6 address into |address|, which must hold
+// 16 bytes. Returns the family, or AF_UNSPEC if |text| is neither.
+int ParseAddress(const std::string& text, void* address) {
+  if (inet_pton(AF_INET, text.c_str(), address) == 1) {
+    return AF_INET;
+  }
+  if (inet_pton(AF_INET6, text.c_str(), address) == 1) {
+    return AF_INET6;
+  }
+  return AF_UNSPEC;
+}
+
+bool IsLoopback(int family, const void* address) {
+  if (family == AF_INET) {
+    return static_cast<const uint8_t*>(address)[0] == 127;
+  }
+  return IN6_IS_ADDR_LOOPBACK(static_cast<const struct in6_addr*>(address));
+}
+
+// Runs |argv| and reports whether it exited successfully.
+bool RunProgram(char* const argv[]) {
+  pid_t pid;
+  if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv, environ) != 0) {
+    return false;
+  }
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+}  // namespace
+
+TunDevice::TunDevice() {}
+
+TunDevice::~TunDevice() { Close(); }
+
+bool TunDevice::Open(const std::string& name, int queue_count,
+                     bool vnet_header) {
+  Close();
+  for (int i = 0; i < queue_count; i++) {
+    int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+      Close();
+      return false;
+    }
+    struct ifreq ifr = {};
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+    if (vnet_header) {
+      ifr.ifr_flags |= IFF_VNET_HDR;
+    }
+    strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+    if (ioctl(fd, TUNSETIFF, &ifr) != 0) {
+      close(fd);
+      Close();
+      return false;
+    }
+    name_ = ifr.ifr_name;
+    queues_.push_back(fd);
+  }
+  return !queues_.empty();
+}
+
+unsigned TunDevice::EnableOffload() {
+  if (queues_.empty()) {
+    return 0;
+  }
+  // Offloads are a property of the device, so one queue sets them for all.
+  // Kernels without UDP segmentation offload reject the whole set.
+  const unsigned kTcp = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6;
+  for (unsigned flags : {kTcp | TUN_F_USO4 | TUN_F_USO6, kTcp,
+                         unsigned{TUN_F_CSUM}}) {
+    if (ioctl(queues_[0], TUNSETOFFLOAD, flags) == 0) {
+      return flags;
+    }
+  }
+  return 0;
+}
+
+bool TunDevice::Configure(const std::string& ipv4, int ipv4_prefix,
+                          const std::string& ipv6, int ipv6_prefix, int mtu) {
+  int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    return false;
+  }
+  const char* name = name_.c_str();
+
+  struct in_addr address;
+  bool ok = inet_pton(AF_INET, ipv4.c_str(), &address) == 1 &&
+            SetIpv4(sock, name, SIOCSIFADDR, address.s_addr) &&
+            SetIpv4(sock, name, SIOCSIFNETMASK,
+                    htonl(ipv4_prefix == 0 ? 0 : ~0u << (32 - ipv4_prefix)));
+
+  struct ifreq ifr = {};
+  strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+  ifr.ifr_mtu = mtu;
+  ok = ok && ioctl(sock, SIOCSIFMTU, &ifr) == 0;
+  ok = ok && ioctl(sock, SIOCGIFFLAGS, &ifr) == 0;
+  ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+  ok = ok && ioctl(sock, SIOCSIFFLAGS, &ifr) == 0;
+  close(sock);
+
+  if (ok && !ipv6.empty()) {
+    int sock6 = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    In6Ifreq request = {};
+    ok = sock6 >= 0 &&
+         inet_pton(AF_INET6, ipv6.c_str(), &request.addr) == 1 &&
+         ioctl(sock6, SIOCGIFINDEX, &ifr) == 0;
+    if (ok) {
+      request.prefix_length = static_cast<uint32_t>(ipv6_prefix);
+      request.ifindex = ifr.ifr_ifindex;
+      ok = ioctl(sock6, SIOCSIFADDR, &request) == 0;
+    }
+    if (sock6 >= 0) {
+      close(sock6);
+    }
+  }
+  return ok;
+}
+
+bool TunDevice::AddDefaultRoutes(bool ipv6) {
+  int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    return false;
+  }
+  const char* name = name_.c_str();
+  bool ok = AddIpv4Route(sock, name, "0.0.0.0", "128.0.0.0") &&
+            AddIpv4Route(sock, name, "128.0.0.0", "128.0.0.0");
+  close(sock);
+
+  if (ok && ipv6) {
+    int sock6 = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct ifreq ifr = {};
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    ok = sock6 >= 0 && ioctl(sock6, SIOCGIFINDEX, &ifr) == 0 &&
+         AddIpv6Route(sock6, ifr.ifr_ifindex, "::", 1) &&
+         AddIpv6Route(sock6, ifr.ifr_ifindex, "8000::", 1);
+    if (sock6 >= 0) {
+      close(sock6);
+    }
+  }
+  return ok;
+}
+
+bool TunDevice::ExcludeAddresses(const std::vector<std::string>& addresses) {
+  RemoveExclusions();
+  Rtnetlink netlink;
+  if (!netlink.ok()) {
+    return false;
+  }
+  bool ok = true;
+  for (const std::string& text : addresses) {
+    struct in6_addr address;
+    int family = ParseAddress(text, &address);
+    if (family == AF_UNSPEC || IsLoopback(family, &address)) {
+      continue;
+    }
+    // Recorded even when nothing was added, so a partial set is removed.
+    excluded_.push_back(text);
+    if (netlink.AddHostRoutes(family, &address) == 0) {
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+void TunDevice::RemoveExclusions() {
+  if (excluded_.empty()) {
+    return;
+  }
+  Rtnetlink netlink;
+  for (const std::string& text : excluded_) {
+    struct in6_addr address;
+    int family = ParseAddress(text, &address);
+    if (netlink.ok() && family != AF_UNSPEC) {
+      netlink.DeleteHostRoutes(family, &address);
+    }
+  }
+  excluded_.clear();
+}
+
+bool TunDevice::SetDns(const std::string& address) {
+  std::string name = name_;
+  std::string server = address;
+  std::string domain = "~.";
+  char tool[] = "resolvectl";
+  char dns[] = "dns";
+  char domain_command[] = "domain";
+  char* set_server[] = {tool, dns, &name[0], &server[0], nullptr};
+  char* route_all[] = {tool, domain_command, &name[0], &domain[0], nullptr};
+  return RunProgram(set_server) && RunProgram(route_all);
+}
+
+void TunDevice::Close() {
+  RemoveExclusions();
+  for (int fd : queues_) {
+    close(fd);
+  }
+  queues_.clear();
+}
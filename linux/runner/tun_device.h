@@ -0,0 +1,72 @@
+#ifndef RUNNER_TUN_DEVICE_H_
+#define RUNNER_TUN_DEVICE_H_
+
+#include <string>
+#include <vector>
+
+// A multi-queue Linux TUN interface. Each queue is a separate file
+// descriptor; the kernel spreads flows across queues by hash so every queue
+// can be served by its own thread without sharing flow state.
+class TunDevice {
+ public:
+  TunDevice();
+  ~TunDevice();
+
+  // Prevent copying.
+  TunDevice(TunDevice const&) = delete;
+  TunDevice& operator=(TunDevice const&) = delete;
+
+  // Creates (or attaches to) interface |name| with |queue_count| queues in
+  // non-blocking mode. With |vnet_header| every packet read or written
+  // carries a virtio-net header (IFF_VNET_HDR), which offloads need.
+  // Returns false and closes any opened queue on failure.
+  bool Open(const std::string& name, int queue_count, bool vnet_header);
+
+  // Lets the kernel hand over super-packets of up to 64 KB: checksum
+  // offload and TSO for IPv4 and IPv6, and UDP segmentation offload where
+  // the kernel has it (6.2 and later). Needs a device opened with
+  // |vnet_header|. Returns the TUN_F_* flags in effect, 0 when the kernel
+  // refused them all.
+  unsigned EnableOffload();
+
+  // Assigns |ipv4|/|ipv4_prefix| and, when not empty, |ipv6|/|ipv6_prefix|,
+  // sets |mtu| and brings the link up.
+  bool Configure(const std::string& ipv4, int ipv4_prefix,
+                 const std::string& ipv6, int ipv6_prefix, int mtu);
+
+  // Routes all traffic through the interface using two half-default routes
+  // per family, which take precedence over the existing default route
+  // without replacing it.
+  bool AddDefaultRoutes(bool ipv6);
+
+  // Routes |addresses| around the interface through the current default
+  // routes, in place of those excluded before, so the proxy core's own
+  // connections to its server do not loop back into the device. Loopback
+  // addresses never enter it and are skipped. Returns false if an address
+  // found no default route to go through.
+  bool ExcludeAddresses(const std::vector<std::string>& addresses);
+
+  // Removes the routes ExcludeAddresses() added. Unlike the half-default
+  // routes they do not go away with the interface.
+  void RemoveExclusions();
+
+  // Makes systemd-resolved send every lookup to |address| over this
+  // interface. Returns false where resolvectl is not available. The setting
+  // goes away with the interface.
+  bool SetDns(const std::string& address);
+
+  // Removes the exclusions and closes every queue, which removes a
+  // non-persistent interface.
+  void Close();
+
+  const std::string& name() const { return name_; }
+  const std::vector<int>& queues() const { return queues_; }
+  bool is_open() const { return !queues_.empty(); }
+
+ private:
+  std::string name_;
+  std::vector<int> queues_;
+  std::vector<std::string> excluded_;
+};
+
+#endif  // RUNNER_TUN_DEVICE_H_
@@ -0,0 +1,91 @@
+#include "tun_offload.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace {
+
+void Store16(uint8_t* p, uint16_t value) {
+  p[0] = static_cast<uint8_t>(value >> 8);
+  p[1] = static_cast<uint8_t>(value);
+}
+
+}  // namespace
+
+ssize_t ReadTunPacket(int fd, bool vnet_header, uint8_t* buffer, size_t size,
+                      VirtioNetHeader* header) {
+  memset(header, 0, sizeof(*header));
+  if (!vnet_header) {
+    return read(fd, buffer, size);
+  }
+  // The header lands apart from the packet, which keeps the packet at the
+  // start of its buffer like on a plain queue.
+  struct iovec parts[2];
+  parts[0].iov_base = header;
+  parts[0].iov_len = sizeof(*header);
+  parts[1].iov_base = buffer;
+  parts[1].iov_len = size;
+  ssize_t length = readv(fd, parts, 2);
+  if (length < 0) {
+    return length;
+  }
+  if (static_cast<size_t>(length) < sizeof(*header)) {
+    return 0;
+  }
+  return length - static_cast<ssize_t>(sizeof(*header));
+}
+
+ssize_t WriteTunPacket(int fd, const VirtioNetHeader* header,
+                       const uint8_t* packet, size_t length) {
+  if (header == nullptr) {
+    return write(fd, packet, length);
+  }
+  struct iovec parts[2];
+  parts[0].iov_base = const_cast<VirtioNetHeader*>(header);
+  parts[0].iov_len = sizeof(*header);
+  parts[1].iov_base = const_cast<uint8_t*>(packet);
+  parts[1].iov_len = length;
+  ssize_t written = writev(fd, parts, 2);
+  if (written < 0) {
+    return written;
+  }
+  return written - static_cast<ssize_t>(sizeof(*header));
+}
+
+void SetTcpOffload(const uint8_t* packet, size_t length, uint16_t mss,
+                   VirtioNetHeader* header) {
+  bool ipv6 = (packet[0] >> 4) == 6;
+  size_t ip_length = ipv6 ? kIpv6HeaderSize : kIpv4HeaderSize;
+  size_t tcp_length = static_cast<size_t>(packet[ip_length + 12] >> 4) * 4;
+  size_t headers = ip_length + tcp_length;
+  memset(header, 0, sizeof(*header));
+  header->flags = kVirtioNetNeedsChecksum;
+  header->csum_start = static_cast<uint16_t>(ip_length);
+  header->csum_offset = 16;
+  header->hdr_len = static_cast<uint16_t>(headers);
+  if (length - headers > mss) {
+    header->gso_type = ipv6 ? kVirtioNetGsoTcpV6 : kVirtioNetGsoTcpV4;
+    header->gso_size = mss;
+  }
+}
+
+size_t CopyUdpSegment(const uint8_t* packet, const PacketInfo& info,
+                      size_t offset, size_t length, uint8_t* out) {
+  size_t headers = info.payload_offset;
+  memcpy(out, packet, headers);
+  memcpy(out + headers, packet + headers + offset, length);
+  size_t udp_length = kUdpHeaderSize + length;
+  Store16(out + info.l4_offset + 4, static_cast<uint16_t>(udp_length));
+  if (info.family == AF_INET6) {
+    Store16(out + 4, static_cast<uint16_t>(udp_length));
+  } else {
+    Store16(out + 2, static_cast<uint16_t>(info.l4_offset + udp_length));
+    Store16(out + 10, 0);
+    uint16_t checksum = ChecksumFinish(ChecksumAdd(out, info.l4_offset, 0));
+    memcpy(out + 10, &checksum, sizeof(checksum));
+  }
+  return headers + length;
+}
@@ -0,0 +1,71 @@
+#ifndef RUNNER_TUN_OFFLOAD_H_
+#define RUNNER_TUN_OFFLOAD_H_
+
+#include <linux/if_tun.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "packet_headers.h"
+
+// Segmentation and checksum offload on a TUN queue opened with
+// IFF_VNET_HDR, where every packet read or written is preceded by a
+// VirtioNetHeader saying what work is still to be done on it. The kernel
+// then hands over and accepts TCP (and UDP) super-packets of up to 64 KB,
+// leaving checksums to whichever side consumes the packet.
+
+#ifndef TUN_F_USO4
+#define TUN_F_USO4 0x20
+#endif
+#ifndef TUN_F_USO6
+#define TUN_F_USO6 0x40
+#endif
+
+// Mirrors the kernel's struct virtio_net_hdr, whose header does not
+// compile as C++. Fields are in host order.
+struct VirtioNetHeader {
+  uint8_t flags;
+  uint8_t gso_type;
+  uint16_t hdr_len;
+  uint16_t gso_size;
+  uint16_t csum_start;
+  uint16_t csum_offset;
+};
+static_assert(sizeof(VirtioNetHeader) == 10, "virtio_net_hdr is 10 bytes");
+
+constexpr uint8_t kVirtioNetNeedsChecksum = 1;
+constexpr uint8_t kVirtioNetGsoTcpV4 = 1;
+constexpr uint8_t kVirtioNetGsoTcpV6 = 4;
+constexpr uint8_t kVirtioNetGsoUdpL4 = 5;
+
+// The largest packet on an offloading queue, headers included.
+constexpr size_t kMaxSuperPacket = 65535;
+
+// Reads a packet from |fd| into |buffer|. With |vnet_header| its
+// virtio-net header goes to |header|; otherwise |header| is zeroed.
+// Returns what read() would.
+ssize_t ReadTunPacket(int fd, bool vnet_header, uint8_t* buffer, size_t size,
+                      VirtioNetHeader* header);
+
+// Writes |packet| to |fd|, preceded by |header| when it is not null. Every
+// packet on an IFF_VNET_HDR queue needs one; a zeroed header asks for no
+// offload. Returns what write() would.
+ssize_t WriteTunPacket(int fd, const VirtioNetHeader* header,
+                       const uint8_t* packet, size_t length);
+
+// Fills |header| for a TCP |packet| written with a partial checksum (see
+// TcpSegmentSpec): the kernel completes the checksum and cuts a payload
+// longer than |mss| into segments of |mss| bytes.
+void SetTcpOffload(const uint8_t* packet, size_t length, uint16_t mss,
+                   VirtioNetHeader* header);
+
+// Copies the |length| payload bytes at |offset| of the UDP super-packet
+// |packet|, parsed as |info|, to |out| as a datagram of its own, with the
+// IP and UDP length fields (and the IPv4 header checksum) patched. The UDP
+// checksum is left as it was, since datagrams are relayed without it.
+// Returns the packet length.
+size_t CopyUdpSegment(const uint8_t* packet, const PacketInfo& info,
+                      size_t offset, size_t length, uint8_t* out);
+
+#endif  // RUNNER_TUN_OFFLOAD_H_
@@ -0,0 +1,333 @@
+#include "tun_ring.h"
+
+#include <fcntl.h>
+#include <poll.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#include "log_ring.h"
+
+namespace {
+
+constexpr unsigned kRingEntries = 256;
+// Reads kept posted. Each waits on the queue by itself and an arriving
+// packet wakes them all, so there are only enough for a burst.
+constexpr size_t kReadSlots = 16;
+// Larger pools, such as the 64 KB buffers of an offloading queue, are not
+// worth pinning.
+constexpr size_t kMaxPinnedBytes = 16 * 1024 * 1024;
+// Rounds of waiting for cancelled reads on shutdown.
+constexpr int kCancelAttempts = 20;
+constexpr int kCancelWaitMs = 50;
+// Failed writes are summed up at most this often, so a queue that keeps
+// refusing packets does not flood the log.
+constexpr int64_t kWriteFailureLogIntervalMs = 1000;
+
+// The low bits of an operation's user_data say what it was; the rest hold
+// the read slot.
+constexpr uint64_t kReadOp = 0;
+constexpr uint64_t kWriteOp = 1;
+constexpr uint64_t kPollOp = 2;
+constexpr uint64_t kCancelOp = 3;
+constexpr int kOpBits = 2;
+constexpr uint64_t kOpMask = (1 << kOpBits) - 1;
+
+uint64_t ReadTag(size_t slot) { return (slot << kOpBits) | kReadOp; }
+
+int64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+TunRing::TunRing(int tun_fd, bool vnet_header, PacketPool* pool)
+    : tun_fd_(tun_fd), vnet_header_(vnet_header), pool_(pool) {}
+
+TunRing::~TunRing() {
+  if (ring_.is_open()) {
+    // Posted reads would still land in their buffers, so they are cancelled
+    // and waited for before the buffers go back to the pool.
+    bool posted = false;
+    for (size_t i = 0; i < slots_.size(); i++) {
+      if (slots_[i].state != SlotState::kPosted) {
+        continue;
+      }
+      io_uring_sqe* sqe = ring_.Prepare();
+      if (sqe == nullptr) {
+        break;
+      }
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = ReadTag(i);
+      sqe->user_data = kCancelOp;
+      posted = true;
+    }
+    for (int attempt = 0; posted && attempt < kCancelAttempts; attempt++) {
+      if (!ring_.Submit(1, kCancelWaitMs)) {
+        break;
+      }
+      ring_.Reap([this](const io_uring_cqe& cqe) { OnCompletion(cqe); });
+      posted = false;
+      for (const ReadSlot& slot : slots_) {
+        posted = posted || slot.state == SlotState::kPosted;
+      }
+    }
+  }
+  for (ReadSlot& slot : slots_) {
+    // A read that could not be cancelled keeps its buffer.
+    if (slot.buffer != nullptr && slot.state != SlotState::kPosted) {
+      pool_->Release(slot.buffer);
+    }
+  }
+  if (file_flags_ >= 0) {
+    fcntl(tun_fd_, F_SETFL, file_flags_);
+  }
+}
+
+bool TunRing::Init(int epoll_fd) {
+  epoll_fd_ = epoll_fd;
+  if (!ring_.Init(kRingEntries)) {
+    return false;
+  }
+  // Posted reads wait in the kernel for a packet, which takes a blocking
+  // file: on a non-blocking one they complete at once with EAGAIN. TUN
+  // writes never block either way.
+  int flags = fcntl(tun_fd_, F_GETFL);
+  if (flags < 0 || fcntl(tun_fd_, F_SETFL, flags & ~O_NONBLOCK) != 0) {
+    return false;
+  }
+  file_flags_ = flags;
+  fixed_file_ = ring_.RegisterFiles(&tun_fd_, 1);
+  // Read buffers need a virtio-net header in front on an offloading
+  // queue, which fixed buffers cannot scatter.
+  fixed_buffers_ = !vnet_header_ &&
+                   pool_->storage_size() <= kMaxPinnedBytes &&
+                   ring_.RegisterBuffer(pool_->storage(),
+                                        pool_->storage_size());
+  slots_.resize(kReadSlots);
+  PostReads();
+  PostPoll();
+  return ring_.Submit(0, 0);
+}
+
+bool TunRing::Wait(int timeout_ms) {
+  if (!poll_posted_) {
+    PostPoll();
+  }
+  unsigned wait_for = ready_.empty() && !epoll_ready_ ? 1 : 0;
+  if (!ring_.Submit(wait_for, timeout_ms)) {
+    return false;
+  }
+  ring_.Reap([this](const io_uring_cqe& cqe) { OnCompletion(cqe); });
+  return true;
+}
+
+size_t TunRing::TakePackets(uint8_t** buffers, size_t* lengths,
+                            VirtioNetHeader* headers, size_t max) {
+  size_t count = 0;
+  while (count < max && !ready_.empty()) {
+    ReadSlot& slot = slots_[ready_.front()];
+    ready_.pop_front();
+    buffers[count] = slot.buffer;
+    lengths[count] = slot.length;
+    if (vnet_header_) {
+      headers[count] = slot.header;
+    } else {
+      memset(&headers[count], 0, sizeof(headers[count]));
+    }
+    slot.buffer = nullptr;
+    slot.state = SlotState::kIdle;
+    count++;
+  }
+  PostReads();
+  return count;
+}
+
+bool TunRing::TakeEpollReady() {
+  bool ready = epoll_ready_;
+  epoll_ready_ = false;
+  return ready;
+}
+
+void TunRing::QueueWrite(const uint8_t* packet, size_t length,
+                         const VirtioNetHeader* header) {
+  PendingWrite write;
+  write.packet = packet;
+  write.length = length;
+  write.has_header = header != nullptr;
+  if (header != nullptr) {
+    write.header = *header;
+  }
+  writes_.push_back(write);
+}
+
+void TunRing::Flush() {
+  // The iovecs point into |writes_|, so nothing is prepared until every
+  // write is queued. The writes are not linked: a TUN write never blocks,
+  // so the kernel issues each inline in submission order, and one that
+  // fails drops only its own packet, as a failed write() does.
+  for (PendingWrite& write : writes_) {
+    PrepareWrite(&write);
+  }
+  while (writes_in_flight_ > 0) {
+    if (!ring_.Submit(static_cast<unsigned>(writes_in_flight_), -1)) {
+      writes_in_flight_ = 0;
+      break;
+    }
+    ring_.Reap([this](const io_uring_cqe& cqe) { OnCompletion(cqe); });
+  }
+  writes_.clear();
+  if (failed_writes_ > 0) {
+    LogFailedWrites();
+  }
+}
+
+const char* TunRing::features() const {
+  if (fixed_file_ && fixed_buffers_) {
+    return "fixed files and buffers";
+  }
+  return fixed_file_ ? "fixed files" : "no fixed files";
+}
+
+void TunRing::PostReads() {
+  size_t buffer_size = pool_->buffer_size();
+  for (size_t i = 0; i < slots_.size(); i++) {
+    ReadSlot& slot = slots_[i];
+    if (slot.state != SlotState::kIdle) {
+      continue;
+    }
+    if (slot.buffer == nullptr) {
+      slot.buffer = pool_->Acquire();
+      if (slot.buffer == nullptr) {
+        return;
+      }
+    }
+    io_uring_sqe* sqe = ring_.Prepare();
+    if (sqe == nullptr) {
+      return;
+    }
+    SetTarget(sqe);
+    if (vnet_header_) {
+      // The header lands apart from the packet, as with ReadTunPacket().
+      slot.parts[0].iov_base = &slot.header;
+      slot.parts[0].iov_len = sizeof(slot.header);
+      slot.parts[1].iov_base = slot.buffer;
+      slot.parts[1].iov_len = buffer_size;
+      sqe->opcode = IORING_OP_READV;
+      sqe->addr = reinterpret_cast<uintptr_t>(slot.parts);
+      sqe->len = 2;
+    } else {
+      sqe->opcode = fixed_buffers_ ? IORING_OP_READ_FIXED : IORING_OP_READ;
+      sqe->addr = reinterpret_cast<uintptr_t>(slot.buffer);
+      sqe->len = static_cast<uint32_t>(buffer_size);
+    }
+    sqe->user_data = ReadTag(i);
+    slot.state = SlotState::kPosted;
+  }
+}
+
+void TunRing::PostPoll() {
+  io_uring_sqe* sqe = ring_.Prepare();
+  if (sqe == nullptr) {
+    return;
+  }
+  // One request that completes every time the epoll set wakes, until it
+  // is cancelled or overflows.
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = epoll_fd_;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = kPollOp;
+  poll_posted_ = true;
+}
+
+void TunRing::PrepareWrite(PendingWrite* write) {
+  io_uring_sqe* sqe = ring_.Prepare();
+  if (sqe == nullptr) {
+    return;
+  }
+  SetTarget(sqe);
+  if (write->has_header) {
+    write->parts[0].iov_base = &write->header;
+    write->parts[0].iov_len = sizeof(write->header);
+    write->parts[1].iov_base = const_cast<uint8_t*>(write->packet);
+    write->parts[1].iov_len = write->length;
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->addr = reinterpret_cast<uintptr_t>(write->parts);
+    sqe->len = 2;
+  } else {
+    sqe->opcode = fixed_buffers_ && InPool(write->packet, write->length)
+                      ? IORING_OP_WRITE_FIXED
+                      : IORING_OP_WRITE;
+    sqe->addr = reinterpret_cast<uintptr_t>(write->packet);
+    sqe->len = static_cast<uint32_t>(write->length);
+  }
+  sqe->user_data = kWriteOp;
+  writes_in_flight_++;
+}
+
+void TunRing::OnCompletion(const io_uring_cqe& cqe) {
+  switch (cqe.user_data & kOpMask) {
+    case kReadOp: {
+      ReadSlot& slot = slots_[cqe.user_data >> kOpBits];
+      int header =
+          vnet_header_ ? static_cast<int>(sizeof(VirtioNetHeader)) : 0;
+      // Failed reads keep their buffer and are posted again.
+      slot.state = SlotState::kIdle;
+      if (cqe.res > header) {
+        slot.length = static_cast<size_t>(cqe.res - header);
+        slot.state = SlotState::kReady;
+        ready_.push_back(cqe.user_data >> kOpBits);
+      }
+      break;
+    }
+    case kWriteOp:
+      writes_in_flight_--;
+      // A full queue drops the packet; TCP retransmission recovers it.
+      if (cqe.res < 0 && cqe.res != -EAGAIN) {
+        failed_writes_++;
+        last_write_error_ = -cqe.res;
+      }
+      break;
+    case kPollOp:
+      epoll_ready_ = epoll_ready_ || cqe.res > 0;
+      if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+        poll_posted_ = false;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void TunRing::LogFailedWrites() {
+  int64_t now_ms = NowMs();
+  if (last_failure_log_ms_ != 0 &&
+      now_ms - last_failure_log_ms_ < kWriteFailureLogIntervalMs) {
+    return;
+  }
+  last_failure_log_ms_ = now_ms;
+  WriteLog(LogLevel::kWarning, "tun",
+           std::to_string(failed_writes_) + " packet write(s) to the queue " +
+               "failed, the last with: " + strerror(last_write_error_));
+  failed_writes_ = 0;
+}
+
+void TunRing::SetTarget(io_uring_sqe* sqe) const {
+  if (fixed_file_) {
+    sqe->fd = 0;
+    sqe->flags |= IOSQE_FIXED_FILE;
+  } else {
+    sqe->fd = tun_fd_;
+  }
+}
+
+bool TunRing::InPool(const uint8_t* data, size_t length) const {
+  const uint8_t* storage = pool_->storage();
+  return data >= storage && data + length <= storage + pool_->storage_size();
+}
@@ -0,0 +1,118 @@
+#ifndef RUNNER_TUN_RING_H_
+#define RUNNER_TUN_RING_H_
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "io_ring.h"
+#include "packet_pool.h"
+#include "tun_offload.h"
+
+// Moves one TUN queue's packets through an IoRing. Reads stay posted into
+// pool buffers, so packets are waiting in memory when the worker wakes
+// instead of costing a read() each, and a round's packets leave as writes
+// submitted together. The worker's epoll set is
+// watched from the same ring by a multishot poll, so one wait covers the
+// queue and every relay socket.
+//
+// A pool small enough to pin is registered with the kernel, and the queue
+// itself as a fixed file, which spares the page and file lookups on every
+// operation. Use from a single thread, the one that called Init().
+class TunRing {
+ public:
+  // |pool| provides the read buffers; packets read are handed over along
+  // with their buffer.
+  TunRing(int tun_fd, bool vnet_header, PacketPool* pool);
+  ~TunRing();
+
+  // Prevent copying.
+  TunRing(TunRing const&) = delete;
+  TunRing& operator=(TunRing const&) = delete;
+
+  // Sets up the ring, posts the reads and starts watching |epoll_fd|.
+  // Returns false where io_uring is unavailable.
+  bool Init(int epoll_fd);
+
+  // Waits up to |timeout_ms| for a packet or for the epoll set to become
+  // readable. Returns false if the ring failed.
+  bool Wait(int timeout_ms);
+
+  // Moves up to |max| packets read so far to |buffers|, |lengths| and, on
+  // a queue with virtio-net headers, |headers|, and posts new reads in
+  // their place. Returns how many.
+  size_t TakePackets(uint8_t** buffers, size_t* lengths,
+                     VirtioNetHeader* headers, size_t max);
+
+  // Whether the epoll set became readable since the last call.
+  bool TakeEpollReady();
+
+  // Queues |packet| for the next Flush(), preceded by |header| when it is
+  // not null. It must stay valid until then.
+  void QueueWrite(const uint8_t* packet, size_t length,
+                  const VirtioNetHeader* header);
+
+  // Writes the queued packets in order and waits until they are all done.
+  // Like consecutive write() calls, a failed write drops only its packet;
+  // failures are logged, summed up at most once a second.
+  void Flush();
+
+  // Describes the ring's setup for logs, e.g. "fixed files and buffers".
+  const char* features() const;
+
+ private:
+  enum class SlotState { kIdle, kPosted, kReady };
+
+  struct ReadSlot {
+    uint8_t* buffer = nullptr;
+    SlotState state = SlotState::kIdle;
+    size_t length = 0;
+    VirtioNetHeader header;
+    struct iovec parts[2];
+  };
+
+  struct PendingWrite {
+    const uint8_t* packet;
+    size_t length;
+    bool has_header;
+    VirtioNetHeader header;
+    struct iovec parts[2];
+  };
+
+  void PostReads();
+  void PostPoll();
+  void PrepareWrite(PendingWrite* write);
+  void OnCompletion(const io_uring_cqe& cqe);
+  // Logs the writes that failed since the last time, unless that was less
+  // than a second ago.
+  void LogFailedWrites();
+  // Points |sqe| at the queue, as the fixed file when registered.
+  void SetTarget(io_uring_sqe* sqe) const;
+  bool InPool(const uint8_t* data, size_t length) const;
+
+  int tun_fd_;
+  bool vnet_header_;
+  PacketPool* pool_;
+  int epoll_fd_ = -1;
+  int file_flags_ = -1;
+  IoRing ring_;
+  bool fixed_file_ = false;
+  bool fixed_buffers_ = false;
+
+  std::vector<ReadSlot> slots_;
+  // Slots in the order their reads completed.
+  std::deque<size_t> ready_;
+  std::vector<PendingWrite> writes_;
+  size_t writes_in_flight_ = 0;
+  // Writes failed since they were last logged, and the errno of the latest.
+  uint64_t failed_writes_ = 0;
+  int last_write_error_ = 0;
+  int64_t last_failure_log_ms_ = 0;
+  bool poll_posted_ = false;
+  bool epoll_ready_ = false;
+};
+
+#endif  // RUNNER_TUN_RING_H_
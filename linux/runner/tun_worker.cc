@@ -0,0 +1,1337 @@
+#include "tun_worker.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+
+#include "net_util.h"
+
+namespace {
+
+constexpr size_t kReadBatchSize = 64;
+constexpr int kMaxEvents = 256;
+
+// Bytes of client data held for a proxy socket that is not keeping up; this
+// is the receive window advertised to the client.
+constexpr uint32_t kReceiveWindow = 256 * 1024;
+constexpr uint8_t kOurWindowScale = 3;
+// Upper bound on unacknowledged bytes sent to the client per flow.
+constexpr uint32_t kMaxInFlight = 256 * 1024;
+// Buffers kept back for control packets and TUN reads.
+constexpr size_t kPoolReserve = 64;
+// Segments held per flow while waiting for a retransmission to fill a hole.
+constexpr size_t kMaxOutOfOrder = 128;
+
+constexpr int kInitialRtoMs = 200;
+constexpr int kMaxRtoMs = 8000;
+constexpr int kMaxRetransmits = 10;
+constexpr int kDupAckThreshold = 3;
+constexpr int64_t kHandshakeTimeoutMs = 10000;
+constexpr int64_t kIdleTimeoutMs = 60 * 60 * 1000;
+constexpr int64_t kHousekeepingMs = 1000;
+constexpr int64_t kTimerTickMs = 4;
+
+constexpr uint16_t kDnsPort = 53;
+
+// Where the answer to an intercepted DNS query goes.
+struct DnsReturnPath {
+  int tun_fd;
+  bool vnet_header;
+  int family;
+  uint8_t client[16];
+  uint8_t server[16];
+  uint16_t client_port;
+  uint16_t server_port;
+};
+
+// Distinguishes the queue, stop and UDP relay descriptors from flow sockets
+// in epoll.
+char kTunTag;
+char kStopTag;
+char kUdpTag;
+
+bool SeqLt(uint32_t a, uint32_t b) { return static_cast<int32_t>(a - b) < 0; }
+bool SeqLeq(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b) <= 0;
+}
+
+// Builds a pipelined SOCKS5 greeting and CONNECT request for a raw address.
+size_t BuildSocksRequest(const FlowKey& key, uint8_t* out) {
+  size_t length = 0;
+  const uint8_t header[] = {0x05, 0x01, 0x00, 0x05, 0x01, 0x00};
+  memcpy(out, header, sizeof(header));
+  length += sizeof(header);
+  size_t address_length = AddressLength(key.family);
+  out[length++] = key.family == AF_INET6 ? 0x04 : 0x01;
+  memcpy(out + length, key.remote, address_length);
+  length += address_length;
+  out[length++] = static_cast<uint8_t>(key.remote_port >> 8);
+  out[length++] = static_cast<uint8_t>(key.remote_port);
+  return length;
+}
+
+}  // namespace
+
+enum class TcpState {
+  kProxyConnecting,
+  kProxyHandshake,
+  kSynReceived,
+  kEstablished,
+};
+
+struct TunWorker::TcpFlow {
+  struct Pending {
+    uint8_t* buffer;
+    const uint8_t* data;
+    size_t length;
+  };
+
+  struct Segment {
+    uint8_t* buffer;
+    uint32_t seq;
+    uint16_t length;
+    uint8_t flags;
+    // Headers are in the buffer from an earlier transmission.
+    bool sent = false;
+  };
+
+  // Client data that arrived past a hole, kept in its packet buffer.
+  struct OutOfOrder {
+    uint8_t* buffer;
+    uint32_t seq;
+    const uint8_t* data;
+    size_t length;
+    bool fin;
+  };
+
+  FlowKey key;
+  TcpState state = TcpState::kProxyConnecting;
+  TimerWheel::Timer timer;
+  int fd = -1;
+  uint32_t interest = 0;
+  bool registered = false;
+  bool closed = false;
+  int64_t created_ms = 0;
+  int64_t last_activity_ms = 0;
+
+  uint8_t socks_reply[2 + 4 + 1 + 255 + 2];
+  size_t socks_received = 0;
+  size_t socks_expected = 7;
+
+  // Client to proxy.
+  uint32_t rcv_nxt = 0;
+  std::deque<Pending> to_socket;
+  size_t to_socket_bytes = 0;
+  std::deque<OutOfOrder> out_of_order;
+  bool client_fin = false;
+  bool write_shut = false;
+  uint32_t advertised_window = 0;
+  bool ack_pending = false;
+
+  // Proxy to client.
+  uint32_t iss = 0;
+  uint32_t snd_una = 0;
+  uint32_t snd_nxt = 0;
+  uint32_t snd_wnd = 0;
+  uint8_t client_window_scale = 0;
+  bool window_scaling = false;
+  uint16_t mss = 536;
+  std::deque<Segment> unacked;
+  bool socket_eof = false;
+  bool fin_sent = false;
+  bool starved = false;
+  bool in_starved_list = false;
+  int dup_acks = 0;
+  // Set while retransmitting after a loss, until everything sent before the
+  // loss is acknowledged.
+  bool in_recovery = false;
+  uint32_t recovery_point = 0;
+  int64_t rto_deadline_ms = 0;
+  int rto_ms = kInitialRtoMs;
+  int retransmits = 0;
+};
+
+TunWorker::TunWorker(int tun_fd, const TunWorkerOptions& options)
+    : tun_fd_(tun_fd),
+      options_(options),
+      pool_(options.offload ? options.pool_buffers / 4 : options.pool_buffers,
+            options.offload ? kMaxSuperPacket + kPacketHeadroom
+                            : options.mtu + kPacketHeadroom),
+      random_(std::random_device()()),
+      flows_(options.max_flows),
+      timers_(MonotonicNowMs(), kTimerTickMs) {}
+
+TunWorker::~TunWorker() {
+  Stop();
+  udp_.reset();
+  flows_.ForEach([](const FlowKey&, std::unique_ptr<TcpFlow>& flow) {
+    close(flow->fd);
+  });
+  flows_.Clear();
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+  if (stop_fd_ >= 0) {
+    close(stop_fd_);
+  }
+}
+
+bool TunWorker::Start(int index) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (epoll_fd_ < 0 || stop_fd_ < 0) {
+    return false;
+  }
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = &kTunTag;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, tun_fd_, &event) != 0) {
+    return false;
+  }
+  event.data.ptr = &kStopTag;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &event) != 0) {
+    return false;
+  }
+  if (options_.relay_udp) {
+    udp_.reset(new UdpRelay(tun_fd_, options_.offload, &pool_, options_.mtu,
+                            options_.max_flows));
+    udp_->SetProxy(options_.socks_host, options_.socks_port);
+    event.data.ptr = &kUdpTag;
+    if (!udp_->Init() ||
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, udp_->fd(), &event) != 0) {
+      return false;
+    }
+  }
+
+  // The thread sets up its ring before any packet moves and reports back,
+  // so the backend is settled when Start() returns.
+  std::promise<void> ring_ready;
+  std::future<void> ring_started = ring_ready.get_future();
+  thread_ = std::thread(
+      [this, index, ring_ready = std::move(ring_ready)]() mutable {
+        std::string name = "tun-q" + std::to_string(index);
+        pthread_setname_np(pthread_self(), name.c_str());
+        if (options_.io_uring && SetUpRing()) {
+          io_backend_ = std::string("io_uring with ") + ring_->features();
+        }
+        ring_ready.set_value();
+        Run();
+        ring_.reset();
+      });
+  ring_started.wait();
+  return true;
+}
+
+void TunWorker::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  uint64_t one = 1;
+  if (write(stop_fd_, &one, sizeof(one)) != sizeof(one)) {
+    return;
+  }
+  thread_.join();
+}
+
+bool TunWorker::SetUpRing() {
+  ring_.reset(new TunRing(tun_fd_, options_.offload, &pool_));
+  // The queue leaves the epoll set; the ring reads it from now on.
+  if (!ring_->Init(epoll_fd_) ||
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, tun_fd_, nullptr) != 0) {
+    ring_.reset();
+    return false;
+  }
+  return true;
+}
+
+void TunWorker::Run() {
+  struct epoll_event events[kMaxEvents];
+  next_timer_ms_ = MonotonicNowMs() + kHousekeepingMs;
+  // Whether the epoll set may still hold events the ring's poll will not
+  // report again: sockets are level-triggered, so one only partly drained
+  // stays ready without a new wakeup.
+  bool more_events = false;
+
+  for (;;) {
+    int count = 0;
+    if (ring_) {
+      // Packets and socket readiness arrive through the one wait.
+      int timeout = more_events ? 0 : NextTimeoutMs(MonotonicNowMs());
+      if (!ring_->Wait(timeout)) {
+        return;
+      }
+      ReadTun();
+      if (ring_->TakeEpollReady() || more_events) {
+        count = epoll_wait(epoll_fd_, events, kMaxEvents, 0);
+      }
+      more_events = count > 0;
+    } else {
+      count = epoll_wait(epoll_fd_, events, kMaxEvents,
+                         NextTimeoutMs(MonotonicNowMs()));
+    }
+    if (count < 0 && errno != EINTR) {
+      return;
+    }
+    for (int i = 0; i < count; i++) {
+      void* tag = events[i].data.ptr;
+      if (tag == &kStopTag) {
+        return;
+      }
+      if (tag == &kTunTag) {
+        ReadTun();
+        continue;
+      }
+      if (tag == &kUdpTag) {
+        udp_->Poll();
+        continue;
+      }
+      TcpFlow* flow = static_cast<TcpFlow*>(tag);
+      if (!flow->closed) {
+        OnSocketEvent(flow, events[i].events);
+      }
+    }
+
+    int64_t now = MonotonicNowMs();
+    if (now >= next_timer_ms_) {
+      RunTimers(now);
+    }
+
+    // End of round: coalesced ACKs, the batched UDP sends and TUN writes,
+    // then buffers and flows that could still have been referenced above.
+    for (TcpFlow* flow : ack_pending_) {
+      if (!flow->closed && flow->ack_pending) {
+        SendControl(flow, kTcpAck);
+      }
+    }
+    ack_pending_.clear();
+    if (udp_) {
+      udp_->Flush();
+    }
+    FlushTx();
+    for (uint8_t* buffer : release_queue_) {
+      pool_.Release(buffer);
+    }
+    release_queue_.clear();
+    closed_flows_.clear();
+  }
+}
+
+void TunWorker::ReadTun() {
+  uint8_t* batch[kReadBatchSize];
+  size_t lengths[kReadBatchSize];
+  VirtioNetHeader offloads[kReadBatchSize];
+  if (ring_) {
+    HandleBatch(batch, lengths, offloads,
+                ring_->TakePackets(batch, lengths, offloads, kReadBatchSize));
+    return;
+  }
+  size_t count = 0;
+  while (count < kReadBatchSize) {
+    uint8_t* buffer = pool_.Acquire();
+    if (buffer == nullptr) {
+      break;
+    }
+    ssize_t length = ReadTunPacket(tun_fd_, options_.offload, buffer,
+                                   pool_.buffer_size(), &offloads[count]);
+    if (length <= 0) {
+      pool_.Release(buffer);
+      break;
+    }
+    batch[count] = buffer;
+    lengths[count] = static_cast<size_t>(length);
+    count++;
+  }
+  HandleBatch(batch, lengths, offloads, count);
+}
+
+void TunWorker::HandleBatch(uint8_t** batch, const size_t* lengths,
+                            const VirtioNetHeader* offloads, size_t count) {
+  // Headers are parsed for the whole batch first, so the parser stays hot
+  // and the handlers below find them ready.
+  PacketInfo infos[kReadBatchSize];
+  bool parsed[kReadBatchSize];
+  ParsePackets(batch, lengths, count, infos, parsed);
+  for (size_t i = 0; i < count; i++) {
+    // TCP super-packets need nothing special: the payload is relayed as
+    // one stream write, and checksums left partial are never checked.
+    if (parsed[i] && infos[i].protocol == kIpProtoUdp &&
+        offloads[i].gso_type == kVirtioNetGsoUdpL4 &&
+        offloads[i].gso_size > 0) {
+      SplitUdpSuperPacket(batch[i], infos[i], offloads[i].gso_size);
+      continue;
+    }
+    HandlePacket(batch[i], parsed[i] ? &infos[i] : nullptr);
+  }
+}
+
+void TunWorker::SplitUdpSuperPacket(uint8_t* buffer, const PacketInfo& info,
+                                    uint16_t segment_size) {
+  for (size_t offset = 0; offset < info.payload_length;
+       offset += segment_size) {
+    uint8_t* segment = pool_.Acquire();
+    if (segment == nullptr) {
+      break;
+    }
+    size_t length = std::min<size_t>(segment_size,
+                                     info.payload_length - offset);
+    length = CopyUdpSegment(buffer, info, offset, length, segment);
+    PacketInfo segment_info;
+    HandlePacket(segment, ParsePacket(segment, length, &segment_info)
+                              ? &segment_info
+                              : nullptr);
+  }
+  pool_.Release(buffer);
+}
+
+void TunWorker::HandlePacket(uint8_t* buffer, const PacketInfo* parsed) {
+  if (parsed != nullptr) {
+    const PacketInfo& info = *parsed;
+    if (info.protocol == kIpProtoTcp) {
+      HandleTcp(buffer, info);
+      return;
+    }
+    if (info.protocol == kIpProtoUdp && info.dst_port == kDnsPort &&
+        options_.dns != nullptr) {
+      HandleDns(buffer, info);
+      return;
+    }
+    if (info.protocol == kIpProtoUdp && udp_) {
+      HandleUdp(buffer, info);
+      return;
+    }
+  }
+  // Other protocols are not relayed by this engine.
+  pool_.Release(buffer);
+}
+
+void TunWorker::HandleDns(uint8_t* buffer, const PacketInfo& info) {
+  DnsReturnPath path;
+  path.tun_fd = tun_fd_;
+  path.vnet_header = options_.offload;
+  path.family = info.family;
+  memcpy(path.client, info.src, AddressLength(info.family));
+  memcpy(path.server, info.dst, AddressLength(info.family));
+  path.client_port = info.src_port;
+  path.server_port = info.dst_port;
+  size_t headers =
+      (info.family == AF_INET6 ? kIpv6HeaderSize : kIpv4HeaderSize) +
+      kUdpHeaderSize;
+  size_t max_length = static_cast<size_t>(options_.mtu) - headers;
+
+  // Cache hits are answered before Resolve() returns; misses from the
+  // forwarder thread, which writes the reply to the queue itself.
+  options_.dns->Resolve(
+      buffer + info.payload_offset, info.payload_length, max_length,
+      [path](const uint8_t* response, size_t length) {
+        std::vector<uint8_t> packet(kPacketHeadroom + length);
+        memcpy(packet.data() + kPacketHeadroom, response, length);
+        UdpDatagramSpec spec;
+        spec.family = path.family;
+        spec.src = path.server;
+        spec.dst = path.client;
+        spec.src_port = path.server_port;
+        spec.dst_port = path.client_port;
+        size_t packet_length = 0;
+        uint8_t* start = WriteUdpHeaders(packet.data() + kPacketHeadroom,
+                                         length, spec, &packet_length);
+        VirtioNetHeader none = {};
+        if (WriteTunPacket(path.tun_fd, path.vnet_header ? &none : nullptr,
+                           start, packet_length) < 0) {
+          // Dropped like any lost datagram; the client retries.
+        }
+      });
+  pool_.Release(buffer);
+}
+
+void TunWorker::HandleUdp(uint8_t* buffer, const PacketInfo& info) {
+  ApplyProxyChange();
+  udp_->HandleDatagram(buffer, info);
+}
+
+void TunWorker::HandleTcp(uint8_t* buffer, const PacketInfo& info) {
+  FlowKey key = FlowKey::FromPacket(info);
+  std::unique_ptr<TcpFlow>* found = flows_.Find(key);
+  if (found == nullptr) {
+    if ((info.tcp_flags & (kTcpSyn | kTcpAck | kTcpRst)) == kTcpSyn) {
+      CreateFlow(info);
+    } else if ((info.tcp_flags & kTcpRst) == 0) {
+      SendResetFor(info);
+    }
+    pool_.Release(buffer);
+    return;
+  }
+
+  TcpFlow* flow = found->get();
+  flow->last_activity_ms = MonotonicNowMs();
+  if (info.tcp_flags & kTcpRst) {
+    CloseFlow(flow, false);
+    pool_.Release(buffer);
+    return;
+  }
+  if (info.tcp_flags & kTcpSyn) {
+    // A retransmitted SYN: our SYN-ACK was lost.
+    if (flow->state == TcpState::kSynReceived) {
+      SendSynAck(flow);
+    }
+    pool_.Release(buffer);
+    return;
+  }
+  if (flow->state == TcpState::kProxyConnecting ||
+      flow->state == TcpState::kProxyHandshake) {
+    pool_.Release(buffer);
+    return;
+  }
+
+  if (info.tcp_flags & kTcpAck) {
+    ProcessAck(flow, info);
+  }
+  bool kept = false;
+  if (!flow->closed && flow->state == TcpState::kEstablished &&
+      (info.payload_length > 0 || (info.tcp_flags & kTcpFin))) {
+    kept = ProcessData(flow, buffer, info);
+  }
+  if (!kept) {
+    pool_.Release(buffer);
+  }
+  if (!flow->closed) {
+    MaybeFinish(flow);
+  }
+}
+
+void TunWorker::CreateFlow(const PacketInfo& info) {
+  if (flows_.size() >= flows_.max_flows()) {
+    SendResetFor(info);
+    return;
+  }
+  std::unique_ptr<TcpFlow> flow(new TcpFlow());
+  flow->key = FlowKey::FromPacket(info);
+  flow->created_ms = flow->last_activity_ms = MonotonicNowMs();
+  flow->rcv_nxt = info.seq + 1;
+  flow->iss = random_();
+  flow->snd_una = flow->iss;
+  flow->snd_nxt = flow->iss;
+  flow->snd_wnd = info.window;
+
+  // Options: MSS and window scale; SACK and timestamps are not negotiated.
+  const uint8_t* options = info.tcp_options;
+  size_t length = info.tcp_options_length;
+  for (size_t i = 0; i < length;) {
+    uint8_t kind = options[i];
+    if (kind == 0) {
+      break;
+    }
+    if (kind == 1) {
+      i++;
+      continue;
+    }
+    if (i + 1 >= length || options[i + 1] < 2 || i + options[i + 1] > length) {
+      break;
+    }
+    if (kind == 2 && options[i + 1] == 4) {
+      flow->mss = static_cast<uint16_t>((options[i + 2] << 8) | options[i + 3]);
+    } else if (kind == 3 && options[i + 1] == 3) {
+      flow->window_scaling = true;
+      flow->client_window_scale = std::min<uint8_t>(options[i + 2], 14);
+    }
+    i += options[i + 1];
+  }
+  size_t headers = (info.family == AF_INET6 ? kIpv6HeaderSize
+                                            : kIpv4HeaderSize) +
+                   kTcpHeaderSize;
+  size_t limit = std::min<size_t>(options_.mtu - headers,
+                                  pool_.buffer_size() - kPacketHeadroom);
+  flow->mss = static_cast<uint16_t>(std::min<size_t>(flow->mss, limit));
+
+  ApplyProxyChange();
+
+  struct sockaddr_storage proxy;
+  socklen_t proxy_length = 0;
+  memset(&proxy, 0, sizeof(proxy));
+  auto* v4 = reinterpret_cast<struct sockaddr_in*>(&proxy);
+  auto* v6 = reinterpret_cast<struct sockaddr_in6*>(&proxy);
+  if (inet_pton(AF_INET, options_.socks_host.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(options_.socks_port);
+    proxy_length = sizeof(*v4);
+  } else if (inet_pton(AF_INET6, options_.socks_host.c_str(),
+                       &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(options_.socks_port);
+    proxy_length = sizeof(*v6);
+  } else {
+    SendResetFor(info);
+    return;
+  }
+
+  flow->fd = socket(proxy.ss_family,
+                    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (flow->fd < 0) {
+    SendResetFor(info);
+    return;
+  }
+  int one = 1;
+  setsockopt(flow->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(flow->fd, reinterpret_cast<struct sockaddr*>(&proxy),
+              proxy_length) != 0 &&
+      errno != EINPROGRESS) {
+    close(flow->fd);
+    SendResetFor(info);
+    return;
+  }
+
+  struct epoll_event event = {};
+  event.events = EPOLLOUT;
+  event.data.ptr = flow.get();
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, flow->fd, &event) != 0) {
+    close(flow->fd);
+    SendResetFor(info);
+    return;
+  }
+  flow->interest = EPOLLOUT;
+  flow->registered = true;
+  flow->timer.owner = flow.get();
+  ScheduleFlowTimer(flow.get());
+  active_flows_.fetch_add(1, std::memory_order_relaxed);
+  FlowKey key = flow->key;
+  flows_.Insert(key, std::move(flow));
+}
+
+void TunWorker::ApplyProxyChange() {
+  if (!proxy_changed_.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(proxy_mutex_);
+  options_.socks_host = pending_proxy_host_;
+  options_.socks_port = pending_proxy_port_;
+  proxy_changed_.store(false, std::memory_order_relaxed);
+  if (udp_) {
+    udp_->SetProxy(options_.socks_host, options_.socks_port);
+  }
+}
+
+void TunWorker::SetProxy(const std::string& host, uint16_t port) {
+  std::lock_guard<std::mutex> lock(proxy_mutex_);
+  pending_proxy_host_ = host;
+  pending_proxy_port_ = port;
+  proxy_changed_.store(true, std::memory_order_release);
+}
+
+void TunWorker::OnSocketEvent(TcpFlow* flow, uint32_t events) {
+  if (flow->state == TcpState::kProxyConnecting ||
+      flow->state == TcpState::kProxyHandshake) {
+    AdvanceSocksHandshake(flow, events);
+    return;
+  }
+
+  if (events & EPOLLERR) {
+    CloseFlow(flow, true);
+    return;
+  }
+  if (events & EPOLLOUT) {
+    DrainToSocket(flow);
+  }
+  if (!flow->closed && (events & EPOLLHUP)) {
+    // Nothing more will arrive; whatever is buffered is pumped as the
+    // client's window allows, driven by its ACKs rather than by epoll.
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, flow->fd, nullptr);
+    flow->registered = false;
+  }
+  if (!flow->closed && (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP))) {
+    PumpSocketToTun(flow);
+  }
+  if (!flow->closed) {
+    MaybeFinish(flow);
+  }
+}
+
+void TunWorker::AdvanceSocksHandshake(TcpFlow* flow, uint32_t events) {
+  if (flow->state == TcpState::kProxyConnecting) {
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    getsockopt(flow->fd, SOL_SOCKET, SO_ERROR, &error, &error_length);
+    uint8_t request[6 + 1 + 16 + 2];
+    size_t length = BuildSocksRequest(flow->key, request);
+    if (error != 0 || (events & EPOLLERR) ||
+        send(flow->fd, request, length, MSG_NOSIGNAL) !=
+            static_cast<ssize_t>(length)) {
+      CloseFlow(flow, true);
+      return;
+    }
+    flow->state = TcpState::kProxyHandshake;
+    UpdateSocketInterest(flow);
+    return;
+  }
+
+  // Read exactly the reply so early data from the remote stays queued in
+  // the socket for the relay.
+  ssize_t received =
+      recv(flow->fd, flow->socks_reply + flow->socks_received,
+           flow->socks_expected - flow->socks_received, 0);
+  if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (received <= 0) {
+    CloseFlow(flow, true);
+    return;
+  }
+  flow->socks_received += static_cast<size_t>(received);
+  const uint8_t* reply = flow->socks_reply;
+  if (flow->socks_received >= 2 && (reply[0] != 0x05 || reply[1] != 0x00)) {
+    CloseFlow(flow, true);
+    return;
+  }
+  if (flow->socks_received >= 6 && (reply[2] != 0x05 || reply[3] != 0x00)) {
+    CloseFlow(flow, true);
+    return;
+  }
+  if (flow->socks_received == 7 && flow->socks_expected == 7) {
+    switch (reply[5]) {
+      case 0x01:
+        flow->socks_expected = 6 + 4 + 2;
+        break;
+      case 0x04:
+        flow->socks_expected = 6 + 16 + 2;
+        break;
+      case 0x03:
+        flow->socks_expected = 6 + 1 + reply[6] + 2;
+        break;
+      default:
+        CloseFlow(flow, true);
+        return;
+    }
+  }
+  if (flow->socks_received < flow->socks_expected) {
+    return;
+  }
+
+  flow->state = TcpState::kSynReceived;
+  SendSynAck(flow);
+  UpdateSocketInterest(flow);
+}
+
+void TunWorker::ProcessAck(TcpFlow* flow, const PacketInfo& info) {
+  uint32_t ack = info.ack;
+  if (flow->state == TcpState::kSynReceived) {
+    if (ack != flow->iss + 1) {
+      return;
+    }
+    flow->state = TcpState::kEstablished;
+    flow->snd_una = ack;
+  }
+
+  flow->snd_wnd = flow->window_scaling
+                      ? static_cast<uint32_t>(info.window)
+                            << flow->client_window_scale
+                      : info.window;
+
+  int64_t now = MonotonicNowMs();
+  if (SeqLt(flow->snd_una, ack) && SeqLeq(ack, flow->snd_nxt)) {
+    while (!flow->unacked.empty()) {
+      const TcpFlow::Segment& segment = flow->unacked.front();
+      uint32_t end = segment.seq + segment.length +
+                     ((segment.flags & kTcpFin) ? 1 : 0);
+      if (!SeqLeq(end, ack)) {
+        break;
+      }
+      ReleaseLater(segment.buffer);
+      flow->unacked.pop_front();
+    }
+    flow->snd_una = ack;
+    flow->dup_acks = 0;
+    flow->retransmits = 0;
+    flow->rto_ms = kInitialRtoMs;
+    flow->rto_deadline_ms = 0;
+    if (flow->in_recovery && SeqLt(ack, flow->recovery_point)) {
+      // A partial ACK exposes the next hole; resend it right away.
+      TransmitSegment(flow, 0);
+    } else {
+      flow->in_recovery = false;
+    }
+    if (!flow->unacked.empty()) {
+      ArmRetransmit(flow, now);
+    }
+  } else if (ack == flow->snd_una && !flow->unacked.empty() &&
+             info.payload_length == 0 && (info.tcp_flags & kTcpFin) == 0) {
+    if (++flow->dup_acks == kDupAckThreshold && !flow->in_recovery) {
+      EnterRecovery(flow);
+    }
+  }
+
+  PumpSocketToTun(flow);
+}
+
+bool TunWorker::ProcessData(TcpFlow* flow, uint8_t* buffer,
+                            const PacketInfo& info) {
+  uint32_t seq = info.seq;
+  const uint8_t* data = buffer + info.payload_offset;
+  size_t length = info.payload_length;
+  bool fin = (info.tcp_flags & kTcpFin) != 0;
+
+  if (flow->client_fin) {
+    // A retransmitted FIN: our ACK was lost.
+    QueueAck(flow);
+    return false;
+  }
+  if (SeqLt(seq, flow->rcv_nxt)) {
+    uint32_t overlap = flow->rcv_nxt - seq;
+    if (overlap > length) {
+      QueueAck(flow);
+      return false;
+    }
+    data += overlap;
+    length -= overlap;
+    seq = flow->rcv_nxt;
+  }
+  if (seq != flow->rcv_nxt) {
+    return HoldOutOfOrder(flow, buffer, seq, data, length, fin);
+  }
+
+  QueueAck(flow);
+  bool kept = Deliver(flow, buffer, data, length, fin);
+
+  // Segments that were waiting behind the gap just filled.
+  while (!flow->closed && !flow->out_of_order.empty()) {
+    TcpFlow::OutOfOrder segment = flow->out_of_order.front();
+    if (SeqLt(flow->rcv_nxt, segment.seq) || flow->client_fin) {
+      break;
+    }
+    flow->out_of_order.pop_front();
+    uint32_t overlap = flow->rcv_nxt - segment.seq;
+    if (overlap > segment.length ||
+        (overlap == segment.length && !segment.fin)) {
+      ReleaseLater(segment.buffer);
+      continue;
+    }
+    if (!Deliver(flow, segment.buffer, segment.data + overlap,
+                 segment.length - overlap, segment.fin)) {
+      ReleaseLater(segment.buffer);
+    }
+  }
+  if (!flow->closed) {
+    UpdateSocketInterest(flow);
+  }
+  return kept;
+}
+
+bool TunWorker::HoldOutOfOrder(TcpFlow* flow, uint8_t* buffer, uint32_t seq,
+                               const uint8_t* data, size_t length, bool fin) {
+  // Every segment past a hole is answered right away with a duplicate ACK so
+  // the client retransmits the hole without waiting for its timer.
+  SendControl(flow, kTcpAck);
+
+  std::deque<TcpFlow::OutOfOrder>& queue = flow->out_of_order;
+  if (queue.size() >= kMaxOutOfOrder || pool_.available() < kPoolReserve ||
+      !SeqLeq(seq + static_cast<uint32_t>(length),
+              flow->rcv_nxt + ReceiveWindow(flow))) {
+    return false;
+  }
+  auto position = queue.begin();
+  while (position != queue.end() && SeqLt(position->seq, seq)) {
+    ++position;
+  }
+  if (position != queue.end() && position->seq == seq) {
+    return false;
+  }
+  queue.insert(position, {buffer, seq, data, length, fin});
+  return true;
+}
+
+bool TunWorker::Deliver(TcpFlow* flow, uint8_t* buffer, const uint8_t* data,
+                        size_t length, bool fin) {
+  uint32_t window = ReceiveWindow(flow);
+  if (length > window) {
+    length = window;
+    fin = false;
+  }
+
+  bool kept = false;
+  if (length > 0) {
+    size_t sent = 0;
+    if (flow->to_socket.empty()) {
+      ssize_t result = send(flow->fd, data, length, MSG_NOSIGNAL);
+      if (result < 0 && errno != EAGAIN && errno != EINTR) {
+        CloseFlow(flow, true);
+        return false;
+      }
+      sent = result > 0 ? static_cast<size_t>(result) : 0;
+      bytes_up_.fetch_add(sent, std::memory_order_relaxed);
+    }
+    if (sent < length) {
+      // Hold the remainder in the packet buffer itself until the proxy
+      // socket drains.
+      if (pool_.available() < kPoolReserve) {
+        length = sent;
+        fin = false;
+      } else {
+        flow->to_socket.push_back({buffer, data + sent, length - sent});
+        flow->to_socket_bytes += length - sent;
+        kept = true;
+      }
+    }
+    flow->rcv_nxt += static_cast<uint32_t>(length);
+  }
+
+  if (fin) {
+    flow->rcv_nxt++;
+    flow->client_fin = true;
+    if (flow->to_socket.empty()) {
+      shutdown(flow->fd, SHUT_WR);
+      flow->write_shut = true;
+    }
+  }
+  return kept;
+}
+
+void TunWorker::QueueAck(TcpFlow* flow) {
+  if (!flow->ack_pending) {
+    flow->ack_pending = true;
+    ack_pending_.push_back(flow);
+  }
+}
+
+void TunWorker::DrainToSocket(TcpFlow* flow) {
+  bool was_constrained = flow->advertised_window < kReceiveWindow / 2;
+  while (!flow->to_socket.empty()) {
+    TcpFlow::Pending& pending = flow->to_socket.front();
+    ssize_t sent = send(flow->fd, pending.data, pending.length, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EINTR) {
+        break;
+      }
+      CloseFlow(flow, true);
+      return;
+    }
+    bytes_up_.fetch_add(static_cast<uint64_t>(sent),
+                        std::memory_order_relaxed);
+    flow->to_socket_bytes -= static_cast<size_t>(sent);
+    pending.data += sent;
+    pending.length -= static_cast<size_t>(sent);
+    if (pending.length > 0) {
+      break;
+    }
+    ReleaseLater(pending.buffer);
+    flow->to_socket.pop_front();
+  }
+
+  if (flow->to_socket.empty() && flow->client_fin && !flow->write_shut) {
+    shutdown(flow->fd, SHUT_WR);
+    flow->write_shut = true;
+  }
+  if (was_constrained && ReceiveWindow(flow) >= kReceiveWindow / 2) {
+    // Window update so the client resumes sending.
+    QueueAck(flow);
+  }
+  UpdateSocketInterest(flow);
+}
+
+void TunWorker::PumpSocketToTun(TcpFlow* flow) {
+  if (flow->state != TcpState::kEstablished) {
+    return;
+  }
+  flow->starved = false;
+  int64_t now = MonotonicNowMs();
+  while (!flow->socket_eof) {
+    uint32_t in_flight = flow->snd_nxt - flow->snd_una;
+    uint32_t window = std::min(flow->snd_wnd, kMaxInFlight);
+    if (in_flight >= window) {
+      break;
+    }
+    if (pool_.available() <= kPoolReserve) {
+      flow->starved = true;
+      if (!flow->in_starved_list) {
+        flow->in_starved_list = true;
+        starved_.push_back(flow);
+      }
+      break;
+    }
+    uint8_t* buffer = pool_.Acquire();
+    // With offload one segment fills a super-packet, which the kernel cuts
+    // into MSS-sized ones.
+    size_t segment_size = flow->mss;
+    if (options_.offload) {
+      segment_size = kMaxSuperPacket - kTcpHeaderSize -
+                     (flow->key.family == AF_INET6 ? kIpv6HeaderSize
+                                                   : kIpv4HeaderSize);
+    }
+    size_t room = std::min<size_t>(segment_size, window - in_flight);
+    ssize_t received = recv(flow->fd, buffer + kPacketHeadroom, room, 0);
+    if (received < 0) {
+      pool_.Release(buffer);
+      if (errno == EAGAIN || errno == EINTR) {
+        break;
+      }
+      CloseFlow(flow, true);
+      return;
+    }
+
+    TcpFlow::Segment segment;
+    segment.buffer = buffer;
+    segment.seq = flow->snd_nxt;
+    if (received == 0) {
+      flow->socket_eof = true;
+      segment.length = 0;
+      segment.flags = kTcpFin | kTcpAck;
+      flow->snd_nxt++;
+      flow->fin_sent = true;
+    } else {
+      segment.length = static_cast<uint16_t>(received);
+      segment.flags = kTcpAck | kTcpPsh;
+      flow->snd_nxt += static_cast<uint32_t>(received);
+      bytes_down_.fetch_add(static_cast<uint64_t>(received),
+                            std::memory_order_relaxed);
+    }
+    flow->unacked.push_back(segment);
+    TransmitSegment(flow, flow->unacked.size() - 1);
+    ArmRetransmit(flow, now);
+  }
+  UpdateSocketInterest(flow);
+}
+
+void TunWorker::MaybeFinish(TcpFlow* flow) {
+  if (flow->client_fin && flow->fin_sent && flow->snd_una == flow->snd_nxt &&
+      flow->to_socket.empty()) {
+    if (flow->ack_pending) {
+      // Acknowledge the client's FIN before the flow goes away.
+      SendControl(flow, kTcpAck);
+    }
+    CloseFlow(flow, false);
+  }
+}
+
+void TunWorker::CloseFlow(TcpFlow* flow, bool reset) {
+  if (flow->closed) {
+    return;
+  }
+  if (reset) {
+    SendControl(flow, kTcpRst | kTcpAck);
+  }
+  flow->closed = true;
+  close(flow->fd);
+  for (const TcpFlow::Pending& pending : flow->to_socket) {
+    ReleaseLater(pending.buffer);
+  }
+  for (const TcpFlow::Segment& segment : flow->unacked) {
+    ReleaseLater(segment.buffer);
+  }
+  for (const TcpFlow::OutOfOrder& segment : flow->out_of_order) {
+    ReleaseLater(segment.buffer);
+  }
+  flow->to_socket.clear();
+  flow->unacked.clear();
+  flow->out_of_order.clear();
+  timers_.Cancel(&flow->timer);
+  if (flow->in_starved_list) {
+    starved_.erase(std::find(starved_.begin(), starved_.end(), flow));
+  }
+
+  std::unique_ptr<TcpFlow>* found = flows_.Find(flow->key);
+  if (found != nullptr) {
+    closed_flows_.push_back(std::move(*found));
+    flows_.Erase(flow->key);
+  }
+  active_flows_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void TunWorker::UpdateSocketInterest(TcpFlow* flow) {
+  if (flow->closed || !flow->registered) {
+    return;
+  }
+  uint32_t want = 0;
+  switch (flow->state) {
+    case TcpState::kProxyConnecting:
+      want = EPOLLOUT;
+      break;
+    case TcpState::kProxyHandshake:
+      want = EPOLLIN;
+      break;
+    case TcpState::kSynReceived:
+      break;
+    case TcpState::kEstablished:
+      if (!flow->socket_eof && !flow->starved &&
+          flow->snd_nxt - flow->snd_una <
+              std::min(flow->snd_wnd, kMaxInFlight)) {
+        want |= EPOLLIN | EPOLLRDHUP;
+      }
+      if (!flow->to_socket.empty()) {
+        want |= EPOLLOUT;
+      }
+      break;
+  }
+  if (want == flow->interest) {
+    return;
+  }
+  struct epoll_event event = {};
+  event.events = want;
+  event.data.ptr = flow;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, flow->fd, &event);
+  flow->interest = want;
+}
+
+uint32_t TunWorker::ReceiveWindow(const TcpFlow* flow) const {
+  return flow->to_socket_bytes >= kReceiveWindow
+             ? 0
+             : kReceiveWindow - static_cast<uint32_t>(flow->to_socket_bytes);
+}
+
+void TunWorker::SendSynAck(TcpFlow* flow) {
+  uint8_t* buffer = pool_.Acquire();
+  if (buffer == nullptr) {
+    return;
+  }
+  uint16_t our_mss = flow->mss;
+  uint8_t options[8] = {2, 4, static_cast<uint8_t>(our_mss >> 8),
+                        static_cast<uint8_t>(our_mss), 1, 3, 3,
+                        kOurWindowScale};
+  TcpSegmentSpec spec;
+  spec.family = flow->key.family;
+  spec.src = flow->key.remote;
+  spec.dst = flow->key.client;
+  spec.src_port = flow->key.remote_port;
+  spec.dst_port = flow->key.client_port;
+  spec.seq = flow->iss;
+  spec.ack = flow->rcv_nxt;
+  spec.flags = kTcpSyn | kTcpAck;
+  // The window in a SYN segment is never scaled.
+  spec.window =
+      static_cast<uint16_t>(std::min<uint32_t>(kReceiveWindow, 65535));
+  spec.options = options;
+  spec.options_length = flow->window_scaling ? 8 : 4;
+
+  size_t length = 0;
+  uint8_t* packet =
+      WriteTcpHeaders(buffer + kPacketHeadroom, 0, spec, &length);
+  flow->snd_nxt = flow->iss + 1;
+  flow->advertised_window = spec.window;
+  QueueTx(packet, length, buffer, 0);
+}
+
+void TunWorker::SendControl(TcpFlow* flow, uint8_t flags) {
+  uint8_t* buffer = pool_.Acquire();
+  if (buffer == nullptr) {
+    return;
+  }
+  uint32_t window = ReceiveWindow(flow);
+  uint8_t scale = flow->window_scaling ? kOurWindowScale : 0;
+  TcpSegmentSpec spec;
+  spec.family = flow->key.family;
+  spec.src = flow->key.remote;
+  spec.dst = flow->key.client;
+  spec.src_port = flow->key.remote_port;
+  spec.dst_port = flow->key.client_port;
+  spec.seq = flow->snd_nxt;
+  spec.ack = flow->rcv_nxt;
+  spec.flags = flags;
+  spec.window = static_cast<uint16_t>(std::min<uint32_t>(window >> scale,
+                                                         65535));
+  spec.options = nullptr;
+  spec.options_length = 0;
+
+  size_t length = 0;
+  uint8_t* packet =
+      WriteTcpHeaders(buffer + kPacketHeadroom, 0, spec, &length);
+  flow->ack_pending = false;
+  flow->advertised_window = window;
+  QueueTx(packet, length, buffer, 0);
+}
+
+void TunWorker::SendResetFor(const PacketInfo& info) {
+  uint8_t* buffer = pool_.Acquire();
+  if (buffer == nullptr) {
+    return;
+  }
+  TcpSegmentSpec spec;
+  spec.family = info.family;
+  spec.src = info.dst;
+  spec.dst = info.src;
+  spec.src_port = info.dst_port;
+  spec.dst_port = info.src_port;
+  if (info.tcp_flags & kTcpAck) {
+    spec.seq = info.ack;
+    spec.ack = 0;
+    spec.flags = kTcpRst;
+  } else {
+    spec.seq = 0;
+    spec.ack = info.seq + static_cast<uint32_t>(info.payload_length) +
+               ((info.tcp_flags & kTcpSyn) ? 1 : 0) +
+               ((info.tcp_flags & kTcpFin) ? 1 : 0);
+    spec.flags = kTcpRst | kTcpAck;
+  }
+  spec.window = 0;
+  spec.options = nullptr;
+  spec.options_length = 0;
+
+  size_t length = 0;
+  uint8_t* packet =
+      WriteTcpHeaders(buffer + kPacketHeadroom, 0, spec, &length);
+  QueueTx(packet, length, buffer, 0);
+}
+
+void TunWorker::TransmitSegment(TcpFlow* flow, size_t index) {
+  TcpFlow::Segment& segment = flow->unacked[index];
+  uint32_t window = ReceiveWindow(flow);
+  uint8_t scale = flow->window_scaling ? kOurWindowScale : 0;
+  uint16_t scaled_window =
+      static_cast<uint16_t>(std::min<uint32_t>(window >> scale, 65535));
+
+  uint8_t* packet = nullptr;
+  size_t length = 0;
+  if (segment.sent) {
+    // A retransmission: only the acknowledgment and window can have moved,
+    // so patch those and the checksum rather than summing the payload again.
+    uint8_t* tcp = segment.buffer + kPacketHeadroom - kTcpHeaderSize;
+    size_t ip_length =
+        flow->key.family == AF_INET6 ? kIpv6HeaderSize : kIpv4HeaderSize;
+    RewriteTcpAckWindow(tcp, flow->rcv_nxt, scaled_window, options_.offload);
+    packet = tcp - ip_length;
+    length = ip_length + kTcpHeaderSize + segment.length;
+  } else {
+    TcpSegmentSpec spec;
+    spec.family = flow->key.family;
+    spec.src = flow->key.remote;
+    spec.dst = flow->key.client;
+    spec.src_port = flow->key.remote_port;
+    spec.dst_port = flow->key.client_port;
+    spec.seq = segment.seq;
+    spec.ack = flow->rcv_nxt;
+    spec.flags = segment.flags;
+    spec.window = scaled_window;
+    spec.options = nullptr;
+    spec.options_length = 0;
+    spec.partial_checksum = options_.offload;
+    packet = WriteTcpHeaders(segment.buffer + kPacketHeadroom, segment.length,
+                             spec, &length);
+    segment.sent = true;
+  }
+  // Data segments carry the ACK, so no separate one is needed this round.
+  flow->ack_pending = false;
+  flow->advertised_window = window;
+  QueueTx(packet, length, nullptr, options_.offload ? flow->mss : 0);
+}
+
+void TunWorker::EnterRecovery(TcpFlow* flow) {
+  flow->in_recovery = true;
+  flow->recovery_point = flow->snd_nxt;
+  TransmitSegment(flow, 0);
+}
+
+void TunWorker::ArmRetransmit(TcpFlow* flow, int64_t now_ms) {
+  if (flow->rto_deadline_ms != 0) {
+    return;
+  }
+  flow->rto_deadline_ms = now_ms + flow->rto_ms;
+  if (!flow->timer.scheduled() ||
+      flow->timer.deadline_ms > flow->rto_deadline_ms) {
+    timers_.Schedule(&flow->timer, flow->rto_deadline_ms);
+  }
+  next_timer_ms_ = std::min(next_timer_ms_, flow->rto_deadline_ms);
+}
+
+void TunWorker::QueueTx(const uint8_t* data, size_t length, uint8_t* owned,
+                        uint16_t offload_mss) {
+  tx_queue_.push_back({data, length, owned, offload_mss});
+}
+
+void TunWorker::FlushTx() {
+  for (const TxPacket& packet : tx_queue_) {
+    VirtioNetHeader offload = {};
+    if (packet.offload_mss != 0) {
+      SetTcpOffload(packet.data, packet.length, packet.offload_mss, &offload);
+    }
+    const VirtioNetHeader* header = options_.offload ? &offload : nullptr;
+    if (ring_) {
+      ring_->QueueWrite(packet.data, packet.length, header);
+      continue;
+    }
+    // A full queue drops the packet; TCP retransmission recovers it.
+    if (WriteTunPacket(tun_fd_, header, packet.data, packet.length) < 0 &&
+        errno != EAGAIN) {
+      break;
+    }
+  }
+  if (ring_) {
+    ring_->Flush();
+  }
+  for (const TxPacket& packet : tx_queue_) {
+    if (packet.owned != nullptr) {
+      pool_.Release(packet.owned);
+    }
+  }
+  tx_queue_.clear();
+}
+
+void TunWorker::ReleaseLater(uint8_t* buffer) {
+  release_queue_.push_back(buffer);
+}
+
+void TunWorker::ScheduleFlowTimer(TcpFlow* flow) {
+  int64_t deadline = flow->last_activity_ms + kIdleTimeoutMs;
+  if (flow->state != TcpState::kEstablished) {
+    deadline = std::min(deadline, flow->created_ms + kHandshakeTimeoutMs);
+  }
+  if (flow->rto_deadline_ms != 0) {
+    deadline = std::min(deadline, flow->rto_deadline_ms);
+  }
+  timers_.Schedule(&flow->timer, deadline);
+}
+
+void TunWorker::OnFlowTimer(TcpFlow* flow, int64_t now_ms) {
+  bool handshaking = flow->state != TcpState::kEstablished;
+  if ((handshaking && now_ms - flow->created_ms > kHandshakeTimeoutMs) ||
+      now_ms - flow->last_activity_ms > kIdleTimeoutMs) {
+    CloseFlow(flow, true);
+    return;
+  }
+  if (flow->rto_deadline_ms != 0 && now_ms >= flow->rto_deadline_ms) {
+    if (++flow->retransmits > kMaxRetransmits) {
+      CloseFlow(flow, true);
+      return;
+    }
+    EnterRecovery(flow);
+    flow->rto_ms = std::min(flow->rto_ms * 2, kMaxRtoMs);
+    flow->rto_deadline_ms = now_ms + flow->rto_ms;
+  }
+  ScheduleFlowTimer(flow);
+}
+
+void TunWorker::RunTimers(int64_t now_ms) {
+  // Only flows whose timer is due are looked at, however many are open.
+  expired_timers_.clear();
+  timers_.Advance(now_ms, &expired_timers_);
+  for (TimerWheel::Timer* timer : expired_timers_) {
+    TcpFlow* flow = static_cast<TcpFlow*>(timer->owner);
+    if (!flow->closed) {
+      OnFlowTimer(flow, now_ms);
+    }
+  }
+
+  std::vector<TcpFlow*> starved;
+  starved.swap(starved_);
+  for (TcpFlow* flow : starved) {
+    flow->in_starved_list = false;
+  }
+  for (TcpFlow* flow : starved) {
+    if (!flow->closed && flow->starved) {
+      PumpSocketToTun(flow);
+    }
+  }
+  if (udp_) {
+    udp_->RunTimers(now_ms);
+  }
+  next_timer_ms_ =
+      std::min(now_ms + kHousekeepingMs, timers_.NextDeadlineMs());
+}
+
+int TunWorker::NextTimeoutMs(int64_t now_ms) const {
+  return static_cast<int>(std::max<int64_t>(0, next_timer_ms_ - now_ms));
+}
@@ -0,0 +1,211 @@
+#ifndef RUNNER_TUN_WORKER_H_
+#define RUNNER_TUN_WORKER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dns_forwarder.h"
+#include "flow_key.h"
+#include "flow_table.h"
+#include "packet_headers.h"
+#include "packet_pool.h"
+#include "timer_wheel.h"
+#include "tun_offload.h"
+#include "tun_ring.h"
+#include "udp_relay.h"
+
+struct TunWorkerOptions {
+  std::string socks_host = "127.0.0.1";
+  uint16_t socks_port = 5000;
+  int mtu = 1500;
+  // Buffers preallocated for this worker's queue.
+  size_t pool_buffers = 4096;
+  // TCP connections, and separately UDP associations, tracked at once.
+  // Connections beyond it are reset and datagrams dropped.
+  size_t max_flows = 65536;
+  // Answers the DNS queries (UDP port 53) arriving on the queue. Not owned;
+  // it must be stopped before the queue is closed, as its replies are
+  // written to the queue directly.
+  DnsForwarder* dns = nullptr;
+  // Relay other UDP through SOCKS5 UDP ASSOCIATE; off drops it, which
+  // makes QUIC clients fall back to TCP.
+  bool relay_udp = true;
+  // The queue carries virtio-net headers (TunDevice::Open() with
+  // |vnet_header|). Proxy data then goes to the client as TCP super-packets
+  // of up to 64 KB that the kernel checksums and segments, and super-packets
+  // the kernel hands over are taken whole. Buffers grow to fit them, so the
+  // pool has a quarter of |pool_buffers|.
+  bool offload = false;
+  // Move the queue's packets through io_uring (see TunRing), with epoll
+  // kept for the relay sockets. Falls back to reading and writing the queue
+  // after epoll readiness where io_uring is unavailable.
+  bool io_uring = false;
+};
+
+// Serves one TUN queue on its own thread. TCP connections arriving on the
+// queue are terminated here and relayed to the SOCKS5 proxy, and other UDP
+// than DNS goes to it through a UdpRelay; the kernel keeps each flow on a
+// single queue, so flow state is never shared between workers and needs no
+// locking.
+//
+// Packets are read in batches into buffers from a preallocated pool. Client
+// payload is sent to the proxy socket straight out of the packet buffer that
+// carried it, and proxy data is received directly behind reserved header
+// space in a pool buffer, so payload bytes are never copied in userspace.
+// Sent segments keep their buffer until acknowledged, which doubles as the
+// retransmission queue. With TunWorkerOptions::io_uring the queue is read
+// and written through a TunRing, and one wait covers it and the sockets.
+class TunWorker {
+ public:
+  TunWorker(int tun_fd, const TunWorkerOptions& options);
+  ~TunWorker();
+
+  // Prevent copying.
+  TunWorker(TunWorker const&) = delete;
+  TunWorker& operator=(TunWorker const&) = delete;
+
+  // Starts the worker thread. Returns false if the event loop could not be
+  // set up.
+  bool Start(int index);
+
+  // How the queue's packets move, for logs: "epoll", or "io_uring" and its
+  // features. Valid once Start() has returned.
+  const std::string& io_backend() const { return io_backend_; }
+
+  // Stops the thread and closes every relayed connection.
+  void Stop();
+
+  // Relays flows that start from now on through the proxy at |host|:|port|.
+  // Flows already relayed keep their proxy connection until they end. Safe
+  // to call from any thread.
+  void SetProxy(const std::string& host, uint16_t port);
+
+  uint64_t bytes_up() const {
+    return bytes_up_.load(std::memory_order_relaxed) +
+           (udp_ ? udp_->bytes_up() : 0);
+  }
+  uint64_t bytes_down() const {
+    return bytes_down_.load(std::memory_order_relaxed) +
+           (udp_ ? udp_->bytes_down() : 0);
+  }
+  uint64_t active_flows() const {
+    return active_flows_.load(std::memory_order_relaxed) +
+           (udp_ ? udp_->active_sessions() : 0);
+  }
+
+ private:
+  struct TcpFlow;
+
+  // A packet waiting to be written to the TUN queue at the end of the
+  // current round. |owned| buffers go back to the pool once written. A
+  // nonzero |offload_mss| marks a TCP segment with a partial checksum for
+  // the kernel to finish and cut into segments of that size.
+  struct TxPacket {
+    const uint8_t* data;
+    size_t length;
+    uint8_t* owned;
+    uint16_t offload_mss;
+  };
+
+  // Sets up |ring_| on the worker thread, which io_uring then expects to
+  // be the only one using it. Returns false to stay on epoll.
+  bool SetUpRing();
+  void Run();
+  void ReadTun();
+  void HandleBatch(uint8_t** batch, const size_t* lengths,
+                   const VirtioNetHeader* offloads, size_t count);
+  // |parsed| is null for a packet whose headers did not parse.
+  void HandlePacket(uint8_t* buffer, const PacketInfo* parsed);
+  void HandleTcp(uint8_t* buffer, const PacketInfo& info);
+  void HandleDns(uint8_t* buffer, const PacketInfo& info);
+  void HandleUdp(uint8_t* buffer, const PacketInfo& info);
+  // Splits a UDP super-packet from the kernel into datagrams of
+  // |segment_size| bytes, each handled like a packet read on its own.
+  void SplitUdpSuperPacket(uint8_t* buffer, const PacketInfo& info,
+                           uint16_t segment_size);
+  // Takes up a proxy change from SetProxy().
+  void ApplyProxyChange();
+
+  void CreateFlow(const PacketInfo& info);
+  void OnSocketEvent(TcpFlow* flow, uint32_t events);
+  void AdvanceSocksHandshake(TcpFlow* flow, uint32_t events);
+  void ProcessAck(TcpFlow* flow, const PacketInfo& info);
+  // These return true when they kept |buffer| for later delivery.
+  bool ProcessData(TcpFlow* flow, uint8_t* buffer, const PacketInfo& info);
+  bool HoldOutOfOrder(TcpFlow* flow, uint8_t* buffer, uint32_t seq,
+                      const uint8_t* data, size_t length, bool fin);
+  bool Deliver(TcpFlow* flow, uint8_t* buffer, const uint8_t* data,
+               size_t length, bool fin);
+  void QueueAck(TcpFlow* flow);
+  void DrainToSocket(TcpFlow* flow);
+  void PumpSocketToTun(TcpFlow* flow);
+  void MaybeFinish(TcpFlow* flow);
+  void CloseFlow(TcpFlow* flow, bool reset);
+  void UpdateSocketInterest(TcpFlow* flow);
+  uint32_t ReceiveWindow(const TcpFlow* flow) const;
+
+  void SendSynAck(TcpFlow* flow);
+  void SendControl(TcpFlow* flow, uint8_t flags);
+  void SendResetFor(const PacketInfo& info);
+  void TransmitSegment(TcpFlow* flow, size_t index);
+  void EnterRecovery(TcpFlow* flow);
+  void ArmRetransmit(TcpFlow* flow, int64_t now_ms);
+
+  void QueueTx(const uint8_t* data, size_t length, uint8_t* owned,
+               uint16_t offload_mss);
+  void FlushTx();
+  void ReleaseLater(uint8_t* buffer);
+  // Arms the flow's timer for the earliest of its handshake, idle and
+  // retransmission deadlines.
+  void ScheduleFlowTimer(TcpFlow* flow);
+  void OnFlowTimer(TcpFlow* flow, int64_t now_ms);
+  void RunTimers(int64_t now_ms);
+  int NextTimeoutMs(int64_t now_ms) const;
+
+  int tun_fd_;
+  TunWorkerOptions options_;
+  PacketPool pool_;
+  int epoll_fd_ = -1;
+  int stop_fd_ = -1;
+  std::thread thread_;
+  // Null when the queue is served through epoll.
+  std::unique_ptr<TunRing> ring_;
+  std::string io_backend_ = "epoll";
+  std::mt19937 random_;
+  // Null when UDP relaying is off.
+  std::unique_ptr<UdpRelay> udp_;
+
+  FlowTable<std::unique_ptr<TcpFlow>> flows_;
+  std::vector<std::unique_ptr<TcpFlow>> closed_flows_;
+  // One timer per flow. Activity only moves |last_activity_ms|; a timer
+  // that fires early is simply pushed back.
+  TimerWheel timers_;
+  std::vector<TimerWheel::Timer*> expired_timers_;
+  // Flows that ran out of pool buffers, retried on housekeeping.
+  std::vector<TcpFlow*> starved_;
+  std::vector<TcpFlow*> ack_pending_;
+  std::vector<TxPacket> tx_queue_;
+  std::vector<uint8_t*> release_queue_;
+  int64_t next_timer_ms_ = 0;
+
+  // A proxy change from SetProxy(), applied by the worker thread before it
+  // opens its next proxy connection.
+  std::mutex proxy_mutex_;
+  std::string pending_proxy_host_;
+  uint16_t pending_proxy_port_ = 0;
+  std::atomic<bool> proxy_changed_{false};
+
+  std::atomic<uint64_t> bytes_up_{0};
+  std::atomic<uint64_t> bytes_down_{0};
+  std::atomic<uint64_t> active_flows_{0};
+};
+
+#endif  // RUNNER_TUN_WORKER_H_
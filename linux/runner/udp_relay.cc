@@ -0,0 +1,666 @@
+#include "udp_relay.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "log_ring.h"
+#include "net_util.h"
+#include "tun_offload.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace {
+
+constexpr int kMaxEvents = 64;
+
+// Datagrams held per association while its handshake is under way.
+constexpr size_t kMaxHeld = 64;
+// Buffers left to TCP and TUN reads when datagrams are held.
+constexpr size_t kPoolReserve = 64;
+
+// sendmmsg() batch limits. The kernel takes at most 64 segments per
+// UDP_SEGMENT send, and the segments must fit one IP datagram.
+constexpr unsigned kSendBatch = 64;
+constexpr size_t kMaxSendIovecs = 1024;
+constexpr size_t kMaxSegments = 64;
+constexpr size_t kMaxSegmentedBytes = 65000;
+
+// recvmmsg() slots. With GRO a slot can hold a whole coalesced train.
+constexpr unsigned kGroSlots = 8;
+constexpr size_t kGroSlotSize = 65536;
+constexpr unsigned kPlainSlots = 64;
+// Receive calls per readiness event, so one busy association cannot
+// starve the rest of the worker.
+constexpr int kMaxReceiveCalls = 4;
+
+constexpr int64_t kHandshakeTimeoutMs = 10000;
+constexpr int64_t kIdleTimeoutMs = 2 * 60 * 1000;
+constexpr int64_t kTimerTickMs = 16;
+
+// SOCKS5 greeting pipelined with a UDP ASSOCIATE request. The client's
+// address is not known until the relay answers, so it is left unspecified.
+const uint8_t kAssociateRequest[] = {0x05, 0x01, 0x00, 0x05, 0x03, 0x00,
+                                     0x01, 0,    0,    0,    0,    0,
+                                     0};
+
+// Fills |address| from a numeric |host|. Returns the address length, or 0
+// when |host| is not a numeric address.
+socklen_t ToSockaddr(const std::string& host, uint16_t port,
+                     struct sockaddr_storage* address) {
+  memset(address, 0, sizeof(*address));
+  auto* v4 = reinterpret_cast<struct sockaddr_in*>(address);
+  auto* v6 = reinterpret_cast<struct sockaddr_in6*>(address);
+  if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(port);
+    return sizeof(*v4);
+  }
+  if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(port);
+    return sizeof(*v6);
+  }
+  return 0;
+}
+
+bool IsZero(const uint8_t* bytes, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (bytes[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+enum class SessionState {
+  kConnecting,
+  kHandshake,
+  kReady,
+};
+
+struct UdpRelay::Session {
+  // Tells the two sockets of a session apart in the epoll set.
+  struct Tag {
+    Session* session;
+    bool relay;
+  };
+
+  // The client's socket; the remote half of the key is zero.
+  FlowKey key;
+  SessionState state = SessionState::kConnecting;
+  TimerWheel::Timer timer;
+  int control_fd = -1;
+  int relay_fd = -1;
+  Tag control_tag;
+  Tag relay_tag;
+  bool closed = false;
+  int64_t created_ms = 0;
+  int64_t last_activity_ms = 0;
+
+  struct sockaddr_storage proxy;
+  socklen_t proxy_length = 0;
+
+  uint8_t socks_reply[2 + 4 + 1 + 255 + 2];
+  size_t socks_received = 0;
+  size_t socks_expected = 7;
+
+  // Datagrams for the relay: held during the handshake, then sent at the
+  // end of each round.
+  std::vector<Outgoing> queued;
+};
+
+UdpRelay::UdpRelay(int tun_fd, bool vnet_header, PacketPool* pool, int mtu,
+                   size_t max_sessions)
+    : tun_fd_(tun_fd),
+      vnet_header_(vnet_header),
+      pool_(pool),
+      mtu_(mtu),
+      sessions_(max_sessions),
+      timers_(MonotonicNowMs(), kTimerTickMs) {}
+
+UdpRelay::~UdpRelay() {
+  sessions_.ForEach([this](const FlowKey&, std::unique_ptr<Session>& session) {
+    close(session->control_fd);
+    if (session->relay_fd >= 0) {
+      close(session->relay_fd);
+    }
+    for (const Outgoing& datagram : session->queued) {
+      pool_->Release(datagram.buffer);
+    }
+  });
+  sessions_.Clear();
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+bool UdpRelay::Init() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  return epoll_fd_ >= 0;
+}
+
+void UdpRelay::SetProxy(const std::string& host, uint16_t port) {
+  proxy_host_ = host;
+  proxy_port_ = port;
+}
+
+void UdpRelay::HandleDatagram(uint8_t* buffer, const PacketInfo& info) {
+  FlowKey key = FlowKey::FromPacket(info);
+  memset(key.remote, 0, sizeof(key.remote));
+  key.remote_port = 0;
+
+  Session* session = nullptr;
+  std::unique_ptr<Session>* found = sessions_.Find(key);
+  if (found != nullptr) {
+    session = found->get();
+  } else {
+    session = CreateSession(key);
+  }
+  bool ready = session != nullptr && session->state == SessionState::kReady;
+  if (session == nullptr ||
+      (!ready && (session->queued.size() >= kMaxHeld ||
+                  pool_->available() < kPoolReserve))) {
+    pool_->Release(buffer);
+    return;
+  }
+
+  // The SOCKS UDP request header takes the place of the IP and UDP
+  // headers, so the payload goes out of the packet buffer as it is. The
+  // destination is copied out first, as the header overwrites it.
+  size_t address_length = AddressLength(info.family);
+  uint8_t remote[16];
+  memcpy(remote, info.dst, address_length);
+  uint8_t* payload = buffer + info.payload_offset;
+  uint8_t* header = payload - (4 + address_length + 2);
+  header[0] = 0;
+  header[1] = 0;
+  header[2] = 0;
+  header[3] = info.family == AF_INET6 ? 0x04 : 0x01;
+  memcpy(header + 4, remote, address_length);
+  header[4 + address_length] = static_cast<uint8_t>(info.dst_port >> 8);
+  header[5 + address_length] = static_cast<uint8_t>(info.dst_port);
+
+  session->queued.push_back(
+      {buffer, header, static_cast<size_t>(payload - header) +
+                           info.payload_length});
+  session->last_activity_ms = MonotonicNowMs();
+  bytes_up_.fetch_add(info.payload_length, std::memory_order_relaxed);
+  if (ready && session->queued.size() == 1) {
+    dirty_.push_back(session);
+  }
+}
+
+UdpRelay::Session* UdpRelay::CreateSession(const FlowKey& key) {
+  if (sessions_.size() >= sessions_.max_flows()) {
+    return nullptr;
+  }
+  std::unique_ptr<Session> session(new Session());
+  session->key = key;
+  session->created_ms = session->last_activity_ms = MonotonicNowMs();
+  session->control_tag = {session.get(), false};
+  session->relay_tag = {session.get(), true};
+  session->proxy_length =
+      ToSockaddr(proxy_host_, proxy_port_, &session->proxy);
+  if (session->proxy_length == 0) {
+    return nullptr;
+  }
+
+  session->control_fd =
+      socket(session->proxy.ss_family,
+             SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (session->control_fd < 0) {
+    return nullptr;
+  }
+  if (connect(session->control_fd,
+              reinterpret_cast<struct sockaddr*>(&session->proxy),
+              session->proxy_length) != 0 &&
+      errno != EINPROGRESS) {
+    close(session->control_fd);
+    return nullptr;
+  }
+  struct epoll_event event = {};
+  event.events = EPOLLOUT;
+  event.data.ptr = &session->control_tag;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, session->control_fd, &event) != 0) {
+    close(session->control_fd);
+    return nullptr;
+  }
+
+  if (receive_area_.empty()) {
+    size_t slots = gro_ ? kGroSlots : kPlainSlots;
+    slot_size_ = gro_ ? kGroSlotSize
+                      : static_cast<size_t>(mtu_) + kPacketHeadroom;
+    receive_area_.resize(slots * (kPacketHeadroom + slot_size_));
+  }
+  session->timer.owner = session.get();
+  timers_.Schedule(&session->timer,
+                   session->created_ms + kHandshakeTimeoutMs);
+  active_sessions_.fetch_add(1, std::memory_order_relaxed);
+  Session* raw = session.get();
+  sessions_.Insert(key, std::move(session));
+  return raw;
+}
+
+void UdpRelay::Poll() {
+  struct epoll_event events[kMaxEvents];
+  int count = epoll_wait(epoll_fd_, events, kMaxEvents, 0);
+  for (int i = 0; i < count; i++) {
+    auto* tag = static_cast<Session::Tag*>(events[i].data.ptr);
+    Session* session = tag->session;
+    if (session->closed) {
+      continue;
+    }
+    if (tag->relay) {
+      ReceiveReplies(session);
+    } else {
+      OnControlEvent(session, events[i].events);
+    }
+  }
+}
+
+void UdpRelay::OnControlEvent(Session* session, uint32_t events) {
+  if (session->state != SessionState::kReady) {
+    if (!AdvanceHandshake(session, events)) {
+      CloseSession(session);
+    }
+    return;
+  }
+  // The association lasts as long as its TCP connection; the proxy has
+  // nothing more to say on it, so any event means it is going away.
+  CloseSession(session);
+}
+
+bool UdpRelay::AdvanceHandshake(Session* session, uint32_t events) {
+  if (session->state == SessionState::kConnecting) {
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    getsockopt(session->control_fd, SOL_SOCKET, SO_ERROR, &error,
+               &error_length);
+    if (error != 0 || (events & EPOLLERR) ||
+        send(session->control_fd, kAssociateRequest,
+             sizeof(kAssociateRequest),
+             MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(kAssociateRequest))) {
+      return false;
+    }
+    session->state = SessionState::kHandshake;
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &session->control_tag;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, session->control_fd,
+                     &event) == 0;
+  }
+
+  ssize_t received =
+      recv(session->control_fd, session->socks_reply + session->socks_received,
+           session->socks_expected - session->socks_received, 0);
+  if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return true;
+  }
+  if (received <= 0) {
+    return false;
+  }
+  session->socks_received += static_cast<size_t>(received);
+  const uint8_t* reply = session->socks_reply;
+  if (session->socks_received >= 2 && (reply[0] != 0x05 || reply[1] != 0x00)) {
+    return false;
+  }
+  if (session->socks_received >= 6 && (reply[2] != 0x05 || reply[3] != 0x00)) {
+    return false;
+  }
+  if (session->socks_received == 7 && session->socks_expected == 7) {
+    switch (reply[5]) {
+      case 0x01:
+        session->socks_expected = 6 + 4 + 2;
+        break;
+      case 0x04:
+        session->socks_expected = 6 + 16 + 2;
+        break;
+      case 0x03:
+        session->socks_expected = 6 + 1 + reply[6] + 2;
+        break;
+      default:
+        return false;
+    }
+  }
+  if (session->socks_received < session->socks_expected) {
+    return true;
+  }
+
+  if (!OpenRelaySocket(session)) {
+    return false;
+  }
+  struct epoll_event event = {};
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.ptr = &session->control_tag;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, session->control_fd, &event) != 0) {
+    return false;
+  }
+  session->state = SessionState::kReady;
+  if (!session->queued.empty()) {
+    dirty_.push_back(session);
+  }
+  return true;
+}
+
+bool UdpRelay::OpenRelaySocket(Session* session) {
+  // The relay's address comes with the reply. An unspecified or named one
+  // means the proxy's own address, on the port given.
+  const uint8_t* reply = session->socks_reply;
+  size_t port_offset = session->socks_expected - 2;
+  uint16_t port = static_cast<uint16_t>((reply[port_offset] << 8) |
+                                        reply[port_offset + 1]);
+  struct sockaddr_storage relay = session->proxy;
+  socklen_t relay_length = session->proxy_length;
+  if (reply[5] == 0x01 && !IsZero(reply + 6, 4)) {
+    auto* v4 = reinterpret_cast<struct sockaddr_in*>(&relay);
+    memset(&relay, 0, sizeof(relay));
+    v4->sin_family = AF_INET;
+    memcpy(&v4->sin_addr, reply + 6, 4);
+    relay_length = sizeof(*v4);
+  } else if (reply[5] == 0x04 && !IsZero(reply + 6, 16)) {
+    auto* v6 = reinterpret_cast<struct sockaddr_in6*>(&relay);
+    memset(&relay, 0, sizeof(relay));
+    v6->sin6_family = AF_INET6;
+    memcpy(&v6->sin6_addr, reply + 6, 16);
+    relay_length = sizeof(*v6);
+  }
+  if (relay.ss_family == AF_INET6) {
+    reinterpret_cast<struct sockaddr_in6*>(&relay)->sin6_port = htons(port);
+  } else {
+    reinterpret_cast<struct sockaddr_in*>(&relay)->sin_port = htons(port);
+  }
+
+  session->relay_fd =
+      socket(relay.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (session->relay_fd < 0) {
+    return false;
+  }
+  if (gro_) {
+    int one = 1;
+    if (setsockopt(session->relay_fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) !=
+        0) {
+      // Older kernels; the receive slots already in place are just larger
+      // than they need to be.
+      gro_ = false;
+      WriteLog(LogLevel::kInfo, "tun2socks",
+               "UDP_GRO unavailable; replies are received one by one");
+    }
+  }
+  if (connect(session->relay_fd, reinterpret_cast<struct sockaddr*>(&relay),
+              relay_length) != 0) {
+    return false;
+  }
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = &session->relay_tag;
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, session->relay_fd, &event) == 0;
+}
+
+void UdpRelay::ReceiveReplies(Session* session) {
+  const size_t stride = kPacketHeadroom + slot_size_;
+  const unsigned slots =
+      static_cast<unsigned>(receive_area_.size() / stride);
+  struct mmsghdr messages[kPlainSlots];
+  struct iovec iov[kPlainSlots];
+  alignas(struct cmsghdr) uint8_t control[kPlainSlots][CMSG_SPACE(
+      sizeof(int))];
+
+  for (int call = 0; call < kMaxReceiveCalls; call++) {
+    memset(messages, 0, sizeof(messages[0]) * slots);
+    for (unsigned i = 0; i < slots; i++) {
+      iov[i].iov_base = receive_area_.data() + i * stride + kPacketHeadroom;
+      iov[i].iov_len = slot_size_;
+      messages[i].msg_hdr.msg_iov = &iov[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+      messages[i].msg_hdr.msg_control = control[i];
+      messages[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+    int count = recvmmsg(session->relay_fd, messages, slots, MSG_DONTWAIT,
+                         nullptr);
+    if (count < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+          errno != ECONNREFUSED) {
+        CloseSession(session);
+      }
+      return;
+    }
+    session->last_activity_ms = MonotonicNowMs();
+
+    for (int i = 0; i < count; i++) {
+      const struct msghdr& header = messages[i].msg_hdr;
+      if (header.msg_flags & MSG_TRUNC) {
+        continue;
+      }
+      size_t length = messages[i].msg_len;
+      size_t segment = length;
+      for (struct cmsghdr* cmsg =
+               CMSG_FIRSTHDR(const_cast<struct msghdr*>(&header));
+           cmsg != nullptr;
+           cmsg = CMSG_NXTHDR(const_cast<struct msghdr*>(&header), cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+          int size = 0;
+          memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+          if (size > 0) {
+            segment = static_cast<size_t>(size);
+          }
+        }
+      }
+      // Coalesced datagrams are delivered in order, each writing its
+      // headers over the tail of the one before it, which is already out.
+      auto* base = static_cast<uint8_t*>(iov[i].iov_base);
+      for (size_t offset = 0; offset < length; offset += segment) {
+        DeliverReply(session, base + offset,
+                     std::min(segment, length - offset));
+      }
+    }
+    if (static_cast<unsigned>(count) < slots) {
+      return;
+    }
+  }
+}
+
+void UdpRelay::DeliverReply(Session* session, uint8_t* datagram,
+                            size_t length) {
+  // RSV, FRAG and ATYP; fragmented datagrams are not reassembled.
+  if (length < 4 || datagram[0] != 0 || datagram[1] != 0 ||
+      datagram[2] != 0) {
+    return;
+  }
+  int family;
+  if (datagram[3] == 0x01) {
+    family = AF_INET;
+  } else if (datagram[3] == 0x04) {
+    family = AF_INET6;
+  } else {
+    return;
+  }
+  if (family != session->key.family) {
+    return;
+  }
+  size_t address_length = AddressLength(family);
+  size_t header_length = 4 + address_length + 2;
+  size_t headers = (family == AF_INET6 ? kIpv6HeaderSize : kIpv4HeaderSize) +
+                   kUdpHeaderSize;
+  if (length < header_length ||
+      length - header_length + headers > static_cast<size_t>(mtu_)) {
+    return;
+  }
+
+  // Copied out, as the IP and UDP headers are written over them.
+  uint8_t remote[16];
+  memcpy(remote, datagram + 4, address_length);
+  uint16_t remote_port =
+      static_cast<uint16_t>((datagram[4 + address_length] << 8) |
+                            datagram[5 + address_length]);
+  UdpDatagramSpec spec;
+  spec.family = family;
+  spec.src = remote;
+  spec.dst = session->key.client;
+  spec.src_port = remote_port;
+  spec.dst_port = session->key.client_port;
+  size_t payload_length = length - header_length;
+  size_t packet_length = 0;
+  uint8_t* packet = WriteUdpHeaders(datagram + header_length, payload_length,
+                                    spec, &packet_length);
+  VirtioNetHeader none = {};
+  if (WriteTunPacket(tun_fd_, vnet_header_ ? &none : nullptr, packet,
+                     packet_length) < 0) {
+    // Dropped like any lost datagram.
+    return;
+  }
+  bytes_down_.fetch_add(payload_length, std::memory_order_relaxed);
+}
+
+void UdpRelay::Flush() {
+  for (Session* session : dirty_) {
+    if (!session->closed) {
+      SendQueued(session);
+    }
+  }
+  dirty_.clear();
+  closed_sessions_.clear();
+}
+
+void UdpRelay::SendQueued(Session* session) {
+  std::vector<Outgoing>& queued = session->queued;
+  struct mmsghdr messages[kSendBatch];
+  struct iovec iov[kMaxSendIovecs];
+  alignas(struct cmsghdr) uint8_t control[kSendBatch][CMSG_SPACE(
+      sizeof(uint16_t))];
+  // Index into |queued| of the first datagram of each message.
+  size_t first[kSendBatch + 1];
+
+  bool segment = gso_;
+  size_t index = 0;
+  while (index < queued.size()) {
+    memset(messages, 0, sizeof(messages));
+    unsigned count = 0;
+    size_t iov_count = 0;
+    size_t next = index;
+    while (next < queued.size() && count < kSendBatch &&
+           iov_count < kMaxSendIovecs) {
+      // A run of equally sized datagrams, where the last may be shorter,
+      // goes out as one segmented send.
+      size_t size = queued[next].length;
+      size_t run = 1;
+      while (segment && next + run < queued.size() && run < kMaxSegments &&
+             iov_count + run < kMaxSendIovecs &&
+             (run + 1) * size <= kMaxSegmentedBytes &&
+             queued[next + run - 1].length == size &&
+             queued[next + run].length <= size) {
+        run++;
+      }
+      struct msghdr* header = &messages[count].msg_hdr;
+      header->msg_iov = &iov[iov_count];
+      header->msg_iovlen = run;
+      for (size_t i = 0; i < run; i++) {
+        iov[iov_count].iov_base = const_cast<uint8_t*>(queued[next + i].data);
+        iov[iov_count].iov_len = queued[next + i].length;
+        iov_count++;
+      }
+      if (run > 1) {
+        header->msg_control = control[count];
+        header->msg_controllen = sizeof(control[count]);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(header);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t segment_size = static_cast<uint16_t>(size);
+        memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+      }
+      first[count++] = next;
+      next += run;
+    }
+    first[count] = next;
+
+    int sent = sendmmsg(session->relay_fd, messages, count, MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (segment && (errno == EIO || errno == EINVAL)) {
+        // EIO: the route's device cannot checksum segmented sends, so
+        // segmentation is off from now on. EINVAL: a run did not fit the
+        // path MTU. Either way this batch goes again unsegmented.
+        if (errno == EIO) {
+          gso_ = false;
+          WriteLog(LogLevel::kInfo, "tun2socks",
+                   "UDP_SEGMENT unavailable; datagrams are sent one by one");
+        }
+        segment = false;
+        continue;
+      }
+      // A full socket buffer drops the rest, as the network would.
+      break;
+    }
+    index = first[sent];
+  }
+
+  for (const Outgoing& datagram : queued) {
+    pool_->Release(datagram.buffer);
+  }
+  queued.clear();
+}
+
+void UdpRelay::CloseSession(Session* session) {
+  if (session->closed) {
+    return;
+  }
+  session->closed = true;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, session->control_fd, nullptr);
+  close(session->control_fd);
+  if (session->relay_fd >= 0) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, session->relay_fd, nullptr);
+    close(session->relay_fd);
+  }
+  for (const Outgoing& datagram : session->queued) {
+    pool_->Release(datagram.buffer);
+  }
+  session->queued.clear();
+  timers_.Cancel(&session->timer);
+  active_sessions_.fetch_sub(1, std::memory_order_relaxed);
+
+  // Freed at the end of the round; the session may still be referenced
+  // by this round's events.
+  std::unique_ptr<Session>* found = sessions_.Find(session->key);
+  closed_sessions_.push_back(std::move(*found));
+  sessions_.Erase(session->key);
+}
+
+void UdpRelay::RunTimers(int64_t now_ms) {
+  expired_timers_.clear();
+  timers_.Advance(now_ms, &expired_timers_);
+  for (TimerWheel::Timer* timer : expired_timers_) {
+    Session* session = static_cast<Session*>(timer->owner);
+    bool handshaking = session->state != SessionState::kReady;
+    if ((handshaking && now_ms - session->created_ms > kHandshakeTimeoutMs) ||
+        now_ms - session->last_activity_ms > kIdleTimeoutMs) {
+      CloseSession(session);
+      continue;
+    }
+    // Traffic since the timer was set; wait out the rest of the idle time.
+    int64_t deadline = session->last_activity_ms + kIdleTimeoutMs;
+    if (handshaking) {
+      deadline = std::min(deadline, session->created_ms + kHandshakeTimeoutMs);
+    }
+    timers_.Schedule(&session->timer, deadline);
+  }
+}
@@ -0,0 +1,123 @@
+#ifndef RUNNER_UDP_RELAY_H_
+#define RUNNER_UDP_RELAY_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flow_key.h"
+#include "flow_table.h"
+#include "packet_headers.h"
+#include "packet_pool.h"
+#include "timer_wheel.h"
+
+// Relays the UDP datagrams arriving on one TUN queue through SOCKS5 UDP
+// ASSOCIATE. Each client socket gets one association, which carries its
+// datagrams to every remote; replies from any remote are routed back to it.
+// Owned by a TunWorker and only used on its thread.
+//
+// Datagrams are batched per round: the ones a round read from the queue
+// are sent with a single sendmmsg() per association at the end of the
+// round, runs of equally sized datagrams going out as one UDP_SEGMENT (GSO)
+// send. Replies are received with recvmmsg() on sockets with UDP_GRO, so
+// one call picks up many coalesced datagrams; they are split, given their
+// IP and UDP headers in place and written to the queue.
+class UdpRelay {
+ public:
+  // |pool| supplies the buffers of datagrams read from the queue at
+  // |tun_fd|; both outlive the relay. |vnet_header| says whether the queue
+  // takes a virtio-net header on every packet. At most |max_sessions|
+  // associations are open at once; datagrams of further clients are
+  // dropped.
+  UdpRelay(int tun_fd, bool vnet_header, PacketPool* pool, int mtu,
+           size_t max_sessions);
+  ~UdpRelay();
+
+  // Prevent copying.
+  UdpRelay(UdpRelay const&) = delete;
+  UdpRelay& operator=(UdpRelay const&) = delete;
+
+  // Creates the relay's epoll set. Returns false on failure.
+  bool Init();
+
+  // Becomes readable when an association has work; the owner calls Poll()
+  // then.
+  int fd() const { return epoll_fd_; }
+
+  // New associations go to the SOCKS proxy at |host|:|port|.
+  void SetProxy(const std::string& host, uint16_t port);
+
+  // Takes |buffer|, a UDP packet described by |info|, and queues its
+  // payload for the client's association, opening one if needed.
+  void HandleDatagram(uint8_t* buffer, const PacketInfo& info);
+
+  // Serves the associations that have events.
+  void Poll();
+
+  // Sends the datagrams queued this round and frees closed associations.
+  void Flush();
+
+  // Expires idle associations and stalled handshakes.
+  void RunTimers(int64_t now_ms);
+
+  uint64_t bytes_up() const {
+    return bytes_up_.load(std::memory_order_relaxed);
+  }
+  uint64_t bytes_down() const {
+    return bytes_down_.load(std::memory_order_relaxed);
+  }
+  uint64_t active_sessions() const {
+    return active_sessions_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Session;
+
+  // A datagram whose payload sits in |buffer|, behind its SOCKS header.
+  struct Outgoing {
+    uint8_t* buffer;
+    const uint8_t* data;
+    size_t length;
+  };
+
+  Session* CreateSession(const FlowKey& key);
+  void OnControlEvent(Session* session, uint32_t events);
+  bool AdvanceHandshake(Session* session, uint32_t events);
+  bool OpenRelaySocket(Session* session);
+  void ReceiveReplies(Session* session);
+  void DeliverReply(Session* session, uint8_t* datagram, size_t length);
+  void SendQueued(Session* session);
+  void CloseSession(Session* session);
+
+  int tun_fd_;
+  bool vnet_header_;
+  PacketPool* pool_;
+  int mtu_;
+  int epoll_fd_ = -1;
+  std::string proxy_host_ = "127.0.0.1";
+  uint16_t proxy_port_ = 0;
+  // Cleared for good once the kernel refuses a segmented send.
+  bool gso_ = true;
+  bool gro_ = true;
+
+  FlowTable<std::unique_ptr<Session>> sessions_;
+  std::vector<std::unique_ptr<Session>> closed_sessions_;
+  // Idle and handshake expiry, one timer per association.
+  TimerWheel timers_;
+  std::vector<TimerWheel::Timer*> expired_timers_;
+  // Associations with datagrams queued this round.
+  std::vector<Session*> dirty_;
+  // recvmmsg() slots, each preceded by header room; allocated with the
+  // first association.
+  std::vector<uint8_t> receive_area_;
+  size_t slot_size_ = 0;
+
+  std::atomic<uint64_t> bytes_up_{0};
+  std::atomic<uint64_t> bytes_down_{0};
+  std::atomic<uint64_t> active_sessions_{0};
+};
+
+#endif  // RUNNER_UDP_RELAY_H_
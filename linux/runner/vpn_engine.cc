@@ -0,0 +1,882 @@
+#include "vpn_engine.h"
+
+#include <unistd.h>
+
+#include <cstdlib>
+
+#include "log_ring.h"
+#include "net_util.h"
+#include "subscription.h"
+
+const char* VpnStatusName(VpnStatus status) {
+  switch (status) {
+    case VpnStatus::kConnecting:
+      return "connecting";
+    case VpnStatus::kConnected:
+      return "connected";
+    case VpnStatus::kDisconnecting:
+      return "disconnecting";
+    case VpnStatus::kDisconnected:
+      break;
+  }
+  return "disconnected";
+}
+
+VpnEngineOptions VpnEngineOptions::FromEnvironment() {
+  VpnEngineOptions options;
+  if (const char* port = getenv("MIMIVPN_SOCKS_PORT")) {
+    int value = atoi(port);
+    if (value > 0 && value < 65536) {
+      options.socks_port = static_cast<uint16_t>(value);
+    }
+  }
+  if (const char* host = getenv("MIMIVPN_PING_HOST")) {
+    options.ping_host = host;
+  }
+  if (const char* interval = getenv("MIMIVPN_PING_INTERVAL_MS")) {
+    int value = atoi(interval);
+    if (value >= 0) {
+      options.latency_interval_ms = value;
+    }
+  }
+  if (const char* ports = getenv("MIMIVPN_FAILOVER_PORTS")) {
+    std::string list = ports;
+    size_t start = 0;
+    while (start < list.size()) {
+      size_t end = list.find(',', start);
+      if (end == std::string::npos) {
+        end = list.size();
+      }
+      int value = atoi(list.substr(start, end - start).c_str());
+      if (value > 0 && value < 65536) {
+        FailoverCandidate candidate;
+        candidate.label = "port " + std::to_string(value);
+        candidate.socks_host = options.socks_host;
+        candidate.socks_port = static_cast<uint16_t>(value);
+        options.failover_candidates.push_back(candidate);
+      }
+      start = end + 1;
+    }
+  }
+  if (const char* port = getenv("MIMIVPN_PROXY_PORT")) {
+    int value = atoi(port);
+    if (value > 0 && value < 65536) {
+      options.local_proxy.port = static_cast<uint16_t>(value);
+    }
+  }
+  if (const char* standin = getenv("MIMIVPN_SOCKS_STANDIN")) {
+    options.use_socks_standin = standin[0] == '1';
+  }
+  if (const char* no_routes = getenv("MIMIVPN_TUN_NO_ROUTES")) {
+    options.tun_default_routes = no_routes[0] != '1';
+  }
+  if (const char* udp = getenv("MIMIVPN_TUN_UDP")) {
+    options.tun_udp_relay = udp[0] != '0';
+  }
+  if (const char* offload = getenv("MIMIVPN_TUN_OFFLOAD")) {
+    options.tun_offload = offload[0] != '0';
+  }
+  if (const char* io_uring = getenv("MIMIVPN_TUN_IO_URING")) {
+    options.tun_io_uring = io_uring[0] != '0';
+  }
+  if (const char* server = getenv("MIMIVPN_DNS_SERVER")) {
+    options.dns.server_host = server;
+  }
+  if (const char* forwarder = getenv("MIMIVPN_DNS_FORWARDER")) {
+    options.dns_forwarder = forwarder[0] != '0';
+  }
+  if (const char* host = getenv("MIMIVPN_SPEEDTEST_HOST")) {
+    options.speed_test.host = host;
+  }
+  if (const char* port = getenv("MIMIVPN_SPEEDTEST_PORT")) {
+    int value = atoi(port);
+    if (value > 0 && value < 65536) {
+      options.speed_test.port = static_cast<uint16_t>(value);
+    }
+  }
+  if (const char* streams = getenv("MIMIVPN_SPEEDTEST_STREAMS")) {
+    int value = atoi(streams);
+    if (value > 0) {
+      options.speed_test.streams = value;
+    }
+  }
+  if (const char* loopback = getenv("MIMIVPN_SPEEDTEST_LOOPBACK")) {
+    options.use_speed_test_server = loopback[0] == '1';
+  }
+  if (const char* watcher = getenv("MIMIVPN_NETWORK_WATCHER")) {
+    options.network_watcher = watcher[0] != '0';
+  }
+  return options;
+}
+
+VpnEngine::VpnEngine(const VpnEngineOptions& options,
+                     ProgressCallback progress, LatencyCallback on_latency,
+                     NetworkCallback on_network)
+    : options_(options),
+      progress_(std::move(progress)),
+      on_latency_(std::move(on_latency)),
+      on_network_(std::move(on_network)),
+      upstream_host_(options.socks_host),
+      upstream_port_(options.socks_port),
+      failover_candidates_(options.failover_candidates),
+      probe_thread_("vpn-probe"),
+      speed_test_thread_("vpn-speedtest"),
+      control_thread_("vpn-control") {
+  if (!options_.tls_session_path.empty()) {
+    tls_sessions_.reset(new TlsSessionCache());
+    tls_sessions_->Open(options_.tls_session_path);
+  }
+  if (options_.network_watcher) {
+    NetworkWatcherOptions watcher_options;
+    watcher_options.ignored_interfaces.push_back(
+        Tun2SocksOptions().device_name);
+    network_watcher_.reset(
+        new NetworkWatcher(watcher_options, [this](const NetworkState& state) {
+          control_thread_.Post([this, state] {
+            Rebind(state);
+            if (on_network_) {
+              on_network_(state);
+            }
+          });
+        }));
+    if (!network_watcher_->Start()) {
+      WriteLog(LogLevel::kWarning, "vpn",
+               "Network watcher unavailable; relying on Dart's checks");
+      network_watcher_.reset();
+    }
+  }
+}
+
+VpnEngine::~VpnEngine() {
+  // Stopped first so no change is posted to the stopping control thread.
+  network_watcher_.reset();
+  CancelProbe();
+  CancelSpeedTest();
+  probe_thread_.Stop();
+  speed_test_thread_.Stop();
+  speed_test_server_.reset();
+  control_thread_.Stop();
+  TearDown();
+}
+
+void VpnEngine::Connect(std::function<void(bool)> done) {
+  control_thread_.Post([this, done] { done(BringUp()); });
+}
+
+void VpnEngine::SetFailoverCandidates(
+    std::vector<FailoverCandidate> candidates) {
+  auto shared_candidates =
+      std::make_shared<std::vector<FailoverCandidate>>(std::move(candidates));
+  control_thread_.Post([this, shared_candidates] {
+    failover_candidates_ = std::move(*shared_candidates);
+    if (status() == VpnStatus::kConnected) {
+      StopFailover();
+      StartFailover();
+    }
+  });
+}
+
+void VpnEngine::Disconnect(std::function<void(bool)> done) {
+  control_thread_.Post([this, done] {
+    TearDown();
+    done(true);
+  });
+}
+
+void VpnEngine::StartVpn(const std::string& flow_line,
+                         const std::string& pattern,
+                         std::function<void(const std::string&)> done) {
+  // The attempt runs asynchronously; like the core on other platforms the
+  // call itself returns as soon as the attempt is queued.
+  {
+    std::lock_guard<std::mutex> lock(flow_line_mutex_);
+    flow_line_ = flow_line;
+  }
+  auto shared_flow_line = std::make_shared<std::string>(flow_line);
+  control_thread_.Post([this, shared_flow_line, pattern] {
+    session_label_ = pattern.empty() ? "auto" : pattern;
+    ParsedSubscription flow = ParseSubscription(*shared_flow_line);
+    size_t chosen = 0;
+    for (size_t i = 0; i < flow.configs.size(); i++) {
+      if (!pattern.empty() && flow.View(flow.configs[i].name) == pattern) {
+        chosen = i;
+        break;
+      }
+    }
+    if (flow.configs.empty()) {
+      server_host_.clear();
+      Progress("[WARN] The flow line holds no usable share link");
+      Emit(ProgressEventType::kConfigCount, 1);
+      Emit(ProgressEventType::kConfigIndex, 1);
+    } else {
+      const SubscriptionConfig& config = flow.configs[chosen];
+      server_host_ = std::string(flow.View(config.host));
+      Emit(ProgressEventType::kConfigCount,
+           static_cast<int32_t>(flow.configs.size()));
+      Emit(ProgressEventType::kConfigIndex, static_cast<int32_t>(chosen) + 1);
+    }
+    if (upstream_host_ == options_.socks_host &&
+        upstream_port_ == options_.socks_port) {
+      upstream_server_ = server_host_;
+    }
+    Emit(ProgressEventType::kConfigLabel, 0, session_label_);
+    Emit(BringUp() ? ProgressEventType::kConnected
+                   : ProgressEventType::kFailed);
+  });
+  done("VPN started successfully");
+}
+
+std::string VpnEngine::flow_line() const {
+  std::lock_guard<std::mutex> lock(flow_line_mutex_);
+  return flow_line_;
+}
+
+void VpnEngine::StopVpn(std::function<void(const std::string&)> done) {
+  control_thread_.Post([this, done] {
+    TearDown();
+    done("VPN_STOPPED");
+  });
+}
+
+void VpnEngine::CalculatePing(std::function<void(int64_t)> done) {
+  {
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    if (latency_monitor_) {
+      LatencySnapshot snapshot = latency_monitor_->Snapshot();
+      // A probe counts as recent while the next one is not overdue.
+      int64_t max_age_ms =
+          options_.latency_interval_ms + options_.connect_timeout_ms;
+      if (snapshot.updated_ms > 0 &&
+          MonotonicNowMs() - snapshot.updated_ms <= max_age_ms) {
+        done(snapshot.last_ok ? snapshot.last_rtt_ms : 0);
+        return;
+      }
+    }
+  }
+  control_thread_.Post([this, done] { done(MeasurePing()); });
+}
+
+LatencySnapshot VpnEngine::latency() const {
+  std::lock_guard<std::mutex> lock(latency_mutex_);
+  return latency_monitor_ ? latency_monitor_->Snapshot() : LatencySnapshot();
+}
+
+void VpnEngine::StartTun2Socks(std::function<void(bool)> done) {
+  control_thread_.Post([this, done] {
+    if (tun2socks_) {
+      done(true);
+      return;
+    }
+    Tun2SocksOptions tun_options;
+    tun_options.socks_host = upstream_host_;
+    tun_options.socks_port = upstream_port_;
+    tun_options.add_default_routes = options_.tun_default_routes;
+    tun_options.server_host = upstream_server_;
+    tun_options.relay_udp = options_.tun_udp_relay;
+    tun_options.offload = options_.tun_offload;
+    tun_options.io_uring = options_.tun_io_uring;
+    tun_options.dns_forwarder = options_.dns_forwarder;
+    tun_options.dns = options_.dns;
+    std::unique_ptr<Tun2Socks> tun2socks(new Tun2Socks(tun_options));
+    if (!tun2socks->Start()) {
+      Progress("[ERROR] Could not create TUN device " +
+               tun_options.device_name);
+      done(false);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(tun_mutex_);
+      tun2socks_ = std::move(tun2socks);
+    }
+    ApplySplitTunnel();
+    Progress("[INFO] Routing through " + tun_options.device_name);
+    done(true);
+  });
+}
+
+DnsForwarderStats VpnEngine::dns_stats() const {
+  std::lock_guard<std::mutex> lock(tun_mutex_);
+  return tun2socks_ ? tun2socks_->dns_stats() : DnsForwarderStats();
+}
+
+void VpnEngine::StopTun2Socks(std::function<void()> done) {
+  control_thread_.Post([this, done] {
+    ResetTun2Socks();
+    done();
+  });
+}
+
+void VpnEngine::StartLocalProxy(uint16_t port,
+                                std::function<void(uint16_t)> done) {
+  control_thread_.Post([this, port, done] {
+    if (local_proxy_) {
+      done(local_proxy_->port());
+      return;
+    }
+    LocalProxyOptions proxy_options = options_.local_proxy;
+    if (port != 0) {
+      proxy_options.port = port;
+    }
+    proxy_options.socks_host = upstream_host_;
+    proxy_options.socks_port = upstream_port_;
+    std::unique_ptr<LocalProxy> proxy(new LocalProxy(proxy_options));
+    if (!proxy->Start()) {
+      Progress("[ERROR] Could not open the local proxy on port " +
+               std::to_string(proxy_options.port));
+      done(0);
+      return;
+    }
+    local_proxy_ = std::move(proxy);
+    Progress("[INFO] Local proxy on " + proxy_options.listen_host + ":" +
+             std::to_string(local_proxy_->port()));
+    done(local_proxy_->port());
+  });
+}
+
+void VpnEngine::StopLocalProxy(std::function<void()> done) {
+  control_thread_.Post([this, done] {
+    local_proxy_.reset();
+    done();
+  });
+}
+
+void VpnEngine::SetSplitTunnel(bool enabled, std::vector<std::string> apps) {
+  auto shared_apps =
+      std::make_shared<std::vector<std::string>>(std::move(apps));
+  control_thread_.Post([this, enabled, shared_apps] {
+    split_enabled_ = enabled;
+    split_apps_ = std::move(*shared_apps);
+    ApplySplitTunnel();
+  });
+}
+
+void VpnEngine::ProbeConfigs(
+    std::vector<ProbeTarget> targets, const ConfigProberOptions& options,
+    ConfigProber::ResultCallback on_result,
+    std::function<void(const std::vector<ProbeResult>&)> done) {
+  uint64_t generation = ++probe_generation_;
+  CancelProbe();
+  auto shared_targets =
+      std::make_shared<std::vector<ProbeTarget>>(std::move(targets));
+  probe_thread_.Post([this, generation, shared_targets, options, on_result,
+                      done] {
+    ConfigProberOptions run_options = options;
+    run_options.session_cache = tls_sessions_.get();
+    ConfigProber prober(run_options);
+    {
+      // Checked under the lock so a newer call either sees this run and
+      // cancels it, or this run sees the newer call and never starts.
+      std::lock_guard<std::mutex> lock(probe_mutex_);
+      if (generation != probe_generation_.load()) {
+        done(std::vector<ProbeResult>());
+        return;
+      }
+      active_prober_ = &prober;
+    }
+    std::vector<ProbeResult> healthy = prober.Run(
+        *shared_targets, [this, shared_targets,
+                          &on_result](const ProbeResult& result) {
+          if (result.ok && (*shared_targets)[result.index].tls) {
+            std::lock_guard<std::mutex> lock(tls_stats_mutex_);
+            double ms = static_cast<double>(result.latency_ms);
+            if (result.resumed) {
+              tls_stats_.resumed_ms.Add(ms);
+            } else {
+              tls_stats_.full_ms.Add(ms);
+            }
+            tls_stats_.fast_open += result.fast_open ? 1 : 0;
+          }
+          if (on_result) {
+            on_result(result);
+          }
+        });
+    done(healthy);
+    // Tickets the servers issue after the handshake are collected once the
+    // caller has its answer, still cancellable by the next run.
+    prober.AwaitSessionTickets();
+    {
+      std::lock_guard<std::mutex> lock(probe_mutex_);
+      active_prober_ = nullptr;
+    }
+    if (tls_sessions_) {
+      tls_sessions_->Save();
+    }
+  });
+}
+
+void VpnEngine::CancelProbe() {
+  std::lock_guard<std::mutex> lock(probe_mutex_);
+  if (active_prober_ != nullptr) {
+    active_prober_->Cancel();
+  }
+}
+
+TlsHandshakeStats VpnEngine::tls_stats() const {
+  std::lock_guard<std::mutex> lock(tls_stats_mutex_);
+  TlsHandshakeStats stats = tls_stats_;
+  stats.cached_sessions = tls_sessions_ ? tls_sessions_->size() : 0;
+  return stats;
+}
+
+void VpnEngine::RecordReconnect(double ms) {
+  std::lock_guard<std::mutex> lock(tls_stats_mutex_);
+  tls_stats_.reconnect_ms.Add(ms);
+}
+
+NetworkState VpnEngine::network_state() const {
+  if (network_watcher_) {
+    return network_watcher_->state();
+  }
+  return NetworkWatcher::Read({Tun2SocksOptions().device_name});
+}
+
+void VpnEngine::MeasureThroughput(
+    SpeedTestDirection direction, int64_t bytes, int count,
+    SpeedTest::ProgressCallback on_progress,
+    std::function<void(const std::vector<SpeedSample>&)> done) {
+  uint64_t generation = ++speed_test_generation_;
+  CancelSpeedTest();
+  speed_test_thread_.Post([this, generation, direction, bytes, count,
+                           on_progress, done] {
+    SpeedTestOptions test_options = options_.speed_test;
+    if (!PrepareSpeedTest(&test_options)) {
+      done(std::vector<SpeedSample>());
+      return;
+    }
+
+    SpeedTest test(test_options);
+    {
+      std::lock_guard<std::mutex> lock(speed_test_mutex_);
+      if (generation != speed_test_generation_.load()) {
+        done(std::vector<SpeedSample>());
+        return;
+      }
+      active_speed_test_ = &test;
+    }
+    std::vector<SpeedSample> samples =
+        test.Run(direction, bytes, count, on_progress);
+    {
+      std::lock_guard<std::mutex> lock(speed_test_mutex_);
+      active_speed_test_ = nullptr;
+    }
+    done(samples);
+  });
+}
+
+void VpnEngine::MeasureResponsiveness(
+    const ResponsivenessOptions& responsiveness,
+    SpeedTest::ProgressCallback on_progress,
+    std::function<void(const ResponsivenessResult&)> done) {
+  uint64_t generation = ++speed_test_generation_;
+  CancelSpeedTest();
+  speed_test_thread_.Post([this, generation, responsiveness, on_progress,
+                           done] {
+    SpeedTestOptions test_options = options_.speed_test;
+    if (!PrepareSpeedTest(&test_options)) {
+      done(ResponsivenessResult());
+      return;
+    }
+
+    ResponsivenessTest test(test_options, responsiveness);
+    {
+      std::lock_guard<std::mutex> lock(speed_test_mutex_);
+      if (generation != speed_test_generation_.load()) {
+        done(ResponsivenessResult());
+        return;
+      }
+      active_responsiveness_test_ = &test;
+    }
+    ResponsivenessResult result = test.Run(on_progress);
+    {
+      std::lock_guard<std::mutex> lock(speed_test_mutex_);
+      active_responsiveness_test_ = nullptr;
+    }
+    done(result);
+  });
+}
+
+void VpnEngine::CancelSpeedTest() {
+  std::lock_guard<std::mutex> lock(speed_test_mutex_);
+  if (active_speed_test_ != nullptr) {
+    active_speed_test_->Cancel();
+  }
+  if (active_responsiveness_test_ != nullptr) {
+    active_responsiveness_test_->Cancel();
+  }
+}
+
+bool VpnEngine::PrepareSpeedTest(SpeedTestOptions* test_options) {
+  if (!options_.use_speed_test_server) {
+    return true;
+  }
+  if (!speed_test_server_) {
+    speed_test_server_.reset(new SpeedTestServer());
+    if (!speed_test_server_->Start(0)) {
+      Progress("[ERROR] Could not start the loopback speed test server");
+      speed_test_server_.reset();
+      return false;
+    }
+  }
+  test_options->host = "127.0.0.1";
+  test_options->port = speed_test_server_->port();
+  return true;
+}
+
+bool VpnEngine::IsTunnelRunning() const {
+  VpnStatus current = status();
+  return current == VpnStatus::kConnected ||
+         current == VpnStatus::kConnecting;
+}
+
+bool VpnEngine::IsPrepared() const {
+  return access("/dev/net/tun", R_OK | W_OK) == 0;
+}
+
+bool VpnEngine::BringUp() {
+  if (status() == VpnStatus::kConnected) {
+    return true;
+  }
+  SetStatus(VpnStatus::kConnecting);
+
+  if (options_.use_socks_standin && !standin_) {
+    standin_.reset(new SocksStandIn());
+    if (!standin_->Start(options_.socks_port)) {
+      Progress("[ERROR] SOCKS stand-in could not bind port " +
+               std::to_string(options_.socks_port));
+      standin_.reset();
+      SetStatus(VpnStatus::kDisconnected);
+      return false;
+    }
+    Progress("[INFO] SOCKS stand-in listening on 127.0.0.1:" +
+             std::to_string(standin_->port()));
+  }
+
+  // The session counts as up once the proxy relays a connection.
+  if (MeasurePing() <= 0) {
+    TearDown();
+    return false;
+  }
+  SetStatus(VpnStatus::kConnected);
+  StartLatencyMonitor();
+  StartFailover();
+  return true;
+}
+
+void VpnEngine::TearDown() {
+  if (status() == VpnStatus::kDisconnected && !standin_ && !tun2socks_ &&
+      !local_proxy_) {
+    return;
+  }
+  SetStatus(VpnStatus::kDisconnecting);
+  StopFailover();
+  StopLatencyMonitor();
+  // The device goes first so no new flows reach a proxy that is going away.
+  ResetTun2Socks();
+  local_proxy_.reset();
+  upstream_host_ = options_.socks_host;
+  upstream_port_ = options_.socks_port;
+  upstream_server_ = server_host_;
+  if (standin_) {
+    standin_->Stop();
+    standin_.reset();
+  }
+  SetStatus(VpnStatus::kDisconnected);
+}
+
+int64_t VpnEngine::MeasurePing() {
+  int64_t start = MonotonicNowNs();
+  int fd = ConnectTcp(upstream_host_, upstream_port_,
+                      options_.connect_timeout_ms);
+  if (fd < 0) {
+    return 0;
+  }
+  bool ok = Socks5Connect(fd, options_.ping_host, options_.ping_port,
+                          options_.connect_timeout_ms);
+  int64_t elapsed_ms = (MonotonicNowNs() - start + 999999) / 1000000;
+  close(fd);
+  return ok ? elapsed_ms : 0;
+}
+
+void VpnEngine::StartLatencyMonitor(int64_t reconnect_start_ns) {
+  if (options_.latency_interval_ms <= 0) {
+    return;
+  }
+  LatencyMonitorOptions monitor_options;
+  monitor_options.socks_host = upstream_host_;
+  monitor_options.socks_port = upstream_port_;
+  monitor_options.target_host = options_.ping_host;
+  monitor_options.target_port = options_.ping_port;
+  monitor_options.interval_ms = options_.latency_interval_ms;
+  monitor_options.timeout_ms = options_.connect_timeout_ms;
+  monitor_options.window = options_.latency_window;
+
+  LatencyMonitor::ChangeCallback on_change = on_latency_;
+  if (reconnect_start_ns > 0) {
+    // A probe is a SOCKS CONNECT through the new upstream, so the first
+    // one to succeed is when the tunnel carries traffic again. The first
+    // success is always reported, as a change from no result or a failure.
+    auto timed = std::make_shared<bool>(false);
+    on_change = [this, reconnect_start_ns, timed,
+                 on_latency = on_latency_](const LatencySnapshot& snapshot) {
+      if (!*timed && snapshot.last_ok) {
+        *timed = true;
+        RecordReconnect((MonotonicNowNs() - reconnect_start_ns) / 1e6);
+      }
+      if (on_latency) {
+        on_latency(snapshot);
+      }
+    };
+  }
+  std::unique_ptr<LatencyMonitor> monitor(
+      new LatencyMonitor(monitor_options, std::move(on_change)));
+  monitor->Start();
+  {
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    // After a failover switch this swaps out the old upstream's monitor,
+    // which is then joined outside the lock.
+    latency_monitor_.swap(monitor);
+  }
+}
+
+void VpnEngine::StopLatencyMonitor() {
+  std::unique_ptr<LatencyMonitor> monitor;
+  {
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    monitor = std::move(latency_monitor_);
+  }
+  if (!monitor) {
+    return;
+  }
+  // Joined outside the lock so CalculatePing() never waits on a probe.
+  monitor.reset();
+  // Tell listeners the figures no longer apply.
+  if (on_latency_) {
+    on_latency_(LatencySnapshot());
+  }
+}
+
+void VpnEngine::StartFailover() {
+  if (failover_candidates_.empty() || options_.latency_interval_ms <= 0) {
+    return;
+  }
+  // The endpoint the session started on comes first so a later switch can
+  // return to it.
+  std::vector<FailoverCandidate> candidates;
+  FailoverCandidate primary;
+  primary.label = session_label_.empty() ? "primary" : session_label_;
+  primary.socks_host = options_.socks_host;
+  primary.socks_port = options_.socks_port;
+  candidates.push_back(primary);
+  candidates.insert(candidates.end(), failover_candidates_.begin(),
+                    failover_candidates_.end());
+
+  size_t active = 0;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (candidates[i].socks_host == upstream_host_ &&
+        candidates[i].socks_port == upstream_port_) {
+      active = i;
+      break;
+    }
+  }
+
+  FailoverOptions failover_options = options_.failover;
+  failover_options.standby_probe.target_host = options_.ping_host;
+  failover_options.standby_probe.target_port = options_.ping_port;
+  failover_options.standby_probe.interval_ms = options_.latency_interval_ms;
+  failover_options.standby_probe.timeout_ms = options_.connect_timeout_ms;
+  failover_options.standby_probe.window = options_.latency_window;
+
+  uint64_t generation = ++failover_generation_;
+  failover_.reset(new FailoverScheduler(
+      failover_options, candidates, active, [this] { return latency(); },
+      [this](Tun2SocksStats* stats) {
+        std::lock_guard<std::mutex> lock(tun_mutex_);
+        if (!tun2socks_) {
+          return false;
+        }
+        *stats = tun2socks_->stats();
+        return true;
+      },
+      [this, generation](size_t index, const std::string& reason) {
+        control_thread_.Post([this, generation, index, reason] {
+          SwitchUpstream(generation, index, reason);
+        });
+      }));
+  // A candidate list without the current upstream starts over from the
+  // session's own endpoint.
+  if (active == 0 && (upstream_host_ != options_.socks_host ||
+                      upstream_port_ != options_.socks_port)) {
+    SwitchUpstream(generation, 0, "the upstream in use is not a candidate");
+  }
+  failover_->Start();
+}
+
+void VpnEngine::StopFailover() {
+  ++failover_generation_;
+  failover_.reset();
+}
+
+void VpnEngine::SelectUpstream(const std::string& label,
+                               std::function<void(bool)> done) {
+  control_thread_.Post([this, label, done] {
+    FailoverCandidate candidate;
+    size_t index = 0;
+    while (UpstreamAt(index, &candidate) && candidate.label != label) {
+      index++;
+    }
+    if (candidate.label != label) {
+      done(false);
+      return;
+    }
+    // The scheduler restarts from the chosen upstream instead of switching
+    // straight back to the one it considered best.
+    bool failing_over = failover_ != nullptr;
+    StopFailover();
+    UseUpstream(candidate, index);
+    if (failing_over) {
+      StartFailover();
+    }
+    done(true);
+  });
+}
+
+void VpnEngine::SwitchUpstream(uint64_t generation, size_t index,
+                               const std::string& reason) {
+  if (generation != failover_generation_ || !failover_) {
+    return;
+  }
+  FailoverCandidate candidate;
+  if (!UpstreamAt(index, &candidate)) {
+    return;
+  }
+  // The switch event carries only the label; this says why.
+  if (status() == VpnStatus::kConnected) {
+    Progress("[WARN] Switching upstream to " + candidate.label + ": " +
+             reason);
+  }
+  UseUpstream(candidate, index);
+}
+
+bool VpnEngine::UpstreamAt(size_t index, FailoverCandidate* candidate) const {
+  if (index == 0) {
+    candidate->label = session_label_.empty() ? "primary" : session_label_;
+    candidate->socks_host = options_.socks_host;
+    candidate->socks_port = options_.socks_port;
+    candidate->server_host = server_host_;
+    return true;
+  }
+  if (index - 1 < failover_candidates_.size()) {
+    *candidate = failover_candidates_[index - 1];
+    return true;
+  }
+  return false;
+}
+
+void VpnEngine::UseUpstream(const FailoverCandidate& candidate,
+                            size_t index) {
+  int64_t start = MonotonicNowNs();
+  upstream_host_ = candidate.socks_host;
+  upstream_port_ = candidate.socks_port;
+  upstream_server_ = candidate.server_host;
+  {
+    std::lock_guard<std::mutex> lock(tun_mutex_);
+    if (tun2socks_) {
+      tun2socks_->SetUpstream(upstream_host_, upstream_port_);
+    }
+  }
+  // Outside the lock, as it may wait on the resolver; only this thread
+  // replaces |tun2socks_|.
+  if (tun2socks_) {
+    tun2socks_->RouteServer(upstream_server_);
+  }
+  if (local_proxy_) {
+    local_proxy_->SetUpstream(upstream_host_, upstream_port_);
+  }
+  // Without a tunnel there is nothing to switch yet; the next connection
+  // simply starts on this upstream.
+  if (status() != VpnStatus::kConnected) {
+    return;
+  }
+  StartLatencyMonitor(start);
+  Emit(ProgressEventType::kConfigSwitched, static_cast<int32_t>(index) - 1,
+       candidate.label);
+}
+
+void VpnEngine::ApplySplitTunnel() {
+  if (!tun2socks_ || !split_enabled_ || split_apps_.empty()) {
+    split_tunnel_.reset();
+    return;
+  }
+  if (split_tunnel_) {
+    split_tunnel_->SetApps(split_apps_);
+    return;
+  }
+  split_tunnel_.reset(new SplitTunnel(SplitTunnelOptions()));
+  if (!split_tunnel_->Start(split_apps_)) {
+    Progress("[WARN] Split tunneling is unavailable; tunneling all traffic");
+    split_tunnel_.reset();
+  }
+}
+
+void VpnEngine::Rebind(const NetworkState& state) {
+  if (status() != VpnStatus::kConnected || !state.online) {
+    return;
+  }
+  int64_t start = MonotonicNowNs();
+  // The core's connection to its server and bypassed traffic follow the
+  // new default route...
+  if (tun2socks_) {
+    tun2socks_->RouteServer(upstream_server_);
+  }
+  if (split_tunnel_) {
+    split_tunnel_->RefreshRoutes();
+  }
+  // ...and an immediate probe makes the core dial the upstream over the
+  // new path, instead of after its stalled connections time out.
+  StartLatencyMonitor(start);
+  if (failover_) {
+    // The standby figures were taken on the old network.
+    StopFailover();
+    StartFailover();
+  }
+  int64_t elapsed_ms = (MonotonicNowNs() - start) / 1000000;
+  Progress("[INFO] Network changed to " +
+           std::string(NetworkKindName(state.kind)) + " (" + state.interface +
+           "); tunnel rebound in " + std::to_string(elapsed_ms) + " ms");
+}
+
+void VpnEngine::ResetTun2Socks() {
+  // Bypassed traffic is routed back through the device before it goes.
+  split_tunnel_.reset();
+  std::unique_ptr<Tun2Socks> tun2socks;
+  {
+    std::lock_guard<std::mutex> lock(tun_mutex_);
+    tun2socks = std::move(tun2socks_);
+  }
+  // Stopped outside the lock so the failover thread never waits on it.
+}
+
+void VpnEngine::SetStatus(VpnStatus status) { status_.store(status); }
+
+void VpnEngine::Progress(const std::string& message) {
+  Emit(ProgressEventType::kLog, 0, message);
+}
+
+void VpnEngine::Emit(ProgressEventType type, int32_t value,
+                     const std::string& text) {
+  ProgressEvent event;
+  event.type = type;
+  event.value = value;
+  event.text = text;
+
+  LogLevel level = LogLevel::kInfo;
+  if (text.compare(0, 7, "[ERROR]") == 0) {
+    level = LogLevel::kError;
+  } else if (text.compare(0, 6, "[WARN]") == 0) {
+    level = LogLevel::kWarning;
+  }
+  WriteLog(level, "vpn", ProgressEventLine(event));
+  if (progress_) {
+    progress_(event);
+  }
+}
@@ -0,0 +1,394 @@
+#ifndef RUNNER_VPN_ENGINE_H_
+#define RUNNER_VPN_ENGINE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "config_prober.h"
+#include "failover_scheduler.h"
+#include "latency_monitor.h"
+#include "local_proxy.h"
+#include "network_watcher.h"
+#include "progress_event.h"
+#include "responsiveness_test.h"
+#include "socks_standin.h"
+#include "split_tunnel.h"
+#include "speed_test.h"
+#include "speed_test_server.h"
+#include "streaming_stats.h"
+#include "tls_session_cache.h"
+#include "tun2socks.h"
+#include "worker_thread.h"
+
+// Connection states reported to Dart through getVpnStatus.
+enum class VpnStatus {
+  kDisconnected,
+  kConnecting,
+  kConnected,
+  kDisconnecting,
+};
+
+// Returns the lower-case name Dart expects for |status|, e.g. "connected".
+const char* VpnStatusName(VpnStatus status);
+
+// Successful TLS handshakes of the config probes since the engine started,
+// split by whether they resumed a cached session.
+struct TlsHandshakeStats {
+  // Handshake times in milliseconds, TCP connect included.
+  StreamingStats full_ms;
+  StreamingStats resumed_ms;
+  // Handshakes whose ClientHello the server took in the SYN.
+  uint64_t fast_open = 0;
+  // Sessions waiting in the cache for the next handshake.
+  size_t cached_sessions = 0;
+  // How long traffic took to flow again after an upstream switch or a
+  // rebind, up to the first proxied connection that went through, plus the
+  // reconnects the app drove. Switches are only timed while latency
+  // monitoring is on. Kept for the whole process, unlike the speed test's
+  // series.
+  StreamingStats reconnect_ms;
+};
+
+struct VpnEngineOptions {
+  // The local SOCKS5 endpoint exposed by the proxy core.
+  std::string socks_host = "127.0.0.1";
+  uint16_t socks_port = 5000;
+
+  // Destination reached through the proxy to check and time the tunnel.
+  std::string ping_host = "1.1.1.1";
+  uint16_t ping_port = 80;
+
+  int connect_timeout_ms = 5000;
+
+  // While connected the tunnel is probed this often so calculatePing can
+  // answer from cached figures. 0 disables the monitor.
+  int latency_interval_ms = 2000;
+  // Probes the latency figures cover.
+  size_t latency_window = 30;
+
+  // Serve |socks_port| from an in-process SocksStandIn instead of expecting
+  // a proxy core to be listening there.
+  bool use_socks_standin = false;
+
+  // Let startTun2socks install the half-default routes. Disabling this is
+  // useful when routing is managed outside the app.
+  bool tun_default_routes = true;
+
+  // Relay UDP, QUIC included, through the tunnel. Off leaves only TCP and
+  // DNS, and applications fall back from QUIC to TCP.
+  bool tun_udp_relay = true;
+
+  // Exchange 64 KB super-packets with the kernel through virtio-net
+  // headers (TSO, USO and checksum offload). Off reads and writes one
+  // MTU-sized packet at a time.
+  bool tun_offload = true;
+
+  // Move TUN packets through io_uring, falling back to epoll where the
+  // kernel or a seccomp filter refuses it. Off always uses epoll.
+  bool tun_io_uring = true;
+
+  // The SOCKS5 and HTTP CONNECT proxy startLocalProxy opens for the
+  // proxy-only mode. Its upstream always follows the tunnel's.
+  LocalProxyOptions local_proxy;
+
+  // Answer DNS inside the TUN device from a caching forwarder that
+  // resolves through the proxy.
+  bool dns_forwarder = true;
+  DnsForwarderOptions dns;
+
+  // Upstreams to fail over to while connected, besides the one at
+  // |socks_host|:|socks_port|. Usually set through setFailoverCandidates.
+  std::vector<FailoverCandidate> failover_candidates;
+  FailoverOptions failover;
+
+  // Server and stream count for measureThroughput.
+  SpeedTestOptions speed_test;
+
+  // Measure against an in-process SpeedTestServer on loopback instead of
+  // |speed_test|'s host, to benchmark the engine without a network.
+  bool use_speed_test_server = false;
+
+  // Where the config probes keep their TLS sessions between launches, so
+  // the probe before a reconnect resumes instead of running a full
+  // handshake. Empty keeps no sessions.
+  std::string tls_session_path = TlsSessionCache::DefaultPath();
+
+  // Follow the host's network over netlink and rebind the tunnel as soon
+  // as the default route moves, instead of waiting for traffic to stall.
+  bool network_watcher = true;
+
+  // Reads overrides from MIMIVPN_SOCKS_PORT, MIMIVPN_PING_HOST,
+  // MIMIVPN_PING_INTERVAL_MS, MIMIVPN_FAILOVER_PORTS (comma-separated
+  // SOCKS ports on |socks_host|), MIMIVPN_PROXY_PORT, MIMIVPN_SOCKS_STANDIN=1,
+  // MIMIVPN_TUN_NO_ROUTES=1, MIMIVPN_TUN_UDP=0, MIMIVPN_TUN_OFFLOAD=0,
+  // MIMIVPN_TUN_IO_URING=0, MIMIVPN_DNS_SERVER, MIMIVPN_DNS_FORWARDER=0,
+  // MIMIVPN_SPEEDTEST_HOST, MIMIVPN_SPEEDTEST_PORT, MIMIVPN_SPEEDTEST_STREAMS,
+  // MIMIVPN_SPEEDTEST_LOOPBACK=1 and MIMIVPN_NETWORK_WATCHER=0.
+  static VpnEngineOptions FromEnvironment();
+};
+
+// Owns the native tunnel state for the com.mimivpn.vpn channel. Every
+// operation that can block runs on a dedicated control thread so the GTK main
+// loop never waits on the network; completion callbacks are invoked on that
+// thread and must marshal back to the main loop themselves.
+class VpnEngine {
+ public:
+  // Receives the typed counterparts of the "Data: ..." lines the proxy core
+  // emits on other platforms, plus free-form log lines.
+  using ProgressCallback = std::function<void(const ProgressEvent& event)>;
+
+  // Receives the latency monitor's figures whenever they change notably.
+  // Runs on the monitor thread.
+  using LatencyCallback = LatencyMonitor::ChangeCallback;
+
+  // Receives the host's network after each change, once the tunnel has been
+  // rebound to it. Runs on the control thread.
+  using NetworkCallback = NetworkWatcher::ChangeCallback;
+
+  VpnEngine(const VpnEngineOptions& options, ProgressCallback progress,
+            LatencyCallback on_latency, NetworkCallback on_network);
+  ~VpnEngine();
+
+  // Prevent copying.
+  VpnEngine(VpnEngine const&) = delete;
+  VpnEngine& operator=(VpnEngine const&) = delete;
+
+  // Brings the upstream session up if it is not already; reports whether the
+  // tunnel is usable.
+  void Connect(std::function<void(bool)> done);
+
+  // Replaces the upstreams the session may fail over to. Takes effect at
+  // once when connected. A switch is reported as a kConfigSwitched progress
+  // event whose value is the candidate's index in |candidates|, or -1 for
+  // the endpoint the session started on, after a log event saying why.
+  void SetFailoverCandidates(std::vector<FailoverCandidate> candidates);
+
+  // Tears the upstream session down.
+  void Disconnect(std::function<void(bool)> done);
+
+  // Moves the tunnel to the upstream labelled |label|: the session's own
+  // endpoint or one of the failover candidates. Takes effect at once when
+  // connected, reported as a kConfigSwitched progress event, and silently
+  // for the next connection otherwise. Reports whether |label| was found.
+  void SelectUpstream(const std::string& label,
+                      std::function<void(bool)> done);
+
+  // Starts a connection attempt and reports the outcome through the
+  // progress callback. |flow_line| holds the share links to try, as a
+  // subscription would: one per line, optionally base64-encoded as a whole.
+  // The one whose name is |pattern|, or else the first, is the session's
+  // server; its position is reported as the config index. The proxy core
+  // itself is not driven from here: the tunnel still runs through the SOCKS
+  // endpoint in |options|.
+  void StartVpn(const std::string& flow_line, const std::string& pattern,
+                std::function<void(const std::string&)> done);
+
+  // The |flow_line| of the last StartVpn() call; empty before the first.
+  std::string flow_line() const;
+
+  // Cancels any attempt in progress and stops the session.
+  void StopVpn(std::function<void(const std::string&)> done);
+
+  // Reports the tunnel's latency in milliseconds, or 0 when the tunnel is
+  // down or the probe fails. While the latency monitor has a recent probe
+  // the answer comes from it immediately, on the calling thread; otherwise a
+  // proxied connection to the ping target is timed on the control thread.
+  void CalculatePing(std::function<void(int64_t)> done);
+
+  // The latency monitor's current figures; all zero while disconnected.
+  LatencySnapshot latency() const;
+
+  // Brings up the TUN device and routes the host's traffic into the SOCKS
+  // proxy. Reports whether the device is up.
+  void StartTun2Socks(std::function<void(bool)> done);
+
+  // Removes the TUN device, restoring the previous routes.
+  void StopTun2Socks(std::function<void()> done);
+
+  // Opens the local proxy for the proxy-only mode on |port|, or on the
+  // configured port when |port| is 0. Reports the bound port, or 0 when the
+  // proxy could not start.
+  void StartLocalProxy(uint16_t port, std::function<void(uint16_t)> done);
+
+  // Closes the local proxy and every connection through it.
+  void StopLocalProxy(std::function<void()> done);
+
+  // The TUN device's DNS forwarder counters; all zero while the device is
+  // down or the forwarder is disabled.
+  DnsForwarderStats dns_stats() const;
+
+  // Lets the processes of |apps| (executable names or paths) bypass the
+  // tunnel while the TUN device is up. Disabled, or with no apps, all
+  // traffic is tunneled.
+  void SetSplitTunnel(bool enabled, std::vector<std::string> apps);
+
+  // Probes |targets| on a dedicated thread so it can overlap with the
+  // control thread's work. |on_result| runs as each probe finishes and
+  // |done| with the healthy results once the run ends. Starting a new run
+  // cancels the previous one, which then reports what it had found.
+  void ProbeConfigs(std::vector<ProbeTarget> targets,
+                    const ConfigProberOptions& options,
+                    ConfigProber::ResultCallback on_result,
+                    std::function<void(const std::vector<ProbeResult>&)> done);
+
+  // Cancels the probe run in progress, if any.
+  void CancelProbe();
+
+  TlsHandshakeStats tls_stats() const;
+
+  // Adds a reconnect the engine did not time itself, such as the app
+  // restarting the core, to tls_stats().
+  void RecordReconnect(double ms);
+
+  // The host's network as last seen by the watcher, or read on the spot
+  // when the watcher is off.
+  NetworkState network_state() const;
+
+  // Runs |count| throughput samples of |bytes| each on a dedicated thread.
+  // |on_progress| receives the running speed of the current sample and
+  // |done| every sample once the run ends. Starting a new run cancels the
+  // previous one.
+  void MeasureThroughput(
+      SpeedTestDirection direction, int64_t bytes, int count,
+      SpeedTest::ProgressCallback on_progress,
+      std::function<void(const std::vector<SpeedSample>&)> done);
+
+  // Measures latency idle and while the path is saturated in each
+  // direction, on the same thread as throughput runs. |on_progress|
+  // receives the load's running speed and |done| the result. Starting a
+  // new run cancels the previous one, of either kind.
+  void MeasureResponsiveness(
+      const ResponsivenessOptions& responsiveness,
+      SpeedTest::ProgressCallback on_progress,
+      std::function<void(const ResponsivenessResult&)> done);
+
+  // Cancels the throughput or responsiveness run in progress, if any.
+  void CancelSpeedTest();
+
+  VpnStatus status() const { return status_.load(); }
+
+  bool IsTunnelRunning() const;
+
+  // True when this process may create TUN devices.
+  bool IsPrepared() const;
+
+  const VpnEngineOptions& options() const { return options_; }
+
+ private:
+  // Control-thread helpers.
+  bool BringUp();
+  void TearDown();
+  int64_t MeasurePing();
+  // Restarts latency monitoring on the current upstream. A nonzero
+  // |reconnect_start_ns| records the time from then to the first probe
+  // that goes through as a reconnect.
+  void StartLatencyMonitor(int64_t reconnect_start_ns = 0);
+  void StopLatencyMonitor();
+  void StartFailover();
+  void StopFailover();
+  // Moves to the failover candidate at |index| for |reason|, unless the
+  // scheduler of |generation| has been replaced since.
+  void SwitchUpstream(uint64_t generation, size_t index,
+                      const std::string& reason);
+  // Fills in |candidate| for |index|, 0 being the session's own endpoint
+  // and the failover candidates following it. False when out of range.
+  bool UpstreamAt(size_t index, FailoverCandidate* candidate) const;
+  void UseUpstream(const FailoverCandidate& candidate, size_t index);
+  void ResetTun2Socks();
+  void ApplySplitTunnel();
+  // Moves the connected tunnel onto |state|'s network without tearing the
+  // device down.
+  void Rebind(const NetworkState& state);
+
+  // Speed-test-thread helper: points |test_options| at the loopback server
+  // when |use_speed_test_server| is set, starting it on first use. False
+  // if it cannot be started.
+  bool PrepareSpeedTest(SpeedTestOptions* test_options);
+
+  void SetStatus(VpnStatus status);
+  // Reports a free-form log line.
+  void Progress(const std::string& message);
+  void Emit(ProgressEventType type, int32_t value = 0,
+            const std::string& text = std::string());
+
+  VpnEngineOptions options_;
+  ProgressCallback progress_;
+  LatencyCallback on_latency_;
+  NetworkCallback on_network_;
+  std::atomic<VpnStatus> status_{VpnStatus::kDisconnected};
+
+  // Only touched on the control thread.
+  std::unique_ptr<SocksStandIn> standin_;
+  // The SOCKS endpoint the tunnel currently runs through; |options_|'
+  // endpoint until a failover switch.
+  std::string upstream_host_;
+  uint16_t upstream_port_ = 0;
+  std::string session_label_;
+  // Written on the caller's thread by StartVpn(), read by flow_line().
+  mutable std::mutex flow_line_mutex_;
+  std::string flow_line_;
+  // The proxy server the session's config points at, from |flow_line|;
+  // empty when the flow line held no share link.
+  std::string server_host_;
+  // The proxy server of the upstream in use, routed around the device.
+  std::string upstream_server_;
+  std::vector<FailoverCandidate> failover_candidates_;
+  std::unique_ptr<FailoverScheduler> failover_;
+  // Bumped whenever |failover_| is replaced, so a switch it queued can tell
+  // it has been superseded.
+  uint64_t failover_generation_ = 0;
+
+  // Split tunneling as last requested, and its state while the device is up.
+  bool split_enabled_ = false;
+  std::vector<std::string> split_apps_;
+  std::unique_ptr<SplitTunnel> split_tunnel_;
+
+  // Only touched on the control thread.
+  std::unique_ptr<LocalProxy> local_proxy_;
+
+  // Set and cleared on the control thread; the lock lets the failover
+  // thread read the traffic counters.
+  mutable std::mutex tun_mutex_;
+  std::unique_ptr<Tun2Socks> tun2socks_;
+
+  // Set and cleared on the control thread; the lock lets CalculatePing()
+  // read it from any thread.
+  mutable std::mutex latency_mutex_;
+  std::unique_ptr<LatencyMonitor> latency_monitor_;
+
+  // Guards |active_prober_|, which is only set while a run is in progress.
+  std::mutex probe_mutex_;
+  ConfigProber* active_prober_ = nullptr;
+  std::atomic<uint64_t> probe_generation_{0};
+
+  // Shared by every probe run. Null when |tls_session_path| is empty.
+  std::unique_ptr<TlsSessionCache> tls_sessions_;
+  mutable std::mutex tls_stats_mutex_;
+  TlsHandshakeStats tls_stats_;
+
+  // Null when |network_watcher| is off or netlink is unavailable. Its
+  // changes are handled on the control thread.
+  std::unique_ptr<NetworkWatcher> network_watcher_;
+
+  // Same scheme as the probe state above, for throughput and
+  // responsiveness runs.
+  std::mutex speed_test_mutex_;
+  SpeedTest* active_speed_test_ = nullptr;
+  ResponsivenessTest* active_responsiveness_test_ = nullptr;
+  std::atomic<uint64_t> speed_test_generation_{0};
+
+  // Only touched on the speed test thread.
+  std::unique_ptr<SpeedTestServer> speed_test_server_;
+
+  // Declared last so they are joined before the state above is destroyed.
+  WorkerThread probe_thread_;
+  WorkerThread speed_test_thread_;
+  WorkerThread control_thread_;
+};
+
+#endif  // RUNNER_VPN_ENGINE_H_
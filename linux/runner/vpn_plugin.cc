@@ -0,0 +1,1349 @@
+#include "vpn_plugin.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config_prober.h"
+#include "config_store.h"
+#include "log_ring.h"
+#include "progress_event.h"
+#include "share_link.h"
+#include "startup_trace.h"
+#include "streaming_stats.h"
+#include "subscription.h"
+#include "vpn_engine.h"
+
+namespace {
+
+constexpr char kChannelName[] = "com.mimivpn.vpn";
+constexpr char kProgressChannelName[] = "com.defyx.progress_events";
+constexpr char kProbeChannelName[] = "com.mimivpn.probe_results";
+constexpr char kSpeedTestChannelName[] = "com.mimivpn.speed_test";
+constexpr char kLatencyChannelName[] = "com.mimivpn.latency";
+constexpr char kNetworkChannelName[] = "com.mimivpn.network";
+constexpr char kQuickActionChannelName[] = "com.mimivpn.quick_actions";
+
+// Progress events are held this long and sent as one batch, so a burst such
+// as a run of config switches reaches Dart once per frame.
+constexpr guint kProgressBatchMs = 16;
+
+// A method call answered from the VPN control thread, waiting to be sent from
+// the main loop.
+struct PendingResponse {
+  FlMethodCall* method_call;
+  FlMethodResponse* response;
+};
+
+// A finished config probe waiting to be sent from the main loop.
+struct PendingProbeResult {
+  VpnPlugin* plugin;
+  ProbeResult result;
+};
+
+// A running throughput reading waiting to be sent from the main loop.
+struct PendingSpeed {
+  VpnPlugin* plugin;
+  double mbps;
+};
+
+// Latency monitor figures waiting to be sent from the main loop.
+struct PendingLatency {
+  VpnPlugin* plugin;
+  LatencySnapshot snapshot;
+};
+
+// A network change waiting to be sent from the main loop.
+struct PendingNetwork {
+  VpnPlugin* plugin;
+  NetworkState state;
+};
+
+// The outcome of a quick action waiting to be sent from the main loop.
+struct PendingQuickAction {
+  VpnPlugin* plugin;
+  std::string action;
+  std::string server;
+  bool ok;
+};
+
+// VPN state loaded by vpn_plugin_prewarm() while the window is built.
+struct Prewarm {
+  std::thread thread;
+  ConfigStore* config_store = nullptr;
+  VpnEngineOptions options;
+};
+
+Prewarm* prewarm = nullptr;
+
+}  // namespace
+
+struct _VpnPlugin {
+  GObject parent_instance;
+
+  FlEventChannel* progress_channel;
+  gboolean progress_listening;
+  ProgressBatch* progress_batch;
+
+  FlEventChannel* probe_channel;
+  gboolean probe_listening;
+
+  FlEventChannel* speed_test_channel;
+  gboolean speed_test_listening;
+
+  FlEventChannel* latency_channel;
+  gboolean latency_listening;
+
+  FlEventChannel* network_channel;
+  gboolean network_listening;
+
+  FlEventChannel* quick_action_channel;
+  gboolean quick_action_listening;
+
+  VpnEngine* engine;
+
+  // Cached server configs and their probe history. Only touched on the
+  // main thread.
+  ConfigStore* config_store;
+
+  // Speed test statistics by series name, e.g. "download". Only touched on
+  // the main thread.
+  std::map<std::string, StreamingStats>* stats;
+
+  gchar* timezone;
+  gchar* connection_method;
+};
+
+G_DEFINE_TYPE(VpnPlugin, vpn_plugin, g_object_get_type())
+
+// The plugin quick actions from the command line are run on. Not owned.
+static VpnPlugin* quick_action_plugin = nullptr;
+
+static gboolean respond_cb(gpointer user_data) {
+  PendingResponse* pending = static_cast<PendingResponse*>(user_data);
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(pending->method_call, pending->response,
+                              &error)) {
+    g_warning("Failed to send method call response: %s", error->message);
+  }
+  g_object_unref(pending->method_call);
+  g_object_unref(pending->response);
+  delete pending;
+  return G_SOURCE_REMOVE;
+}
+
+// Takes a reference on |method_call| so it can be answered after the handler
+// returns.
+static FlMethodCall* hold_method_call(FlMethodCall* method_call) {
+  return static_cast<FlMethodCall*>(g_object_ref(method_call));
+}
+
+// Answers a held |method_call| with |result| from the main loop. Safe to call
+// from any thread; releases the reference taken by hold_method_call().
+static void respond_success_later(FlMethodCall* method_call, FlValue* result) {
+  PendingResponse* pending = new PendingResponse{
+      method_call, FL_METHOD_RESPONSE(fl_method_success_response_new(result))};
+  fl_value_unref(result);
+  g_main_context_invoke(nullptr, respond_cb, pending);
+}
+
+static gboolean flush_progress_cb(gpointer user_data) {
+  VpnPlugin* self = VPN_PLUGIN(user_data);
+  if (self->progress_batch == nullptr) {
+    return G_SOURCE_REMOVE;
+  }
+  std::vector<uint8_t> batch = self->progress_batch->Take();
+  if (self->progress_listening && !batch.empty()) {
+    g_autoptr(FlValue) event =
+        fl_value_new_uint8_list(batch.data(), batch.size());
+    g_autoptr(GError) error = nullptr;
+    if (!fl_event_channel_send(self->progress_channel, event, nullptr,
+                               &error)) {
+      g_warning("Failed to send progress events: %s", error->message);
+    }
+  }
+  return G_SOURCE_REMOVE;
+}
+
+// Queues |event| for the progress channel, scheduling a flush when it starts
+// a new batch. Safe to call from any thread.
+static void vpn_plugin_send_progress(VpnPlugin* self,
+                                     const ProgressEvent& event) {
+  if (!self->progress_batch->Add(event)) {
+    return;
+  }
+  g_timeout_add_full(G_PRIORITY_DEFAULT, kProgressBatchMs, flush_progress_cb,
+                     g_object_ref(self), g_object_unref);
+}
+
+// Returns {"index", "ok", "connectMs", "latencyMs", "resumed", "fastOpen"}
+// for |result|.
+static FlValue* probe_result_to_value(const ProbeResult& result) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(
+      value, "index", fl_value_new_int(static_cast<int64_t>(result.index)));
+  fl_value_set_string_take(value, "ok", fl_value_new_bool(result.ok));
+  fl_value_set_string_take(value, "connectMs",
+                           fl_value_new_int(result.connect_ms));
+  fl_value_set_string_take(value, "latencyMs",
+                           fl_value_new_int(result.latency_ms));
+  fl_value_set_string_take(value, "resumed",
+                           fl_value_new_bool(result.resumed));
+  fl_value_set_string_take(value, "fastOpen",
+                           fl_value_new_bool(result.fast_open));
+  return value;
+}
+
+static gboolean send_probe_result_cb(gpointer user_data) {
+  PendingProbeResult* pending = static_cast<PendingProbeResult*>(user_data);
+  VpnPlugin* self = pending->plugin;
+  if (self->probe_listening) {
+    g_autoptr(FlValue) event = probe_result_to_value(pending->result);
+    g_autoptr(GError) error = nullptr;
+    if (!fl_event_channel_send(self->probe_channel, event, nullptr, &error)) {
+      g_warning("Failed to send probe result: %s", error->message);
+    }
+  }
+  g_object_unref(self);
+  delete pending;
+  return G_SOURCE_REMOVE;
+}
+
+// Queues |result| for the probe results channel. Safe to call from any
+// thread.
+static void vpn_plugin_send_probe_result(VpnPlugin* self,
+                                         const ProbeResult& result) {
+  PendingProbeResult* pending = new PendingProbeResult{
+      static_cast<VpnPlugin*>(g_object_ref(self)), result};
+  g_main_context_invoke(nullptr, send_probe_result_cb, pending);
+}
+
+static gboolean send_speed_cb(gpointer user_data) {
+  PendingSpeed* pending = static_cast<PendingSpeed*>(user_data);
+  VpnPlugin* self = pending->plugin;
+  if (self->speed_test_listening) {
+    g_autoptr(FlValue) event = fl_value_new_float(pending->mbps);
+    g_autoptr(GError) error = nullptr;
+    if (!fl_event_channel_send(self->speed_test_channel, event, nullptr,
+                               &error)) {
+      g_warning("Failed to send speed test progress: %s", error->message);
+    }
+  }
+  g_object_unref(self);
+  delete pending;
+  return G_SOURCE_REMOVE;
+}
+
+// Queues |mbps| for the speed test channel. Safe to call from any thread.
+static void vpn_plugin_send_speed(VpnPlugin* self, double mbps) {
+  PendingSpeed* pending =
+      new PendingSpeed{static_cast<VpnPlugin*>(g_object_ref(self)), mbps};
+  g_main_context_invoke(nullptr, send_speed_cb, pending);
+}
+
+// Returns {"ok", "idleLatencyMs", "loadedLatencyMs", "downloadLatencyMs",
+// "uploadLatencyMs", "rpm", "latencyInflation", "downloadMbps",
+// "uploadMbps", "probes", "lostProbes"} for |result|.
+static FlValue* responsiveness_to_value(const ResponsivenessResult& result) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "ok", fl_value_new_bool(result.ok));
+  fl_value_set_string_take(value, "idleLatencyMs",
+                           fl_value_new_float(result.idle_latency_ms));
+  fl_value_set_string_take(value, "loadedLatencyMs",
+                           fl_value_new_float(result.loaded_latency_ms));
+  fl_value_set_string_take(value, "downloadLatencyMs",
+                           fl_value_new_float(result.download_latency_ms));
+  fl_value_set_string_take(value, "uploadLatencyMs",
+                           fl_value_new_float(result.upload_latency_ms));
+  fl_value_set_string_take(value, "rpm", fl_value_new_float(result.rpm));
+  fl_value_set_string_take(value, "latencyInflation",
+                           fl_value_new_float(result.inflation_percent));
+  fl_value_set_string_take(value, "downloadMbps",
+                           fl_value_new_float(result.download_mbps));
+  fl_value_set_string_take(value, "uploadMbps",
+                           fl_value_new_float(result.upload_mbps));
+  fl_value_set_string_take(value, "probes", fl_value_new_int(result.probes));
+  fl_value_set_string_take(value, "lostProbes",
+                           fl_value_new_int(result.lost_probes));
+  return value;
+}
+
+// Returns {"rttMs", "avgMs", "minMs", "jitterMs", "lossPercent", "samples",
+// "ok"} for |snapshot|.
+static FlValue* latency_to_value(const LatencySnapshot& snapshot) {
+  FlValue* value = fl_value_new_map();
+  int64_t rtt_ms = snapshot.last_ok ? snapshot.last_rtt_ms : 0;
+  fl_value_set_string_take(value, "rttMs", fl_value_new_int(rtt_ms));
+  fl_value_set_string_take(value, "avgMs",
+                           fl_value_new_int(snapshot.avg_rtt_ms));
+  fl_value_set_string_take(value, "minMs",
+                           fl_value_new_int(snapshot.min_rtt_ms));
+  fl_value_set_string_take(value, "jitterMs",
+                           fl_value_new_int(snapshot.jitter_ms));
+  fl_value_set_string_take(value, "lossPercent",
+                           fl_value_new_float(snapshot.loss_percent));
+  fl_value_set_string_take(
+      value, "samples",
+      fl_value_new_int(static_cast<int64_t>(snapshot.samples)));
+  fl_value_set_string_take(value, "ok", fl_value_new_bool(snapshot.last_ok));
+  return value;
+}
+
+// Returns {"online", "kind", "interface", "gateway", "addresses",
+// "generation"} for |state|.
+static FlValue* network_state_to_value(const NetworkState& state) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "online", fl_value_new_bool(state.online));
+  fl_value_set_string_take(value, "kind",
+                           fl_value_new_string(NetworkKindName(state.kind)));
+  fl_value_set_string_take(value, "interface",
+                           fl_value_new_string(state.interface.c_str()));
+  fl_value_set_string_take(value, "gateway",
+                           fl_value_new_string(state.gateway.c_str()));
+  FlValue* addresses = fl_value_new_list();
+  for (const std::string& address : state.addresses) {
+    fl_value_append_take(addresses, fl_value_new_string(address.c_str()));
+  }
+  fl_value_set_string_take(value, "addresses", addresses);
+  fl_value_set_string_take(
+      value, "generation",
+      fl_value_new_int(static_cast<int64_t>(state.generation)));
+  return value;
+}
+
+static FlValue* dns_stats_to_value(const DnsForwarderStats& stats) {
+  FlValue* value = fl_value_new_map();
+  double hit_rate =
+      stats.queries > 0 ? 100.0 * stats.cache_hits / stats.queries : 0;
+  fl_value_set_string_take(value, "queries",
+                           fl_value_new_int(stats.queries));
+  fl_value_set_string_take(value, "hits", fl_value_new_int(stats.cache_hits));
+  fl_value_set_string_take(value, "negativeHits",
+                           fl_value_new_int(stats.negative_hits));
+  fl_value_set_string_take(value, "coalesced",
+                           fl_value_new_int(stats.coalesced));
+  fl_value_set_string_take(value, "prefetches",
+                           fl_value_new_int(stats.prefetches));
+  fl_value_set_string_take(value, "upstreamQueries",
+                           fl_value_new_int(stats.upstream_queries));
+  fl_value_set_string_take(value, "upstreamFailures",
+                           fl_value_new_int(stats.upstream_failures));
+  fl_value_set_string_take(
+      value, "entries",
+      fl_value_new_int(static_cast<int64_t>(stats.cache_entries)));
+  fl_value_set_string_take(value, "hitRate", fl_value_new_float(hit_rate));
+  fl_value_set_string_take(value, "upstreamAvgMs",
+                           fl_value_new_float(stats.upstream_avg_ms));
+  fl_value_set_string_take(value, "upstreamP50Ms",
+                           fl_value_new_float(stats.upstream_p50_ms));
+  fl_value_set_string_take(value, "upstreamP95Ms",
+                           fl_value_new_float(stats.upstream_p95_ms));
+  return value;
+}
+
+// Returns the startup marks as a list of {"name", "ms"} maps, oldest first.
+static FlValue* startup_trace_to_value() {
+  FlValue* value = fl_value_new_list();
+  for (const StartupPhase& phase : StartupTrace::Default().phases()) {
+    FlValue* entry = fl_value_new_map();
+    fl_value_set_string_take(entry, "name",
+                             fl_value_new_string(phase.name.c_str()));
+    fl_value_set_string_take(entry, "ms", fl_value_new_float(phase.ms));
+    fl_value_append_take(value, entry);
+  }
+  return value;
+}
+
+static gboolean send_latency_cb(gpointer user_data) {
+  PendingLatency* pending = static_cast<PendingLatency*>(user_data);
+  VpnPlugin* self = pending->plugin;
+  if (self->latency_listening) {
+    g_autoptr(FlValue) event = latency_to_value(pending->snapshot);
+    g_autoptr(GError) error = nullptr;
+    if (!fl_event_channel_send(self->latency_channel, event, nullptr,
+                               &error)) {
+      g_warning("Failed to send latency update: %s", error->message);
+    }
+  }
+  g_object_unref(self);
+  delete pending;
+  return G_SOURCE_REMOVE;
+}
+
+// Queues |snapshot| for the latency channel. Safe to call from any thread.
+static void vpn_plugin_send_latency(VpnPlugin* self,
+                                    const LatencySnapshot& snapshot) {
+  PendingLatency* pending = new PendingLatency{
+      static_cast<VpnPlugin*>(g_object_ref(self)), snapshot};
+  g_main_context_invoke(nullptr, send_latency_cb, pending);
+}
+
+static gboolean send_network_cb(gpointer user_data) {
+  PendingNetwork* pending = static_cast<PendingNetwork*>(user_data);
+  VpnPlugin* self = pending->plugin;
+  if (self->network_listening) {
+    g_autoptr(FlValue) event = network_state_to_value(pending->state);
+    g_autoptr(GError) error = nullptr;
+    if (!fl_event_channel_send(self->network_channel, event, nullptr,
+                               &error)) {
+      g_warning("Failed to send network change: %s", error->message);
+    }
+  }
+  g_object_unref(self);
+  delete pending;
+  return G_SOURCE_REMOVE;
+}
+
+// Queues |state| for the network channel. Safe to call from any thread.
+static void vpn_plugin_send_network(VpnPlugin* self,
+                                    const NetworkState& state) {
+  PendingNetwork* pending = new PendingNetwork{
+      static_cast<VpnPlugin*>(g_object_ref(self)), state};
+  g_main_context_invoke(nullptr, send_network_cb, pending);
+}
+
+static gboolean send_quick_action_cb(gpointer user_data) {
+  PendingQuickAction* pending = static_cast<PendingQuickAction*>(user_data);
+  VpnPlugin* self = pending->plugin;
+  if (self->quick_action_listening && self->engine != nullptr) {
+    g_autoptr(FlValue) event = fl_value_new_map();
+    fl_value_set_string_take(event, "action",
+                             fl_value_new_string(pending->action.c_str()));
+    if (!pending->server.empty()) {
+      fl_value_set_string_take(event, "server",
+                               fl_value_new_string(pending->server.c_str()));
+    }
+    fl_value_set_string_take(event, "ok", fl_value_new_bool(pending->ok));
+    fl_value_set_string_take(
+        event, "status",
+        fl_value_new_string(VpnStatusName(self->engine->status())));
+    g_autoptr(GError) error = nullptr;
+    if (!fl_event_channel_send(self->quick_action_channel, event, nullptr,
+                               &error)) {
+      g_warning("Failed to send quick action: %s", error->message);
+    }
+  }
+  g_object_unref(self);
+  delete pending;
+  return G_SOURCE_REMOVE;
+}
+
+// Queues the outcome of a quick action for Dart. Safe to call from any
+// thread.
+static void vpn_plugin_send_quick_action(VpnPlugin* self,
+                                         const std::string& action,
+                                         const std::string& server, bool ok) {
+  PendingQuickAction* pending = new PendingQuickAction{
+      static_cast<VpnPlugin*>(g_object_ref(self)), action, server, ok};
+  g_main_context_invoke(nullptr, send_quick_action_cb, pending);
+}
+
+// Returns {"count", "min", "max", "mean", "p50", "p90", "jitter",
+// "lossPercent"} for |stats|.
+static FlValue* stats_to_value(const StreamingStats& stats) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(
+      value, "count", fl_value_new_int(static_cast<int64_t>(stats.count())));
+  fl_value_set_string_take(value, "min", fl_value_new_float(stats.min()));
+  fl_value_set_string_take(value, "max", fl_value_new_float(stats.max()));
+  fl_value_set_string_take(value, "mean", fl_value_new_float(stats.mean()));
+  fl_value_set_string_take(value, "p50",
+                           fl_value_new_float(stats.Quantile(0.5)));
+  fl_value_set_string_take(value, "p90",
+                           fl_value_new_float(stats.Quantile(0.9)));
+  fl_value_set_string_take(value, "jitter",
+                           fl_value_new_float(stats.jitter()));
+  fl_value_set_string_take(value, "lossPercent",
+                           fl_value_new_float(stats.loss_percent()));
+  return value;
+}
+
+// Returns {"full", "resumed", "fastOpen", "cachedSessions"} for |stats|,
+// the first two as stats_to_value() maps of handshake times.
+static FlValue* tls_stats_to_value(const TlsHandshakeStats& stats) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "full", stats_to_value(stats.full_ms));
+  fl_value_set_string_take(value, "resumed",
+                           stats_to_value(stats.resumed_ms));
+  fl_value_set_string_take(
+      value, "fastOpen",
+      fl_value_new_int(static_cast<int64_t>(stats.fast_open)));
+  fl_value_set_string_take(
+      value, "cachedSessions",
+      fl_value_new_int(static_cast<int64_t>(stats.cached_sessions)));
+  fl_value_set_string_take(value, "reconnect",
+                           stats_to_value(stats.reconnect_ms));
+  return value;
+}
+
+// Returns {"sequence", "timeMs", "level", "source", "message"} for |record|.
+static FlValue* log_record_to_value(const LogRecord& record) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(
+      value, "sequence",
+      fl_value_new_int(static_cast<int64_t>(record.sequence)));
+  fl_value_set_string_take(value, "timeMs", fl_value_new_int(record.time_ms));
+  fl_value_set_string_take(value, "level",
+                           fl_value_new_string(LogLevelName(record.level)));
+  fl_value_set_string_take(value, "source",
+                           fl_value_new_string(record.source.c_str()));
+  fl_value_set_string_take(value, "message",
+                           fl_value_new_string(record.message.c_str()));
+  return value;
+}
+
+// Returns a parsed subscription as parallel lists, which cross the channel
+// far faster than one map per config: {"ok", "links", "names", "schemes",
+// "hosts", "serverNames", "ports" (Int32List), "tls" (Uint8List),
+// "errorLines" (Int32List), "errorReasons", "duplicates"}.
+static FlValue* subscription_to_value(const ParsedSubscription& parsed) {
+  FlValue* links = fl_value_new_list();
+  FlValue* names = fl_value_new_list();
+  FlValue* schemes = fl_value_new_list();
+  FlValue* hosts = fl_value_new_list();
+  FlValue* server_names = fl_value_new_list();
+  std::vector<int32_t> ports;
+  std::vector<uint8_t> tls;
+  ports.reserve(parsed.configs.size());
+  tls.reserve(parsed.configs.size());
+  auto append = [&parsed](FlValue* list, SubscriptionString string) {
+    std::string_view view = parsed.View(string);
+    fl_value_append_take(list,
+                         fl_value_new_string_sized(view.data(), view.size()));
+  };
+  for (const SubscriptionConfig& config : parsed.configs) {
+    append(links, config.link);
+    append(names, config.name);
+    append(schemes, config.scheme);
+    append(hosts, config.host);
+    append(server_names, config.server_name);
+    ports.push_back(config.port);
+    tls.push_back(config.tls ? 1 : 0);
+  }
+  std::vector<int32_t> error_lines;
+  FlValue* error_reasons = fl_value_new_list();
+  for (const SubscriptionError& error : parsed.errors) {
+    error_lines.push_back(static_cast<int32_t>(error.line));
+    fl_value_append_take(error_reasons, fl_value_new_string(error.reason));
+  }
+
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "ok", fl_value_new_bool(parsed.ok));
+  fl_value_set_string_take(value, "links", links);
+  fl_value_set_string_take(value, "names", names);
+  fl_value_set_string_take(value, "schemes", schemes);
+  fl_value_set_string_take(value, "hosts", hosts);
+  fl_value_set_string_take(value, "serverNames", server_names);
+  fl_value_set_string_take(value, "ports",
+                           fl_value_new_int32_list(ports.data(), ports.size()));
+  fl_value_set_string_take(value, "tls",
+                           fl_value_new_uint8_list(tls.data(), tls.size()));
+  fl_value_set_string_take(
+      value, "errorLines",
+      fl_value_new_int32_list(error_lines.data(), error_lines.size()));
+  fl_value_set_string_take(value, "errorReasons", error_reasons);
+  fl_value_set_string_take(value, "duplicates",
+                           fl_value_new_int(parsed.duplicates));
+  return value;
+}
+
+// Returns {"name", "config", "country", "flag", "premium", "ping",
+// "successRate", "probes", "lastGoodMs"} for the config at |index| in
+// |store|. "ping" is the last successful RTT, or null before one.
+static FlValue* stored_config_to_value(const ConfigStore& store,
+                                       size_t index) {
+  StoredConfig config = store.Get(index);
+  ServerHealth health = store.Health(index);
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "name",
+                           fl_value_new_string(config.name.c_str()));
+  fl_value_set_string_take(value, "config",
+                           fl_value_new_string(config.config.c_str()));
+  fl_value_set_string_take(value, "country",
+                           fl_value_new_string(config.country.c_str()));
+  fl_value_set_string_take(value, "flag",
+                           fl_value_new_string(config.flag.c_str()));
+  fl_value_set_string_take(value, "premium",
+                           fl_value_new_bool(config.premium));
+  fl_value_set_string_take(value, "ping",
+                           health.last_rtt_ms > 0
+                               ? fl_value_new_int(health.last_rtt_ms)
+                               : fl_value_new_null());
+  fl_value_set_string_take(value, "successRate",
+                           fl_value_new_float(health.success_rate));
+  fl_value_set_string_take(value, "probes", fl_value_new_int(health.probes));
+  fl_value_set_string_take(value, "lastGoodMs",
+                           fl_value_new_int(health.last_good_ms));
+  return value;
+}
+
+// Returns the string value of |key| in the map |args|, or nullptr.
+static const gchar* lookup_string_arg(FlValue* args, const gchar* key) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return nullptr;
+  }
+  FlValue* value = fl_value_lookup_string(args, key);
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_STRING) {
+    return nullptr;
+  }
+  return fl_value_get_string(value);
+}
+
+// Returns the integer value of |key| in the map |args|, or |fallback|.
+static int64_t lookup_int_arg(FlValue* args, const gchar* key,
+                              int64_t fallback) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return fallback;
+  }
+  FlValue* value = fl_value_lookup_string(args, key);
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_INT) {
+    return fallback;
+  }
+  return fl_value_get_int(value);
+}
+
+// Returns the boolean value of |key| in the map |args|, or |fallback|.
+static bool lookup_bool_arg(FlValue* args, const gchar* key, bool fallback) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return fallback;
+  }
+  FlValue* value = fl_value_lookup_string(args, key);
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_BOOL) {
+    return fallback;
+  }
+  return fl_value_get_bool(value);
+}
+
+// Reads the VpnConfig maps in |list|. Entries without a name are skipped.
+static std::vector<StoredConfig> stored_configs_from_value(FlValue* list) {
+  std::vector<StoredConfig> configs;
+  for (size_t i = 0; i < fl_value_get_length(list); i++) {
+    FlValue* entry = fl_value_get_list_value(list, i);
+    const gchar* name = lookup_string_arg(entry, "name");
+    if (name == nullptr) {
+      continue;
+    }
+    StoredConfig config;
+    config.name = name;
+    const gchar* link = lookup_string_arg(entry, "config");
+    const gchar* country = lookup_string_arg(entry, "country");
+    const gchar* flag = lookup_string_arg(entry, "flag");
+    config.config = link != nullptr ? link : "";
+    config.country = country != nullptr ? country : "";
+    config.flag = flag != nullptr ? flag : "";
+    config.premium = lookup_bool_arg(entry, "premium", false);
+    configs.push_back(config);
+  }
+  return configs;
+}
+
+// Returns the list value of |key| in the map |args|, or nullptr.
+static FlValue* lookup_list_arg(FlValue* args, const gchar* key) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return nullptr;
+  }
+  FlValue* value = fl_value_lookup_string(args, key);
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_LIST) {
+    return nullptr;
+  }
+  return value;
+}
+
+// Turns the share links in |configs| into probe targets. Links that cannot
+// be parsed keep their slot with an empty host, so they fail immediately
+// and result indices still match the Dart list.
+static std::vector<ProbeTarget> probe_targets_from_links(FlValue* configs) {
+  std::vector<ProbeTarget> targets;
+  size_t length = fl_value_get_length(configs);
+  targets.reserve(length);
+  for (size_t i = 0; i < length; i++) {
+    ProbeTarget target;
+    FlValue* link = fl_value_get_list_value(configs, i);
+    ShareLinkEndpoint endpoint;
+    if (fl_value_get_type(link) == FL_VALUE_TYPE_STRING &&
+        ParseShareLinkEndpoint(fl_value_get_string(link), &endpoint)) {
+      target.host = endpoint.host;
+      target.port = endpoint.port;
+      target.tls = endpoint.tls;
+      target.server_name = endpoint.server_name;
+    }
+    targets.push_back(target);
+  }
+  return targets;
+}
+
+// Reads the {"label", "host", "port"} maps in |list| into failover
+// candidates. Entries without a valid port are skipped; "host" defaults to
+// loopback.
+static std::vector<FailoverCandidate> failover_candidates_from_value(
+    FlValue* list) {
+  std::vector<FailoverCandidate> candidates;
+  for (size_t i = 0; i < fl_value_get_length(list); i++) {
+    FlValue* entry = fl_value_get_list_value(list, i);
+    int64_t port = lookup_int_arg(entry, "port", 0);
+    if (port <= 0 || port >= 65536) {
+      continue;
+    }
+    FailoverCandidate candidate;
+    candidate.socks_port = static_cast<uint16_t>(port);
+    if (const gchar* host = lookup_string_arg(entry, "host")) {
+      candidate.socks_host = host;
+    }
+    if (const gchar* server = lookup_string_arg(entry, "server")) {
+      candidate.server_host = server;
+    }
+    const gchar* label = lookup_string_arg(entry, "label");
+    candidate.label = label != nullptr ? label : "port " + std::to_string(port);
+    candidates.push_back(candidate);
+  }
+  return candidates;
+}
+
+static FlMethodResponse* invalid_arguments_response() {
+  return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "INVALID_ARGUMENTS", "Missing required parameters", nullptr));
+}
+
+// Called when a method call is received from Flutter. Calls that touch the
+// network are handed to the engine's control thread and answered later.
+static void vpn_plugin_handle_method_call(VpnPlugin* self,
+                                          FlMethodCall* method_call) {
+  g_autoptr(FlMethodResponse) response = nullptr;
+
+  const gchar* method = fl_method_call_get_name(method_call);
+  FlValue* args = fl_method_call_get_args(method_call);
+  VpnEngine* engine = self->engine;
+
+  if (strcmp(method, "connect") == 0) {
+    FlMethodCall* held = hold_method_call(method_call);
+    engine->Connect([held](bool connected) {
+      respond_success_later(held, fl_value_new_bool(connected));
+    });
+    return;
+  } else if (strcmp(method, "disconnect") == 0) {
+    FlMethodCall* held = hold_method_call(method_call);
+    engine->Disconnect([held](bool disconnected) {
+      respond_success_later(held, fl_value_new_bool(disconnected));
+    });
+    return;
+  } else if (strcmp(method, "startVPN") == 0) {
+    const gchar* flow_line = lookup_string_arg(args, "flowLine");
+    const gchar* pattern = lookup_string_arg(args, "pattern");
+    if (flow_line == nullptr || pattern == nullptr) {
+      response = invalid_arguments_response();
+    } else {
+      FlMethodCall* held = hold_method_call(method_call);
+      engine->StartVpn(flow_line, pattern, [held](const std::string& result) {
+        respond_success_later(held, fl_value_new_string(result.c_str()));
+      });
+      return;
+    }
+  } else if (strcmp(method, "stopVPN") == 0) {
+    FlMethodCall* held = hold_method_call(method_call);
+    engine->StopVpn([held](const std::string& result) {
+      respond_success_later(held, fl_value_new_string(result.c_str()));
+    });
+    return;
+  } else if (strcmp(method, "calculatePing") == 0) {
+    FlMethodCall* held = hold_method_call(method_call);
+    engine->CalculatePing([held](int64_t ping_ms) {
+      respond_success_later(held, fl_value_new_int(ping_ms));
+    });
+    return;
+  } else if (strcmp(method, "setFailoverCandidates") == 0) {
+    FlValue* candidates = args != nullptr &&
+                                  fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                              ? fl_value_lookup_string(args, "candidates")
+                              : nullptr;
+    if (candidates == nullptr ||
+        fl_value_get_type(candidates) != FL_VALUE_TYPE_LIST) {
+      response = invalid_arguments_response();
+    } else {
+      engine->SetFailoverCandidates(
+          failover_candidates_from_value(candidates));
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+    }
+  } else if (strcmp(method, "setSplitTunnel") == 0) {
+    FlValue* apps = lookup_list_arg(args, "apps");
+    std::vector<std::string> names;
+    if (apps != nullptr) {
+      for (size_t i = 0; i < fl_value_get_length(apps); i++) {
+        FlValue* app = fl_value_get_list_value(apps, i);
+        if (fl_value_get_type(app) == FL_VALUE_TYPE_STRING) {
+          names.push_back(fl_value_get_string(app));
+        }
+      }
+    }
+    engine->SetSplitTunnel(lookup_bool_arg(args, "enabled", false),
+                           std::move(names));
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "loadConfigs") == 0) {
+    // Best candidates first, optionally only those in "country".
+    const ConfigStore& store = *self->config_store;
+    const gchar* country = lookup_string_arg(args, "country");
+    std::vector<size_t> ranked = store.Ranked();
+    if (country != nullptr) {
+      std::vector<size_t> matches = store.FindByCountry(country);
+      ranked.erase(std::remove_if(ranked.begin(), ranked.end(),
+                                  [&matches](size_t index) {
+                                    return !std::binary_search(
+                                        matches.begin(), matches.end(),
+                                        index);
+                                  }),
+                   ranked.end());
+    }
+    g_autoptr(FlValue) result = fl_value_new_list();
+    for (size_t index : ranked) {
+      fl_value_append_take(result, stored_config_to_value(store, index));
+    }
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "storeConfigs") == 0) {
+    FlValue* configs = lookup_list_arg(args, "configs");
+    if (configs == nullptr) {
+      response = invalid_arguments_response();
+    } else {
+      bool stored = self->config_store->Replace(
+          stored_configs_from_value(configs));
+      g_autoptr(FlValue) result = fl_value_new_bool(stored);
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    }
+  } else if (strcmp(method, "recordConfigHealth") == 0) {
+    FlValue* results = lookup_list_arg(args, "results");
+    if (results == nullptr) {
+      response = invalid_arguments_response();
+    } else {
+      int64_t now_ms = g_get_real_time() / 1000;
+      for (size_t i = 0; i < fl_value_get_length(results); i++) {
+        FlValue* entry = fl_value_get_list_value(results, i);
+        const gchar* name = lookup_string_arg(entry, "name");
+        int index = name != nullptr ? self->config_store->FindByName(name)
+                                    : -1;
+        if (index < 0) {
+          continue;
+        }
+        self->config_store->RecordProbe(
+            static_cast<size_t>(index), lookup_bool_arg(entry, "ok", false),
+            static_cast<int32_t>(lookup_int_arg(entry, "rttMs", 0)), now_ms);
+      }
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+    }
+  } else if (strcmp(method, "getLatencyStats") == 0) {
+    g_autoptr(FlValue) result = latency_to_value(engine->latency());
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "getNetworkState") == 0) {
+    g_autoptr(FlValue) result = network_state_to_value(engine->network_state());
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "getStartupTrace") == 0) {
+    g_autoptr(FlValue) result = startup_trace_to_value();
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "markStartupPhase") == 0) {
+    const gchar* name = lookup_string_arg(args, "name");
+    if (name == nullptr) {
+      response = invalid_arguments_response();
+    } else {
+      StartupTrace::Default().Mark(name);
+      StartupTrace::Default().WriteToFile(StartupTrace::DefaultPath());
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+    }
+  } else if (strcmp(method, "getDnsStats") == 0) {
+    g_autoptr(FlValue) result = dns_stats_to_value(engine->dns_stats());
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "getTlsStats") == 0) {
+    g_autoptr(FlValue) result = tls_stats_to_value(engine->tls_stats());
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "recordReconnect") == 0) {
+    int64_t ms = lookup_int_arg(args, "ms", -1);
+    if (ms < 0) {
+      response = invalid_arguments_response();
+    } else {
+      engine->RecordReconnect(static_cast<double>(ms));
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+    }
+  } else if (strcmp(method, "startTun2socks") == 0) {
+    FlMethodCall* held = hold_method_call(method_call);
+    engine->StartTun2Socks([held](bool started) {
+      respond_success_later(held, fl_value_new_bool(started));
+    });
+    return;
+  } else if (strcmp(method, "stopTun2Socks") == 0) {
+    FlMethodCall* held = hold_method_call(method_call);
+    engine->StopTun2Socks(
+        [held] { respond_success_later(held, fl_value_new_null()); });
+    return;
+  } else if (strcmp(method, "startLocalProxy") == 0) {
+    int64_t port = lookup_int_arg(args, "port", 0);
+    if (port < 0 || port > 65535) {
+      response = invalid_arguments_response();
+    } else {
+      FlMethodCall* held = hold_method_call(method_call);
+      engine->StartLocalProxy(
+          static_cast<uint16_t>(port), [held](uint16_t bound_port) {
+            respond_success_later(held, fl_value_new_int(bound_port));
+          });
+      return;
+    }
+  } else if (strcmp(method, "stopLocalProxy") == 0) {
+    FlMethodCall* held = hold_method_call(method_call);
+    engine->StopLocalProxy(
+        [held] { respond_success_later(held, fl_value_new_null()); });
+    return;
+  } else if (strcmp(method, "probeConfigs") == 0) {
+    FlValue* configs = args != nullptr &&
+                               fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                           ? fl_value_lookup_string(args, "configs")
+                           : nullptr;
+    if (configs == nullptr ||
+        fl_value_get_type(configs) != FL_VALUE_TYPE_LIST) {
+      response = invalid_arguments_response();
+    } else {
+      ConfigProberOptions options;
+      options.concurrency = static_cast<int>(
+          lookup_int_arg(args, "concurrency", options.concurrency));
+      options.timeout_ms = static_cast<int>(
+          lookup_int_arg(args, "timeoutMs", options.timeout_ms));
+      options.stop_after =
+          static_cast<size_t>(lookup_int_arg(args, "stopAfter", 0));
+      FlMethodCall* held = hold_method_call(method_call);
+      engine->ProbeConfigs(
+          probe_targets_from_links(configs), options,
+          [self](const ProbeResult& result) {
+            vpn_plugin_send_probe_result(self, result);
+          },
+          [held](const std::vector<ProbeResult>& healthy) {
+            FlValue* result = fl_value_new_list();
+            for (const ProbeResult& probe : healthy) {
+              fl_value_append_take(result, probe_result_to_value(probe));
+            }
+            respond_success_later(held, result);
+          });
+      return;
+    }
+  } else if (strcmp(method, "cancelProbe") == 0) {
+    engine->CancelProbe();
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "measureThroughput") == 0) {
+    const gchar* direction = lookup_string_arg(args, "direction");
+    int64_t bytes = lookup_int_arg(args, "bytes", 0);
+    int64_t count = lookup_int_arg(args, "count", 0);
+    if (direction == nullptr || bytes <= 0 || count <= 0) {
+      response = invalid_arguments_response();
+    } else {
+      FlMethodCall* held = hold_method_call(method_call);
+      engine->MeasureThroughput(
+          strcmp(direction, "upload") == 0 ? SpeedTestDirection::kUpload
+                                           : SpeedTestDirection::kDownload,
+          bytes, static_cast<int>(count),
+          [self](double mbps) { vpn_plugin_send_speed(self, mbps); },
+          [held](const std::vector<SpeedSample>& samples) {
+            // Failed samples are reported as 0 Mbps.
+            FlValue* result = fl_value_new_list();
+            for (const SpeedSample& sample : samples) {
+              fl_value_append_take(
+                  result, fl_value_new_float(sample.ok ? sample.mbps : 0));
+            }
+            respond_success_later(held, result);
+          });
+      return;
+    }
+  } else if (strcmp(method, "measureResponsiveness") == 0) {
+    ResponsivenessOptions responsiveness;
+    responsiveness.idle_probes = static_cast<int>(
+        lookup_int_arg(args, "idleProbes", responsiveness.idle_probes));
+    responsiveness.load_ms = static_cast<int>(
+        lookup_int_arg(args, "loadMs", responsiveness.load_ms));
+    responsiveness.ramp_ms = static_cast<int>(
+        lookup_int_arg(args, "rampMs", responsiveness.ramp_ms));
+    if (responsiveness.idle_probes <= 0 || responsiveness.ramp_ms < 0 ||
+        responsiveness.load_ms <= responsiveness.ramp_ms) {
+      response = invalid_arguments_response();
+    } else {
+      FlMethodCall* held = hold_method_call(method_call);
+      engine->MeasureResponsiveness(
+          responsiveness,
+          [self](double mbps) { vpn_plugin_send_speed(self, mbps); },
+          [held](const ResponsivenessResult& result) {
+            respond_success_later(held, responsiveness_to_value(result));
+          });
+      return;
+    }
+  } else if (strcmp(method, "cancelSpeedTest") == 0) {
+    engine->CancelSpeedTest();
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "addStats") == 0) {
+    const gchar* series = lookup_string_arg(args, "series");
+    FlValue* values = args != nullptr &&
+                              fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                          ? fl_value_lookup_string(args, "values")
+                          : nullptr;
+    if (series == nullptr) {
+      response = invalid_arguments_response();
+    } else {
+      StreamingStats& stats = (*self->stats)[series];
+      if (values != nullptr &&
+          fl_value_get_type(values) == FL_VALUE_TYPE_LIST) {
+        for (size_t i = 0; i < fl_value_get_length(values); i++) {
+          FlValue* value = fl_value_get_list_value(values, i);
+          if (fl_value_get_type(value) == FL_VALUE_TYPE_FLOAT) {
+            stats.Add(fl_value_get_float(value));
+          } else if (fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+            stats.Add(static_cast<double>(fl_value_get_int(value)));
+          }
+        }
+      }
+      int64_t expected = lookup_int_arg(args, "expected", 0);
+      if (expected > 0) {
+        stats.AddExpected(static_cast<uint64_t>(expected));
+      }
+      g_autoptr(FlValue) result = stats_to_value(stats);
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    }
+  } else if (strcmp(method, "resetStats") == 0) {
+    self->stats->clear();
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "readLogs") == 0) {
+    int64_t after = lookup_int_arg(args, "after", 0);
+    int64_t limit = lookup_int_arg(args, "limit", 256);
+    std::vector<LogRecord> records = LogRing::Default().Read(
+        static_cast<uint64_t>(std::max<int64_t>(after, 0)),
+        static_cast<size_t>(std::max<int64_t>(limit, 1)));
+    g_autoptr(FlValue) result = fl_value_new_list();
+    for (const LogRecord& record : records) {
+      fl_value_append_take(result, log_record_to_value(record));
+    }
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "appendLog") == 0) {
+    const gchar* message = lookup_string_arg(args, "message");
+    if (message == nullptr) {
+      response = invalid_arguments_response();
+    } else {
+      const gchar* level = lookup_string_arg(args, "level");
+      const gchar* source = lookup_string_arg(args, "source");
+      WriteLog(LogLevelFromName(level != nullptr ? level : "info"),
+               source != nullptr ? source : "app", message);
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+    }
+  } else if (strcmp(method, "clearLogs") == 0) {
+    LogRing::Default().Clear();
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "exportLogs") == 0) {
+    const gchar* path = lookup_string_arg(args, "path");
+    if (path == nullptr) {
+      response = invalid_arguments_response();
+    } else {
+      g_autoptr(FlValue) result =
+          fl_value_new_bool(LogRing::Default().ExportToFile(path));
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    }
+  } else if (strcmp(method, "parseSubscription") == 0) {
+    const gchar* text = lookup_string_arg(args, "text");
+    if (text == nullptr) {
+      response = invalid_arguments_response();
+    } else {
+      g_autoptr(FlValue) result =
+          subscription_to_value(ParseSubscription(text));
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    }
+  } else if (strcmp(method, "getVpnStatus") == 0) {
+    g_autoptr(FlValue) result =
+        fl_value_new_string(VpnStatusName(engine->status()));
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "isTunnelRunning") == 0) {
+    g_autoptr(FlValue) result = fl_value_new_bool(engine->IsTunnelRunning());
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "prepareVPN") == 0 ||
+             strcmp(method, "isVPNPrepared") == 0 ||
+             strcmp(method, "grantVpnPermission") == 0) {
+    g_autoptr(FlValue) result = fl_value_new_bool(engine->IsPrepared());
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "getFlag") == 0) {
+    // No GeoIP data ships with the Linux runner; Dart maps "" to "xx".
+    g_autoptr(FlValue) result = fl_value_new_string("");
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "getFlowLine") == 0) {
+    // The runner does not fetch flow lines itself; this is the one the
+    // session was last started with.
+    g_autoptr(FlValue) result =
+        fl_value_new_string(engine->flow_line().c_str());
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "setAsnName") == 0) {
+    g_autoptr(FlValue) result = fl_value_new_string("ASN_NAME_SET");
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "setTimezone") == 0) {
+    const gchar* timezone = lookup_string_arg(args, "timezone");
+    if (timezone == nullptr) {
+      response = invalid_arguments_response();
+    } else {
+      g_free(self->timezone);
+      self->timezone = g_strdup(timezone);
+      g_autoptr(FlValue) result = fl_value_new_string("LOCAL_TIMEZONE_SET");
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    }
+  } else if (strcmp(method, "setConnectionMethod") == 0) {
+    const gchar* connection_method = lookup_string_arg(args, "method");
+    g_free(self->connection_method);
+    self->connection_method = g_strdup(connection_method);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send method call response: %s", error->message);
+  }
+}
+
+static FlMethodErrorResponse* progress_listen_cb(FlEventChannel* channel,
+                                                 FlValue* args,
+                                                 gpointer user_data) {
+  VPN_PLUGIN(user_data)->progress_listening = TRUE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* progress_cancel_cb(FlEventChannel* channel,
+                                                 FlValue* args,
+                                                 gpointer user_data) {
+  VPN_PLUGIN(user_data)->progress_listening = FALSE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* probe_listen_cb(FlEventChannel* channel,
+                                              FlValue* args,
+                                              gpointer user_data) {
+  VPN_PLUGIN(user_data)->probe_listening = TRUE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* probe_cancel_cb(FlEventChannel* channel,
+                                              FlValue* args,
+                                              gpointer user_data) {
+  VPN_PLUGIN(user_data)->probe_listening = FALSE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* speed_test_listen_cb(FlEventChannel* channel,
+                                                   FlValue* args,
+                                                   gpointer user_data) {
+  VPN_PLUGIN(user_data)->speed_test_listening = TRUE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* speed_test_cancel_cb(FlEventChannel* channel,
+                                                   FlValue* args,
+                                                   gpointer user_data) {
+  VPN_PLUGIN(user_data)->speed_test_listening = FALSE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* latency_listen_cb(FlEventChannel* channel,
+                                                FlValue* args,
+                                                gpointer user_data) {
+  VPN_PLUGIN(user_data)->latency_listening = TRUE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* latency_cancel_cb(FlEventChannel* channel,
+                                                FlValue* args,
+                                                gpointer user_data) {
+  VPN_PLUGIN(user_data)->latency_listening = FALSE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* network_listen_cb(FlEventChannel* channel,
+                                                FlValue* args,
+                                                gpointer user_data) {
+  VPN_PLUGIN(user_data)->network_listening = TRUE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* network_cancel_cb(FlEventChannel* channel,
+                                                FlValue* args,
+                                                gpointer user_data) {
+  VPN_PLUGIN(user_data)->network_listening = FALSE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* quick_action_listen_cb(FlEventChannel* channel,
+                                                     FlValue* args,
+                                                     gpointer user_data) {
+  VPN_PLUGIN(user_data)->quick_action_listening = TRUE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* quick_action_cancel_cb(FlEventChannel* channel,
+                                                     FlValue* args,
+                                                     gpointer user_data) {
+  VPN_PLUGIN(user_data)->quick_action_listening = FALSE;
+  return nullptr;
+}
+
+static void vpn_plugin_dispose(GObject* object) {
+  VpnPlugin* self = VPN_PLUGIN(object);
+  if (quick_action_plugin == self) {
+    quick_action_plugin = nullptr;
+  }
+  // Joins the control thread, so no callback can run after this.
+  delete self->engine;
+  self->engine = nullptr;
+  delete self->stats;
+  self->stats = nullptr;
+  delete self->config_store;
+  self->config_store = nullptr;
+  delete self->progress_batch;
+  self->progress_batch = nullptr;
+  g_clear_object(&self->progress_channel);
+  g_clear_object(&self->probe_channel);
+  g_clear_object(&self->speed_test_channel);
+  g_clear_object(&self->latency_channel);
+  g_clear_object(&self->network_channel);
+  g_clear_object(&self->quick_action_channel);
+  g_clear_pointer(&self->timezone, g_free);
+  g_clear_pointer(&self->connection_method, g_free);
+  G_OBJECT_CLASS(vpn_plugin_parent_class)->dispose(object);
+}
+
+static void vpn_plugin_class_init(VpnPluginClass* klass) {
+  G_OBJECT_CLASS(klass)->dispose = vpn_plugin_dispose;
+}
+
+static void vpn_plugin_init(VpnPlugin* self) {
+  self->progress_batch = new ProgressBatch();
+  self->stats = new std::map<std::string, StreamingStats>();
+  VpnEngineOptions options;
+  if (prewarm != nullptr) {
+    prewarm->thread.join();
+    self->config_store = prewarm->config_store;
+    options = prewarm->options;
+    delete prewarm;
+    prewarm = nullptr;
+  } else {
+    // A missing or outdated store is simply empty until storeConfigs.
+    self->config_store = new ConfigStore();
+    self->config_store->Open(ConfigStore::DefaultPath());
+    options = VpnEngineOptions::FromEnvironment();
+  }
+  self->engine = new VpnEngine(
+      options,
+      [self](const ProgressEvent& event) {
+        vpn_plugin_send_progress(self, event);
+      },
+      [self](const LatencySnapshot& snapshot) {
+        vpn_plugin_send_latency(self, snapshot);
+      },
+      [self](const NetworkState& state) {
+        vpn_plugin_send_network(self, state);
+      });
+  StartupTrace::Default().Mark("vpn_plugin_ready");
+}
+
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
+                           gpointer user_data) {
+  VpnPlugin* plugin = VPN_PLUGIN(user_data);
+  vpn_plugin_handle_method_call(plugin, method_call);
+}
+
+void vpn_plugin_prewarm() {
+  if (prewarm != nullptr) {
+    return;
+  }
+  prewarm = new Prewarm();
+  Prewarm* state = prewarm;
+  state->thread = std::thread([state] {
+    pthread_setname_np(pthread_self(), "vpn-prewarm");
+    state->options = VpnEngineOptions::FromEnvironment();
+    // A missing or outdated store is simply empty until storeConfigs.
+    state->config_store = new ConfigStore();
+    state->config_store->Open(ConfigStore::DefaultPath());
+    // Creates the log ring before anything on the main thread logs.
+    WriteLog(LogLevel::kDebug, "startup", "VPN state loaded");
+    StartupTrace::Default().Mark("vpn_state_loaded");
+  });
+}
+
+void vpn_plugin_register_with_registrar(FlPluginRegistrar* registrar) {
+  VpnPlugin* plugin =
+      VPN_PLUGIN(g_object_new(vpn_plugin_get_type(), nullptr));
+  FlBinaryMessenger* messenger = fl_plugin_registrar_get_messenger(registrar);
+
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  g_autoptr(FlMethodChannel) channel = fl_method_channel_new(
+      messenger, kChannelName, FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(channel, method_call_cb,
+                                            g_object_ref(plugin),
+                                            g_object_unref);
+
+  plugin->progress_channel = fl_event_channel_new(
+      messenger, kProgressChannelName, FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(plugin->progress_channel,
+                                       progress_listen_cb, progress_cancel_cb,
+                                       plugin, nullptr);
+
+  plugin->probe_channel = fl_event_channel_new(
+      messenger, kProbeChannelName, FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(plugin->probe_channel, probe_listen_cb,
+                                       probe_cancel_cb, plugin, nullptr);
+
+  plugin->speed_test_channel = fl_event_channel_new(
+      messenger, kSpeedTestChannelName, FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(plugin->speed_test_channel,
+                                       speed_test_listen_cb,
+                                       speed_test_cancel_cb, plugin, nullptr);
+
+  plugin->latency_channel = fl_event_channel_new(
+      messenger, kLatencyChannelName, FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(plugin->latency_channel,
+                                       latency_listen_cb, latency_cancel_cb,
+                                       plugin, nullptr);
+
+  plugin->network_channel = fl_event_channel_new(
+      messenger, kNetworkChannelName, FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(plugin->network_channel,
+                                       network_listen_cb, network_cancel_cb,
+                                       plugin, nullptr);
+
+  plugin->quick_action_channel = fl_event_channel_new(
+      messenger, kQuickActionChannelName, FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(
+      plugin->quick_action_channel, quick_action_listen_cb,
+      quick_action_cancel_cb, plugin, nullptr);
+  quick_action_plugin = plugin;
+
+  g_object_unref(plugin);
+}
+
+void vpn_plugin_handle_quick_action(const gchar* action, const gchar* server) {
+  VpnPlugin* self = quick_action_plugin;
+  if (self == nullptr || self->engine == nullptr) {
+    g_warning("Quick action %s arrived before the VPN plugin", action);
+    return;
+  }
+  std::string name = action;
+  if (name == "toggle") {
+    name = self->engine->IsTunnelRunning() ? "disconnect" : "connect";
+  }
+  WriteLog(LogLevel::kInfo, "quick-action", name);
+  // The callbacks run on the control thread; the reference keeps the
+  // plugin alive until the outcome has been queued.
+  VpnPlugin* held = VPN_PLUGIN(g_object_ref(self));
+  auto report = [held, name](const std::string& target, bool ok) {
+    vpn_plugin_send_quick_action(held, name, target, ok);
+    g_object_unref(held);
+  };
+  if (name == "connect") {
+    self->engine->Connect([report](bool ok) { report("", ok); });
+  } else if (name == "disconnect") {
+    self->engine->Disconnect([report](bool ok) { report("", ok); });
+  } else if (name == "select-server" && server != nullptr) {
+    std::string label = server;
+    self->engine->SelectUpstream(
+        label, [report, label](bool ok) { report(label, ok); });
+  } else {
+    g_warning("Unknown quick action: %s", action);
+    g_object_unref(held);
+  }
+}
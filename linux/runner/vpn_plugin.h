@@ -0,0 +1,37 @@
+#ifndef RUNNER_VPN_PLUGIN_H_
+#define RUNNER_VPN_PLUGIN_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+G_DECLARE_FINAL_TYPE(VpnPlugin, vpn_plugin, VPN, PLUGIN, GObject)
+
+/**
+ * vpn_plugin_register_with_registrar:
+ * @registrar: an #FlPluginRegistrar.
+ *
+ * Serves the com.mimivpn.vpn method channel and the
+ * com.defyx.progress_events event channel from the native VPN engine.
+ */
+void vpn_plugin_register_with_registrar(FlPluginRegistrar* registrar);
+
+/**
+ * vpn_plugin_prewarm:
+ *
+ * Starts opening the config store and reading the engine options on a
+ * background thread, so the plugin created later by
+ * vpn_plugin_register_with_registrar() only has to pick them up. Call once,
+ * before the window is created.
+ */
+void vpn_plugin_prewarm();
+
+/**
+ * vpn_plugin_handle_quick_action:
+ * @action: "connect", "disconnect", "toggle" or "select-server".
+ * @server: (allow-none): the upstream label for "select-server".
+ *
+ * Runs a command-line quick action on the registered plugin's engine and
+ * reports the outcome to Dart on com.mimivpn.quick_actions.
+ */
+void vpn_plugin_handle_quick_action(const gchar* action, const gchar* server);
+
+#endif  // RUNNER_VPN_PLUGIN_H_
@@ -0,0 +1,52 @@
+#include "worker_thread.h"
+
+#include <pthread.h>
+
+WorkerThread::WorkerThread(const std::string& name) {
+  thread_ = std::thread(&WorkerThread::Run, this);
+  pthread_setname_np(thread_.native_handle(), name.substr(0, 15).c_str());
+}
+
+WorkerThread::~WorkerThread() { Stop(); }
+
+void WorkerThread::Post(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    tasks_.push_back(std::move(task));
+  }
+  wake_.notify_one();
+}
+
+void WorkerThread::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool WorkerThread::IsCurrent() const {
+  return std::this_thread::get_id() == thread_.get_id();
+}
+
+void WorkerThread::Run() {
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef RUNNER_WORKER_THREAD_H_
+#define RUNNER_WORKER_THREAD_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// A single background thread that runs posted tasks one at a time, in the
+// order they were posted. Used to keep blocking network work off the GTK main
+// loop.
+class WorkerThread {
+ public:
+  using Task = std::function<void()>;
+
+  // Starts a thread named |name| (truncated to the 15 characters Linux
+  // allows).
+  explicit WorkerThread(const std::string& name);
+
+  // Stops the thread; see Stop().
+  ~WorkerThread();
+
+  // Prevent copying.
+  WorkerThread(WorkerThread const&) = delete;
+  WorkerThread& operator=(WorkerThread const&) = delete;
+
+  // Queues |task| to run on the worker thread. Tasks posted after Stop() are
+  // dropped.
+  void Post(Task task);
+
+  // Runs the tasks that are already queued, then joins the thread. Safe to
+  // call more than once, but not from the worker thread itself.
+  void Stop();
+
+  // Returns true when called from the worker thread.
+  bool IsCurrent() const;
+
+ private:
+  void Run();
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<Task> tasks_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+#endif  // RUNNER_WORKER_THREAD_H_
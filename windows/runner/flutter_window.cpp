@@ -1,8 +1,52 @@
 #include "flutter_window.h"
 
+#include <flutter/standard_method_codec.h>
+
 #include <optional>
 
 #include "flutter/generated_plugin_registrant.h"
+#include "startup_trace.h"
+
+namespace {
+
+using flutter::EncodableValue;
+
+// Answers getStartupTrace with a list of {"name", "ms"} maps and records
+// the phases Dart reports through markStartupPhase.
+void HandleVpnMethodCall(
+    const flutter::MethodCall<EncodableValue>& call,
+    std::unique_ptr<flutter::MethodResult<EncodableValue>> result) {
+  if (call.method_name() == "getStartupTrace") {
+    flutter::EncodableList phases;
+    for (const StartupPhase& phase : StartupTrace::Default().phases()) {
+      phases.push_back(EncodableValue(flutter::EncodableMap{
+          {EncodableValue("name"), EncodableValue(phase.name)},
+          {EncodableValue("ms"), EncodableValue(phase.ms)},
+      }));
+    }
+    result->Success(EncodableValue(phases));
+  } else if (call.method_name() == "markStartupPhase") {
+    const auto* args = std::get_if<flutter::EncodableMap>(call.arguments());
+    const std::string* name = nullptr;
+    if (args != nullptr) {
+      auto found = args->find(EncodableValue("name"));
+      if (found != args->end()) {
+        name = std::get_if<std::string>(&found->second);
+      }
+    }
+    if (name == nullptr) {
+      result->Error("INVALID_ARGUMENTS", "Missing required parameters");
+      return;
+    }
+    StartupTrace::Default().Mark(*name);
+    StartupTrace::Default().WriteToFile(StartupTrace::DefaultPath());
+    result->Success();
+  } else {
+    result->NotImplemented();
+  }
+}
+
+}  // namespace
 
 FlutterWindow::FlutterWindow(const flutter::DartProject& project)
     : project_(project) {}
@@ -14,6 +58,8 @@ bool FlutterWindow::OnCreate() {
     return false;
   }
 
+  StartupTrace::Default().Mark("window_created");
+
   RECT frame = GetClientArea();
 
   // The size here must match the window dimensions to avoid unnecessary surface
@@ -24,11 +70,20 @@ bool FlutterWindow::OnCreate() {
   if (!flutter_controller_->engine() || !flutter_controller_->view()) {
     return false;
   }
+  StartupTrace::Default().Mark("engine_started");
   RegisterPlugins(flutter_controller_->engine());
+  vpn_channel_ =
+      std::make_unique<flutter::MethodChannel<flutter::EncodableValue>>(
+          flutter_controller_->engine()->messenger(), "com.mimivpn.vpn",
+          &flutter::StandardMethodCodec::GetInstance());
+  vpn_channel_->SetMethodCallHandler(HandleVpnMethodCall);
+  StartupTrace::Default().Mark("plugins_registered");
   SetChildContent(flutter_controller_->view()->GetNativeWindow());
 
   flutter_controller_->engine()->SetNextFrameCallback([&]() {
+    StartupTrace::Default().Mark("first_frame");
     this->Show();
+    StartupTrace::Default().WriteToFile(StartupTrace::DefaultPath());
   });
 
   // Flutter can complete the first frame before the "show window" callback is
@@ -40,6 +95,7 @@ bool FlutterWindow::OnCreate() {
 }
 
 void FlutterWindow::OnDestroy() {
+  vpn_channel_ = nullptr;
   if (flutter_controller_) {
     flutter_controller_ = nullptr;
   }
@@ -0,0 +1,122 @@
+#include "startup_trace.h"
+
+#include <stdio.h>
+
+#include <fstream>
+
+namespace {
+
+LONGLONG PerformanceCounterNow() {
+  LARGE_INTEGER now;
+  ::QueryPerformanceCounter(&now);
+  return now.QuadPart;
+}
+
+ULONGLONG FileTimeTicks(const FILETIME& time) {
+  return (static_cast<ULONGLONG>(time.dwHighDateTime) << 32) |
+         time.dwLowDateTime;
+}
+
+// Returns how long ago the process was created, in 100 ns units, or 0 when
+// Windows does not say.
+ULONGLONG ProcessAge() {
+  FILETIME creation, exit, kernel, user, now;
+  if (!::GetProcessTimes(::GetCurrentProcess(), &creation, &exit, &kernel,
+                         &user)) {
+    return 0;
+  }
+  ::GetSystemTimePreciseAsFileTime(&now);
+  ULONGLONG created = FileTimeTicks(creation);
+  ULONGLONG current = FileTimeTicks(now);
+  return current > created ? current - created : 0;
+}
+
+// Escapes |text| for a JSON string.
+std::string JsonEscape(const std::string& text) {
+  std::string escaped;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped.push_back('\\');
+      escaped.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      escaped += code;
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
+
+}  // namespace
+
+StartupTrace::StartupTrace() {
+  LARGE_INTEGER frequency;
+  ::QueryPerformanceFrequency(&frequency);
+  ticks_per_second_ = frequency.QuadPart;
+  // Both clocks are read back to back; the wall clock only says how far
+  // back the creation was.
+  LONGLONG now = PerformanceCounterNow();
+  ULONGLONG age = ProcessAge();
+  origin_ticks_ =
+      now - static_cast<LONGLONG>(age * ticks_per_second_ / 10000000);
+}
+
+StartupTrace& StartupTrace::Default() {
+  static StartupTrace* trace = new StartupTrace();
+  return *trace;
+}
+
+void StartupTrace::Mark(const std::string& name) {
+  double ms = (PerformanceCounterNow() - origin_ticks_) * 1000.0 /
+              ticks_per_second_;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const StartupPhase& phase : phases_) {
+    if (phase.name == name) {
+      return;
+    }
+  }
+  phases_.push_back(StartupPhase{name, ms});
+}
+
+std::vector<StartupPhase> StartupTrace::phases() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return phases_;
+}
+
+bool StartupTrace::WriteToFile(const std::wstring& path) const {
+  size_t separator = path.find_last_of(L"\\/");
+  if (separator != std::wstring::npos) {
+    ::CreateDirectoryW(path.substr(0, separator).c_str(), nullptr);
+  }
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    return false;
+  }
+  // One instant event per phase, on one track.
+  std::vector<StartupPhase> marks = phases();
+  file << "{\"traceEvents\":[";
+  for (size_t i = 0; i < marks.size(); i++) {
+    char timestamp[32];
+    snprintf(timestamp, sizeof(timestamp), "%.0f", marks[i].ms * 1000);
+    file << (i == 0 ? "\n" : ",\n") << "{\"name\":\""
+         << JsonEscape(marks[i].name) << "\",\"ph\":\"i\",\"s\":\"p\","
+         << "\"pid\":" << ::GetCurrentProcessId() << ",\"tid\":0,\"ts\":"
+         << timestamp << "}";
+  }
+  file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return file.good();
+}
+
+std::wstring StartupTrace::DefaultPath() {
+  wchar_t buffer[MAX_PATH];
+  DWORD length = ::GetEnvironmentVariableW(L"MIMIVPN_STARTUP_TRACE", buffer,
+                                           MAX_PATH);
+  if (length > 0 && length < MAX_PATH) {
+    return buffer;
+  }
+  length = ::GetEnvironmentVariableW(L"LOCALAPPDATA", buffer, MAX_PATH);
+  std::wstring directory = length > 0 && length < MAX_PATH ? buffer : L".";
+  return directory + L"\\mimivpn\\startup-trace.json";
+}
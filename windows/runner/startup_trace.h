@@ -0,0 +1,55 @@
+#ifndef RUNNER_STARTUP_TRACE_H_
+#define RUNNER_STARTUP_TRACE_H_
+
+#include <windows.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct StartupPhase {
+  std::string name;
+  // Milliseconds since the process was created, so the time the loader
+  // spends before wWinMain is counted too.
+  double ms = 0;
+};
+
+// Monotonic timestamps for the phases of a cold start, from process
+// creation to the first Flutter frame and on to the first connection. Safe
+// to use from any thread.
+class StartupTrace {
+ public:
+  StartupTrace();
+
+  // Prevent copying.
+  StartupTrace(StartupTrace const&) = delete;
+  StartupTrace& operator=(StartupTrace const&) = delete;
+
+  // The process-wide trace the runner and Dart mark phases on.
+  static StartupTrace& Default();
+
+  // Records that |name| was reached now. Only the first mark of a name
+  // counts.
+  void Mark(const std::string& name);
+
+  // Returns the marks so far, oldest first.
+  std::vector<StartupPhase> phases() const;
+
+  // Writes the marks to |path| as Chrome trace events. Returns false on
+  // I/O failure.
+  bool WriteToFile(const std::wstring& path) const;
+
+  // %MIMIVPN_STARTUP_TRACE%, or startup-trace.json under
+  // %LOCALAPPDATA%\mimivpn.
+  static std::wstring DefaultPath();
+
+ private:
+  // QueryPerformanceCounter reading of the process creation.
+  LONGLONG origin_ticks_;
+  LONGLONG ticks_per_second_;
+
+  mutable std::mutex mutex_;
+  std::vector<StartupPhase> phases_;
+};
+
+#endif  // RUNNER_STARTUP_TRACE_H_